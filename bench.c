@@ -0,0 +1,1174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include "mycdata.h"
+
+/*
+ * ./bench [-n maxSize] [-t maxThreads] [-s structure] [-d seq|uniform|zipf] [-f csv|json]
+ *
+ * every structure runs insert, lookup, iterate and delete over sizes 1K, 10K, ...
+ * up to maxSize (1M by default), the concurrent ones also at 1, 2, 4 ... maxThreads,
+ * one csv line or json object per phase, latency is sampled every BENCH_SAMPLE ops
+ * the wsDeque owner pushes alone and the thieves steal at every thread count, the
+ * spscRing runs on one thread as its two sides cannot be split by key
+ * left out: lookup on the stack, queue, heap, rings and deque and on the intrusive
+ * list, which have no search, the threadPool, whose tasks are not a container,
+ * and the read only roDict and mphDict, built once from a Dict
+ */
+
+#ifndef BENCH_SAMPLE
+#define BENCH_SAMPLE 16
+#endif // BENCH_SAMPLE
+
+#ifndef BENCH_ZIPF_THETA
+#define BENCH_ZIPF_THETA 0.99
+#endif // BENCH_ZIPF_THETA
+
+/*
+ * ----------------------------------------------------------------------- Keys
+ */
+
+// benchVals[i] == i, the elements
+int *benchVals;
+// "key-i" for strDict
+char **benchStrs;
+int benchStrsSize;
+
+int benchKey(void *el)
+{
+    return *(int *)el;
+}
+int benchCompare(void *a, void *b)
+{
+    return *(int *)a - *(int *)b;
+}
+UINT64 benchRandom(UINT64 *seed)
+{
+    // xorshift64*
+    UINT64 x = *seed;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *seed = x;
+    return x * 0x2545F4914F6CDD1DUL;
+}
+double benchUniform(UINT64 *seed)
+{
+    return (benchRandom(seed) >> 11) * (1.0 / 9007199254740992.0);
+}
+long benchGcd(long a, long b)
+{
+    while (b)
+    {
+        long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+void benchKeys(int *keys, int n, const char *dist, UINT64 seed)
+{
+    int i;
+    if (!strcmp(dist, "seq"))
+    {
+        for (i = 0; i < n; i++)
+            keys[i] = i;
+    }
+    else if (!strcmp(dist, "uniform"))
+    {
+        for (i = 0; i < n; i++)
+            keys[i] = (int)(benchRandom(&seed) % n);
+    }
+    else
+    {
+        // Gray et al., "Quickly generating billion-record synthetic databases"
+        double theta = BENCH_ZIPF_THETA, zetan = 0, zeta2 = 1 + pow(0.5, theta);
+        for (i = 1; i <= n; i++)
+            zetan += 1 / pow(i, theta);
+        double alpha = 1 / (1 - theta);
+        double eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+        // scatter the ranks so the hot keys are not neighbours, k * a mod n is a
+        // bijection for a coprime to n, so every rank keeps its own key
+        long a = (long)(n * 0.6180339887) | 1;
+        while (benchGcd(a, n) != 1)
+            a += 2;
+        for (i = 0; i < n; i++)
+        {
+            double u = benchUniform(&seed), uz = u * zetan;
+            long k;
+            if (uz < 1)
+                k = 0;
+            else if (uz < zeta2)
+                k = 1;
+            else
+                k = (long)(n * pow(eta * u - eta + 1, alpha));
+            keys[i] = (int)((k < n ? k : n - 1) * a % n);
+        }
+    }
+}
+double benchNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+int benchDoubleCompare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+double benchClockCost()
+{
+    // the median cost of the two clock reads around a sampled op
+    double s[1001];
+    int i;
+    for (i = 0; i < 1001; i++)
+    {
+        double t0 = benchNow();
+        s[i] = benchNow() - t0;
+    }
+    qsort(s, 1001, sizeof(double), benchDoubleCompare);
+    return s[500];
+}
+
+/*
+ * ----------------------------------------------------------------- Structures
+ */
+
+// insert on one thread, lookup and delete on all of them
+#define BENCH_OWNER 2
+
+struct benchOps
+{
+    const char *name;
+    // 0 one thread, 1 every op at 1, 2, 4 ... maxThreads, or BENCH_OWNER
+    int concurrent;
+    // 0 for no limit, O(n) ops stop early
+    long maxSize;
+    void *(*create)(int n);
+    void (*destroy)(void *p);
+    int (*insert)(void *p, int key);
+    int (*lookup)(void *p, int key);
+    int (*remove)(void *p, int key);
+    long (*iterate)(void *p);
+};
+
+void *stackCreate(int n)
+{
+    (void)n;
+    return stackNew();
+}
+void stackDestroy(void *p)
+{
+    stackFree(p);
+}
+int stackInsert(void *p, int key)
+{
+    return stackPush(p, &benchVals[key]);
+}
+int stackRemove(void *p, int key)
+{
+    (void)key;
+    return stackPop(p) != NULL;
+}
+long stackIterate(void *p)
+{
+    struct Stack *s = p;
+    long sum = 0;
+    int i;
+    for (i = 0; i < s->size; i++)
+        sum += *(int *)s->els[i];
+    return sum;
+}
+
+void *queueCreate(int n)
+{
+    (void)n;
+    return queueNew();
+}
+void queueDestroy(void *p)
+{
+    queueFree(p);
+}
+int queueInsert(void *p, int key)
+{
+    return queueOffer(p, &benchVals[key]);
+}
+int queueRemove(void *p, int key)
+{
+    (void)key;
+    return queuePoll(p) != NULL;
+}
+long queueIterate(void *p)
+{
+    struct Queue *q = p;
+    long sum = 0;
+    int i;
+    for (i = 0; i < q->size; i++)
+        sum += *(int *)q->els[(q->head + i) & (q->cap - 1)];
+    return sum;
+}
+
+void *avlCreate(int n)
+{
+    (void)n;
+    return avlTreeNew(benchKey);
+}
+void avlDestroy(void *p)
+{
+    avlTreeFree(p);
+}
+int avlInsert(void *p, int key)
+{
+    return avlTreeAdd(p, &benchVals[key]);
+}
+int avlLookup(void *p, int key)
+{
+    return avlTreeSearch(p, &benchVals[key]) != NULL;
+}
+int avlRemove(void *p, int key)
+{
+    return avlTreeRemove(p, &benchVals[key]);
+}
+long avlSum(struct avlTreeNode *n)
+{
+    // in order, the depth is the tree height
+    return n ? avlSum(n->left) + n->key + avlSum(n->right) : 0;
+}
+long avlIterate(void *p)
+{
+    return avlSum(((struct avlTree *)p)->root);
+}
+
+void *rbCreate(int n)
+{
+    (void)n;
+    return rbTreeNew(benchKey);
+}
+void rbDestroy(void *p)
+{
+    rbTreeFree(p);
+}
+int rbInsert(void *p, int key)
+{
+    return rbTreeInsert(p, &benchVals[key]);
+}
+int rbLookup(void *p, int key)
+{
+    return rbTreeSearch(p, &benchVals[key]) != NULL;
+}
+int rbRemove(void *p, int key)
+{
+    return rbTreeDelete(p, &benchVals[key]);
+}
+long rbSum(struct rbTreeNode *n)
+{
+    // RB_NIL is static, every file has its own, the tree's one has no children
+    return n->left ? rbSum(n->left) + n->key + rbSum(n->right) : 0;
+}
+long rbIterate(void *p)
+{
+    return rbSum(((struct rbTree *)p)->root);
+}
+
+void *slCreate(int n)
+{
+    (void)n;
+    return skipListNew(benchKey);
+}
+void slDestroy(void *p)
+{
+    skipListFree(p);
+}
+int slInsert(void *p, int key)
+{
+    return skipListInsert(p, &benchVals[key]);
+}
+int slLookup(void *p, int key)
+{
+    return skipListGet(p, key) != NULL;
+}
+int slRemove(void *p, int key)
+{
+    return skipListDelete(p, key);
+}
+long slIterate(void *p)
+{
+    // the head node holds the smallest element
+    struct skipListNode *n = ((struct skipList *)p)->head;
+    long sum = 0;
+    for (; n; n = n->next[0])
+        sum += n->key;
+    return sum;
+}
+
+void *bhCreate(int n)
+{
+    (void)n;
+    return bhNew(benchKey);
+}
+void bhDestroy(void *p)
+{
+    bhFree(p);
+}
+int bhBenchInsert(void *p, int key)
+{
+    return bhInsert(p, &benchVals[key]);
+}
+int bhRemove(void *p, int key)
+{
+    (void)key;
+    return bhDeleteMin(p);
+}
+long bhIterate(void *p)
+{
+    // table[0] is unused
+    struct binaryHeap *h = p;
+    long sum = 0;
+    int i;
+    for (i = 1; i <= h->size; i++)
+        sum += *(int *)h->table[i];
+    return sum;
+}
+
+void *bitSetCreate(int n)
+{
+    (void)n;
+    return bitSetNew();
+}
+void bitSetDestroy(void *p)
+{
+    bitSetFree(p);
+}
+int bitSetInsert(void *p, int key)
+{
+    return bitSetOn(p, key);
+}
+int bitSetLookup(void *p, int key)
+{
+    return bitSetGet(p, key);
+}
+int bitSetRemove(void *p, int key)
+{
+    return bitSetOff(p, key);
+}
+long bitSetIterate(void *p)
+{
+    struct bitSet *bs = p;
+    long sum = 0;
+    int i;
+    for (i = 0; i < bs->size * 64; i++)
+        sum += bitSetGet(bs, i);
+    return sum;
+}
+
+void *listCreate(int n)
+{
+    (void)n;
+    struct List *l = listNew();
+    // contains and remove by value are O(1) with the index
+    if (l && !listIndexOn(l))
+    {
+        listFree(l);
+        return NULL;
+    }
+    return l;
+}
+void listDestroy(void *p)
+{
+    listFree(p);
+}
+int listInsert(void *p, int key)
+{
+    // a set like the trees, the index slows down with many equal values
+    return listContains(p, &benchVals[key]) || listAdd(p, &benchVals[key]);
+}
+int listLookup(void *p, int key)
+{
+    return listContains(p, &benchVals[key]);
+}
+int listBenchRemove(void *p, int key)
+{
+    return listRemoveValue(p, &benchVals[key]);
+}
+long listIterate(void *p)
+{
+    struct listNode *n = ((struct List *)p)->head;
+    long sum = 0;
+    for (; n; n = n->next)
+        sum += *(int *)n->val;
+    return sum;
+}
+
+// the intrusive containers link preallocated items, items[key].key == key
+struct benchItem
+{
+    int key;
+    int in;
+    struct iListLink link;
+    struct irbNode rb;
+    struct iavlNode avl;
+};
+struct benchIntrusive
+{
+    struct iList list;
+    struct irbTree rb;
+    struct iavlTree avl;
+    struct benchItem *items;
+};
+
+int benchItemRbCompare(struct irbNode *a, struct irbNode *b)
+{
+    return containerOf(a, struct benchItem, rb)->key - containerOf(b, struct benchItem, rb)->key;
+}
+int benchItemAvlCompare(struct iavlNode *a, struct iavlNode *b)
+{
+    return containerOf(a, struct benchItem, avl)->key - containerOf(b, struct benchItem, avl)->key;
+}
+void *intrusiveCreate(int n)
+{
+    struct benchIntrusive *b = malloc(sizeof(struct benchIntrusive));
+    struct benchItem *items = calloc(n, sizeof(struct benchItem));
+    if (!b || !items)
+    {
+        free(b);
+        free(items);
+        return NULL;
+    }
+    int i;
+    for (i = 0; i < n; i++)
+        items[i].key = i;
+    iListInit(&b->list);
+    irbTreeInit(&b->rb, benchItemRbCompare);
+    iavlTreeInit(&b->avl, benchItemAvlCompare);
+    b->items = items;
+    return b;
+}
+void intrusiveDestroy(void *p)
+{
+    struct benchIntrusive *b = p;
+    free(b->items);
+    free(b);
+}
+
+int iListBenchInsert(void *p, int key)
+{
+    struct benchItem *item = ((struct benchIntrusive *)p)->items + key;
+    if (!item->in)
+        iListAddTail(&((struct benchIntrusive *)p)->list, &item->link);
+    item->in = 1;
+    return 1;
+}
+int iListBenchRemove(void *p, int key)
+{
+    struct benchItem *item = ((struct benchIntrusive *)p)->items + key;
+    if (!item->in)
+        return 0;
+    iListRemove(&((struct benchIntrusive *)p)->list, &item->link);
+    item->in = 0;
+    return 1;
+}
+long iListIterate(void *p)
+{
+    struct iListLink *n = ((struct benchIntrusive *)p)->list.head;
+    long sum = 0;
+    for (; n; n = n->next)
+        sum += containerOf(n, struct benchItem, link)->key;
+    return sum;
+}
+
+int irbInsert(void *p, int key)
+{
+    struct benchIntrusive *b = p;
+    return irbTreeInsert(&b->rb, &b->items[key].rb) == NULL;
+}
+int irbLookup(void *p, int key)
+{
+    struct benchIntrusive *b = p;
+    return irbTreeSearch(&b->rb, &b->items[key].rb) != NULL;
+}
+int irbRemove(void *p, int key)
+{
+    // items[key] is the only item with its key, it is in the tree when found
+    struct benchIntrusive *b = p;
+    struct irbNode *n = irbTreeSearch(&b->rb, &b->items[key].rb);
+    if (n)
+        irbTreeDelete(&b->rb, n);
+    return n != NULL;
+}
+long irbIterate(void *p)
+{
+    struct irbNode *n = irbTreeFindMin(&((struct benchIntrusive *)p)->rb);
+    long sum = 0;
+    for (; n; n = irbTreeNext(n))
+        sum += containerOf(n, struct benchItem, rb)->key;
+    return sum;
+}
+
+int iavlInsert(void *p, int key)
+{
+    struct benchIntrusive *b = p;
+    return iavlTreeInsert(&b->avl, &b->items[key].avl) == NULL;
+}
+int iavlLookup(void *p, int key)
+{
+    struct benchIntrusive *b = p;
+    return iavlTreeSearch(&b->avl, &b->items[key].avl) != NULL;
+}
+int iavlRemove(void *p, int key)
+{
+    struct benchIntrusive *b = p;
+    struct iavlNode *n = iavlTreeSearch(&b->avl, &b->items[key].avl);
+    if (n)
+        iavlTreeDelete(&b->avl, n);
+    return n != NULL;
+}
+long iavlIterate(void *p)
+{
+    struct iavlNode *n = iavlTreeFindMin(&((struct benchIntrusive *)p)->avl);
+    long sum = 0;
+    for (; n; n = iavlTreeNext(n))
+        sum += containerOf(n, struct benchItem, avl)->key;
+    return sum;
+}
+
+// the positional lists look up and remove at key % size
+void *ulCreate(int n)
+{
+    (void)n;
+    return unrolledListNew();
+}
+void ulDestroy(void *p)
+{
+    unrolledListFree(p);
+}
+int ulInsert(void *p, int key)
+{
+    return unrolledListAdd(p, &benchVals[key]);
+}
+int ulLookup(void *p, int key)
+{
+    int size = unrolledListSize(p);
+    return size && unrolledListGet(p, key % size) != NULL;
+}
+int ulRemove(void *p, int key)
+{
+    int size = unrolledListSize(p);
+    return size && unrolledListRemove(p, key % size);
+}
+long ulIterate(void *p)
+{
+    struct unrolledListNode *n = ((struct unrolledList *)p)->head;
+    long sum = 0;
+    int i;
+    for (; n; n = n->next)
+        for (i = 0; i < n->size; i++)
+            sum += *(int *)n->vals[i];
+    return sum;
+}
+
+void *treapCreate(int n)
+{
+    (void)n;
+    return treapListNew();
+}
+void treapDestroy(void *p)
+{
+    treapListFree(p);
+}
+int treapInsert(void *p, int key)
+{
+    return treapListAdd(p, &benchVals[key]);
+}
+int treapLookup(void *p, int key)
+{
+    int size = treapListSize(p);
+    return size && treapListGet(p, key % size) != NULL;
+}
+int treapRemove(void *p, int key)
+{
+    int size = treapListSize(p);
+    return size && treapListRemove(p, key % size);
+}
+long treapSum(struct treapListNode *n)
+{
+    return n ? treapSum(n->left) + *(int *)n->val + treapSum(n->right) : 0;
+}
+long treapIterate(void *p)
+{
+    return treapSum(((struct treapList *)p)->root);
+}
+
+void *dictCreate(int n)
+{
+    (void)n;
+    return dictNew(benchKey, benchCompare, benchCompare);
+}
+void dictDestroy(void *p)
+{
+    dictFree(p);
+}
+int dictInsert(void *p, int key)
+{
+    return dictPut(p, &benchVals[key], &benchVals[key]);
+}
+int dictLookup(void *p, int key)
+{
+    return dictGet(p, &benchVals[key]) != NULL;
+}
+int dictBenchRemove(void *p, int key)
+{
+    return dictRemove(p, &benchVals[key]);
+}
+long dictIterate(void *p)
+{
+    struct Dict *d = p;
+    long sum = 0, i;
+    if (!d->table)
+        return 0;
+    for (i = 0; i < d->cap; i++)
+    {
+        struct dictEntry *e;
+        for (e = d->table[i]; e; e = e->next)
+            sum += *(int *)e->key;
+    }
+    return sum;
+}
+
+void *strDictCreate(int n)
+{
+    (void)n;
+    return strDictNew(0);
+}
+void strDictDestroy(void *p)
+{
+    strDictFree(p);
+}
+int strDictInsert(void *p, int key)
+{
+    return strDictPut(p, benchStrs[key], &benchVals[key]);
+}
+int strDictLookup(void *p, int key)
+{
+    return strDictGet(p, benchStrs[key]) != NULL;
+}
+int strDictBenchRemove(void *p, int key)
+{
+    return strDictRemove(p, benchStrs[key]);
+}
+long strDictIterate(void *p)
+{
+    // a slot is empty when its hash is 0
+    struct strDict *d = p;
+    long sum = 0, i;
+    if (!d->table)
+        return 0;
+    for (i = 0; i < d->cap; i++)
+        if (d->table[i].hash)
+            sum += *(int *)d->table[i].val;
+    return sum;
+}
+
+void *lruCreate(int n)
+{
+    // half of the keys fit, the rest evicts
+    return lruCacheNew(n / 2 > 0 ? n / 2 : 1, benchKey, benchCompare, NULL, NULL);
+}
+void lruDestroy(void *p)
+{
+    lruCacheFree(p);
+}
+int lruInsert(void *p, int key)
+{
+    return lruCachePut(p, &benchVals[key], &benchVals[key]);
+}
+int lruLookup(void *p, int key)
+{
+    return lruCacheGet(p, &benchVals[key]) != NULL;
+}
+int lruRemove(void *p, int key)
+{
+    return lruCacheRemove(p, &benchVals[key]);
+}
+long lruIterate(void *p)
+{
+    // most recent first
+    struct iListLink *n = ((struct lruCache *)p)->list.head;
+    long sum = 0;
+    for (; n; n = n->next)
+        sum += *(int *)containerOf(n, struct lruCacheEntry, link)->key;
+    return sum;
+}
+
+void *clockCreate(int n)
+{
+    // half of the keys fit, the rest evicts
+    return clockCacheNew(n / 2 > 0 ? n / 2 : 1, benchKey, benchCompare, NULL, NULL);
+}
+void clockDestroy(void *p)
+{
+    clockCacheFree(p);
+}
+int clockInsert(void *p, int key)
+{
+    return clockCachePut(p, &benchVals[key], &benchVals[key]);
+}
+int clockLookup(void *p, int key)
+{
+    return clockCacheGet(p, &benchVals[key]) != NULL;
+}
+int clockRemove(void *p, int key)
+{
+    return clockCacheRemove(p, &benchVals[key]);
+}
+long clockIterate(void *p)
+{
+    // a free slot has no key
+    struct clockCache *c = p;
+    long sum = 0;
+    int i;
+    for (i = 0; i < c->used; i++)
+        if (c->slots[i].key)
+            sum += *(int *)c->slots[i].key;
+    return sum;
+}
+
+void *shardedDictCreate(int n)
+{
+    (void)n;
+    return shardedDictNew(SD_SHARDS, benchKey, benchCompare, benchCompare);
+}
+void shardedDictDestroy(void *p)
+{
+    shardedDictFree(p);
+}
+int shardedDictInsert(void *p, int key)
+{
+    return shardedDictPut(p, &benchVals[key], &benchVals[key]);
+}
+int shardedDictLookup(void *p, int key)
+{
+    return shardedDictGet(p, &benchVals[key]) != NULL;
+}
+int shardedDictBenchRemove(void *p, int key)
+{
+    return shardedDictRemove(p, &benchVals[key]);
+}
+long shardedDictIterate(void *p)
+{
+    // single threaded, the shard locks are not taken
+    struct shardedDict *sd = p;
+    long sum = 0;
+    int i;
+    for (i = 0; i < sd->n; i++)
+        sum += dictIterate(sd->shards[i].dict);
+    return sum;
+}
+
+void *lfDictCreate(int n)
+{
+    (void)n;
+    return lfDictNew(benchKey, benchCompare, benchCompare);
+}
+void lfDictDestroy(void *p)
+{
+    lfDictFree(p);
+}
+int lfDictInsert(void *p, int key)
+{
+    return lfDictPut(p, &benchVals[key], &benchVals[key]);
+}
+int lfDictLookup(void *p, int key)
+{
+    return lfDictGet(p, &benchVals[key]) != NULL;
+}
+int lfDictBenchRemove(void *p, int key)
+{
+    return lfDictRemove(p, &benchVals[key]);
+}
+long lfDictIterate(void *p)
+{
+    // bucket 0 heads the whole list, dummies have no key, a marked next pointer
+    // means the node is deleted
+    struct lfDict *d = p;
+    struct lfDictNode *n = d->segments[0] ? *d->segments[0] : NULL;
+    long sum = 0;
+    while (n)
+    {
+        struct lfDictNode *next = (struct lfDictNode *)((unsigned long)n->next & ~1UL);
+        if (n->key && next == n->next)
+            sum += *(int *)n->key;
+        n = next;
+    }
+    return sum;
+}
+
+void *mpmcCreate(int n)
+{
+    return mpmcRingNew(n);
+}
+void mpmcDestroy(void *p)
+{
+    mpmcRingFree(p);
+}
+int mpmcInsert(void *p, int key)
+{
+    return mpmcRingOffer(p, &benchVals[key]);
+}
+int mpmcRemove(void *p, int key)
+{
+    (void)key;
+    return mpmcRingPoll(p) != NULL;
+}
+long mpmcIterate(void *p)
+{
+    // single threaded, the cells from head to tail are full
+    struct mpmcRing *r = p;
+    long sum = 0;
+    UINT64 i;
+    for (i = r->head; i != r->tail; i++)
+        sum += *(int *)r->cells[i & r->mask].el;
+    return sum;
+}
+
+void *spscCreate(int n)
+{
+    return spscRingNew(n);
+}
+void spscDestroy(void *p)
+{
+    spscRingFree(p);
+}
+int spscInsert(void *p, int key)
+{
+    return spscRingOffer(p, &benchVals[key]);
+}
+int spscRemove(void *p, int key)
+{
+    (void)key;
+    return spscRingPoll(p) != NULL;
+}
+long spscIterate(void *p)
+{
+    struct spscRing *r = p;
+    long sum = 0;
+    UINT64 i;
+    for (i = r->head; i != r->tail; i++)
+        sum += *(int *)r->els[i & r->mask];
+    return sum;
+}
+
+void *wsCreate(int n)
+{
+    return wsDequeNew(n);
+}
+void wsDestroy(void *p)
+{
+    wsDequeFree(p);
+}
+int wsInsert(void *p, int key)
+{
+    // the owner pushes, run on one thread
+    return wsDequePush(p, &benchVals[key]);
+}
+int wsRemove(void *p, int key)
+{
+    // the thieves steal, NULL as well when another thief won
+    (void)key;
+    return wsDequeSteal(p) != NULL;
+}
+long wsIterate(void *p)
+{
+    struct wsDeque *d = p;
+    long sum = 0, i;
+    for (i = d->top; i < d->bottom; i++)
+        sum += *(int *)d->array->els[i & (d->array->cap - 1)];
+    return sum;
+}
+
+struct benchOps benchStructures[] = {
+    {"stack", 0, 0, stackCreate, stackDestroy, stackInsert, NULL, stackRemove, stackIterate},
+    {"queue", 0, 0, queueCreate, queueDestroy, queueInsert, NULL, queueRemove, queueIterate},
+    {"avlTree", 0, 0, avlCreate, avlDestroy, avlInsert, avlLookup, avlRemove, avlIterate},
+    {"rbTree", 0, 0, rbCreate, rbDestroy, rbInsert, rbLookup, rbRemove, rbIterate},
+    {"skipList", 0, 0, slCreate, slDestroy, slInsert, slLookup, slRemove, slIterate},
+    {"binaryHeap", 0, 0, bhCreate, bhDestroy, bhBenchInsert, NULL, bhRemove, bhIterate},
+    {"bitSet", 0, 0, bitSetCreate, bitSetDestroy, bitSetInsert, bitSetLookup, bitSetRemove, bitSetIterate},
+    {"list", 0, 0, listCreate, listDestroy, listInsert, listLookup, listBenchRemove, listIterate},
+    {"iList", 0, 0, intrusiveCreate, intrusiveDestroy, iListBenchInsert, NULL, iListBenchRemove,
+     iListIterate},
+    {"irbTree", 0, 0, intrusiveCreate, intrusiveDestroy, irbInsert, irbLookup, irbRemove, irbIterate},
+    {"iavlTree", 0, 0, intrusiveCreate, intrusiveDestroy, iavlInsert, iavlLookup, iavlRemove,
+     iavlIterate},
+    {"unrolledList", 0, 100000, ulCreate, ulDestroy, ulInsert, ulLookup, ulRemove, ulIterate},
+    {"treapList", 0, 0, treapCreate, treapDestroy, treapInsert, treapLookup, treapRemove,
+     treapIterate},
+    {"dict", 0, 0, dictCreate, dictDestroy, dictInsert, dictLookup, dictBenchRemove, dictIterate},
+    {"strDict", 0, 0, strDictCreate, strDictDestroy, strDictInsert, strDictLookup, strDictBenchRemove,
+     strDictIterate},
+    {"lruCache", 0, 0, lruCreate, lruDestroy, lruInsert, lruLookup, lruRemove, lruIterate},
+    {"clockCache", 0, 0, clockCreate, clockDestroy, clockInsert, clockLookup, clockRemove,
+     clockIterate},
+    {"shardedDict", 1, 0, shardedDictCreate, shardedDictDestroy, shardedDictInsert, shardedDictLookup,
+     shardedDictBenchRemove, shardedDictIterate},
+    {"lfDict", 1, 0, lfDictCreate, lfDictDestroy, lfDictInsert, lfDictLookup, lfDictBenchRemove,
+     lfDictIterate},
+    {"mpmcRing", 1, 0, mpmcCreate, mpmcDestroy, mpmcInsert, NULL, mpmcRemove, mpmcIterate},
+    {"spscRing", 0, 0, spscCreate, spscDestroy, spscInsert, NULL, spscRemove, spscIterate},
+    {"wsDeque", BENCH_OWNER, 0, wsCreate, wsDestroy, wsInsert, NULL, wsRemove, wsIterate},
+};
+
+/*
+ * ---------------------------------------------------------------------- Runner
+ */
+
+struct benchThread
+{
+    void *p;
+    int (*op)(void *, int);
+    int *keys;
+    int n;
+    int *go;
+    double *samples;
+    int nSamples;
+};
+struct benchResult
+{
+    long ops;
+    double seconds;
+    double p50, p90, p99, p999, pMax;
+};
+
+void *benchWorker(void *arg)
+{
+    struct benchThread *t = arg;
+    int i;
+    t->nSamples = 0;
+    while (!__atomic_load_n(t->go, __ATOMIC_ACQUIRE))
+        ;
+    for (i = 0; i < t->n; i++)
+    {
+        if (i % BENCH_SAMPLE == 0)
+        {
+            double t0 = benchNow();
+            t->op(t->p, t->keys[i]);
+            t->samples[t->nSamples++] = benchNow() - t0;
+        }
+        else
+            t->op(t->p, t->keys[i]);
+    }
+    return NULL;
+}
+// subtracted from every sample
+double benchClock;
+
+double benchPercentile(double *s, int n, double q)
+{
+    if (!n)
+        return 0;
+    int i = (int)(q * (n - 1) + 0.5);
+    return s[i] > benchClock ? (s[i] - benchClock) * 1e9 : 0;
+}
+int benchRun(void *p, int (*op)(void *, int), int *keys, int n, int threads, struct benchResult *r)
+{
+    struct benchThread ts[64];
+    pthread_t tids[64];
+    double *samples = malloc(sizeof(double) * (n / BENCH_SAMPLE + threads + 1));
+    if (!samples)
+        return 0;
+    int i, from = 0, total = 0, go = threads == 1;
+    for (i = 0; i < threads; i++)
+    {
+        int len = n / threads + (i < n % threads);
+        ts[i].p = p;
+        ts[i].op = op;
+        ts[i].keys = keys + from;
+        ts[i].n = len;
+        ts[i].samples = samples + from / BENCH_SAMPLE + i;
+        ts[i].go = &go;
+        from += len;
+    }
+    // the threads wait for go, their creation stays out of the timing
+    for (i = 0; i < threads && threads > 1; i++)
+        pthread_create(&tids[i], NULL, benchWorker, &ts[i]);
+    double t0 = benchNow();
+    if (threads == 1)
+        benchWorker(&ts[0]);
+    else
+    {
+        __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+        for (i = 0; i < threads; i++)
+            pthread_join(tids[i], NULL);
+    }
+    r->seconds = benchNow() - t0;
+    r->ops = n;
+
+    // gather the samples of all threads in front
+    for (i = 0; i < threads; i++)
+    {
+        memmove(samples + total, ts[i].samples, sizeof(double) * ts[i].nSamples);
+        total += ts[i].nSamples;
+    }
+    qsort(samples, total, sizeof(double), benchDoubleCompare);
+    r->p50 = benchPercentile(samples, total, 0.5);
+    r->p90 = benchPercentile(samples, total, 0.9);
+    r->p99 = benchPercentile(samples, total, 0.99);
+    r->p999 = benchPercentile(samples, total, 0.999);
+    r->pMax = benchPercentile(samples, total, 1);
+    free(samples);
+    return 1;
+}
+void benchPrint(int json, const char *name, const char *op, const char *dist, int size, int threads,
+                struct benchResult *r)
+{
+    double mops = r->seconds > 0 ? r->ops / r->seconds / 1e6 : 0;
+    if (json)
+        printf("{\"structure\":\"%s\",\"op\":\"%s\",\"dist\":\"%s\",\"size\":%d,\"threads\":%d,"
+               "\"ops\":%ld,\"seconds\":%.6f,\"mops\":%.3f,\"p50_ns\":%.0f,\"p90_ns\":%.0f,"
+               "\"p99_ns\":%.0f,\"p999_ns\":%.0f,\"max_ns\":%.0f}\n",
+               name, op, dist, size, threads, r->ops, r->seconds, mops, r->p50, r->p90, r->p99,
+               r->p999, r->pMax);
+    else
+        printf("%s,%s,%s,%d,%d,%ld,%.6f,%.3f,%.0f,%.0f,%.0f,%.0f,%.0f\n", name, op, dist, size, threads,
+               r->ops, r->seconds, mops, r->p50, r->p90, r->p99, r->p999, r->pMax);
+    fflush(stdout);
+}
+int benchStrings(int n)
+{
+    if (n <= benchStrsSize)
+        return 1;
+    char **strs = realloc(benchStrs, sizeof(char *) * n);
+    if (!strs)
+        return 0;
+    benchStrs = strs;
+    for (; benchStrsSize < n; benchStrsSize++)
+    {
+        char buf[32];
+        sprintf(buf, "key-%d", benchStrsSize);
+        benchStrs[benchStrsSize] = strdup(buf);
+        if (!benchStrs[benchStrsSize])
+            return 0;
+    }
+    return 1;
+}
+void benchUsage()
+{
+    fprintf(stderr, "usage: bench [-n maxSize] [-t maxThreads] [-s structure] "
+                    "[-d seq|uniform|zipf] [-f csv|json]\n");
+}
+
+int main(int argc, char **argv)
+{
+    long maxSize = 1000000;
+    int maxThreads = 4, json = 0, i;
+    const char *only = NULL, *onlyDist = NULL;
+    for (i = 1; i < argc; i++)
+    {
+        if (i + 1 < argc && !strcmp(argv[i], "-n"))
+            maxSize = atol(argv[++i]);
+        else if (i + 1 < argc && !strcmp(argv[i], "-t"))
+            maxThreads = atoi(argv[++i]);
+        else if (i + 1 < argc && !strcmp(argv[i], "-s"))
+            only = argv[++i];
+        else if (i + 1 < argc && !strcmp(argv[i], "-d"))
+            onlyDist = argv[++i];
+        else if (i + 1 < argc && !strcmp(argv[i], "-f"))
+            json = !strcmp(argv[++i], "json");
+        else
+        {
+            benchUsage();
+            return 1;
+        }
+    }
+    if (maxSize < 1000 || maxSize > 100000000 || maxThreads < 1 || maxThreads > 64)
+    {
+        benchUsage();
+        return 1;
+    }
+
+    benchVals = malloc(sizeof(int) * maxSize);
+    int *keys = malloc(sizeof(int) * maxSize);
+    if (!benchVals || !keys)
+    {
+        printError("bench malloc error\n");
+        return 1;
+    }
+    for (i = 0; i < maxSize; i++)
+        benchVals[i] = i;
+    benchClock = benchClockCost();
+    if (!json)
+        printf("structure,op,dist,size,threads,ops,seconds,mops,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+
+    const char *dists[] = {"seq", "uniform", "zipf"};
+    int nStructures = sizeof(benchStructures) / sizeof(benchStructures[0]);
+    int s, d;
+    long size;
+    for (s = 0; s < nStructures; s++)
+    {
+        struct benchOps *b = &benchStructures[s];
+        if (only && strcmp(only, b->name))
+            continue;
+        for (d = 0; d < 3; d++)
+        {
+            if (onlyDist && strcmp(onlyDist, dists[d]))
+                continue;
+            for (size = 1000; size <= maxSize && (!b->maxSize || size <= b->maxSize); size *= 10)
+            {
+                if (b->insert == strDictInsert && !benchStrings(size))
+                {
+                    printError("bench strings error\n");
+                    return 1;
+                }
+                int threads;
+                for (threads = 1; threads <= (b->concurrent ? maxThreads : 1); threads <<= 1)
+                {
+                    struct benchResult r;
+                    void *p = b->create(size);
+                    if (!p)
+                    {
+                        printError("bench %s create error\n", b->name);
+                        return 1;
+                    }
+                    // every phase draws its own keys, an owner inserts alone and only
+                    // its one thread run is reported
+                    int insertThreads = b->concurrent == BENCH_OWNER ? 1 : threads;
+                    benchKeys(keys, size, dists[d], 1 + d);
+                    if (benchRun(p, b->insert, keys, size, insertThreads, &r) &&
+                        insertThreads == threads)
+                        benchPrint(json, b->name, "insert", dists[d], size, threads, &r);
+                    if (b->lookup)
+                    {
+                        benchKeys(keys, size, dists[d], 11 + d);
+                        if (benchRun(p, b->lookup, keys, size, threads, &r))
+                            benchPrint(json, b->name, "lookup", dists[d], size, threads, &r);
+                    }
+                    if (b->iterate && threads == 1)
+                    {
+                        double t0 = benchNow();
+                        volatile long sum = b->iterate(p);
+                        r.seconds = benchNow() - t0;
+                        r.ops = size;
+                        r.p50 = r.p90 = r.p99 = r.p999 = r.pMax = 0;
+                        benchPrint(json, b->name, "iterate", dists[d], size, threads, &r);
+                        (void)sum;
+                    }
+                    benchKeys(keys, size, dists[d], 21 + d);
+                    if (benchRun(p, b->remove, keys, size, threads, &r))
+                        benchPrint(json, b->name, "delete", dists[d], size, threads, &r);
+                    b->destroy(p);
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < benchStrsSize; i++)
+        free(benchStrs[i]);
+    if (benchStrs)
+        free(benchStrs);
+    free(benchVals);
+    free(keys);
+    return 0;
+}
@@ -1,14 +1,34 @@
+#ifdef __linux__
+#define _GNU_SOURCE // mremap
+#endif // __linux__
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
 #include <limits.h>
 #include <time.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif // __linux__
 #include "mycdata.h"
 
 /*
  * ---------------------------------------------------------------------- Common
  */
 
+#define ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_LOAD_RELAXED(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ATOMIC_ADD(p, v) __atomic_add_fetch((p), (v), __ATOMIC_ACQ_REL)
+#ifdef __GNUC__
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p)
+#endif // __GNUC__
+
+#define ATOMIC_CAS(p, e, v) \
+    __atomic_compare_exchange_n((p), (e), (v), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
 static int max(int a, int b)
 {
     return a > b ? a : b;
@@ -63,6 +83,612 @@ void printDebug(const char *msg, ...)
     }
 }
 
+/*
+ * ------------------------------------------------------------------------ Hash
+ */
+
+static UINT64 hashRead8(const UINT8 *p);
+static UINT64 hashRead4(const UINT8 *p);
+static UINT64 hashMum(UINT64 a, UINT64 b);
+UINT64 hashMix64(UINT64 x)
+{
+    // murmur3 fmix64
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdUL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53UL;
+    x ^= x >> 33;
+    return x;
+}
+UINT64 hashBytes(const void *p, long len, UINT64 seed)
+{
+    // wyhash (final version 3), native byte order
+    static const UINT64 s0 = 0xa0761d6478bd642fUL, s1 = 0xe7037ed1a0b428dbUL,
+                        s2 = 0x8ebc6af09c88c6e3UL, s3 = 0x589965cc75374cc3UL;
+    const UINT8 *b = (const UINT8 *)p;
+    UINT64 x, y;
+    seed ^= s0;
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            x = (hashRead4(b) << 32) | hashRead4(b + ((len >> 3) << 2));
+            y = (hashRead4(b + len - 4) << 32) | hashRead4(b + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            x = ((UINT64)b[0] << 16) | ((UINT64)b[len >> 1] << 8) | b[len - 1];
+            y = 0;
+        }
+        else
+            x = y = 0;
+    }
+    else
+    {
+        long i = len;
+        if (i > 48)
+        {
+            UINT64 see1 = seed, see2 = seed;
+            do
+            {
+                seed = hashMum(hashRead8(b) ^ s1, hashRead8(b + 8) ^ seed);
+                see1 = hashMum(hashRead8(b + 16) ^ s2, hashRead8(b + 24) ^ see1);
+                see2 = hashMum(hashRead8(b + 32) ^ s3, hashRead8(b + 40) ^ see2);
+                b += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16)
+        {
+            seed = hashMum(hashRead8(b) ^ s1, hashRead8(b + 8) ^ seed);
+            i -= 16;
+            b += 16;
+        }
+        x = hashRead8(b + i - 16);
+        y = hashRead8(b + i - 8);
+    }
+    return hashMum(s1 ^ (UINT64)len, hashMum(x ^ s1, y ^ seed));
+}
+static UINT64 hashRead8(const UINT8 *p)
+{
+    UINT64 v;
+    memcpy(&v, p, 8);
+    return v;
+}
+static UINT64 hashRead4(const UINT8 *p)
+{
+    UINT32 v;
+    memcpy(&v, p, 4);
+    return v;
+}
+static UINT64 hashMum(UINT64 a, UINT64 b)
+{
+    // 64x64 -> 128 multiply, fold the high half into the low half
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 r = (unsigned __int128)a * b;
+    return (UINT64)r ^ (UINT64)(r >> 64);
+#else
+    UINT64 ha = a >> 32, hb = b >> 32, la = (UINT32)a, lb = (UINT32)b;
+    UINT64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    UINT64 t = rl + (rm0 << 32);
+    UINT64 c = t < rl;
+    UINT64 lo = t + (rm1 << 32);
+    c += lo < t;
+    UINT64 hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return lo ^ hi;
+#endif // __SIZEOF_INT128__
+}
+
+/*
+ * ---------------------------------------------------------------------- Growth
+ */
+
+static int growClamp(long n);
+static int growCap(int (*grow)(int, int), int cap, int need);
+int growDouble(int cap, int need)
+{
+    long n = cap > 0 ? cap : 8;
+    while (n < need)
+        n <<= 1;
+    return growClamp(n);
+}
+int growHalf(int cap, int need)
+{
+    long n = cap > 0 ? cap : 8;
+    while (n < need)
+        n += (n >> 1) + 1;
+    return growClamp(n);
+}
+int growHugePage(int cap, int need)
+{
+    // small arrays double, large ones take one page more at a time
+    long page = GROW_HUGE_PAGE / sizeof(void *);
+    if (need < page)
+        return growDouble(cap, need);
+    return growClamp((need + page - 1) / page * page);
+}
+static int growClamp(long n)
+{
+    return n > INT_MAX ? INT_MAX : (int)n;
+}
+static int growCap(int (*grow)(int, int), int cap, int need)
+{
+    if (need <= cap)
+        return cap;
+    int n = (grow ? grow : growDouble)(cap, need);
+    if (n < need)
+    {
+        printError("growCap grow %d to %d error\n", cap, need);
+        return -1;
+    }
+    return n;
+}
+
+/*
+ * ---------------------------------------------------------------------- Memory
+ */
+
+#define MEM_PAGE 4096
+
+struct memHeader
+{
+    size_t size;
+    size_t mapped; // the mapping length, 0 for malloc
+};
+
+static size_t memMmapThreshold = MEM_MMAP_THRESHOLD;
+
+static int memWantMap(size_t size);
+static void *memMap(size_t size);
+void memSetMmapThreshold(size_t bytes)
+{
+    __atomic_store_n(&memMmapThreshold, bytes, __ATOMIC_RELAXED);
+}
+void *memAlloc(size_t size)
+{
+    struct memHeader *h = memWantMap(size) ? memMap(size) : NULL;
+    if (h)
+        return h + 1;
+    // malloc when small, not on linux or when mmap fails
+    h = malloc(sizeof(struct memHeader) + size);
+    if (!h)
+        return NULL;
+    h->size = size;
+    h->mapped = 0;
+    return h + 1;
+}
+void *memCalloc(size_t size)
+{
+    void *p = memAlloc(size);
+    // a fresh mapping is zero already
+    if (p && !((struct memHeader *)p - 1)->mapped)
+        memset(p, 0, size);
+    return p;
+}
+void *memRealloc(void *p, size_t size)
+{
+    if (!p)
+        return memAlloc(size);
+    struct memHeader *h = (struct memHeader *)p - 1;
+    int map = memWantMap(size);
+    if (!h->mapped && !map)
+    {
+        h = realloc(h, sizeof(struct memHeader) + size);
+        if (!h)
+            return NULL;
+        h->size = size;
+        return h + 1;
+    }
+#ifdef __linux__
+    if (h->mapped && map)
+    {
+        // the kernel moves the pages, nothing is copied
+        size_t len = (sizeof(struct memHeader) + size + MEM_PAGE - 1) & ~(size_t)(MEM_PAGE - 1);
+        void *m = mremap(h, h->mapped, len, MREMAP_MAYMOVE);
+        if (m == MAP_FAILED)
+            return NULL;
+#ifdef MADV_HUGEPAGE
+        madvise(m, len, MADV_HUGEPAGE);
+#endif // MADV_HUGEPAGE
+        h = (struct memHeader *)m;
+        h->size = size;
+        h->mapped = len;
+        return h + 1;
+    }
+#endif // __linux__
+    // crossing the threshold, copy once between malloc and mmap
+    void *q = memAlloc(size);
+    if (!q)
+        return NULL;
+    memcpy(q, p, h->size < size ? h->size : size);
+    memFree(p);
+    return q;
+}
+void memFree(void *p)
+{
+    if (!p)
+        return;
+    struct memHeader *h = (struct memHeader *)p - 1;
+#ifdef __linux__
+    if (h->mapped)
+    {
+        munmap(h, h->mapped);
+        return;
+    }
+#endif // __linux__
+    free(h);
+}
+static int memWantMap(size_t size)
+{
+#ifdef __linux__
+    size_t threshold = __atomic_load_n(&memMmapThreshold, __ATOMIC_RELAXED);
+    return threshold && size >= threshold;
+#else
+    return 0;
+#endif // __linux__
+}
+static void *memMap(size_t size)
+{
+#ifdef __linux__
+    size_t len = (sizeof(struct memHeader) + size + MEM_PAGE - 1) & ~(size_t)(MEM_PAGE - 1);
+    void *m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    madvise(m, len, MADV_HUGEPAGE);
+#endif // MADV_HUGEPAGE
+    struct memHeader *h = (struct memHeader *)m;
+    h->size = size;
+    h->mapped = len;
+    return h;
+#else
+    return NULL;
+#endif // __linux__
+}
+
+/*
+ * ----------------------------------------------------------------------- Stats
+ */
+
+// s is the container's opStats, NULL when its allocation failed
+#ifdef MYCDATA_STATS
+#define STATS_ADD(s, field, n)                                      \
+    do                                                              \
+    {                                                               \
+        if (s)                                                      \
+            __atomic_add_fetch(&(s)->field, (n), __ATOMIC_RELAXED); \
+    } while (0)
+#define STATS_WALK(s, n) statsWalk((s), (n))
+#define STATS_NOW() statsNow()
+#define STATS_RECORD(s, hist, t0)                           \
+    do                                                      \
+    {                                                       \
+        if (s)                                              \
+            statsRecord(&(s)->hist, statsNow() - (t0));     \
+    } while (0)
+#else
+#define STATS_ADD(s, field, n) (void)(s)
+#define STATS_WALK(s, n) ((void)(s), (void)(n))
+#define STATS_NOW() 0
+#define STATS_RECORD(s, hist, t0) ((void)(s), (void)(t0))
+#endif // MYCDATA_STATS
+
+#ifdef MYCDATA_STATS
+static void statsMax(UINT64 *p, UINT64 v);
+static void statsWalk(struct opStats *s, UINT64 n);
+static UINT64 statsNow();
+static void statsRecord(struct statsHistogram *h, UINT64 ns);
+static int statsBucket(UINT64 v);
+#endif // MYCDATA_STATS
+static struct opStats *statsNew();
+static UINT64 statsBucketMax(int i);
+static void statsDumpHistogram(const char *name, struct statsHistogram *h);
+void statsReset(struct opStats *s)
+{
+    if (s)
+        memset(s, 0, sizeof(struct opStats));
+}
+UINT64 statsPercentile(struct statsHistogram *h, double q)
+{
+    if (!h || !h->count)
+        return 0;
+    UINT64 rank = (UINT64)(q * (double)h->count);
+    if (rank >= h->count)
+        rank = h->count - 1;
+    UINT64 seen = 0;
+    int i;
+    for (i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen > rank)
+        {
+            UINT64 v = statsBucketMax(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+void statsDump(struct opStats *s, const char *name)
+{
+    if (!s)
+        return;
+    printf("%s: allocs %lu frees %lu resizes %lu rotations %lu\n", name ? name : "stats",
+           s->allocs, s->frees, s->resizes, s->rotations);
+    if (s->walks)
+        printf("  walks %lu steps %lu mean %.2f max %lu\n", s->walks, s->steps,
+               (double)s->steps / (double)s->walks, s->maxSteps);
+    statsDumpHistogram("insert", &s->insert);
+    statsDumpHistogram("lookup", &s->lookup);
+    statsDumpHistogram("remove", &s->remove);
+}
+#ifdef MYCDATA_STATS
+static void statsMax(UINT64 *p, UINT64 v)
+{
+    UINT64 c = ATOMIC_LOAD_RELAXED(p);
+    while (v > c && !__atomic_compare_exchange_n(p, &c, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+static void statsWalk(struct opStats *s, UINT64 n)
+{
+    if (!s)
+        return;
+    __atomic_add_fetch(&s->walks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->steps, n, __ATOMIC_RELAXED);
+    statsMax(&s->maxSteps, n);
+}
+static UINT64 statsNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000UL + (UINT64)ts.tv_nsec;
+}
+static void statsRecord(struct statsHistogram *h, UINT64 ns)
+{
+    __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum, ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->buckets[statsBucket(ns)], 1, __ATOMIC_RELAXED);
+    statsMax(&h->max, ns);
+}
+static int statsBucket(UINT64 v)
+{
+    // below 2 ^ STATS_SUB_BITS one bucket per value, above it the top
+    // STATS_SUB_BITS bits after the leading one pick the sub-bucket
+    if (v < (1UL << STATS_SUB_BITS))
+        return (int)v;
+    int shift = 63 - __builtin_clzl(v) - STATS_SUB_BITS;
+    return ((shift + 1) << STATS_SUB_BITS) + (int)((v >> shift) & ((1UL << STATS_SUB_BITS) - 1));
+}
+#endif // MYCDATA_STATS
+static struct opStats *statsNew()
+{
+    // every container counts for itself, only when built with MYCDATA_STATS
+#ifdef MYCDATA_STATS
+    return calloc(1, sizeof(struct opStats));
+#else
+    return NULL;
+#endif // MYCDATA_STATS
+}
+static UINT64 statsBucketMax(int i)
+{
+    if (i < (1 << STATS_SUB_BITS))
+        return (UINT64)i;
+    int shift = (i >> STATS_SUB_BITS) - 1;
+    UINT64 sub = (UINT64)(i & ((1 << STATS_SUB_BITS) - 1)) | (1UL << STATS_SUB_BITS);
+    return ((sub + 1) << shift) - 1;
+}
+static void statsDumpHistogram(const char *name, struct statsHistogram *h)
+{
+    if (!h->count)
+        return;
+    printf("  %s ns: count %lu mean %.1f p50 %lu p90 %lu p99 %lu p999 %lu max %lu\n", name,
+           h->count, (double)h->sum / (double)h->count, statsPercentile(h, 0.5),
+           statsPercentile(h, 0.9), statsPercentile(h, 0.99), statsPercentile(h, 0.999), h->max);
+}
+
+/*
+ * -------------------------------------------------------------------- Snapshot
+ */
+
+struct snapshotWriter
+{
+    FILE *f;
+    const char *path;
+    char *tmp; // written first, renamed over path when complete
+    void *buf;
+    long cap;
+};
+struct snapshotReader
+{
+    const UINT8 *base;
+    const UINT8 *p;
+    const UINT8 *end;
+    long len;
+    int mapped;
+    UINT64 count;
+};
+
+static int snapshotCreate(struct snapshotWriter *w, const char *path, UINT32 type, UINT64 count);
+static long snapshotPut(struct snapshotWriter *w, struct snapshotCodec *c, void *x);
+static int snapshotCommit(struct snapshotWriter *w, int ok);
+static int snapshotOpen(struct snapshotReader *r, const char *path, UINT32 type);
+static int snapshotGet(struct snapshotReader *r, struct snapshotCodec *c, void **x);
+static void snapshotClose(struct snapshotReader *r);
+static void snapshotRelease(struct snapshotCodec *c, void *x);
+static void snapshotUnmap(const UINT8 *base, long len, int mapped);
+static int snapshotCodecValid(struct snapshotCodec *c);
+static int snapshotCreate(struct snapshotWriter *w, const char *path, UINT32 type, UINT64 count)
+{
+    w->f = NULL;
+    w->path = path;
+    w->buf = NULL;
+    w->cap = 0;
+    w->tmp = malloc(strlen(path) + 5);
+    if (!w->tmp)
+        return 0;
+    strcpy(w->tmp, path);
+    strcat(w->tmp, ".tmp");
+    w->f = fopen(w->tmp, "wb");
+    if (!w->f)
+    {
+        printError("snapshot open %s error\n", w->tmp);
+        free(w->tmp);
+        return 0;
+    }
+    struct snapshotHeader h;
+    h.magic = SNAPSHOT_MAGIC;
+    h.version = SNAPSHOT_VERSION;
+    h.type = type;
+    h.reserved = 0;
+    h.count = count;
+    if (fwrite(&h, sizeof(h), 1, w->f) != 1)
+    {
+        snapshotCommit(w, 0);
+        return 0;
+    }
+    return 1;
+}
+static long snapshotPut(struct snapshotWriter *w, struct snapshotCodec *c, void *x)
+{
+    // the bytes written, 0 on error, w->buf keeps the encoded x
+    long n = c->encode(x, w->buf, w->cap, c->arg);
+    if (n > w->cap)
+    {
+        void *buf = realloc(w->buf, n);
+        if (!buf)
+            return 0;
+        w->buf = buf;
+        w->cap = n;
+        n = c->encode(x, w->buf, w->cap, c->arg);
+    }
+    if (n < 0 || n > w->cap || n > (long)UINT_MAX)
+    {
+        printError("snapshot encode error\n");
+        return 0;
+    }
+    UINT32 len = (UINT32)n;
+    if (fwrite(&len, sizeof(len), 1, w->f) != 1 || fwrite(w->buf, 1, n, w->f) != (size_t)n)
+        return 0;
+    return sizeof(len) + n;
+}
+static int snapshotCommit(struct snapshotWriter *w, int ok)
+{
+    if (fclose(w->f))
+        ok = 0;
+    if (ok && rename(w->tmp, w->path))
+    {
+        printError("snapshot rename %s error\n", w->path);
+        ok = 0;
+    }
+    if (!ok)
+        remove(w->tmp);
+    free(w->tmp);
+    free(w->buf);
+    return ok;
+}
+static int snapshotOpen(struct snapshotReader *r, const char *path, UINT32 type)
+{
+    r->base = NULL;
+    r->mapped = 0;
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        printError("snapshot open %s error\n", path);
+        return 0;
+    }
+    if (fseek(f, 0, SEEK_END) || (r->len = ftell(f)) < (long)sizeof(struct snapshotHeader))
+    {
+        printError("snapshot %s is too short\n", path);
+        fclose(f);
+        return 0;
+    }
+#ifdef __linux__
+    // the pages are read once in order, the page cache serves a warm restart
+    void *m = mmap(NULL, r->len, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (m != MAP_FAILED)
+    {
+        madvise(m, r->len, MADV_SEQUENTIAL);
+        r->base = m;
+        r->mapped = 1;
+    }
+#endif // __linux__
+    if (!r->base)
+    {
+        void *b = malloc(r->len);
+        rewind(f);
+        if (b && fread(b, 1, r->len, f) != (size_t)r->len)
+        {
+            free(b);
+            b = NULL;
+        }
+        r->base = b;
+    }
+    fclose(f);
+    if (!r->base)
+    {
+        printError("snapshot read %s error\n", path);
+        return 0;
+    }
+
+    struct snapshotHeader h;
+    memcpy(&h, r->base, sizeof(h));
+    if (h.magic != SNAPSHOT_MAGIC || h.version != SNAPSHOT_VERSION || h.type != type)
+    {
+        printError("snapshot %s magic %x version %u type %u error\n", path, h.magic, h.version,
+                   h.type);
+        snapshotClose(r);
+        return 0;
+    }
+    // every record holds at least its length, a larger count is forged
+    if (h.count > (UINT64)(r->len - sizeof(h)) / sizeof(UINT32))
+    {
+        printError("snapshot %s count %lu error\n", path, h.count);
+        snapshotClose(r);
+        return 0;
+    }
+    r->count = h.count;
+    r->p = r->base + sizeof(h);
+    r->end = r->base + r->len;
+    return 1;
+}
+static int snapshotGet(struct snapshotReader *r, struct snapshotCodec *c, void **x)
+{
+    UINT32 len;
+    if (r->end - r->p < (long)sizeof(len))
+        return 0;
+    memcpy(&len, r->p, sizeof(len));
+    r->p += sizeof(len);
+    if (r->end - r->p < (long)len)
+        return 0;
+    *x = c->decode(r->p, len, c->arg);
+    r->p += len;
+    return 1;
+}
+static void snapshotClose(struct snapshotReader *r)
+{
+    snapshotUnmap(r->base, r->len, r->mapped);
+}
+static void snapshotRelease(struct snapshotCodec *c, void *x)
+{
+    if (x && c->release)
+        c->release(x, c->arg);
+}
+static void snapshotUnmap(const UINT8 *base, long len, int mapped)
+{
+#ifdef __linux__
+    if (mapped)
+    {
+        munmap((void *)base, len);
+        return;
+    }
+#endif // __linux__
+    free((void *)base);
+}
+static int snapshotCodecValid(struct snapshotCodec *c)
+{
+    return c && c->encode && c->decode;
+}
+
 /*
  * ----------------------------------------------------------------------- Stack
  */
@@ -75,14 +701,65 @@ struct Stack *stackNew()
     p->els = NULL;
     p->cap = 8;
     p->size = 0;
+    p->grow = growDouble;
+    return p;
+}
+struct Stack *stackNewWithCapacity(int cap)
+{
+    if (cap <= 0)
+        return NULL;
+    struct Stack *p = stackNew();
+    if (p == NULL)
+        return NULL;
+    p->els = memAlloc(sizeof(void *) * cap);
+    if (p->els == NULL)
+    {
+        free(p);
+        return NULL;
+    }
+    p->cap = cap;
     return p;
 }
+int stackReserve(struct Stack *p, int cap)
+{
+    if (p == NULL)
+        return 0;
+    if (p->els != NULL && cap <= p->cap)
+        return 1;
+    if (cap < p->cap)
+        cap = p->cap;
+    void **q = memRealloc(p->els, sizeof(void *) * cap);
+    if (q == NULL)
+        return 0;
+    p->els = q;
+    p->cap = cap;
+    return 1;
+}
+int stackShrinkToFit(struct Stack *p)
+{
+    if (p == NULL)
+        return 0;
+    int cap = p->size > 0 ? p->size : 1;
+    if (p->els == NULL || cap == p->cap)
+        return 1;
+    void **q = memRealloc(p->els, sizeof(void *) * cap);
+    if (q == NULL)
+        return 0;
+    p->els = q;
+    p->cap = cap;
+    return 1;
+}
+void stackSetGrowth(struct Stack *p, int (*grow)(int, int))
+{
+    if (p != NULL)
+        p->grow = grow ? grow : growDouble;
+}
 void stackFree(struct Stack *p)
 {
     if (p == NULL)
         return;
     if (p->els != NULL)
-        free(p->els);
+        memFree(p->els);
     free(p);
 }
 int stackPush(struct Stack *p, void *el)
@@ -91,17 +768,20 @@ int stackPush(struct Stack *p, void *el)
         return 0;
     if (p->els == NULL)
     {
-        p->els = malloc(sizeof(void *) * p->cap);
+        p->els = memAlloc(sizeof(void *) * p->cap);
         if (p->els == NULL)
             return 0;
     }
     if (p->size == p->cap)
     {
-        void **q = realloc(p->els, sizeof(void *) * p->cap << 1);
+        int cap = growCap(p->grow, p->cap, p->size + 1);
+        if (cap < 0)
+            return 0;
+        void **q = memRealloc(p->els, sizeof(void *) * cap);
         if (q == NULL)
             return 0;
         p->els = q;
-        p->cap = p->cap << 1;
+        p->cap = cap;
     }
     *(p->els + p->size) = el;
     p->size++;
@@ -134,6 +814,9 @@ void stackClear(struct Stack *p)
  * ----------------------------------------------------------------------- Queue
  */
 
+static int queueGrow(struct Queue *p, int need);
+static int queueResize(struct Queue *p, int cap);
+static int queueCap(int n);
 struct Queue *queueNew()
 {
     struct Queue *p = malloc(sizeof(struct Queue));
@@ -142,52 +825,63 @@ struct Queue *queueNew()
     p->els = NULL;
     p->cap = 8;
     p->size = p->head = p->tail = 0;
+    p->grow = growDouble;
+    return p;
+}
+struct Queue *queueNewWithCapacity(int cap)
+{
+    if (cap <= 0 || (cap = queueCap(cap)) < 0)
+        return NULL;
+    struct Queue *p = queueNew();
+    if (p == NULL)
+        return NULL;
+    p->els = memAlloc(sizeof(void *) * cap);
+    if (p->els == NULL)
+    {
+        free(p);
+        return NULL;
+    }
+    p->cap = cap;
     return p;
 }
+int queueReserve(struct Queue *p, int cap)
+{
+    if (p == NULL || (cap = queueCap(cap)) < 0)
+        return 0;
+    if (p->els != NULL && cap <= p->cap)
+        return 1;
+    return queueResize(p, cap > p->cap ? cap : p->cap);
+}
+int queueShrinkToFit(struct Queue *p)
+{
+    if (p == NULL)
+        return 0;
+    int cap = queueCap(p->size > 0 ? p->size : 1);
+    if (p->els == NULL || cap == p->cap)
+        return 1;
+    return queueResize(p, cap);
+}
+void queueSetGrowth(struct Queue *p, int (*grow)(int, int))
+{
+    if (p != NULL)
+        p->grow = grow ? grow : growDouble;
+}
 void queueFree(struct Queue *p)
 {
     if (p == NULL)
         return;
     if (p->els != NULL)
-        free(p->els);
+        memFree(p->els);
     free(p);
 }
 int queueOffer(struct Queue *p, void *el)
 {
     if (p == NULL)
         return 0;
-    if (p->els == NULL)
-    {
-        p->els = malloc(sizeof(void *) * p->cap);
-        if (p->els == NULL)
-            return 0;
-    }
-    if (p->size == p->cap)
-    {
-        void **q = realloc(p->els, sizeof(void *) * p->cap << 1);
-        if (q == NULL)
-            return 0;
-        p->els = q;
-        p->cap = p->cap << 1;
-        if (p->tail < p->head)
-        {
-            int i;
-            for (i = 0; i <= p->tail; i++)
-                *(p->els + (p->cap >> 1) + i) = *(p->els + i);
-            p->tail = p->head + p->size - 1;
-        }
-    }
-    int i;
-    if (p->size == 0)
-        p->head = i = 0;
-    else
-    {
-        i = p->tail + 1;
-        if (i == p->cap)
-            i = 0;
-    }
-    *(p->els + i) = el;
-    p->tail = i;
+    if ((p->els == NULL || p->size == p->cap) && !queueGrow(p, p->size + 1))
+        return 0;
+    *(p->els + p->tail) = el;
+    p->tail = (p->tail + 1) & (p->cap - 1);
     p->size++;
     return 1;
 }
@@ -202,13 +896,42 @@ void *queuePoll(struct Queue *p)
     if (p->size == 0)
         p->head = p->tail = 0;
     else
-    {
-        p->head++;
-        if (p->head == p->cap)
-            p->head = 0;
-    }
+        p->head = (p->head + 1) & (p->cap - 1);
     return el;
 }
+int queueOfferBatch(struct Queue *p, void **els, int n)
+{
+    // all or nothing, returns n or 0
+    if (p == NULL || els == NULL || n <= 0)
+        return 0;
+    if ((p->els == NULL || p->cap - p->size < n) && !queueGrow(p, p->size + n))
+        return 0;
+    // at most two runs, up to the end of els and from the start
+    int run = p->cap - p->tail < n ? p->cap - p->tail : n;
+    memcpy(p->els + p->tail, els, sizeof(void *) * run);
+    memcpy(p->els, els + run, sizeof(void *) * (n - run));
+    p->tail = (p->tail + n) & (p->cap - 1);
+    p->size += n;
+    return n;
+}
+int queuePollBatch(struct Queue *p, void **els, int n)
+{
+    if (p == NULL || els == NULL || n <= 0)
+        return 0;
+    if (n > p->size)
+        n = p->size;
+    if (n == 0)
+        return 0;
+    int run = p->cap - p->head < n ? p->cap - p->head : n;
+    memcpy(els, p->els + p->head, sizeof(void *) * run);
+    memcpy(els + run, p->els, sizeof(void *) * (n - run));
+    p->size -= n;
+    if (p->size == 0)
+        p->head = p->tail = 0;
+    else
+        p->head = (p->head + n) & (p->cap - 1);
+    return n;
+}
 void *queuePeek(struct Queue *p)
 {
     return p == NULL || p->size == 0 ? NULL : *(p->els + p->head);
@@ -221,634 +944,986 @@ void queueClear(struct Queue *p)
 {
     p->size = p->head = p->tail = 0;
 }
+static int queueGrow(struct Queue *p, int need)
+{
+    int cap = growCap(p->grow, p->cap, need);
+    if (cap < 0 || (cap = queueCap(cap)) < 0)
+        return 0;
+    if (p->els != NULL && cap == p->cap)
+        return 1;
+    return queueResize(p, cap);
+}
+static int queueResize(struct Queue *p, int cap)
+{
+    // cap is a power of 2, not less than size
+    if (p->els == NULL)
+    {
+        p->els = memAlloc(sizeof(void *) * cap);
+        if (p->els == NULL)
+            return 0;
+        p->cap = cap;
+        return 1;
+    }
+    if (cap < p->cap)
+    {
+        // shrink into a new array, the elements start at 0
+        void **q = memAlloc(sizeof(void *) * cap);
+        if (q == NULL)
+            return 0;
+        int run = p->cap - p->head < p->size ? p->cap - p->head : p->size;
+        memcpy(q, p->els + p->head, sizeof(void *) * run);
+        memcpy(q + run, p->els, sizeof(void *) * (p->size - run));
+        memFree(p->els);
+        p->els = q;
+        p->cap = cap;
+        p->head = 0;
+        p->tail = p->size & (cap - 1);
+        return 1;
+    }
+    void **q = memRealloc(p->els, sizeof(void *) * cap);
+    if (q == NULL)
+        return 0;
+    p->els = q;
+    if (p->size > 0 && p->head + p->size > p->cap)
+    {
+        // the run [0, tail) wrapped, move whichever of the two runs is shorter
+        int front = p->tail, back = p->cap - p->head;
+        if (front <= back)
+        {
+            memcpy(p->els + p->cap, p->els, sizeof(void *) * front);
+            p->tail = p->head + p->size;
+        }
+        else
+        {
+            memcpy(p->els + cap - back, p->els + p->head, sizeof(void *) * back);
+            p->head = cap - back;
+        }
+    }
+    else
+        p->tail = p->head + p->size;
+    p->cap = cap;
+    p->tail &= cap - 1;
+    return 1;
+}
+static int queueCap(int n)
+{
+    int cap = 1;
+    while (cap < n)
+    {
+        if (cap > INT_MAX >> 1)
+            return -1;
+        cap <<= 1;
+    }
+    return cap;
+}
 
 /*
- * -------------------------------------------------------------------- Avl Tree
+ * ------------------------------------------------------------------ Ring Queue
  */
 
-static struct avlTreeNode *avlTreeNodeNew(int k, void *v);
-static void avlTreeNodeFree(struct avlTreeNode *p);
-static struct avlTreeNode *avlTreeBalance(struct avlTreeNode *b);
-static struct avlTreeNode *avlTreeRotateLeft(struct avlTreeNode *n);
-static struct avlTreeNode *avlTreeRotateRight(struct avlTreeNode *n);
-static int avlTreeLh(struct avlTreeNode *n);
-static int avlTreeRh(struct avlTreeNode *n);
-static struct avlTreeNode *avlTreeNodeFindMin(struct avlTreeNode *n);
-
-struct avlTree *avlTreeNew(int (*key)(void *))
+static UINT64 ringCap(int cap);
+struct spscRing *spscRingNew(int cap)
 {
-    if (!key)
+    if (cap <= 0 || cap > (1 << 30))
+    {
+        printError("spscRingNew cap is error\n");
         return NULL;
-    struct avlTree *p = malloc(sizeof(struct avlTree));
-    if (!p)
+    }
+    struct spscRing *r = malloc(sizeof(struct spscRing));
+    if (!r)
+    {
+        printError("spscRingNew error\n");
         return NULL;
-    p->root = NULL;
-    p->size = 0;
-    p->key = key;
-    return p;
+    }
+    UINT64 n = ringCap(cap);
+    r->els = malloc(sizeof(void *) * n);
+    if (!r->els)
+    {
+        printError("spscRingNew error\n");
+        free(r);
+        return NULL;
+    }
+    r->mask = n - 1;
+    r->head = r->tailCache = 0;
+    r->tail = r->headCache = 0;
+    return r;
 }
-void avlTreeFree(struct avlTree *p)
+void spscRingFree(struct spscRing *r)
 {
-    if (!p)
-        return;
-    if (p->root)
+    if (r)
     {
-        struct Stack *s = stackNew();
-        stackPush(s, p->root);
-        while ((struct avlTreeNode *)stackPeek(s))
-        {
-            struct avlTreeNode *n = (struct avlTreeNode *)stackPop(s);
-            if (n->right)
-                stackPush(s, n->right);
-            if (n->left)
-                stackPush(s, n->left);
-            avlTreeNodeFree(n);
-        }
-        stackFree(s);
+        free(r->els);
+        free(r);
     }
-    free(p);
 }
-static struct avlTreeNode *avlTreeNodeNew(int k, void *v)
+int spscRingOffer(struct spscRing *r, void *el)
 {
-    struct avlTreeNode *p = malloc(sizeof(struct avlTreeNode));
-    if (!p)
-        return NULL;
-    p->parent = p->left = p->right = NULL;
-    p->height = 0;
-    p->key = k;
-    p->val = v;
-    return p;
+    return spscRingOfferBatch(r, &el, 1);
 }
-static void avlTreeNodeFree(struct avlTreeNode *p)
+void *spscRingPoll(struct spscRing *r)
 {
-    if (p)
-        free(p);
+    void *el;
+    return spscRingPollBatch(r, &el, 1) ? el : NULL;
 }
-int avlTreeAdd(struct avlTree *p, void *el)
+int spscRingOfferBatch(struct spscRing *r, void **els, int n)
 {
-    if (!p)
+    if (!r)
     {
-        printError("avlTree p is NULL\n");
+        printError("spscRingOfferBatch r is NULL\n");
         return 0;
     }
-
-    int k = (*p->key)(el);
-
-    struct avlTreeNode *q = p->root;
-    while (q)
+    if (n <= 0)
+        return 0;
+    // producer side, only the producer writes tail and headCache
+    UINT64 t = r->tail;
+    UINT64 room = r->mask + 1 - (t - r->headCache);
+    if (room < (UINT64)n)
+    {
+        r->headCache = ATOMIC_LOAD(&r->head);
+        room = r->mask + 1 - (t - r->headCache);
+        if (room == 0)
+            return 0;
+        if (room < (UINT64)n)
+            n = (int)room;
+    }
+    int i;
+    for (i = 0; i < n; i++)
+        r->els[(t + i) & r->mask] = els[i];
+    ATOMIC_STORE(&r->tail, t + n);
+    return n;
+}
+int spscRingPollBatch(struct spscRing *r, void **els, int n)
+{
+    if (!r)
     {
-        if (q->key > k)
-        {
-            /* left */
-            if (q->left)
-                q = q->left;
-            else
-                break;
-        }
-        else if (q->key < k)
-        {
-            if (q->right)
-                q = q->right;
-            else
-                break;
-        }
-        else
-        {
-            q->val = el;
-            return 1;
-        }
+        printError("spscRingPollBatch r is NULL\n");
+        return 0;
     }
-
-    struct avlTreeNode *n = avlTreeNodeNew(k, el);
-    if (!n)
+    if (n <= 0)
         return 0;
-
-    if (q)
+    // consumer side, only the consumer writes head and tailCache
+    UINT64 h = r->head;
+    UINT64 avail = r->tailCache - h;
+    if (avail < (UINT64)n)
+    {
+        r->tailCache = ATOMIC_LOAD(&r->tail);
+        avail = r->tailCache - h;
+        if (avail == 0)
+            return 0;
+        if (avail < (UINT64)n)
+            n = (int)avail;
+    }
+    int i;
+    for (i = 0; i < n; i++)
+        els[i] = r->els[(h + i) & r->mask];
+    ATOMIC_STORE(&r->head, h + n);
+    return n;
+}
+int spscRingSize(struct spscRing *r)
+{
+    if (!r)
+        return 0;
+    UINT64 h = ATOMIC_LOAD(&r->head);
+    return (int)(ATOMIC_LOAD(&r->tail) - h);
+}
+struct mpmcRing *mpmcRingNew(int cap)
+{
+    if (cap <= 0 || cap > (1 << 30))
     {
-        n->parent = q;
-        if (q->key > k)
-            q->left = n;
-        else
-            q->right = n;
+        printError("mpmcRingNew cap is error\n");
+        return NULL;
     }
-
-    struct avlTreeNode *b = n;
-    while (b)
+    struct mpmcRing *r = malloc(sizeof(struct mpmcRing));
+    if (!r)
     {
-        struct avlTreeNode *r = avlTreeBalance(b);
-        b = r->parent;
-        if (!b)
-        {
-            p->root = r;
-            break;
-        }
+        printError("mpmcRingNew error\n");
+        return NULL;
     }
-
-    p->size++;
-
-    return 1;
+    UINT64 n = ringCap(cap);
+    r->cells = malloc(sizeof(struct mpmcRingCell) * n);
+    if (!r->cells)
+    {
+        printError("mpmcRingNew error\n");
+        free(r);
+        return NULL;
+    }
+    UINT64 i;
+    for (i = 0; i < n; i++)
+        r->cells[i].seq = i;
+    r->mask = n - 1;
+    r->tail = r->head = 0;
+    return r;
 }
-int avlTreeRemove(struct avlTree *p, void *el)
+void mpmcRingFree(struct mpmcRing *r)
 {
-    if (!p)
+    if (r)
     {
-        printError("avlTree p is NULL\n");
-        return 0;
+        free(r->cells);
+        free(r);
     }
-
-    struct avlTreeNode *n = avlTreeSearch(p, el);
-    if (!n)
+}
+int mpmcRingOffer(struct mpmcRing *r, void *el)
+{
+    return mpmcRingOfferBatch(r, &el, 1);
+}
+void *mpmcRingPoll(struct mpmcRing *r)
+{
+    void *el;
+    return mpmcRingPollBatch(r, &el, 1) ? el : NULL;
+}
+int mpmcRingOfferBatch(struct mpmcRing *r, void **els, int n)
+{
+    if (!r)
     {
-        printDebug("avlTreeNode not found\n");
+        printError("mpmcRingOfferBatch r is NULL\n");
         return 0;
     }
-
-    if (n->left && n->right)
+    if (n <= 0)
+        return 0;
+    UINT64 pos = ATOMIC_LOAD_RELAXED(&r->tail);
+    int k;
+    for (;;)
     {
-        struct avlTreeNode *rm = avlTreeNodeFindMin(n->right);
-        n->key = rm->key;
-        n->val = rm->val;
-
-        if (rm->parent->left == rm)
-            rm->parent->left = rm->right;
-        else
-            rm->parent->right = rm->right;
-        if (rm->right)
-            rm->right->parent = rm->parent;
-
-        struct avlTreeNode *b = rm->parent;
-        avlTreeNodeFree(rm);
-        while (b)
+        // count the free cells from pos, a cell is free when seq == its position
+        for (k = 0; k < n; k++)
         {
-            b = avlTreeBalance(b);
-            if (b->parent)
-                b = b->parent;
-            else
+            long diff = (long)(ATOMIC_LOAD(&r->cells[(pos + k) & r->mask].seq) - (pos + k));
+            if (diff != 0)
             {
-                p->root = b;
+                if (k == 0 && diff > 0)
+                    k = -1; // another producer moved on, reload tail
                 break;
             }
         }
+        if (k == 0)
+            return 0;
+        if (k > 0 && ATOMIC_CAS(&r->tail, &pos, pos + k))
+            break;
+        if (k < 0)
+            pos = ATOMIC_LOAD_RELAXED(&r->tail);
     }
-    else if (n->left || n->right)
+    int i;
+    for (i = 0; i < k; i++)
     {
-        struct avlTreeNode *lr = n->left ? n->left : n->right;
-        n->key = lr->key;
-        n->val = lr->val;
-
-        n->left = lr->left;
-        if (n->left)
-            n->left->parent = n;
-
-        n->right = lr->right;
-        if (n->right)
-            n->right->parent = n;
-
-        avlTreeNodeFree(lr);
-
-        while (n)
+        struct mpmcRingCell *c = &r->cells[(pos + i) & r->mask];
+        c->el = els[i];
+        ATOMIC_STORE(&c->seq, pos + i + 1);
+    }
+    return k;
+}
+int mpmcRingPollBatch(struct mpmcRing *r, void **els, int n)
+{
+    if (!r)
+    {
+        printError("mpmcRingPollBatch r is NULL\n");
+        return 0;
+    }
+    if (n <= 0)
+        return 0;
+    UINT64 pos = ATOMIC_LOAD_RELAXED(&r->head);
+    int k;
+    for (;;)
+    {
+        // a cell is ready when seq == its position + 1
+        for (k = 0; k < n; k++)
         {
-            n = avlTreeBalance(n);
-            if (n->parent)
-                n = n->parent;
-            else
+            long diff = (long)(ATOMIC_LOAD(&r->cells[(pos + k) & r->mask].seq) - (pos + k + 1));
+            if (diff != 0)
             {
-                p->root = n;
+                if (k == 0 && diff > 0)
+                    k = -1; // another consumer moved on, reload head
                 break;
             }
         }
+        if (k == 0)
+            return 0;
+        if (k > 0 && ATOMIC_CAS(&r->head, &pos, pos + k))
+            break;
+        if (k < 0)
+            pos = ATOMIC_LOAD_RELAXED(&r->head);
     }
-    else
+    int i;
+    for (i = 0; i < k; i++)
     {
-        if (n->parent)
-        {
-            if (n == n->parent->left)
-                n->parent->left = NULL;
-            else
-                n->parent->right = NULL;
-
-            struct avlTreeNode *b = n->parent;
-            while (b)
-            {
-                b = avlTreeBalance(b);
-                if (b->parent)
-                    b = b->parent;
-                else
-                {
-                    p->root = b;
-                    break;
-                }
-            }
-        }
-        else
-            p->root = NULL;
-        avlTreeNodeFree(n);
+        struct mpmcRingCell *c = &r->cells[(pos + i) & r->mask];
+        els[i] = c->el;
+        // free the cell for the producer one lap ahead
+        ATOMIC_STORE(&c->seq, pos + i + r->mask + 1);
     }
+    return k;
+}
+int mpmcRingSize(struct mpmcRing *r)
+{
+    if (!r)
+        return 0;
+    UINT64 h = ATOMIC_LOAD(&r->head);
+    UINT64 t = ATOMIC_LOAD(&r->tail);
+    // producers and consumers race, the result is a snapshot
+    return t > h ? (int)(t - h) : 0;
+}
+static UINT64 ringCap(int cap)
+{
+    UINT64 n = 1;
+    while (n < (UINT64)cap)
+        n <<= 1;
+    return n;
+}
 
-    p->size--;
+/*
+ * ---------------------------------------------------------------- Work Stealing
+ */
 
-    return 1;
-}
-void *avlTreeSearch(struct avlTree *p, void *el)
+struct threadPoolTask
 {
-    if (p && p->root)
+    void (*fn)(void *);
+    void *arg;
+};
+
+static struct wsDequeArray *wsDequeArrayNew(long cap);
+static struct wsDequeArray *wsDequeGrow(struct wsDeque *d, long top, long bottom);
+static void *threadPoolRun(void *p);
+static struct threadPoolTask *threadPoolTake(struct threadPoolWorker *w);
+struct wsDeque *wsDequeNew(int cap)
+{
+    if (cap <= 0 || cap > (1 << 30))
     {
-        int k = (*p->key)(el);
-        struct avlTreeNode *n = p->root;
-        while (n)
+        printError("wsDequeNew cap is error\n");
+        return NULL;
+    }
+    struct wsDeque *d = malloc(sizeof(struct wsDeque));
+    if (!d)
+    {
+        printError("wsDequeNew error\n");
+        return NULL;
+    }
+    long n = 1;
+    while (n < cap)
+        n <<= 1;
+    d->array = wsDequeArrayNew(n);
+    d->retired = stackNew();
+    if (!d->array || !d->retired)
+    {
+        printError("wsDequeNew error\n");
+        if (d->array)
         {
-            if (n->key == k)
-                return n;
-            n = n->key > k ? n->left : n->right;
+            free(d->array->els);
+            free(d->array);
         }
+        stackFree(d->retired);
+        free(d);
+        return NULL;
     }
-    return NULL;
+    d->top = d->bottom = 0;
+    return d;
 }
-void *avlTreeFindMin(struct avlTree *p)
+void wsDequeFree(struct wsDeque *d)
 {
-    if (p && p->root)
+    if (d)
     {
-        struct avlTreeNode *n = p->root;
-        while (n)
+        struct wsDequeArray *a;
+        while ((a = stackPop(d->retired)) != NULL)
         {
-            if (n->left)
-                n = n->left;
-            else
-                return n->val;
+            free(a->els);
+            free(a);
         }
-        return NULL;
+        stackFree(d->retired);
+        free(d->array->els);
+        free(d->array);
+        free(d);
     }
-    return NULL;
 }
-void *avlTreeFindMax(struct avlTree *p)
+int wsDequePush(struct wsDeque *d, void *el)
 {
-    if (p && p->root)
+    if (!d)
     {
-        struct avlTreeNode *n = p->root;
-        while (n)
-        {
-            if (n->right)
-                n = n->right;
-            else
-                return n->val;
-        }
-        return NULL;
+        printError("wsDequePush d is NULL\n");
+        return 0;
     }
-    return NULL;
+    long b = ATOMIC_LOAD_RELAXED(&d->bottom);
+    long t = ATOMIC_LOAD(&d->top);
+    struct wsDequeArray *a = ATOMIC_LOAD_RELAXED(&d->array);
+    if (b - t > a->cap - 1)
+    {
+        a = wsDequeGrow(d, t, b);
+        if (!a)
+            return 0;
+    }
+    __atomic_store_n(&a->els[b & (a->cap - 1)], el, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return 1;
 }
-static struct avlTreeNode *avlTreeBalance(struct avlTreeNode *b)
+void *wsDequePop(struct wsDeque *d)
 {
-    if (avlTreeLh(b) - avlTreeRh(b) > 1)
+    if (!d)
     {
-        /* left */
-        if (avlTreeLh(b->left) >= avlTreeRh(b->left))
-        {
-            /* left left */
-            return avlTreeRotateRight(b);
-        }
-        else
-        {
-            /* left right */
-            avlTreeRotateLeft(b->left);
-            return avlTreeRotateRight(b);
-        }
+        printError("wsDequePop d is NULL\n");
+        return NULL;
     }
-    else if (avlTreeRh(b) - avlTreeLh(b) > 1)
+    long b = ATOMIC_LOAD_RELAXED(&d->bottom) - 1;
+    struct wsDequeArray *a = ATOMIC_LOAD_RELAXED(&d->array);
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = ATOMIC_LOAD_RELAXED(&d->top);
+    void *el = NULL;
+    if (t <= b)
     {
-        /* right */
-        if (avlTreeRh(b->right) >= avlTreeLh(b->right))
-        {
-            /* right right */
-            return avlTreeRotateLeft(b);
-        }
-        else
+        el = __atomic_load_n(&a->els[b & (a->cap - 1)], __ATOMIC_RELAXED);
+        if (t == b)
         {
-            /* right left */
-            avlTreeRotateRight(b->right);
-            return avlTreeRotateLeft(b);
+            // the last element, race the thieves for it
+            if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED))
+                el = NULL;
+            __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
         }
     }
     else
-    {
-        b->height = max(avlTreeLh(b), avlTreeRh(b)) + 1;
-        return b;
-    }
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return el;
 }
-static struct avlTreeNode *avlTreeRotateLeft(struct avlTreeNode *n)
+void *wsDequeSteal(struct wsDeque *d)
 {
-    struct avlTreeNode *p = n->parent;
-    struct avlTreeNode *r = n->right;
-
-    if (p)
+    if (!d)
     {
-        if (p->left && p->left == n)
-            p->left = r;
-        else
-            p->right = r;
+        printError("wsDequeSteal d is NULL\n");
+        return NULL;
     }
-
-    n->parent = r;
-    n->right = r->left;
-    if (n->right)
-        n->right->parent = n;
-    n->height = max(avlTreeLh(n), avlTreeRh(n)) + 1;
-
-    r->parent = p;
-    r->left = n;
-    r->height = max(avlTreeLh(r), avlTreeRh(r)) + 1;
-
-    return r;
+    long t = ATOMIC_LOAD(&d->top);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = ATOMIC_LOAD(&d->bottom);
+    if (t >= b)
+        return NULL;
+    struct wsDequeArray *a = ATOMIC_LOAD(&d->array);
+    void *el = __atomic_load_n(&a->els[t & (a->cap - 1)], __ATOMIC_RELAXED);
+    // NULL as well when another thief or the owner won
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return el;
 }
-static struct avlTreeNode *avlTreeRotateRight(struct avlTreeNode *n)
+long wsDequeSize(struct wsDeque *d)
 {
-    struct avlTreeNode *p = n->parent;
-    struct avlTreeNode *l = n->left;
-
-    if (p)
+    if (!d)
+        return 0;
+    long t = ATOMIC_LOAD(&d->top);
+    long b = ATOMIC_LOAD(&d->bottom);
+    return b > t ? b - t : 0;
+}
+struct threadPool *threadPoolNew(int n)
+{
+    if (n <= 0)
     {
-        if (p->left && p->left == n)
-            p->left = l;
+        printError("threadPoolNew n is error\n");
+        return NULL;
+    }
+    struct threadPool *pool = malloc(sizeof(struct threadPool));
+    if (!pool)
+    {
+        printError("threadPoolNew error\n");
+        return NULL;
+    }
+    pool->workers = calloc(n, sizeof(struct threadPoolWorker));
+    pool->queue = queueNew();
+    if (!pool->workers || !pool->queue || pthread_key_create(&pool->key, NULL))
+    {
+        printError("threadPoolNew error\n");
+        if (pool->workers)
+            free(pool->workers);
+        queueFree(pool->queue);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->n = n;
+    pool->queued = pool->pending = 0;
+    pool->idle = pool->stop = 0;
+    int i, started = 0, ok = 1;
+    for (i = 0; i < n; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].seed = i + 1;
+        pool->workers[i].deque = wsDequeNew(256);
+        if (!pool->workers[i].deque)
+            ok = 0;
+    }
+    while (ok && started < n)
+    {
+        if (pthread_create(&pool->workers[started].tid, NULL, threadPoolRun, pool->workers + started))
+            ok = 0;
         else
-            p->right = l;
+            started++;
+    }
+    if (!ok)
+    {
+        // stop the workers already started, then free as threadPoolFree does
+        printError("threadPoolNew worker error\n");
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = 1;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+        for (i = 0; i < started; i++)
+            pthread_join(pool->workers[i].tid, NULL);
+        for (i = 0; i < n; i++)
+            wsDequeFree(pool->workers[i].deque);
+        pthread_key_delete(pool->key);
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->work);
+        pthread_cond_destroy(&pool->done);
+        queueFree(pool->queue);
+        free(pool->workers);
+        free(pool);
+        return NULL;
     }
-
-    n->parent = l;
-    n->left = l->right;
-    if (n->left)
-        n->left->parent = n;
-    n->height = max(avlTreeLh(n), avlTreeRh(n)) + 1;
-
-    l->parent = p;
-    l->right = n;
-    l->height = max(avlTreeLh(l), avlTreeRh(l)) + 1;
-
-    return l;
+    return pool;
 }
-static int avlTreeLh(struct avlTreeNode *n)
+void threadPoolFree(struct threadPool *pool)
 {
-    return n->left ? n->left->height : -1;
+    // the tasks already submitted run first
+    if (pool)
+    {
+        threadPoolWait(pool);
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = 1;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+        int i;
+        for (i = 0; i < pool->n; i++)
+        {
+            pthread_join(pool->workers[i].tid, NULL);
+            wsDequeFree(pool->workers[i].deque);
+        }
+        pthread_key_delete(pool->key);
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->work);
+        pthread_cond_destroy(&pool->done);
+        queueFree(pool->queue);
+        free(pool->workers);
+        free(pool);
+    }
 }
-static int avlTreeRh(struct avlTreeNode *n)
+int threadPoolSubmit(struct threadPool *pool, void (*fn)(void *), void *arg)
 {
-    return n->right ? n->right->height : -1;
+    if (!pool)
+    {
+        printError("threadPoolSubmit pool is NULL\n");
+        return 0;
+    }
+    if (!fn)
+    {
+        printError("threadPoolSubmit fn is NULL\n");
+        return 0;
+    }
+    struct threadPoolTask *task = malloc(sizeof(struct threadPoolTask));
+    if (!task)
+    {
+        printError("threadPoolSubmit error\n");
+        return 0;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+
+    int ok;
+    struct threadPoolWorker *w = pthread_getspecific(pool->key);
+    if (w)
+        ok = wsDequePush(w->deque, task);
+    else
+    {
+        pthread_mutex_lock(&pool->lock);
+        ok = queueOffer(pool->queue, task);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    if (!ok)
+    {
+        free(task);
+        if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0)
+        {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_broadcast(&pool->done);
+            pthread_mutex_unlock(&pool->lock);
+        }
+        return 0;
+    }
+    // a worker checks queued after it counts itself idle, so it cannot miss this
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return 1;
 }
-static struct avlTreeNode *avlTreeNodeFindMin(struct avlTreeNode *n)
+void threadPoolWait(struct threadPool *pool)
 {
-    while (n->left)
-        n = n->left;
-    return n;
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
 }
-#ifdef DEBUG
-static int avlTreeHeight(struct avlTreeNode *n)
+static struct wsDequeArray *wsDequeArrayNew(long cap)
 {
-    if (n)
-        return max(avlTreeHeight(n->left), avlTreeHeight(n->right)) + 1;
-    else
-        return -1;
+    struct wsDequeArray *a = malloc(sizeof(struct wsDequeArray));
+    if (!a)
+        return NULL;
+    a->els = malloc(sizeof(void *) * cap);
+    if (!a->els)
+    {
+        free(a);
+        return NULL;
+    }
+    a->cap = cap;
+    return a;
 }
-static void avlTreeCheck(struct avlTreeNode *n)
+static struct wsDequeArray *wsDequeGrow(struct wsDeque *d, long top, long bottom)
 {
-    if (n)
+    struct wsDequeArray *old = d->array;
+    struct wsDequeArray *a = wsDequeArrayNew(old->cap << 1);
+    if (!a || !stackPush(d->retired, old))
     {
-        if (n->left && n->left->parent != n)
-            printError("parent set error");
-        if (n->right && n->right->parent != n)
-            printError("parent set error");
-
-        int lh = avlTreeHeight(n->left);
-        int rh = avlTreeHeight(n->right);
-        if (lh - rh > 1)
-            printError("error");
-        if (rh - lh > 1)
-            printError("error");
+        printError("wsDequeGrow error\n");
+        if (a)
+        {
+            free(a->els);
+            free(a);
+        }
+        return NULL;
     }
+    long i;
+    for (i = top; i < bottom; i++)
+        a->els[i & (a->cap - 1)] = __atomic_load_n(&old->els[i & (old->cap - 1)], __ATOMIC_RELAXED);
+    ATOMIC_STORE(&d->array, a);
+    return a;
 }
-void avlTreePrint(struct avlTree *p, void (*printVal)(void *))
+static void *threadPoolRun(void *p)
 {
-    if (p && p->root && printVal)
+    struct threadPoolWorker *w = (struct threadPoolWorker *)p;
+    struct threadPool *pool = w->pool;
+    pthread_setspecific(pool->key, w);
+    for (;;)
     {
-        struct Stack *stack = stackNew();
-        if (!stack)
-            return;
-
-        stackPush(stack, p->root);
-        struct avlTreeNode *printed = NULL;
-        while (stackPeek(stack))
+        struct threadPoolTask *task = threadPoolTake(w);
+        if (task)
         {
-            struct avlTreeNode *n = (struct avlTreeNode *)stackPop(stack);
-            avlTreeCheck(n);
-            if (n->left)
-            {
-                if (printed && printed->key >= n->left->key)
-                {
-                    printVal(n->val);
-                    printed = n;
-                    if (n->right)
-                        stackPush(stack, n->right);
-                }
-                else
-                {
-                    stackPush(stack, n);
-                    stackPush(stack, n->left);
-                }
-            }
-            else
+            __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+            task->fn(task->arg);
+            free(task);
+            if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0)
             {
-                printVal(n->val);
-                printed = n;
-                if (n->right)
-                    stackPush(stack, n->right);
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->done);
+                pthread_mutex_unlock(&pool->lock);
             }
+            continue;
         }
 
-        stackFree(stack);
+        pthread_mutex_lock(&pool->lock);
+        __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+        while (!pool->stop && __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) <= 0)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+        int stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop)
+            return NULL;
     }
 }
-#endif // DEBUG
+static struct threadPoolTask *threadPoolTake(struct threadPoolWorker *w)
+{
+    struct threadPool *pool = w->pool;
+    struct threadPoolTask *task = wsDequePop(w->deque);
+    if (task)
+        return task;
+    if (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) <= 0)
+        return NULL;
+    pthread_mutex_lock(&pool->lock);
+    task = queuePoll(pool->queue);
+    pthread_mutex_unlock(&pool->lock);
+    if (task)
+        return task;
+    // start at a random victim so thieves spread out
+    w->seed = w->seed * 1103515245 + 12345;
+    int i, start = (int)((w->seed >> 16) % pool->n);
+    for (i = 0; i < pool->n; i++)
+    {
+        struct threadPoolWorker *v = pool->workers + (start + i) % pool->n;
+        if (v != w && (task = wsDequeSteal(v->deque)) != NULL)
+            return task;
+    }
+    return NULL;
+}
 
 /*
- * -------------------------------------------------------------- Red-Black Tree
+ * -------------------------------------------------------------------- Avl Tree
  */
 
-static struct rbTreeNode *rbTreeNodeNew(int k, void *v);
-static void rbTreeNodeFree(struct rbTreeNode *p);
-static struct rbTreeNode *p(struct rbTreeNode *n);
-static struct rbTreeNode *l(struct rbTreeNode *n);
-static struct rbTreeNode *r(struct rbTreeNode *n);
-static int c(struct rbTreeNode *n);
-static void rbTreeInsertFixup(struct rbTree *t, struct rbTreeNode *z);
-static void rbTreeDeleteFixup(struct rbTree *t, struct rbTreeNode *x);
-static void rbTreeLeftRotate(struct rbTree *t, struct rbTreeNode *x);
-static void rbTreeRightRotate(struct rbTree *t, struct rbTreeNode *x);
-static void rbTreeTransplant(struct rbTree *t, struct rbTreeNode *u, struct rbTreeNode *v);
-static struct rbTreeNode *rbTreeNodeFindMin(struct rbTreeNode *n);
+static struct avlTreeNode *avlTreeNodeNew(struct avlTree *t, int k, void *v);
+static void avlTreeNodeFree(struct avlTree *t, struct avlTreeNode *p);
+static struct avlTreeNode *avlTreeBalance(struct avlTree *t, struct avlTreeNode *b);
+static struct avlTreeNode *avlTreeRotateLeft(struct avlTree *t, struct avlTreeNode *n);
+static struct avlTreeNode *avlTreeRotateRight(struct avlTree *t, struct avlTreeNode *n);
+static int avlTreeLh(struct avlTreeNode *n);
+static int avlTreeRh(struct avlTreeNode *n);
+static struct avlTreeNode *avlTreeNodeFindMin(struct avlTreeNode *n);
+static int avlTreeAddCore(struct avlTree *p, void *el);
+static int avlTreeRemoveCore(struct avlTree *p, void *el);
+static struct avlTreeNode *avlTreeFind(struct avlTree *p, void *el);
+static struct avlTreeNode *avlTreeBuild(struct avlTreeNode **nodes, long lo, long hi,
+                                        struct avlTreeNode *parent);
 
-struct rbTree *rbTreeNew(int (*key)(void *))
+struct avlTree *avlTreeNew(int (*key)(void *))
 {
     if (!key)
-    {
-        printError("rbTreeNew key is NULL\n");
         return NULL;
-    }
-    struct rbTree *p = malloc(sizeof(struct rbTree));
-    if (p)
-    {
-        // p->root = NULL;
-        p->root = RB_NIL;
-        p->size = 0;
-        p->key = key;
-        return p;
-    }
-    else
-    {
-        printError("rbTreeNew error");
+    struct avlTree *p = malloc(sizeof(struct avlTree));
+    if (!p)
         return NULL;
-    }
+    p->root = NULL;
+    p->size = 0;
+    p->key = key;
+    p->stats = statsNew();
+    return p;
 }
-void rbTreeFree(struct rbTree *p)
+void avlTreeFree(struct avlTree *p)
 {
     if (!p)
         return;
-    if (p->root && p->root != RB_NIL)
+    if (p->root)
     {
         struct Stack *s = stackNew();
         stackPush(s, p->root);
-        while ((struct rbTreeNode *)stackPeek(s))
+        while ((struct avlTreeNode *)stackPeek(s))
         {
-            struct rbTreeNode *n = (struct rbTreeNode *)stackPop(s);
-            if (n->right && n->right != RB_NIL)
+            struct avlTreeNode *n = (struct avlTreeNode *)stackPop(s);
+            if (n->right)
                 stackPush(s, n->right);
-            if (n->left && n->left != RB_NIL)
+            if (n->left)
                 stackPush(s, n->left);
-            rbTreeNodeFree(n);
+            avlTreeNodeFree(p, n);
         }
         stackFree(s);
     }
+    free(p->stats);
     free(p);
 }
-static struct rbTreeNode *rbTreeNodeNew(int k, void *v)
+static struct avlTreeNode *avlTreeNodeNew(struct avlTree *t, int k, void *v)
 {
-    struct rbTreeNode *p = malloc(sizeof(struct rbTreeNode));
+    struct avlTreeNode *p = malloc(sizeof(struct avlTreeNode));
     if (!p)
         return NULL;
-    p->parent = NULL;
-    p->left = p->right = RB_NIL;
-    p->color = RB_RED;
+    p->parent = p->left = p->right = NULL;
+    p->height = 0;
     p->key = k;
     p->val = v;
+    STATS_ADD(t->stats, allocs, 1);
     return p;
 }
-static void rbTreeNodeFree(struct rbTreeNode *p)
+static void avlTreeNodeFree(struct avlTree *t, struct avlTreeNode *p)
 {
     if (p)
+    {
+        STATS_ADD(t->stats, frees, 1);
         free(p);
+    }
 }
-int rbTreeInsert(struct rbTree *t, void *el)
+int avlTreeAdd(struct avlTree *p, void *el)
 {
-    if (!t)
+    if (!p)
     {
-        printError("rbTreeInsert t is NULL");
+        printError("avlTree p is NULL\n");
         return 0;
     }
+    UINT64 t0 = STATS_NOW();
+    int r = avlTreeAddCore(p, el);
+    STATS_RECORD(p->stats, insert, t0);
+    return r;
+}
+static int avlTreeAddCore(struct avlTree *p, void *el)
+{
+    int k = (*p->key)(el);
 
-    int k = t->key(el);
-
-    struct rbTreeNode *y = RB_NIL;
-    struct rbTreeNode *x = t->root;
-    while (x != RB_NIL)
+    struct avlTreeNode *q = p->root;
+    while (q)
     {
-        y = x;
-        if (k < x->key)
-            x = l(x);
-        else if (k > x->key)
-            x = r(x);
+        if (q->key > k)
+        {
+            /* left */
+            if (q->left)
+                q = q->left;
+            else
+                break;
+        }
+        else if (q->key < k)
+        {
+            if (q->right)
+                q = q->right;
+            else
+                break;
+        }
         else
         {
-            x->val = el;
+            q->val = el;
             return 1;
         }
     }
 
-    struct rbTreeNode *z = rbTreeNodeNew(k, el);
-    if (!z)
-    {
-        printError("rbTreeNodeNew error\n");
+    struct avlTreeNode *n = avlTreeNodeNew(p, k, el);
+    if (!n)
         return 0;
-    }
 
-    z->parent = y;
-    if (y == RB_NIL)
-        t->root = z;
-    else if (z->key < y->key)
-        y->left = z;
-    else
-        y->right = z;
+    if (q)
+    {
+        n->parent = q;
+        if (q->key > k)
+            q->left = n;
+        else
+            q->right = n;
+    }
 
-    rbTreeInsertFixup(t, z);
+    struct avlTreeNode *b = n;
+    while (b)
+    {
+        struct avlTreeNode *r = avlTreeBalance(p, b);
+        b = r->parent;
+        if (!b)
+        {
+            p->root = r;
+            break;
+        }
+    }
 
-    t->size++;
+    p->size++;
 
     return 1;
 }
-int rbTreeDelete(struct rbTree *t, void *el)
+int avlTreeRemove(struct avlTree *p, void *el)
 {
-    if (!t)
+    if (!p)
     {
-        printError("rbTreeDelete t is NULL");
+        printError("avlTree p is NULL\n");
         return 0;
     }
-
-    struct rbTreeNode *x = NULL;
-    struct rbTreeNode *y = NULL;
-    struct rbTreeNode *z = rbTreeSearch(t, el);
-
-    if (!z)
+    UINT64 t0 = STATS_NOW();
+    int r = avlTreeRemoveCore(p, el);
+    STATS_RECORD(p->stats, remove, t0);
+    return r;
+}
+static int avlTreeRemoveCore(struct avlTree *p, void *el)
+{
+    struct avlTreeNode *n = avlTreeFind(p, el);
+    if (!n)
+    {
+#ifdef DEBUG
+        printDebug("avlTreeNode not found\n");
+#endif // DEBUG
         return 0;
+    }
 
-    y = z;
-    int yOriginalColor = c(y);
-    if (l(z) == RB_NIL)
+    if (n->left && n->right)
     {
-        x = r(z);
-        rbTreeTransplant(t, z, r(z));
+        struct avlTreeNode *rm = avlTreeNodeFindMin(n->right);
+        n->key = rm->key;
+        n->val = rm->val;
+
+        if (rm->parent->left == rm)
+            rm->parent->left = rm->right;
+        else
+            rm->parent->right = rm->right;
+        if (rm->right)
+            rm->right->parent = rm->parent;
+
+        struct avlTreeNode *b = rm->parent;
+        avlTreeNodeFree(p, rm);
+        while (b)
+        {
+            b = avlTreeBalance(p, b);
+            if (b->parent)
+                b = b->parent;
+            else
+            {
+                p->root = b;
+                break;
+            }
+        }
     }
-    else if (r(z) == RB_NIL)
+    else if (n->left || n->right)
     {
-        x = l(z);
-        rbTreeTransplant(t, z, l(z));
+        struct avlTreeNode *lr = n->left ? n->left : n->right;
+        n->key = lr->key;
+        n->val = lr->val;
+
+        n->left = lr->left;
+        if (n->left)
+            n->left->parent = n;
+
+        n->right = lr->right;
+        if (n->right)
+            n->right->parent = n;
+
+        avlTreeNodeFree(p, lr);
+
+        while (n)
+        {
+            n = avlTreeBalance(p, n);
+            if (n->parent)
+                n = n->parent;
+            else
+            {
+                p->root = n;
+                break;
+            }
+        }
     }
     else
     {
-        y = rbTreeNodeFindMin(r(z));
-        yOriginalColor = c(y);
-        x = r(y);
-        if (p(y) == z)
-            x->parent = y;
-        else
+        if (n->parent)
         {
-            rbTreeTransplant(t, y, r(y));
-            y->right = r(z);
-            r(y)->parent = y;
+            if (n == n->parent->left)
+                n->parent->left = NULL;
+            else
+                n->parent->right = NULL;
+
+            struct avlTreeNode *b = n->parent;
+            while (b)
+            {
+                b = avlTreeBalance(p, b);
+                if (b->parent)
+                    b = b->parent;
+                else
+                {
+                    p->root = b;
+                    break;
+                }
+            }
         }
-        rbTreeTransplant(t, z, y);
-        y->left = l(z);
-        l(y)->parent = y;
-        y->color = c(z);
+        else
+            p->root = NULL;
+        avlTreeNodeFree(p, n);
     }
-    if (yOriginalColor == RB_BLACK)
-        rbTreeDeleteFixup(t, x);
 
-    rbTreeNodeFree(z);
-    t->size--;
+    p->size--;
 
     return 1;
 }
-void *rbTreeSearch(struct rbTree *p, void *el)
+void *avlTreeSearch(struct avlTree *p, void *el)
+{
+    if (!p)
+        return NULL;
+    UINT64 t0 = STATS_NOW();
+    struct avlTreeNode *n = avlTreeFind(p, el);
+    STATS_RECORD(p->stats, lookup, t0);
+    return n;
+}
+static struct avlTreeNode *avlTreeFind(struct avlTree *p, void *el)
 {
     if (p && p->root)
     {
         int k = (*p->key)(el);
-        struct rbTreeNode *n = p->root;
+        struct avlTreeNode *n = p->root;
         while (n)
         {
             if (n->key == k)
@@ -858,15 +1933,28 @@ void *rbTreeSearch(struct rbTree *p, void *el)
     }
     return NULL;
 }
-void *rbTreeFindMin(struct rbTree *p)
+static struct avlTreeNode *avlTreeBuild(struct avlTreeNode **nodes, long lo, long hi,
+                                        struct avlTreeNode *parent)
 {
-    if (p && p->root && p->root != RB_NIL)
+    if (lo > hi)
+        return NULL;
+    long mid = lo + (hi - lo) / 2;
+    struct avlTreeNode *n = nodes[mid];
+    n->parent = parent;
+    n->left = avlTreeBuild(nodes, lo, mid - 1, n);
+    n->right = avlTreeBuild(nodes, mid + 1, hi, n);
+    n->height = max(avlTreeLh(n), avlTreeRh(n)) + 1;
+    return n;
+}
+void *avlTreeFindMin(struct avlTree *p)
+{
+    if (p && p->root)
     {
-        struct rbTreeNode *n = p->root;
-        while (n && n != RB_NIL)
+        struct avlTreeNode *n = p->root;
+        while (n)
         {
-            if (l(n) && l(n) != RB_NIL)
-                n = l(n);
+            if (n->left)
+                n = n->left;
             else
                 return n->val;
         }
@@ -874,15 +1962,15 @@ void *rbTreeFindMin(struct rbTree *p)
     }
     return NULL;
 }
-void *rbTreeFindMax(struct rbTree *p)
+void *avlTreeFindMax(struct avlTree *p)
 {
-    if (p && p->root && p->root != RB_NIL)
+    if (p && p->root)
     {
-        struct rbTreeNode *n = p->root;
-        while (n && n != RB_NIL)
+        struct avlTreeNode *n = p->root;
+        while (n)
         {
-            if (r(n) && r(n) != RB_NIL)
-                n = r(n);
+            if (n->right)
+                n = n->right;
             else
                 return n->val;
         }
@@ -890,1745 +1978,7355 @@ void *rbTreeFindMax(struct rbTree *p)
     }
     return NULL;
 }
-static struct rbTreeNode *p(struct rbTreeNode *n)
-{
-    return n && n->parent ? n->parent : NULL;
-}
-static struct rbTreeNode *l(struct rbTreeNode *n)
+int avlTreeSave(struct avlTree *p, const char *path, struct snapshotCodec *el)
 {
-    return n ? n->left : NULL;
+    if (!p || !path || !snapshotCodecValid(el))
+    {
+        printError("avlTreeSave p, path or codec is NULL\n");
+        return 0;
+    }
+    struct snapshotWriter w;
+    if (!snapshotCreate(&w, path, SNAPSHOT_AVL_TREE, p->size))
+        return 0;
+    // in order, the load builds straight from the sorted records
+    struct Stack *s = stackNew();
+    int ok = s != NULL;
+    struct avlTreeNode *n = p->root;
+    while (ok && (n || stackSize(s)))
+    {
+        if (n)
+        {
+            ok = stackPush(s, n);
+            n = n->left;
+        }
+        else
+        {
+            n = stackPop(s);
+            ok = snapshotPut(&w, el, n->val);
+            n = n->right;
+        }
+    }
+    stackFree(s);
+    return snapshotCommit(&w, ok);
 }
-static struct rbTreeNode *r(struct rbTreeNode *n)
+int avlTreeLoad(struct avlTree *p, const char *path, struct snapshotCodec *el)
 {
-    return n ? n->right : NULL;
+    if (!p || !path || !snapshotCodecValid(el))
+    {
+        printError("avlTreeLoad p, path or codec is NULL\n");
+        return 0;
+    }
+    if (p->size)
+    {
+        printError("avlTreeLoad p is not empty\n");
+        return 0;
+    }
+    struct snapshotReader r;
+    if (!snapshotOpen(&r, path, SNAPSHOT_AVL_TREE))
+        return 0;
+    struct avlTreeNode **nodes = NULL;
+    int ok = r.count <= INT_MAX && (nodes = malloc(sizeof(struct avlTreeNode *) * (r.count + 1)));
+    long n = 0;
+    while (ok && n < (long)r.count)
+    {
+        void *x = NULL;
+        ok = snapshotGet(&r, el, &x) && x;
+        int k = ok ? p->key(x) : 0;
+        ok = ok && (!n || k > nodes[n - 1]->key) && (nodes[n] = avlTreeNodeNew(p, k, x));
+        if (ok)
+            n++;
+        else
+            snapshotRelease(el, x);
+    }
+    snapshotClose(&r);
+    if (!ok)
+        printError("avlTreeLoad %s record %ld error\n", path, n);
+
+    // the middle record is the root, a balanced tree needs no rotation
+    p->root = avlTreeBuild(nodes, 0, n - 1, NULL);
+    p->size = (int)n;
+    free(nodes);
+    return ok;
 }
-static int c(struct rbTreeNode *n)
+struct opStats *avlTreeOpStats(struct avlTree *p)
 {
-    return n ? n->color : RB_BLACK;
+    return p ? p->stats : NULL;
 }
-static void rbTreeInsertFixup(struct rbTree *t, struct rbTreeNode *z)
+static struct avlTreeNode *avlTreeBalance(struct avlTree *t, struct avlTreeNode *b)
 {
-    struct rbTreeNode *y = NULL;
-    while (c(p(z)) == RB_RED)
+    if (avlTreeLh(b) - avlTreeRh(b) > 1)
     {
-        if (p(z) == l(p(p(z))))
+        /* left */
+        if (avlTreeLh(b->left) >= avlTreeRh(b->left))
         {
-            y = r(p(p(z)));
-            if (c(y) == RB_RED)
-            {
-                p(z)->color = RB_BLACK;  // case 1
-                y->color = RB_BLACK;     // case 1
-                p(p(z))->color = RB_RED; // case 1
-                z = p(p(z));             // case 1
-            }
-            else
-            {
-                if (z == r(p(z)))
-                {
-                    z = p(z);               // case 2
-                    rbTreeLeftRotate(t, z); // case 2
-                }
-                p(z)->color = RB_BLACK;        // case 3
-                p(p(z))->color = RB_RED;       // case 3
-                rbTreeRightRotate(t, p(p(z))); // case 3
-            }
+            /* left left */
+            return avlTreeRotateRight(t, b);
         }
         else
         {
-            y = l(p(p(z)));
-            if (c(y) == RB_RED)
-            {
-                p(z)->color = RB_BLACK;  // case 1
-                y->color = RB_BLACK;     // case 1
-                p(p(z))->color = RB_RED; // case 1
-                z = p(p(z));             // case 1
-            }
-            else
-            {
-                if (z == l(p(z)))
-                {
-                    z = p(z);                // case 2
-                    rbTreeRightRotate(t, z); // case 2
-                }
-                p(z)->color = RB_BLACK;       // case 3
-                p(p(z))->color = RB_RED;      // case 3
-                rbTreeLeftRotate(t, p(p(z))); // case 3
-            }
+            /* left right */
+            avlTreeRotateLeft(t, b->left);
+            return avlTreeRotateRight(t, b);
         }
     }
-    t->root->color = RB_BLACK;
+    else if (avlTreeRh(b) - avlTreeLh(b) > 1)
+    {
+        /* right */
+        if (avlTreeRh(b->right) >= avlTreeLh(b->right))
+        {
+            /* right right */
+            return avlTreeRotateLeft(t, b);
+        }
+        else
+        {
+            /* right left */
+            avlTreeRotateRight(t, b->right);
+            return avlTreeRotateLeft(t, b);
+        }
+    }
+    else
+    {
+        b->height = max(avlTreeLh(b), avlTreeRh(b)) + 1;
+        return b;
+    }
 }
-static void rbTreeDeleteFixup(struct rbTree *t, struct rbTreeNode *x)
+static struct avlTreeNode *avlTreeRotateLeft(struct avlTree *t, struct avlTreeNode *n)
 {
-    while (x != t->root && c(x) == RB_BLACK)
+    struct avlTreeNode *p = n->parent;
+    struct avlTreeNode *r = n->right;
+
+    STATS_ADD(t->stats, rotations, 1);
+
+    if (p)
     {
-        if (x == l(p(x)))
+        if (p->left && p->left == n)
+            p->left = r;
+        else
+            p->right = r;
+    }
+
+    n->parent = r;
+    n->right = r->left;
+    if (n->right)
+        n->right->parent = n;
+    n->height = max(avlTreeLh(n), avlTreeRh(n)) + 1;
+
+    r->parent = p;
+    r->left = n;
+    r->height = max(avlTreeLh(r), avlTreeRh(r)) + 1;
+
+    return r;
+}
+static struct avlTreeNode *avlTreeRotateRight(struct avlTree *t, struct avlTreeNode *n)
+{
+    struct avlTreeNode *p = n->parent;
+    struct avlTreeNode *l = n->left;
+
+    STATS_ADD(t->stats, rotations, 1);
+
+    if (p)
+    {
+        if (p->left && p->left == n)
+            p->left = l;
+        else
+            p->right = l;
+    }
+
+    n->parent = l;
+    n->left = l->right;
+    if (n->left)
+        n->left->parent = n;
+    n->height = max(avlTreeLh(n), avlTreeRh(n)) + 1;
+
+    l->parent = p;
+    l->right = n;
+    l->height = max(avlTreeLh(l), avlTreeRh(l)) + 1;
+
+    return l;
+}
+static int avlTreeLh(struct avlTreeNode *n)
+{
+    return n->left ? n->left->height : -1;
+}
+static int avlTreeRh(struct avlTreeNode *n)
+{
+    return n->right ? n->right->height : -1;
+}
+static struct avlTreeNode *avlTreeNodeFindMin(struct avlTreeNode *n)
+{
+    while (n->left)
+        n = n->left;
+    return n;
+}
+#ifdef DEBUG
+static int avlTreeHeight(struct avlTreeNode *n)
+{
+    if (n)
+        return max(avlTreeHeight(n->left), avlTreeHeight(n->right)) + 1;
+    else
+        return -1;
+}
+static void avlTreeCheck(struct avlTreeNode *n)
+{
+    if (n)
+    {
+        if (n->left && n->left->parent != n)
+            printError("parent set error");
+        if (n->right && n->right->parent != n)
+            printError("parent set error");
+
+        int lh = avlTreeHeight(n->left);
+        int rh = avlTreeHeight(n->right);
+        if (lh - rh > 1)
+            printError("error");
+        if (rh - lh > 1)
+            printError("error");
+    }
+}
+void avlTreePrint(struct avlTree *p, void (*printVal)(void *))
+{
+    if (p && p->root && printVal)
+    {
+        struct Stack *stack = stackNew();
+        if (!stack)
+            return;
+
+        stackPush(stack, p->root);
+        struct avlTreeNode *printed = NULL;
+        while (stackPeek(stack))
         {
-            struct rbTreeNode *w = r(p(x));
-            if (c(w) == RB_RED)
-            {
-                w->color = RB_BLACK;       // case 1
-                p(x)->color = RB_RED;      // case 1
-                rbTreeLeftRotate(t, p(x)); // case 1
-                w = r(p(x));               // case 1
-            }
-            if (c(l(w)) == RB_BLACK && c(r(w)) == RB_BLACK)
+            struct avlTreeNode *n = (struct avlTreeNode *)stackPop(stack);
+            avlTreeCheck(n);
+            if (n->left)
             {
-                if (w)                 // xxxx
-                    w->color = RB_RED; // case 2
-                x = p(x);              // case 2
+                if (printed && printed->key >= n->left->key)
+                {
+                    printVal(n->val);
+                    printed = n;
+                    if (n->right)
+                        stackPush(stack, n->right);
+                }
+                else
+                {
+                    stackPush(stack, n);
+                    stackPush(stack, n->left);
+                }
             }
             else
             {
-                if (c(r(w)) == RB_BLACK)
-                {
-                    l(w)->color = RB_BLACK;  // case 3
-                    w->color = RB_RED;       // case 3
-                    rbTreeRightRotate(t, w); // case 3
-                    w = r(p(x));             // case 3
-                }
-                w->color = c(p(x));        // case 4
-                p(x)->color = RB_BLACK;    // case 4
-                r(w)->color = RB_BLACK;    // case 4
-                rbTreeLeftRotate(t, p(x)); // case 4
-                x = t->root;               // case 4
+                printVal(n->val);
+                printed = n;
+                if (n->right)
+                    stackPush(stack, n->right);
             }
         }
-        else
-        {
-            struct rbTreeNode *w = l(p(x));
-            if (c(w) == RB_RED)
-            {
-                w->color = RB_BLACK;        // case 1
-                p(x)->color = RB_RED;       // case 1
-                rbTreeRightRotate(t, p(x)); // case 1
-                w = l(p(x));                // case 1
-            }
-            if (c(r(w)) == RB_BLACK && c(l(w)) == RB_BLACK)
-            {
-                w->color = RB_RED; // case 2
-                x = p(x);          // case 2
-            }
+
+        stackFree(stack);
+    }
+}
+#endif // DEBUG
+
+/*
+ * -------------------------------------------------------------- Red-Black Tree
+ */
+
+static struct rbTreeNode *rbTreeNodeNew(struct rbTree *t, int k, void *v);
+static void rbTreeNodeFree(struct rbTree *t, struct rbTreeNode *p);
+static struct rbTreeNode *p(struct rbTreeNode *n);
+static struct rbTreeNode *l(struct rbTreeNode *n);
+static struct rbTreeNode *r(struct rbTreeNode *n);
+static int c(struct rbTreeNode *n);
+static void rbTreeInsertFixup(struct rbTree *t, struct rbTreeNode *z);
+static void rbTreeDeleteFixup(struct rbTree *t, struct rbTreeNode *x);
+static void rbTreeLeftRotate(struct rbTree *t, struct rbTreeNode *x);
+static void rbTreeRightRotate(struct rbTree *t, struct rbTreeNode *x);
+static void rbTreeTransplant(struct rbTree *t, struct rbTreeNode *u, struct rbTreeNode *v);
+static struct rbTreeNode *rbTreeNodeFindMin(struct rbTreeNode *n);
+static int rbTreeInsertCore(struct rbTree *t, void *el);
+static int rbTreeDeleteCore(struct rbTree *t, void *el);
+static struct rbTreeNode *rbTreeFind(struct rbTree *p, void *el);
+static struct rbTreeNode *rbTreeBuild(struct rbTreeNode **nodes, long lo, long hi,
+                                      struct rbTreeNode *parent, int depth, int redDepth);
+
+struct rbTree *rbTreeNew(int (*key)(void *))
+{
+    if (!key)
+    {
+        printError("rbTreeNew key is NULL\n");
+        return NULL;
+    }
+    struct rbTree *p = malloc(sizeof(struct rbTree));
+    if (p)
+    {
+        // p->root = NULL;
+        p->root = RB_NIL;
+        p->size = 0;
+        p->key = key;
+        p->stats = statsNew();
+        return p;
+    }
+    else
+    {
+        printError("rbTreeNew error");
+        return NULL;
+    }
+}
+void rbTreeFree(struct rbTree *p)
+{
+    if (!p)
+        return;
+    if (p->root && p->root != RB_NIL)
+    {
+        struct Stack *s = stackNew();
+        stackPush(s, p->root);
+        while ((struct rbTreeNode *)stackPeek(s))
+        {
+            struct rbTreeNode *n = (struct rbTreeNode *)stackPop(s);
+            if (n->right && n->right != RB_NIL)
+                stackPush(s, n->right);
+            if (n->left && n->left != RB_NIL)
+                stackPush(s, n->left);
+            rbTreeNodeFree(p, n);
+        }
+        stackFree(s);
+    }
+    free(p->stats);
+    free(p);
+}
+static struct rbTreeNode *rbTreeNodeNew(struct rbTree *t, int k, void *v)
+{
+    struct rbTreeNode *p = malloc(sizeof(struct rbTreeNode));
+    if (!p)
+        return NULL;
+    p->parent = NULL;
+    p->left = p->right = RB_NIL;
+    p->color = RB_RED;
+    p->key = k;
+    p->val = v;
+    STATS_ADD(t->stats, allocs, 1);
+    return p;
+}
+static void rbTreeNodeFree(struct rbTree *t, struct rbTreeNode *p)
+{
+    if (p)
+    {
+        STATS_ADD(t->stats, frees, 1);
+        free(p);
+    }
+}
+int rbTreeInsert(struct rbTree *t, void *el)
+{
+    if (!t)
+    {
+        printError("rbTreeInsert t is NULL\n");
+        return 0;
+    }
+    UINT64 t0 = STATS_NOW();
+    int ok = rbTreeInsertCore(t, el);
+    STATS_RECORD(t->stats, insert, t0);
+    return ok;
+}
+static int rbTreeInsertCore(struct rbTree *t, void *el)
+{
+    int k = t->key(el);
+
+    struct rbTreeNode *y = RB_NIL;
+    struct rbTreeNode *x = t->root;
+    while (x != RB_NIL)
+    {
+        y = x;
+        if (k < x->key)
+            x = l(x);
+        else if (k > x->key)
+            x = r(x);
+        else
+        {
+            x->val = el;
+            return 1;
+        }
+    }
+
+    struct rbTreeNode *z = rbTreeNodeNew(t, k, el);
+    if (!z)
+    {
+        printError("rbTreeNodeNew error\n");
+        return 0;
+    }
+
+    z->parent = y;
+    if (y == RB_NIL)
+        t->root = z;
+    else if (z->key < y->key)
+        y->left = z;
+    else
+        y->right = z;
+
+    rbTreeInsertFixup(t, z);
+
+    t->size++;
+
+    return 1;
+}
+int rbTreeDelete(struct rbTree *t, void *el)
+{
+    if (!t)
+    {
+        printError("rbTreeDelete t is NULL\n");
+        return 0;
+    }
+    UINT64 t0 = STATS_NOW();
+    int ok = rbTreeDeleteCore(t, el);
+    STATS_RECORD(t->stats, remove, t0);
+    return ok;
+}
+static int rbTreeDeleteCore(struct rbTree *t, void *el)
+{
+    struct rbTreeNode *x = NULL;
+    struct rbTreeNode *y = NULL;
+    struct rbTreeNode *z = rbTreeFind(t, el);
+
+    if (!z)
+        return 0;
+
+    y = z;
+    int yOriginalColor = c(y);
+    if (l(z) == RB_NIL)
+    {
+        x = r(z);
+        rbTreeTransplant(t, z, r(z));
+    }
+    else if (r(z) == RB_NIL)
+    {
+        x = l(z);
+        rbTreeTransplant(t, z, l(z));
+    }
+    else
+    {
+        y = rbTreeNodeFindMin(r(z));
+        yOriginalColor = c(y);
+        x = r(y);
+        if (p(y) == z)
+            x->parent = y;
+        else
+        {
+            rbTreeTransplant(t, y, r(y));
+            y->right = r(z);
+            r(y)->parent = y;
+        }
+        rbTreeTransplant(t, z, y);
+        y->left = l(z);
+        l(y)->parent = y;
+        y->color = c(z);
+    }
+    if (yOriginalColor == RB_BLACK)
+        rbTreeDeleteFixup(t, x);
+
+    rbTreeNodeFree(t, z);
+    t->size--;
+
+    return 1;
+}
+void *rbTreeSearch(struct rbTree *p, void *el)
+{
+    if (!p)
+        return NULL;
+    UINT64 t0 = STATS_NOW();
+    struct rbTreeNode *n = rbTreeFind(p, el);
+    STATS_RECORD(p->stats, lookup, t0);
+    return n;
+}
+static struct rbTreeNode *rbTreeFind(struct rbTree *p, void *el)
+{
+    if (p && p->root)
+    {
+        int k = (*p->key)(el);
+        struct rbTreeNode *n = p->root;
+        // RB_NIL has key 0, it must not match an absent key 0
+        while (n && n != RB_NIL)
+        {
+            if (n->key == k)
+                return n;
+            n = n->key > k ? n->left : n->right;
+        }
+    }
+    return NULL;
+}
+static struct rbTreeNode *rbTreeBuild(struct rbTreeNode **nodes, long lo, long hi,
+                                      struct rbTreeNode *parent, int depth, int redDepth)
+{
+    if (lo > hi)
+        return RB_NIL;
+    long mid = lo + (hi - lo) / 2;
+    struct rbTreeNode *n = nodes[mid];
+    n->parent = parent;
+    n->color = depth == redDepth ? RB_RED : RB_BLACK;
+    n->left = rbTreeBuild(nodes, lo, mid - 1, n, depth + 1, redDepth);
+    n->right = rbTreeBuild(nodes, mid + 1, hi, n, depth + 1, redDepth);
+    return n;
+}
+void *rbTreeFindMin(struct rbTree *p)
+{
+    if (p && p->root && p->root != RB_NIL)
+    {
+        struct rbTreeNode *n = p->root;
+        while (n && n != RB_NIL)
+        {
+            if (l(n) && l(n) != RB_NIL)
+                n = l(n);
             else
-            {
-                if (c(l(w)) == RB_BLACK)
-                {
-                    r(w)->color = RB_BLACK; // case 3
-                    w->color = RB_RED;      // case 3
-                    rbTreeLeftRotate(t, w); // case 3
-                    w = l(p(x));            // case 3
-                }
-                w->color = c(p(x));         // case 4
-                p(x)->color = RB_BLACK;     // case 4
-                l(w)->color = RB_BLACK;     // case 4
-                rbTreeRightRotate(t, p(x)); // case 4
-                x = t->root;                // case 4
+                return n->val;
+        }
+        return NULL;
+    }
+    return NULL;
+}
+void *rbTreeFindMax(struct rbTree *p)
+{
+    if (p && p->root && p->root != RB_NIL)
+    {
+        struct rbTreeNode *n = p->root;
+        while (n && n != RB_NIL)
+        {
+            if (r(n) && r(n) != RB_NIL)
+                n = r(n);
+            else
+                return n->val;
+        }
+        return NULL;
+    }
+    return NULL;
+}
+int rbTreeSave(struct rbTree *t, const char *path, struct snapshotCodec *el)
+{
+    if (!t || !path || !snapshotCodecValid(el))
+    {
+        printError("rbTreeSave t, path or codec is NULL\n");
+        return 0;
+    }
+    struct snapshotWriter w;
+    if (!snapshotCreate(&w, path, SNAPSHOT_RB_TREE, t->size))
+        return 0;
+    // in order, the load builds straight from the sorted records
+    struct Stack *s = stackNew();
+    int ok = s != NULL;
+    struct rbTreeNode *n = t->root;
+    while (ok && ((n && n != RB_NIL) || stackSize(s)))
+    {
+        if (n && n != RB_NIL)
+        {
+            ok = stackPush(s, n);
+            n = l(n);
+        }
+        else
+        {
+            n = stackPop(s);
+            ok = snapshotPut(&w, el, n->val);
+            n = r(n);
+        }
+    }
+    stackFree(s);
+    return snapshotCommit(&w, ok);
+}
+int rbTreeLoad(struct rbTree *t, const char *path, struct snapshotCodec *el)
+{
+    if (!t || !path || !snapshotCodecValid(el))
+    {
+        printError("rbTreeLoad t, path or codec is NULL\n");
+        return 0;
+    }
+    if (t->size)
+    {
+        printError("rbTreeLoad t is not empty\n");
+        return 0;
+    }
+    struct snapshotReader rd;
+    if (!snapshotOpen(&rd, path, SNAPSHOT_RB_TREE))
+        return 0;
+    struct rbTreeNode **nodes = NULL;
+    int ok = rd.count <= INT_MAX && (nodes = malloc(sizeof(struct rbTreeNode *) * (rd.count + 1)));
+    long n = 0;
+    while (ok && n < (long)rd.count)
+    {
+        void *x = NULL;
+        ok = snapshotGet(&rd, el, &x) && x;
+        int k = ok ? t->key(x) : 0;
+        ok = ok && (!n || k > nodes[n - 1]->key) && (nodes[n] = rbTreeNodeNew(t, k, x));
+        if (ok)
+            n++;
+        else
+            snapshotRelease(el, x);
+    }
+    snapshotClose(&rd);
+    if (!ok)
+        printError("rbTreeLoad %s record %ld error\n", path, n);
+
+    // a balanced tree has every leaf at depth h - 1 or h, the nodes at depth h
+    // are red and the rest black so every path has h black nodes
+    int h = 0;
+    while ((2L << h) <= n)
+        h++;
+    t->root = rbTreeBuild(nodes, 0, n - 1, RB_NIL, 0, h);
+    if (t->root != RB_NIL)
+        t->root->color = RB_BLACK;
+    t->size = (int)n;
+    free(nodes);
+    return ok;
+}
+struct opStats *rbTreeOpStats(struct rbTree *t)
+{
+    return t ? t->stats : NULL;
+}
+static struct rbTreeNode *p(struct rbTreeNode *n)
+{
+    return n && n->parent ? n->parent : NULL;
+}
+static struct rbTreeNode *l(struct rbTreeNode *n)
+{
+    return n ? n->left : NULL;
+}
+static struct rbTreeNode *r(struct rbTreeNode *n)
+{
+    return n ? n->right : NULL;
+}
+static int c(struct rbTreeNode *n)
+{
+    return n ? n->color : RB_BLACK;
+}
+static void rbTreeInsertFixup(struct rbTree *t, struct rbTreeNode *z)
+{
+    struct rbTreeNode *y = NULL;
+    while (c(p(z)) == RB_RED)
+    {
+        if (p(z) == l(p(p(z))))
+        {
+            y = r(p(p(z)));
+            if (c(y) == RB_RED)
+            {
+                p(z)->color = RB_BLACK;  // case 1
+                y->color = RB_BLACK;     // case 1
+                p(p(z))->color = RB_RED; // case 1
+                z = p(p(z));             // case 1
+            }
+            else
+            {
+                if (z == r(p(z)))
+                {
+                    z = p(z);               // case 2
+                    rbTreeLeftRotate(t, z); // case 2
+                }
+                p(z)->color = RB_BLACK;        // case 3
+                p(p(z))->color = RB_RED;       // case 3
+                rbTreeRightRotate(t, p(p(z))); // case 3
+            }
+        }
+        else
+        {
+            y = l(p(p(z)));
+            if (c(y) == RB_RED)
+            {
+                p(z)->color = RB_BLACK;  // case 1
+                y->color = RB_BLACK;     // case 1
+                p(p(z))->color = RB_RED; // case 1
+                z = p(p(z));             // case 1
+            }
+            else
+            {
+                if (z == l(p(z)))
+                {
+                    z = p(z);                // case 2
+                    rbTreeRightRotate(t, z); // case 2
+                }
+                p(z)->color = RB_BLACK;       // case 3
+                p(p(z))->color = RB_RED;      // case 3
+                rbTreeLeftRotate(t, p(p(z))); // case 3
+            }
+        }
+    }
+    t->root->color = RB_BLACK;
+}
+static void rbTreeDeleteFixup(struct rbTree *t, struct rbTreeNode *x)
+{
+    while (x != t->root && c(x) == RB_BLACK)
+    {
+        if (x == l(p(x)))
+        {
+            struct rbTreeNode *w = r(p(x));
+            if (c(w) == RB_RED)
+            {
+                w->color = RB_BLACK;       // case 1
+                p(x)->color = RB_RED;      // case 1
+                rbTreeLeftRotate(t, p(x)); // case 1
+                w = r(p(x));               // case 1
+            }
+            if (c(l(w)) == RB_BLACK && c(r(w)) == RB_BLACK)
+            {
+                if (w)                 // xxxx
+                    w->color = RB_RED; // case 2
+                x = p(x);              // case 2
+            }
+            else
+            {
+                if (c(r(w)) == RB_BLACK)
+                {
+                    l(w)->color = RB_BLACK;  // case 3
+                    w->color = RB_RED;       // case 3
+                    rbTreeRightRotate(t, w); // case 3
+                    w = r(p(x));             // case 3
+                }
+                w->color = c(p(x));        // case 4
+                p(x)->color = RB_BLACK;    // case 4
+                r(w)->color = RB_BLACK;    // case 4
+                rbTreeLeftRotate(t, p(x)); // case 4
+                x = t->root;               // case 4
+            }
+        }
+        else
+        {
+            struct rbTreeNode *w = l(p(x));
+            if (c(w) == RB_RED)
+            {
+                w->color = RB_BLACK;        // case 1
+                p(x)->color = RB_RED;       // case 1
+                rbTreeRightRotate(t, p(x)); // case 1
+                w = l(p(x));                // case 1
+            }
+            if (c(r(w)) == RB_BLACK && c(l(w)) == RB_BLACK)
+            {
+                w->color = RB_RED; // case 2
+                x = p(x);          // case 2
+            }
+            else
+            {
+                if (c(l(w)) == RB_BLACK)
+                {
+                    r(w)->color = RB_BLACK; // case 3
+                    w->color = RB_RED;      // case 3
+                    rbTreeLeftRotate(t, w); // case 3
+                    w = l(p(x));            // case 3
+                }
+                w->color = c(p(x));         // case 4
+                p(x)->color = RB_BLACK;     // case 4
+                l(w)->color = RB_BLACK;     // case 4
+                rbTreeRightRotate(t, p(x)); // case 4
+                x = t->root;                // case 4
+            }
+        }
+    }
+    x->color = RB_BLACK;
+}
+static void rbTreeLeftRotate(struct rbTree *t, struct rbTreeNode *x)
+{
+    STATS_ADD(t->stats, rotations, 1);
+    struct rbTreeNode *y = r(x);
+    x->right = l(y);
+    if (l(y) != RB_NIL)
+        l(y)->parent = x;
+    y->parent = p(x);
+    if (p(x) == RB_NIL)
+        t->root = y;
+    else if (x == l(p(x)))
+        p(x)->left = y;
+    else
+        p(x)->right = y;
+    y->left = x;
+    x->parent = y;
+}
+static void rbTreeRightRotate(struct rbTree *t, struct rbTreeNode *x)
+{
+    STATS_ADD(t->stats, rotations, 1);
+    struct rbTreeNode *y = l(x);
+    x->left = r(y);
+    if (r(y) != RB_NIL)
+        r(y)->parent = x;
+    y->parent = p(x);
+    if (p(x) == RB_NIL)
+        t->root = y;
+    else if (x == r(p(x)))
+        p(x)->right = y;
+    else
+        p(x)->left = y;
+    y->right = x;
+    x->parent = y;
+}
+static void rbTreeTransplant(struct rbTree *t, struct rbTreeNode *u, struct rbTreeNode *v)
+{
+    if (p(u) == RB_NIL)
+        t->root = v;
+    else if (u == l(p(u)))
+        p(u)->left = v;
+    else
+        p(u)->right = v;
+    if (v) // xxxx
+        v->parent = p(u);
+}
+static struct rbTreeNode *rbTreeNodeFindMin(struct rbTreeNode *n)
+{
+    while (n && n != RB_NIL)
+    {
+        if (l(n) && l(n) != RB_NIL)
+            n = l(n);
+        else
+            return n;
+    }
+    return NULL;
+}
+#ifdef DEBUG
+static void rbTreeCheckParent(struct rbTreeNode *n)
+{
+    if (n && n != RB_NIL)
+    {
+        if (l(n) && l(n) != RB_NIL && p(l(n)) != n)
+            printError("rbTree parent set error\n");
+        if (r(n) && r(n) != RB_NIL && p(r(n)) != n)
+            printError("rbTree parent set error\n");
+    }
+}
+static void rbTreeCheckKey(struct rbTreeNode *n)
+{
+    if (n && n != RB_NIL)
+    {
+        if (l(n) && l(n) != RB_NIL && l(n)->key > n->key)
+            printError("rbTree left node error\n");
+        if (r(n) && r(n) != RB_NIL && r(n)->key < n->key)
+            printError("rbTree right node error\n");
+    }
+}
+static void rbTreeCheckRedColor(struct rbTreeNode *n)
+{
+    if (n && n != RB_NIL)
+    {
+        if (c(n) == RB_RED)
+        {
+            if (p(n) && p(n) != RB_NIL && c(p(n)) == RB_RED)
+                printError("rbTree color error");
+            if (l(n) && l(n) != RB_NIL && c(l(n)) == RB_RED)
+                printError("rbTree color error");
+            if (r(n) && r(n) != RB_NIL && c(r(n)) == RB_RED)
+                printError("rbTree color error");
+        }
+    }
+}
+static int rbTreeLeafBlackColorNumber(struct rbTreeNode *n)
+{
+    int i = 0;
+    while (n && n != RB_NIL)
+    {
+        if (c(n) == RB_BLACK)
+            i++;
+        n = p(n);
+    }
+    return i;
+}
+void rbTreePrint(struct rbTree *t, void (*printVal)(void *))
+{
+    if (t && t->root && t->root != RB_NIL && printVal)
+    {
+        struct Stack *stack = stackNew();
+        if (!stack)
+            goto freePointer;
+
+        struct Stack *leafStack = stackNew();
+        if (!leafStack)
+            goto freePointer;
+
+        stackPush(stack, t->root);
+        struct rbTreeNode *printed = NULL;
+        while (stackPeek(stack))
+        {
+            struct rbTreeNode *n = (struct rbTreeNode *)stackPop(stack);
+            struct rbTreeNode *l = n && n->left != RB_NIL ? n->left : NULL;
+            struct rbTreeNode *r = n && n->right != RB_NIL ? n->right : NULL;
+
+            if (!l && !r)
+                stackPush(leafStack, n);
+
+            rbTreeCheckKey(n);
+            rbTreeCheckParent(n);
+            rbTreeCheckRedColor(n);
+
+            if (l)
+            {
+                if (printed && printed->key >= l->key)
+                {
+                    printVal(n->val);
+                    printed = n;
+                    if (r)
+                        stackPush(stack, r);
+                }
+                else
+                {
+                    stackPush(stack, n);
+                    stackPush(stack, l);
+                }
+            }
+            else
+            {
+                printVal(n->val);
+                printed = n;
+                if (r)
+                    stackPush(stack, r);
+            }
+        }
+
+        if (stackSize(leafStack))
+        {
+            struct rbTreeNode *leaf = (struct rbTreeNode *)stackPeek(leafStack);
+            int blackNumber = rbTreeLeafBlackColorNumber(leaf);
+            if (!blackNumber)
+                printError("rbTree leaf black number error\n");
+            if (stackSize(leafStack) == 1)
+                if (blackNumber != 1)
+                    printError("rbTree leaf black number error\n");
+
+            while (stackPeek(leafStack))
+            {
+                leaf = (struct rbTreeNode *)stackPop(leafStack);
+                if (blackNumber != rbTreeLeafBlackColorNumber(leaf))
+                    printError("rbTree leaf black number error\n");
+            }
+        }
+    freePointer:
+        if (stack)
+            stackFree(stack);
+        if (leafStack)
+            stackFree(leafStack);
+    }
+}
+#endif // DEBUG
+
+/*
+ * ------------------------------------------------------------------------ List
+ */
+
+static struct listNode *listNodeNew(void *val);
+static void listNodeFree();
+static struct listNode *listGetNode(struct List *l, int i);
+static void listUnlink(struct List *l, struct listNode *n);
+static long listIndexSlot(struct List *l, void *el);
+static int listIndexAdd(struct List *l, struct listNode *n);
+static void listIndexPut(struct List *l, struct listNode *n);
+static int listIndexCount(struct List *l, void *el);
+static void listIndexRemove(struct List *l, struct listNode *n);
+static struct listNode *listIndexGet(struct List *l, void *el);
+struct List *listNew()
+{
+    struct List *l = malloc(sizeof(struct List));
+    if (l)
+    {
+        l->head = l->tail = NULL;
+        l->size = 0;
+        l->index = NULL;
+        l->indexCap = 0;
+        return l;
+    }
+    else
+    {
+        printError("listNew error\n");
+        return NULL;
+    }
+}
+void listFree(struct List *l)
+{
+    if (l)
+    {
+        struct listNode *c = l->head;
+        struct listNode *n = NULL;
+        while (c)
+        {
+            n = c->next;
+            listNodeFree(c);
+            c = n;
+        }
+        if (l->index)
+            free(l->index);
+        free(l);
+    }
+}
+static struct listNode *listNodeNew(void *val)
+{
+    struct listNode *n = malloc(sizeof(struct listNode));
+    if (n)
+    {
+        n->prev = n->next = NULL;
+        n->val = val;
+        return n;
+    }
+    else
+    {
+        printError("listNodeNew error\n");
+        return NULL;
+    }
+}
+static void listNodeFree(struct listNode *n)
+{
+    if (n)
+        free(n);
+}
+int listAdd(struct List *l, void *el)
+{
+    if (!l)
+    {
+        printError("listAdd l is NULL\n");
+        return 0;
+    }
+
+    struct listNode *n = listNodeNew(el);
+    if (!n)
+    {
+        printError("listNodeNew error\n");
+        return 0;
+    }
+    if (l->index && !listIndexAdd(l, n))
+    {
+        listNodeFree(n);
+        return 0;
+    }
+
+    if (!l->head)
+        l->head = n;
+    if (l->tail)
+    {
+        n->prev = l->tail;
+        l->tail->next = n;
+    }
+    l->tail = n;
+
+    l->size++;
+    return 1;
+}
+int listSet(struct List *l, int i, void *el)
+{
+    if (!l)
+    {
+        printError("listAdd l is NULL\n");
+        return 0;
+    }
+
+    if (i >= l->size)
+        return 0;
+
+    struct listNode *n = listGetNode(l, i);
+    if (l->index)
+    {
+        // the entry count stays, the freed slot takes the node back
+        listIndexRemove(l, n);
+        n->val = el;
+        listIndexPut(l, n);
+        return 1;
+    }
+    n->val = el;
+
+    return 1;
+}
+int listRemove(struct List *l, int i)
+{
+    if (!l)
+    {
+        printError("listAdd l is NULL\n");
+        return 0;
+    }
+
+    if (i >= l->size)
+        return 0;
+
+    listUnlink(l, listGetNode(l, i));
+    return 1;
+}
+void *listGet(struct List *l, int i)
+{
+    if (!l)
+    {
+        printError("listAdd l is NULL\n");
+        return NULL;
+    }
+
+    if (i >= l->size)
+        return NULL;
+
+    return listGetNode(l, i)->val;
+}
+void *listHead(struct List *l)
+{
+    if (!l)
+    {
+        printError("listAdd l is NULL\n");
+        return NULL;
+    }
+    return l->head ? l->head->val : NULL;
+}
+void *listTail(struct List *l)
+{
+    if (!l)
+    {
+        printError("listAdd l is NULL\n");
+        return NULL;
+    }
+    return l->tail ? l->tail->val : NULL;
+}
+int listContains(struct List *l, void *el)
+{
+    if (!l)
+    {
+        printError("listAdd l is NULL\n");
+        return 0;
+    }
+    if (l->index)
+        return listIndexGet(l, el) ? 1 : 0;
+    if (l->size)
+    {
+        struct listNode *n = l->head;
+        while (n)
+        {
+            if (n->val == el)
+                return 1;
+            else
+                n = n->next;
+        }
+    }
+    return 0;
+}
+int listSize(struct List *l)
+{
+    return l ? l->size : 0;
+}
+int listIndexOn(struct List *l)
+{
+    if (!l)
+    {
+        printError("listIndexOn l is NULL\n");
+        return 0;
+    }
+    if (l->index)
+        return 1;
+    struct listNode *n;
+    for (n = l->head; n; n = n->next)
+    {
+        if (!listIndexAdd(l, n))
+        {
+            if (l->index)
+                free(l->index);
+            l->index = NULL;
+            l->indexCap = 0;
+            return 0;
+        }
+    }
+    if (!l->index)
+    {
+        // empty list, allocate now so later adds are indexed
+        l->index = calloc(8, sizeof(struct listNode *));
+        if (!l->index)
+        {
+            printError("listIndexOn error\n");
+            return 0;
+        }
+        l->indexCap = 8;
+    }
+    return 1;
+}
+int listRemoveValue(struct List *l, void *el)
+{
+    if (!l)
+    {
+        printError("listRemoveValue l is NULL\n");
+        return 0;
+    }
+    struct listNode *n;
+    // equal values may sit anywhere in the index, the first one in list
+    // order is only known for a unique value, otherwise scan
+    if (l->index && listIndexCount(l, el) == 1)
+        n = listIndexGet(l, el);
+    else
+        for (n = l->head; n && n->val != el; n = n->next)
+            ;
+    if (!n)
+        return 0;
+    listUnlink(l, n);
+    return 1;
+}
+static void listUnlink(struct List *l, struct listNode *n)
+{
+    if (l->index)
+        listIndexRemove(l, n);
+    if (n->prev)
+        n->prev->next = n->next;
+    if (n->next)
+        n->next->prev = n->prev;
+    if (n == l->head)
+        l->head = n->next;
+    if (n == l->tail)
+        l->tail = n->prev;
+
+    listNodeFree(n);
+
+    l->size--;
+}
+static long listIndexSlot(struct List *l, void *el)
+{
+    return (long)(hashMix64((UINT64)(unsigned long)el) & (UINT64)(l->indexCap - 1));
+}
+static int listIndexAdd(struct List *l, struct listNode *n)
+{
+    // called before size++, keep the load factor under 0.75
+    if (!l->index || (l->size + 1) * 4 > l->indexCap * 3)
+    {
+        int newCap = l->indexCap ? l->indexCap << 1 : 8;
+        struct listNode **newIndex = calloc(newCap, sizeof(struct listNode *));
+        if (!newIndex)
+        {
+            printError("listIndexAdd error\n");
+            return 0;
+        }
+        struct listNode **old = l->index;
+        int oldCap = l->indexCap;
+        l->index = newIndex;
+        l->indexCap = newCap;
+        int i;
+        for (i = 0; i < oldCap; i++)
+        {
+            if (old[i])
+            {
+                long j = listIndexSlot(l, old[i]->val);
+                while (l->index[j])
+                    j = (j + 1) & (l->indexCap - 1);
+                l->index[j] = old[i];
+            }
+        }
+        if (old)
+            free(old);
+    }
+    listIndexPut(l, n);
+    return 1;
+}
+static void listIndexPut(struct List *l, struct listNode *n)
+{
+    long j = listIndexSlot(l, n->val);
+    while (l->index[j])
+        j = (j + 1) & (l->indexCap - 1);
+    l->index[j] = n;
+}
+static int listIndexCount(struct List *l, void *el)
+{
+    // equal values share the probe run from their slot
+    int c = 0;
+    long i = listIndexSlot(l, el);
+    while (l->index[i])
+    {
+        c += l->index[i]->val == el;
+        i = (i + 1) & (l->indexCap - 1);
+    }
+    return c;
+}
+static void listIndexRemove(struct List *l, struct listNode *n)
+{
+    long mask = l->indexCap - 1;
+    long i = listIndexSlot(l, n->val);
+    while (l->index[i] != n)
+        i = (i + 1) & mask;
+
+    // backward shift deletion
+    long j = i;
+    for (;;)
+    {
+        j = (j + 1) & mask;
+        if (!l->index[j])
+            break;
+        long k = listIndexSlot(l, l->index[j]->val);
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j))
+        {
+            l->index[i] = l->index[j];
+            i = j;
+        }
+    }
+    l->index[i] = NULL;
+}
+static struct listNode *listIndexGet(struct List *l, void *el)
+{
+    long i = listIndexSlot(l, el);
+    while (l->index[i])
+    {
+        if (l->index[i]->val == el)
+            return l->index[i];
+        i = (i + 1) & (l->indexCap - 1);
+    }
+    return NULL;
+}
+static struct listNode *listGetNode(struct List *l, int i)
+{
+    if ((i << 1) < l->size)
+    {
+        struct listNode *n = l->head;
+        int j;
+        for (j = 0; j < i; j++)
+            n = n->next;
+        return n;
+    }
+    else
+    {
+        struct listNode *n = l->tail;
+        int j;
+        for (j = l->size - 1; j > i; j--)
+            n = n->prev;
+        return n;
+    }
+}
+
+/*
+ * ------------------------------------------------------------------- Intrusive
+ */
+
+void iListInit(struct iList *l)
+{
+    l->head = l->tail = NULL;
+    l->size = 0;
+}
+void iListAddHead(struct iList *l, struct iListLink *n)
+{
+    n->prev = NULL;
+    n->next = l->head;
+    if (l->head)
+        l->head->prev = n;
+    else
+        l->tail = n;
+    l->head = n;
+    l->size++;
+}
+void iListAddTail(struct iList *l, struct iListLink *n)
+{
+    n->next = NULL;
+    n->prev = l->tail;
+    if (l->tail)
+        l->tail->next = n;
+    else
+        l->head = n;
+    l->tail = n;
+    l->size++;
+}
+void iListInsertBefore(struct iList *l, struct iListLink *at, struct iListLink *n)
+{
+    if (!at)
+    {
+        iListAddTail(l, n);
+        return;
+    }
+    n->next = at;
+    n->prev = at->prev;
+    if (at->prev)
+        at->prev->next = n;
+    else
+        l->head = n;
+    at->prev = n;
+    l->size++;
+}
+void iListRemove(struct iList *l, struct iListLink *n)
+{
+    if (n->prev)
+        n->prev->next = n->next;
+    else
+        l->head = n->next;
+    if (n->next)
+        n->next->prev = n->prev;
+    else
+        l->tail = n->prev;
+    n->prev = n->next = NULL;
+    l->size--;
+}
+struct iListLink *iListHead(struct iList *l)
+{
+    return l ? l->head : NULL;
+}
+struct iListLink *iListTail(struct iList *l)
+{
+    return l ? l->tail : NULL;
+}
+int iListSize(struct iList *l)
+{
+    return l ? l->size : 0;
+}
+
+/* red-black tree, CLRS 3 with NULL leaves instead of RB_NIL */
+
+static void irbTreeRotateLeft(struct irbTree *t, struct irbNode *x);
+static void irbTreeRotateRight(struct irbTree *t, struct irbNode *x);
+static void irbTreeTransplant(struct irbTree *t, struct irbNode *u, struct irbNode *v);
+static void irbTreeInsertFixup(struct irbTree *t, struct irbNode *z);
+static void irbTreeDeleteFixup(struct irbTree *t, struct irbNode *x, struct irbNode *xp);
+static int irbc(struct irbNode *n);
+void irbTreeInit(struct irbTree *t, int (*compare)(struct irbNode *, struct irbNode *))
+{
+    t->root = NULL;
+    t->size = 0;
+    t->compare = compare;
+}
+struct irbNode *irbTreeInsert(struct irbTree *t, struct irbNode *n)
+{
+    // an equal node is returned and n is not linked
+    struct irbNode *p = NULL;
+    struct irbNode **link = &t->root;
+    while (*link)
+    {
+        p = *link;
+        int c = t->compare(n, p);
+        if (c < 0)
+            link = &p->left;
+        else if (c > 0)
+            link = &p->right;
+        else
+            return p;
+    }
+    n->parent = p;
+    n->left = n->right = NULL;
+    n->color = RB_RED;
+    *link = n;
+    irbTreeInsertFixup(t, n);
+    t->size++;
+    return NULL;
+}
+void irbTreeDelete(struct irbTree *t, struct irbNode *z)
+{
+    struct irbNode *x, *xp;
+    struct irbNode *y = z;
+    int yOriginalColor = y->color;
+    if (!z->left)
+    {
+        x = z->right;
+        xp = z->parent;
+        irbTreeTransplant(t, z, z->right);
+    }
+    else if (!z->right)
+    {
+        x = z->left;
+        xp = z->parent;
+        irbTreeTransplant(t, z, z->left);
+    }
+    else
+    {
+        y = z->right;
+        while (y->left)
+            y = y->left;
+        yOriginalColor = y->color;
+        x = y->right;
+        if (y->parent == z)
+            xp = y;
+        else
+        {
+            xp = y->parent;
+            irbTreeTransplant(t, y, y->right);
+            y->right = z->right;
+            y->right->parent = y;
+        }
+        irbTreeTransplant(t, z, y);
+        y->left = z->left;
+        y->left->parent = y;
+        y->color = z->color;
+    }
+    if (yOriginalColor == RB_BLACK)
+        irbTreeDeleteFixup(t, x, xp);
+    t->size--;
+}
+struct irbNode *irbTreeSearch(struct irbTree *t, struct irbNode *key)
+{
+    struct irbNode *n = t->root;
+    while (n)
+    {
+        int c = t->compare(key, n);
+        if (!c)
+            return n;
+        n = c < 0 ? n->left : n->right;
+    }
+    return NULL;
+}
+struct irbNode *irbTreeFindMin(struct irbTree *t)
+{
+    struct irbNode *n = t->root;
+    while (n && n->left)
+        n = n->left;
+    return n;
+}
+struct irbNode *irbTreeFindMax(struct irbTree *t)
+{
+    struct irbNode *n = t->root;
+    while (n && n->right)
+        n = n->right;
+    return n;
+}
+struct irbNode *irbTreeNext(struct irbNode *n)
+{
+    if (n->right)
+    {
+        n = n->right;
+        while (n->left)
+            n = n->left;
+        return n;
+    }
+    while (n->parent && n == n->parent->right)
+        n = n->parent;
+    return n->parent;
+}
+struct irbNode *irbTreePrev(struct irbNode *n)
+{
+    if (n->left)
+    {
+        n = n->left;
+        while (n->right)
+            n = n->right;
+        return n;
+    }
+    while (n->parent && n == n->parent->left)
+        n = n->parent;
+    return n->parent;
+}
+static int irbc(struct irbNode *n)
+{
+    return n ? n->color : RB_BLACK;
+}
+static void irbTreeRotateLeft(struct irbTree *t, struct irbNode *x)
+{
+    struct irbNode *y = x->right;
+    x->right = y->left;
+    if (y->left)
+        y->left->parent = x;
+    y->parent = x->parent;
+    if (!x->parent)
+        t->root = y;
+    else if (x == x->parent->left)
+        x->parent->left = y;
+    else
+        x->parent->right = y;
+    y->left = x;
+    x->parent = y;
+}
+static void irbTreeRotateRight(struct irbTree *t, struct irbNode *x)
+{
+    struct irbNode *y = x->left;
+    x->left = y->right;
+    if (y->right)
+        y->right->parent = x;
+    y->parent = x->parent;
+    if (!x->parent)
+        t->root = y;
+    else if (x == x->parent->right)
+        x->parent->right = y;
+    else
+        x->parent->left = y;
+    y->right = x;
+    x->parent = y;
+}
+static void irbTreeTransplant(struct irbTree *t, struct irbNode *u, struct irbNode *v)
+{
+    if (!u->parent)
+        t->root = v;
+    else if (u == u->parent->left)
+        u->parent->left = v;
+    else
+        u->parent->right = v;
+    if (v)
+        v->parent = u->parent;
+}
+static void irbTreeInsertFixup(struct irbTree *t, struct irbNode *z)
+{
+    struct irbNode *p, *g, *y;
+    while ((p = z->parent) && p->color == RB_RED)
+    {
+        g = p->parent;
+        if (p == g->left)
+        {
+            y = g->right;
+            if (irbc(y) == RB_RED)
+            {
+                p->color = RB_BLACK; // case 1
+                y->color = RB_BLACK; // case 1
+                g->color = RB_RED;   // case 1
+                z = g;               // case 1
+            }
+            else
+            {
+                if (z == p->right)
+                {
+                    z = p;                   // case 2
+                    irbTreeRotateLeft(t, z); // case 2
+                    p = z->parent;
+                }
+                p->color = RB_BLACK;      // case 3
+                g->color = RB_RED;        // case 3
+                irbTreeRotateRight(t, g); // case 3
+            }
+        }
+        else
+        {
+            y = g->left;
+            if (irbc(y) == RB_RED)
+            {
+                p->color = RB_BLACK; // case 1
+                y->color = RB_BLACK; // case 1
+                g->color = RB_RED;   // case 1
+                z = g;               // case 1
+            }
+            else
+            {
+                if (z == p->left)
+                {
+                    z = p;                    // case 2
+                    irbTreeRotateRight(t, z); // case 2
+                    p = z->parent;
+                }
+                p->color = RB_BLACK;     // case 3
+                g->color = RB_RED;       // case 3
+                irbTreeRotateLeft(t, g); // case 3
+            }
+        }
+    }
+    t->root->color = RB_BLACK;
+}
+static void irbTreeDeleteFixup(struct irbTree *t, struct irbNode *x, struct irbNode *xp)
+{
+    // x may be NULL, xp is its parent
+    while (x != t->root && irbc(x) == RB_BLACK)
+    {
+        if (x == xp->left)
+        {
+            struct irbNode *w = xp->right;
+            if (irbc(w) == RB_RED)
+            {
+                w->color = RB_BLACK;      // case 1
+                xp->color = RB_RED;       // case 1
+                irbTreeRotateLeft(t, xp); // case 1
+                w = xp->right;            // case 1
+            }
+            if (irbc(w->left) == RB_BLACK && irbc(w->right) == RB_BLACK)
+            {
+                w->color = RB_RED; // case 2
+                x = xp;            // case 2
+                xp = x->parent;    // case 2
+            }
+            else
+            {
+                if (irbc(w->right) == RB_BLACK)
+                {
+                    w->left->color = RB_BLACK; // case 3
+                    w->color = RB_RED;         // case 3
+                    irbTreeRotateRight(t, w);  // case 3
+                    w = xp->right;             // case 3
+                }
+                w->color = xp->color;       // case 4
+                xp->color = RB_BLACK;       // case 4
+                w->right->color = RB_BLACK; // case 4
+                irbTreeRotateLeft(t, xp);   // case 4
+                x = t->root;                // case 4
+            }
+        }
+        else
+        {
+            struct irbNode *w = xp->left;
+            if (irbc(w) == RB_RED)
+            {
+                w->color = RB_BLACK;       // case 1
+                xp->color = RB_RED;        // case 1
+                irbTreeRotateRight(t, xp); // case 1
+                w = xp->left;              // case 1
+            }
+            if (irbc(w->right) == RB_BLACK && irbc(w->left) == RB_BLACK)
+            {
+                w->color = RB_RED; // case 2
+                x = xp;            // case 2
+                xp = x->parent;    // case 2
+            }
+            else
+            {
+                if (irbc(w->left) == RB_BLACK)
+                {
+                    w->right->color = RB_BLACK; // case 3
+                    w->color = RB_RED;          // case 3
+                    irbTreeRotateLeft(t, w);    // case 3
+                    w = xp->left;               // case 3
+                }
+                w->color = xp->color;      // case 4
+                xp->color = RB_BLACK;      // case 4
+                w->left->color = RB_BLACK; // case 4
+                irbTreeRotateRight(t, xp); // case 4
+                x = t->root;               // case 4
+            }
+        }
+    }
+    if (x)
+        x->color = RB_BLACK;
+}
+
+/* avl tree, leaf height is 1 */
+
+static int iavlh(struct iavlNode *n);
+static void iavlTreeUpdate(struct iavlNode *n);
+static void iavlTreeReplace(struct iavlTree *t, struct iavlNode *p,
+                            struct iavlNode *old, struct iavlNode *n);
+static struct iavlNode *iavlTreeRotateLeft(struct iavlTree *t, struct iavlNode *x);
+static struct iavlNode *iavlTreeRotateRight(struct iavlTree *t, struct iavlNode *x);
+static void iavlTreeRetrace(struct iavlTree *t, struct iavlNode *n);
+void iavlTreeInit(struct iavlTree *t, int (*compare)(struct iavlNode *, struct iavlNode *))
+{
+    t->root = NULL;
+    t->size = 0;
+    t->compare = compare;
+}
+struct iavlNode *iavlTreeInsert(struct iavlTree *t, struct iavlNode *n)
+{
+    // an equal node is returned and n is not linked
+    struct iavlNode *p = NULL;
+    struct iavlNode **link = &t->root;
+    while (*link)
+    {
+        p = *link;
+        int c = t->compare(n, p);
+        if (c < 0)
+            link = &p->left;
+        else if (c > 0)
+            link = &p->right;
+        else
+            return p;
+    }
+    n->parent = p;
+    n->left = n->right = NULL;
+    n->height = 1;
+    *link = n;
+    iavlTreeRetrace(t, p);
+    t->size++;
+    return NULL;
+}
+void iavlTreeDelete(struct iavlTree *t, struct iavlNode *z)
+{
+    if (z->left && z->right)
+    {
+        // relink the successor y into the place of z
+        struct iavlNode *y = z->right;
+        while (y->left)
+            y = y->left;
+        struct iavlNode *start = y;
+        if (y->parent != z)
+        {
+            start = y->parent;
+            iavlTreeReplace(t, y->parent, y, y->right);
+            if (y->right)
+                y->right->parent = y->parent;
+            y->right = z->right;
+            z->right->parent = y;
+        }
+        y->left = z->left;
+        z->left->parent = y;
+        y->parent = z->parent;
+        iavlTreeReplace(t, z->parent, z, y);
+        y->height = z->height;
+        iavlTreeRetrace(t, start);
+    }
+    else
+    {
+        struct iavlNode *c = z->left ? z->left : z->right;
+        if (c)
+            c->parent = z->parent;
+        iavlTreeReplace(t, z->parent, z, c);
+        iavlTreeRetrace(t, z->parent);
+    }
+    t->size--;
+}
+struct iavlNode *iavlTreeSearch(struct iavlTree *t, struct iavlNode *key)
+{
+    struct iavlNode *n = t->root;
+    while (n)
+    {
+        int c = t->compare(key, n);
+        if (!c)
+            return n;
+        n = c < 0 ? n->left : n->right;
+    }
+    return NULL;
+}
+struct iavlNode *iavlTreeFindMin(struct iavlTree *t)
+{
+    struct iavlNode *n = t->root;
+    while (n && n->left)
+        n = n->left;
+    return n;
+}
+struct iavlNode *iavlTreeFindMax(struct iavlTree *t)
+{
+    struct iavlNode *n = t->root;
+    while (n && n->right)
+        n = n->right;
+    return n;
+}
+struct iavlNode *iavlTreeNext(struct iavlNode *n)
+{
+    if (n->right)
+    {
+        n = n->right;
+        while (n->left)
+            n = n->left;
+        return n;
+    }
+    while (n->parent && n == n->parent->right)
+        n = n->parent;
+    return n->parent;
+}
+struct iavlNode *iavlTreePrev(struct iavlNode *n)
+{
+    if (n->left)
+    {
+        n = n->left;
+        while (n->right)
+            n = n->right;
+        return n;
+    }
+    while (n->parent && n == n->parent->left)
+        n = n->parent;
+    return n->parent;
+}
+static int iavlh(struct iavlNode *n)
+{
+    return n ? n->height : 0;
+}
+static void iavlTreeUpdate(struct iavlNode *n)
+{
+    n->height = max(iavlh(n->left), iavlh(n->right)) + 1;
+}
+static void iavlTreeReplace(struct iavlTree *t, struct iavlNode *p,
+                            struct iavlNode *old, struct iavlNode *n)
+{
+    if (!p)
+        t->root = n;
+    else if (p->left == old)
+        p->left = n;
+    else
+        p->right = n;
+}
+static struct iavlNode *iavlTreeRotateLeft(struct iavlTree *t, struct iavlNode *x)
+{
+    struct iavlNode *y = x->right;
+    x->right = y->left;
+    if (y->left)
+        y->left->parent = x;
+    y->parent = x->parent;
+    iavlTreeReplace(t, x->parent, x, y);
+    y->left = x;
+    x->parent = y;
+    iavlTreeUpdate(x);
+    iavlTreeUpdate(y);
+    return y;
+}
+static struct iavlNode *iavlTreeRotateRight(struct iavlTree *t, struct iavlNode *x)
+{
+    struct iavlNode *y = x->left;
+    x->left = y->right;
+    if (y->right)
+        y->right->parent = x;
+    y->parent = x->parent;
+    iavlTreeReplace(t, x->parent, x, y);
+    y->right = x;
+    x->parent = y;
+    iavlTreeUpdate(x);
+    iavlTreeUpdate(y);
+    return y;
+}
+static void iavlTreeRetrace(struct iavlTree *t, struct iavlNode *n)
+{
+    while (n)
+    {
+        int b = iavlh(n->left) - iavlh(n->right);
+        if (b > 1)
+        {
+            if (iavlh(n->left->left) < iavlh(n->left->right))
+                iavlTreeRotateLeft(t, n->left); // left right
+            n = iavlTreeRotateRight(t, n);
+        }
+        else if (b < -1)
+        {
+            if (iavlh(n->right->right) < iavlh(n->right->left))
+                iavlTreeRotateRight(t, n->right); // right left
+            n = iavlTreeRotateLeft(t, n);
+        }
+        else
+            iavlTreeUpdate(n);
+        n = n->parent;
+    }
+}
+
+/*
+ * --------------------------------------------------------------- Unrolled List
+ */
+
+static struct unrolledListNode *unrolledListNodeNew();
+static struct unrolledListNode *unrolledListGetNode(struct unrolledList *l, int i, int *j);
+static void unrolledListUnlink(struct unrolledList *l, struct unrolledListNode *n);
+struct unrolledList *unrolledListNew()
+{
+    struct unrolledList *l = malloc(sizeof(struct unrolledList));
+    if (l)
+    {
+        l->head = l->tail = NULL;
+        l->size = 0;
+        return l;
+    }
+    printError("unrolledListNew error\n");
+    return NULL;
+}
+void unrolledListFree(struct unrolledList *l)
+{
+    if (l)
+    {
+        struct unrolledListNode *c = l->head;
+        while (c)
+        {
+            struct unrolledListNode *n = c->next;
+            free(c);
+            c = n;
+        }
+        free(l);
+    }
+}
+static struct unrolledListNode *unrolledListNodeNew()
+{
+    struct unrolledListNode *n = malloc(sizeof(struct unrolledListNode));
+    if (n)
+    {
+        n->prev = n->next = NULL;
+        n->size = 0;
+        return n;
+    }
+    printError("unrolledListNodeNew error\n");
+    return NULL;
+}
+int unrolledListAdd(struct unrolledList *l, void *el)
+{
+    if (!l)
+    {
+        printError("unrolledListAdd l is NULL\n");
+        return 0;
+    }
+    if (!l->tail || l->tail->size == UL_NODE_CAP)
+    {
+        struct unrolledListNode *n = unrolledListNodeNew();
+        if (!n)
+            return 0;
+        if (l->tail)
+        {
+            n->prev = l->tail;
+            l->tail->next = n;
+        }
+        else
+            l->head = n;
+        l->tail = n;
+    }
+    l->tail->vals[l->tail->size++] = el;
+    l->size++;
+    return 1;
+}
+int unrolledListSet(struct unrolledList *l, int i, void *el)
+{
+    if (!l)
+    {
+        printError("unrolledListSet l is NULL\n");
+        return 0;
+    }
+    if (i < 0 || i >= l->size)
+        return 0;
+    int j;
+    struct unrolledListNode *n = unrolledListGetNode(l, i, &j);
+    n->vals[j] = el;
+    return 1;
+}
+int unrolledListRemove(struct unrolledList *l, int i)
+{
+    if (!l)
+    {
+        printError("unrolledListRemove l is NULL\n");
+        return 0;
+    }
+    if (i < 0 || i >= l->size)
+        return 0;
+
+    int j;
+    struct unrolledListNode *n = unrolledListGetNode(l, i, &j);
+    memmove(n->vals + j, n->vals + j + 1, sizeof(void *) * (n->size - j - 1));
+    n->size--;
+    l->size--;
+
+    // keep nodes dense: drop an empty node, merge with the next when it fits
+    struct unrolledListNode *next = n->next;
+    if (!n->size)
+        unrolledListUnlink(l, n);
+    else if (next && n->size + next->size <= UL_NODE_CAP)
+    {
+        memcpy(n->vals + n->size, next->vals, sizeof(void *) * next->size);
+        n->size += next->size;
+        unrolledListUnlink(l, next);
+    }
+    return 1;
+}
+void *unrolledListGet(struct unrolledList *l, int i)
+{
+    if (!l)
+    {
+        printError("unrolledListGet l is NULL\n");
+        return NULL;
+    }
+    if (i < 0 || i >= l->size)
+        return NULL;
+    int j;
+    struct unrolledListNode *n = unrolledListGetNode(l, i, &j);
+    return n->vals[j];
+}
+void *unrolledListHead(struct unrolledList *l)
+{
+    if (!l)
+    {
+        printError("unrolledListHead l is NULL\n");
+        return NULL;
+    }
+    return l->head ? l->head->vals[0] : NULL;
+}
+void *unrolledListTail(struct unrolledList *l)
+{
+    if (!l)
+    {
+        printError("unrolledListTail l is NULL\n");
+        return NULL;
+    }
+    return l->tail ? l->tail->vals[l->tail->size - 1] : NULL;
+}
+int unrolledListContains(struct unrolledList *l, void *el)
+{
+    if (!l)
+    {
+        printError("unrolledListContains l is NULL\n");
+        return 0;
+    }
+    struct unrolledListNode *n = l->head;
+    for (; n; n = n->next)
+    {
+        int j;
+        for (j = 0; j < n->size; j++)
+            if (n->vals[j] == el)
+                return 1;
+    }
+    return 0;
+}
+int unrolledListSize(struct unrolledList *l)
+{
+    return l ? l->size : 0;
+}
+static struct unrolledListNode *unrolledListGetNode(struct unrolledList *l, int i, int *j)
+{
+    // skip whole nodes, from the nearer end
+    struct unrolledListNode *n;
+    if ((i << 1) < l->size)
+    {
+        n = l->head;
+        while (i >= n->size)
+        {
+            i -= n->size;
+            n = n->next;
+        }
+    }
+    else
+    {
+        int k = l->size - 1 - i;
+        n = l->tail;
+        while (k >= n->size)
+        {
+            k -= n->size;
+            n = n->prev;
+        }
+        i = n->size - 1 - k;
+    }
+    *j = i;
+    return n;
+}
+static void unrolledListUnlink(struct unrolledList *l, struct unrolledListNode *n)
+{
+    if (n->prev)
+        n->prev->next = n->next;
+    if (n->next)
+        n->next->prev = n->prev;
+    if (n == l->head)
+        l->head = n->next;
+    if (n == l->tail)
+        l->tail = n->prev;
+    free(n);
+}
+
+/*
+ * ------------------------------------------------------------------ Treap List
+ */
+
+static int treapListNodeSize(struct treapListNode *n);
+static void treapListNodeFree(struct treapListNode *n);
+static int treapListNodeContains(struct treapListNode *n, void *el);
+static void treapListUpdate(struct treapListNode *n);
+static void treapListSplit(struct treapListNode *n, int i,
+                           struct treapListNode **l, struct treapListNode **r);
+static struct treapListNode *treapListMerge(struct treapListNode *l, struct treapListNode *r);
+static struct treapListNode *treapListGetNode(struct treapList *l, int i);
+struct treapList *treapListNew()
+{
+    struct treapList *l = malloc(sizeof(struct treapList));
+    if (l)
+    {
+        l->root = NULL;
+        l->seed = (UINT32)time(0) | 1;
+        return l;
+    }
+    printError("treapListNew error\n");
+    return NULL;
+}
+void treapListFree(struct treapList *l)
+{
+    if (!l)
+        return;
+    treapListNodeFree(l->root);
+    free(l);
+}
+int treapListAdd(struct treapList *l, void *el)
+{
+    return treapListInsert(l, treapListSize(l), el);
+}
+int treapListInsert(struct treapList *l, int i, void *el)
+{
+    if (!l)
+    {
+        printError("treapListInsert l is NULL\n");
+        return 0;
+    }
+    if (i < 0 || i > treapListNodeSize(l->root))
+        return 0;
+
+    struct treapListNode *n = malloc(sizeof(struct treapListNode));
+    if (!n)
+    {
+        printError("treapListInsert error\n");
+        return 0;
+    }
+    // xorshift32
+    l->seed ^= l->seed << 13;
+    l->seed ^= l->seed >> 17;
+    l->seed ^= l->seed << 5;
+    n->left = n->right = NULL;
+    n->priority = l->seed;
+    n->size = 1;
+    n->val = el;
+
+    struct treapListNode *a, *b;
+    treapListSplit(l->root, i, &a, &b);
+    l->root = treapListMerge(treapListMerge(a, n), b);
+    return 1;
+}
+int treapListSet(struct treapList *l, int i, void *el)
+{
+    if (!l)
+    {
+        printError("treapListSet l is NULL\n");
+        return 0;
+    }
+    struct treapListNode *n = treapListGetNode(l, i);
+    if (!n)
+        return 0;
+    n->val = el;
+    return 1;
+}
+int treapListRemove(struct treapList *l, int i)
+{
+    if (!l)
+    {
+        printError("treapListRemove l is NULL\n");
+        return 0;
+    }
+    if (i < 0 || i >= treapListNodeSize(l->root))
+        return 0;
+
+    // unlink in place: replace the node by the merge of its subtrees
+    struct treapListNode **p = &l->root;
+    for (;;)
+    {
+        struct treapListNode *n = *p;
+        int ls = treapListNodeSize(n->left);
+        n->size--;
+        if (i < ls)
+            p = &n->left;
+        else if (i > ls)
+        {
+            i -= ls + 1;
+            p = &n->right;
+        }
+        else
+        {
+            *p = treapListMerge(n->left, n->right);
+            free(n);
+            return 1;
+        }
+    }
+}
+void *treapListGet(struct treapList *l, int i)
+{
+    if (!l)
+    {
+        printError("treapListGet l is NULL\n");
+        return NULL;
+    }
+    struct treapListNode *n = treapListGetNode(l, i);
+    return n ? n->val : NULL;
+}
+void *treapListHead(struct treapList *l)
+{
+    if (!l)
+    {
+        printError("treapListHead l is NULL\n");
+        return NULL;
+    }
+    struct treapListNode *n = l->root;
+    while (n && n->left)
+        n = n->left;
+    return n ? n->val : NULL;
+}
+void *treapListTail(struct treapList *l)
+{
+    if (!l)
+    {
+        printError("treapListTail l is NULL\n");
+        return NULL;
+    }
+    struct treapListNode *n = l->root;
+    while (n && n->right)
+        n = n->right;
+    return n ? n->val : NULL;
+}
+int treapListContains(struct treapList *l, void *el)
+{
+    if (!l)
+    {
+        printError("treapListContains l is NULL\n");
+        return 0;
+    }
+    return treapListNodeContains(l->root, el);
+}
+int treapListSize(struct treapList *l)
+{
+    return l ? treapListNodeSize(l->root) : 0;
+}
+static int treapListNodeSize(struct treapListNode *n)
+{
+    return n ? n->size : 0;
+}
+static void treapListNodeFree(struct treapListNode *n)
+{
+    // the expected depth is O(log n), recursion needs no allocation that could fail
+    if (n)
+    {
+        treapListNodeFree(n->left);
+        treapListNodeFree(n->right);
+        free(n);
+    }
+}
+static int treapListNodeContains(struct treapListNode *n, void *el)
+{
+    return n && (n->val == el || treapListNodeContains(n->left, el) ||
+                 treapListNodeContains(n->right, el));
+}
+static void treapListUpdate(struct treapListNode *n)
+{
+    n->size = treapListNodeSize(n->left) + treapListNodeSize(n->right) + 1;
+}
+static void treapListSplit(struct treapListNode *n, int i,
+                           struct treapListNode **l, struct treapListNode **r)
+{
+    // l gets the first i nodes, r the rest
+    if (!n)
+    {
+        *l = *r = NULL;
+        return;
+    }
+    int ls = treapListNodeSize(n->left);
+    if (i <= ls)
+    {
+        treapListSplit(n->left, i, l, &n->left);
+        *r = n;
+    }
+    else
+    {
+        treapListSplit(n->right, i - ls - 1, &n->right, r);
+        *l = n;
+    }
+    treapListUpdate(n);
+}
+static struct treapListNode *treapListMerge(struct treapListNode *l, struct treapListNode *r)
+{
+    if (!l)
+        return r;
+    if (!r)
+        return l;
+    if (l->priority > r->priority)
+    {
+        l->right = treapListMerge(l->right, r);
+        treapListUpdate(l);
+        return l;
+    }
+    r->left = treapListMerge(l, r->left);
+    treapListUpdate(r);
+    return r;
+}
+static struct treapListNode *treapListGetNode(struct treapList *l, int i)
+{
+    if (i < 0 || i >= treapListNodeSize(l->root))
+        return NULL;
+    struct treapListNode *n = l->root;
+    for (;;)
+    {
+        int ls = treapListNodeSize(n->left);
+        if (i < ls)
+            n = n->left;
+        else if (i > ls)
+        {
+            i -= ls + 1;
+            n = n->right;
+        }
+        else
+            return n;
+    }
+}
+
+/*
+ * ------------------------------------------------------------------------ Dict
+ */
+
+static struct dictEntry *dictEntryNew(struct Dict *d, UINT64 hash, void *key, void *val);
+static void dictEntryFree(struct Dict *d, struct dictEntry *e);
+static UINT64 dictHash(struct Dict *d, void *key);
+static UINT64 hash2(UINT64 hash);
+static long tableIndex(struct Dict *d, UINT64 hash);
+static long dictThreshold(struct Dict *d, long cap);
+static int resize(struct Dict *d);
+static void rehash(struct Dict *d);
+static void dictRebucket(struct Dict *d);
+static void dictCheckCluster(struct Dict *d);
+static double dictHitCost(struct Dict *d);
+static struct dictEntry *dictGetEntry(struct Dict *d, UINT64 h, void *key);
+static int dictPutHash(struct Dict *d, UINT64 h, void *key, void *val);
+static int dictPutIndex(struct Dict *d, UINT64 h, long i, void *key, void *val);
+static int dictRemoveHash(struct Dict *d, UINT64 h, void *key);
+static int dictTableInit(struct Dict *d);
+static struct Dict *dictNewCore(int (*keyHash)(void *), UINT64 (*keyHash64)(void *),
+                                int (*keyCompare)(void *, void *),
+                                int (*valCompare)(void *, void *));
+struct Dict *dictNew(int (*keyHash)(void *), int (*keyCompare)(void *, void *),
+                     int (*valCompare)(void *, void *))
+{
+    if (!keyHash)
+    {
+        printError("dictNew keyHash is NULL\n");
+        return NULL;
+    }
+    return dictNewCore(keyHash, NULL, keyCompare, valCompare);
+}
+struct Dict *dictNew64(UINT64 (*keyHash64)(void *), int (*keyCompare)(void *, void *),
+                       int (*valCompare)(void *, void *))
+{
+    if (!keyHash64)
+    {
+        printError("dictNew64 keyHash64 is NULL\n");
+        return NULL;
+    }
+    return dictNewCore(NULL, keyHash64, keyCompare, valCompare);
+}
+static struct Dict *dictNewCore(int (*keyHash)(void *), UINT64 (*keyHash64)(void *),
+                                int (*keyCompare)(void *, void *),
+                                int (*valCompare)(void *, void *))
+{
+    if (!keyCompare)
+    {
+        printError("dictNew keyCompare is NULL\n");
+        return NULL;
+    }
+    if (!valCompare)
+    {
+        printError("dictNew valCompare is NULL\n");
+        return NULL;
+    }
+    struct Dict *d = malloc(sizeof(struct Dict));
+    if (d)
+    {
+        d->table = NULL;
+        d->cap = 8;
+        d->size = 0;
+        d->loadFactor = DICT_LOAD_FACTOR;
+        d->threshold = dictThreshold(d, d->cap);
+        d->mix = DICT_MIX_64;
+        d->warned = 0;
+        d->keyHash = keyHash;
+        d->keyHash64 = keyHash64;
+        d->keyCompare = keyCompare;
+        d->valCompare = valCompare;
+        d->stats = statsNew();
+        return d;
+    }
+    else
+    {
+        printError("dictNew error\n");
+        return NULL;
+    }
+}
+void dictFree(struct Dict *d)
+{
+    if (d)
+    {
+        if (d->table)
+        {
+            long i;
+            for (i = 0; i < d->cap; i++)
+            {
+                struct dictEntry *c = *(d->table + i);
+                struct dictEntry *n = NULL;
+                while (c)
+                {
+                    n = c->next;
+                    dictEntryFree(d, c);
+                    c = n;
+                }
+            }
+
+            memFree(d->table);
+        }
+        free(d->stats);
+        free(d);
+    }
+}
+static struct dictEntry *dictEntryNew(struct Dict *d, UINT64 hash, void *key, void *val)
+{
+    struct dictEntry *entry = malloc(sizeof(struct dictEntry));
+    if (entry)
+    {
+        entry->hash = hash;
+        entry->key = key;
+        entry->val = val;
+        entry->next = NULL;
+        STATS_ADD(d->stats, allocs, 1);
+        return entry;
+    }
+    else
+    {
+        printError("dictEntryNew error\n");
+        return NULL;
+    }
+}
+static void dictEntryFree(struct Dict *d, struct dictEntry *entry)
+{
+    if (entry)
+    {
+        STATS_ADD(d->stats, frees, 1);
+        free(entry);
+    }
+}
+int dictPut(struct Dict *d, void *key, void *val)
+{
+    if (!d)
+    {
+        printError("dictPut d is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("dictPut key is NULL\n");
+        return 0;
+    }
+    UINT64 t0 = STATS_NOW();
+    int r = dictPutHash(d, dictHash(d, key), key, val);
+    STATS_RECORD(d->stats, insert, t0);
+    return r;
+}
+static int dictPutHash(struct Dict *d, UINT64 h, void *key, void *val)
+{
+    if (!dictTableInit(d))
+        return 0;
+    return dictPutIndex(d, h, tableIndex(d, h), key, val);
+}
+static int dictPutIndex(struct Dict *d, UINT64 h, long i, void *key, void *val)
+{
+    // i is the bucket of h in the current table, maybe replace
+    struct dictEntry *entry = *(d->table + i);
+    while (entry)
+    {
+        if (entry->hash == h && !d->keyCompare(key, entry->key))
+        {
+            entry->val = val;
+            return 1;
+        }
+        entry = entry->next;
+    }
+
+    if (d->size >= d->threshold)
+    {
+        if (!resize(d))
+        {
+            printError("resize error\n");
+            return 0;
+        }
+        // the hash is kept, only the index changes with cap
+        i = tableIndex(d, h);
+    }
+    entry = dictEntryNew(d, h, key, val);
+    if (!entry)
+    {
+        printError("dictPut error\n");
+        return 0;
+    }
+    entry->next = *(d->table + i);
+    *(d->table + i) = entry;
+
+    d->size++;
+    return 1;
+}
+int dictRemove(struct Dict *d, void *key)
+{
+    if (!d)
+    {
+        printError("dictRemove d is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("dictRemove key is NULL\n");
+        return 0;
+    }
+    UINT64 t0 = STATS_NOW();
+    int r = dictRemoveHash(d, dictHash(d, key), key);
+    STATS_RECORD(d->stats, remove, t0);
+    return r;
+}
+static int dictRemoveHash(struct Dict *d, UINT64 h, void *key)
+{
+    if (d->size == 0)
+        return 0;
+
+    long i = tableIndex(d, h);
+    struct dictEntry *p = NULL;
+    struct dictEntry *c = *(d->table + i);
+    while (c)
+    {
+        if (c->hash == h && !d->keyCompare(c->key, key))
+        {
+            if (p)
+                p->next = c->next;
+            else
+                *(d->table + i) = c->next;
+            dictEntryFree(d, c);
+            d->size--;
+            return 1;
+        }
+        p = c;
+        c = c->next;
+    }
+    return 0;
+}
+void *dictGet(struct Dict *d, void *key)
+{
+    if (!d)
+    {
+        printError("dictGet d is NULL\n");
+        return NULL;
+    }
+    if (!key)
+    {
+        printError("dictGet key is NULL\n");
+        return NULL;
+    }
+    UINT64 t0 = STATS_NOW();
+    struct dictEntry *entry = dictGetEntry(d, dictHash(d, key), key);
+    STATS_RECORD(d->stats, lookup, t0);
+    return entry ? entry->val : NULL;
+}
+int dictContainsKey(struct Dict *d, void *key)
+{
+    if (!d)
+    {
+        printError("dictGet d is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("dictGet key is NULL\n");
+        return 0;
+    }
+    struct dictEntry *entry = dictGetEntry(d, dictHash(d, key), key);
+    return entry ? 1 : 0;
+}
+int dictContainsValue(struct Dict *d, void *val)
+{
+    if (!d)
+    {
+        printError("dictGet d is NULL\n");
+        return 0;
+    }
+    if (!val)
+    {
+        printError("dictGet val is NULL\n");
+        return 0;
+    }
+    if (d->size == 0)
+        return 0;
+    if (d->table)
+    {
+        long i;
+        for (i = 0; i < d->cap; i++)
+        {
+            struct dictEntry *entry = *(d->table + i);
+            while (entry)
+            {
+                if (!d->valCompare(entry->val, val))
+                    return 1;
+                entry = entry->next;
+            }
+        }
+    }
+    return 0;
+}
+long dictSize(struct Dict *d)
+{
+    return d ? d->size : 0;
+}
+int dictGetBatch(struct Dict *d, void **keys, void **vals, int n)
+{
+    if (!d)
+    {
+        printError("dictGetBatch d is NULL\n");
+        return 0;
+    }
+    if (!keys || !vals)
+    {
+        printError("dictGetBatch keys or vals is NULL\n");
+        return 0;
+    }
+
+    // group prefetching: hash the whole group and prefetch the buckets,
+    // then prefetch the first entries, then walk the chains
+    UINT64 h[DICT_BATCH];
+    struct dictEntry **b[DICT_BATCH];
+    int found = 0;
+    int i;
+    for (i = 0; i < n; i += DICT_BATCH)
+    {
+        int m = n - i < DICT_BATCH ? n - i : DICT_BATCH;
+        int j;
+        for (j = 0; j < m; j++)
+        {
+            if (!keys[i + j])
+            {
+                printError("dictGetBatch key is NULL\n");
+                return found;
+            }
+        }
+        if (d->size == 0)
+        {
+            for (j = 0; j < m; j++)
+                vals[i + j] = NULL;
+            continue;
+        }
+        for (j = 0; j < m; j++)
+        {
+            h[j] = dictHash(d, keys[i + j]);
+            b[j] = d->table + tableIndex(d, h[j]);
+            PREFETCH(b[j]);
+        }
+        for (j = 0; j < m; j++)
+            PREFETCH(*b[j]);
+        for (j = 0; j < m; j++)
+        {
+            struct dictEntry *entry = *b[j];
+            while (entry && (entry->hash != h[j] || d->keyCompare(keys[i + j], entry->key)))
+                entry = entry->next;
+            vals[i + j] = entry ? entry->val : NULL;
+            found += entry ? 1 : 0;
+        }
+    }
+    return found;
+}
+int dictPutBatch(struct Dict *d, void **keys, void **vals, int n)
+{
+    if (!d)
+    {
+        printError("dictPutBatch d is NULL\n");
+        return 0;
+    }
+    if (!keys || !vals)
+    {
+        printError("dictPutBatch keys or vals is NULL\n");
+        return 0;
+    }
+    if (!dictTableInit(d))
+        return 0;
+
+    UINT64 h[DICT_BATCH];
+    long b[DICT_BATCH];
+    int put = 0;
+    int i;
+    for (i = 0; i < n; i += DICT_BATCH)
+    {
+        int m = n - i < DICT_BATCH ? n - i : DICT_BATCH;
+        int j;
+        // grow before the group so the prefetched buckets stay valid
+        while (d->size + m > d->threshold && d->cap < DICT_MAX_CAP)
+            if (!resize(d))
+                return put;
+        for (j = 0; j < m; j++)
+        {
+            if (!keys[i + j])
+            {
+                printError("dictPutBatch key is NULL\n");
+                return put;
+            }
+            h[j] = dictHash(d, keys[i + j]);
+            b[j] = tableIndex(d, h[j]);
+            PREFETCH(d->table + b[j]);
+        }
+        for (j = 0; j < m; j++)
+            PREFETCH(*(d->table + b[j]));
+        for (j = 0; j < m; j++)
+        {
+            if (!dictPutIndex(d, h[j], b[j], keys[i + j], vals[i + j]))
+                return put;
+            put++;
+        }
+    }
+    return put;
+}
+int dictSetLoadFactor(struct Dict *d, float loadFactor)
+{
+    if (!d)
+    {
+        printError("dictSetLoadFactor d is NULL\n");
+        return 0;
+    }
+    if (!(loadFactor > 0))
+    {
+        printError("dictSetLoadFactor loadFactor %f is not positive\n", loadFactor);
+        return 0;
+    }
+    d->loadFactor = loadFactor;
+    d->threshold = d->cap < DICT_MAX_CAP ? dictThreshold(d, d->cap) : LONG_MAX;
+    // a lower factor applies now, the table is allocated on the first put
+    while (d->table && d->size >= d->threshold && d->threshold < LONG_MAX)
+        if (!resize(d))
+            return 0;
+    return 1;
+}
+int dictSetMixer(struct Dict *d, int mix)
+{
+    if (!d)
+    {
+        printError("dictSetMixer d is NULL\n");
+        return 0;
+    }
+    if (mix != DICT_MIX_NONE && mix != DICT_MIX_64)
+    {
+        printError("dictSetMixer mix %d is unknown\n", mix);
+        return 0;
+    }
+    if (d->mix != mix)
+    {
+        d->mix = mix;
+        if (d->table)
+            dictRebucket(d);
+    }
+    return 1;
+}
+int dictStats(struct Dict *d, struct dictStats *s)
+{
+    if (!d || !s)
+    {
+        printError("dictStats d or s is NULL\n");
+        return 0;
+    }
+    memset(s, 0, sizeof(struct dictStats));
+    s->size = d->size;
+    s->cap = d->cap;
+    s->load = (double)d->size / (double)d->cap;
+    s->missCost = s->load;
+    if (!d->table)
+    {
+        s->chains[0] = d->cap;
+        return 1;
+    }
+    long used = 0;
+    long i;
+    for (i = 0; i < d->cap; i++)
+    {
+        long n = 0;
+        struct dictEntry *e = *(d->table + i);
+        for (; e; e = e->next)
+            n++;
+        s->chains[n < DICT_STATS_CHAINS ? n : DICT_STATS_CHAINS - 1]++;
+        if (n > s->maxChain)
+            s->maxChain = n;
+        if (n)
+            used++;
+    }
+    s->meanChain = used ? (double)d->size / (double)used : 0;
+    s->hitCost = dictHitCost(d);
+    return 1;
+}
+struct opStats *dictOpStats(struct Dict *d)
+{
+    return d ? d->stats : NULL;
+}
+int dictSave(struct Dict *d, const char *path, struct snapshotCodec *key,
+             struct snapshotCodec *val)
+{
+    if (!d || !path || !snapshotCodecValid(key) || !snapshotCodecValid(val))
+    {
+        printError("dictSave d, path or codec is NULL\n");
+        return 0;
+    }
+    struct snapshotWriter w;
+    if (!snapshotCreate(&w, path, SNAPSHOT_DICT, d->size))
+        return 0;
+    int ok = 1;
+    long i;
+    for (i = 0; ok && d->table && i < d->cap; i++)
+    {
+        struct dictEntry *e = *(d->table + i);
+        for (; ok && e; e = e->next)
+            ok = snapshotPut(&w, key, e->key) && snapshotPut(&w, val, e->val);
+    }
+    return snapshotCommit(&w, ok);
+}
+int dictLoad(struct Dict *d, const char *path, struct snapshotCodec *key,
+             struct snapshotCodec *val)
+{
+    if (!d || !path || !snapshotCodecValid(key) || !snapshotCodecValid(val))
+    {
+        printError("dictLoad d, path or codec is NULL\n");
+        return 0;
+    }
+    if (d->size)
+    {
+        printError("dictLoad d is not empty\n");
+        return 0;
+    }
+    struct snapshotReader r;
+    if (!snapshotOpen(&r, path, SNAPSHOT_DICT))
+        return 0;
+
+    // size the table once, no resize and no rehash while loading
+    long cap = 8;
+    while (cap < DICT_MAX_CAP && dictThreshold(d, cap) <= (long)r.count)
+        cap <<= 1;
+    memFree(d->table);
+    d->table = NULL;
+    d->cap = cap;
+    d->threshold = cap < DICT_MAX_CAP ? dictThreshold(d, cap) : LONG_MAX;
+    int ok = dictTableInit(d);
+
+    // the keys are distinct, each entry is pushed without a compare
+    UINT64 n;
+    for (n = 0; ok && n < r.count; n++)
+    {
+        void *k = NULL;
+        void *v = NULL;
+        struct dictEntry *e = NULL;
+        ok = snapshotGet(&r, key, &k) && k && snapshotGet(&r, val, &v) &&
+             (e = dictEntryNew(d, dictHash(d, k), k, v));
+        if (ok)
+        {
+            long i = tableIndex(d, e->hash);
+            e->next = *(d->table + i);
+            *(d->table + i) = e;
+            d->size++;
+        }
+        else
+        {
+            snapshotRelease(key, k);
+            snapshotRelease(val, v);
+        }
+    }
+    snapshotClose(&r);
+    if (!ok)
+        printError("dictLoad %s record %lu error\n", path, n);
+    return ok;
+}
+#ifdef DEBUG
+void dictPrint(struct Dict *d, void (*print)(void *, void *))
+{
+    if (!d)
+    {
+        printError("dictPrint d is NULL\n");
+        return;
+    }
+    if (d->size)
+    {
+        long i;
+        for (i = 0; i < d->cap; i++)
+        {
+            struct dictEntry *entry = *(d->table + i);
+            while (entry)
+            {
+                print(entry->key, entry->val);
+                entry = entry->next;
+            }
+        }
+    }
+}
+#endif // DEBUG
+static int dictTableInit(struct Dict *d)
+{
+    if (d->table == NULL)
+    {
+        // zeroed, a mmap'ed table is not touched until used
+        d->table = memCalloc(sizeof(struct dictEntry *) * d->cap);
+        if (!d->table)
+        {
+            printError("dictPut init table error\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+static UINT64 dictHash(struct Dict *d, void *key)
+{
+    // computed once per operation, the entry keeps it for rehash
+    return d->keyHash64 ? d->keyHash64(key) : (UINT64)(UINT32)d->keyHash(key);
+}
+static UINT64 hash2(UINT64 hash)
+{
+    return hashMix64(hash);
+}
+static long tableIndex(struct Dict *d, UINT64 hash)
+{
+    UINT64 h = d->mix == DICT_MIX_NONE ? hash : hash2(hash);
+    return (long)(h & (UINT64)(d->cap - 1));
+}
+static long dictThreshold(struct Dict *d, long cap)
+{
+    double t = (double)cap * d->loadFactor;
+    return t < 1 ? 1 : t >= (double)LONG_MAX ? LONG_MAX : (long)t;
+}
+static int resize(struct Dict *d)
+{
+    if (d->cap < DICT_MAX_CAP)
+    {
+        long newCap = d->cap << 1;
+        long newThreshold = dictThreshold(d, newCap);
+
+        struct dictEntry **newTable = memRealloc(d->table, sizeof(struct dictEntry *) * newCap);
+        if (!newTable)
+        {
+            printError("dict resize error\n");
+            return 0;
+        }
+
+        long i;
+        for (i = d->cap; i < newCap; i++)
+            *(newTable + i) = NULL;
+
+        d->table = newTable;
+        d->threshold = newThreshold;
+        d->cap = newCap;
+
+        rehash(d);
+        STATS_ADD(d->stats, resizes, 1);
+        dictCheckCluster(d);
+
+        return 1;
+    }
+    else if (d->threshold < LONG_MAX)
+    {
+        d->threshold = LONG_MAX;
+        return 1;
+    }
+    else
+    {
+        printError("dict cap is not enough\n");
+        return 0;
+    }
+}
+static void rehash(struct Dict *d)
+{
+    // cap -1 = 2 ^ 3 - 1 = 111     hash2 = hash & 111
+    // cap -1 = 2 ^ 4 - 1 = 1111    hash2 = hash & 1111
+    // cap -1 = 2 ^ 5 - 1 = 11111   hash2 = hash & 11111
+    // ...
+    long i;
+    for (i = (d->cap >> 1) - 1; i >= 0; i--)
+    {
+        struct dictEntry *h = *(d->table + i);
+        struct dictEntry *p = NULL;
+        struct dictEntry *c = *(d->table + i);
+        struct dictEntry *n = NULL;
+        while (c)
+        {
+            n = c->next;
+            long j = tableIndex(d, c->hash);
+            if (j == i)
+                p = c;
+            else
+            {
+                c->next = *(d->table + j);
+                *(d->table + j) = c;
+                if (h == c)
+                    h = *(d->table + i) = n;
+                else
+                    p->next = n;
+            }
+            c = n;
+        }
+    }
+}
+static void dictRebucket(struct Dict *d)
+{
+    // the index function changed, the entries keep the raw hash and all may move
+    struct dictEntry *all = NULL;
+    struct dictEntry *n = NULL;
+    long i;
+    for (i = 0; i < d->cap; i++)
+    {
+        struct dictEntry *c = *(d->table + i);
+        for (; c; c = n)
+        {
+            n = c->next;
+            c->next = all;
+            all = c;
+        }
+        *(d->table + i) = NULL;
+    }
+    for (; all; all = n)
+    {
+        n = all->next;
+        i = tableIndex(d, all->hash);
+        all->next = *(d->table + i);
+        *(d->table + i) = all;
+    }
+}
+static void dictCheckCluster(struct Dict *d)
+{
+    if (d->size < DICT_CLUSTER_MIN || d->warned)
+        return;
+    // uniform hashing compares 1 + load / 2 entries on a hit
+    double load = (double)d->size / (double)d->cap;
+    if (dictHitCost(d) <= DICT_CLUSTER_FACTOR * (1 + load / 2))
+        return;
+    if (d->mix == DICT_MIX_NONE)
+    {
+        printWarn("dict keyHash clusters, switching to hashMix64\n");
+        d->mix = DICT_MIX_64;
+        dictRebucket(d);
+    }
+    else
+    {
+        // equal hashes, no mixer can split them
+        printWarn("dict keyHash collides, lookups degrade toward O(n)\n");
+        d->warned = 1;
+    }
+}
+static double dictHitCost(struct Dict *d)
+{
+    // a chain of n costs 1 + 2 + ... + n over its n keys
+    double cost = 0;
+    long i;
+    for (i = 0; i < d->cap; i++)
+    {
+        long n = 0;
+        struct dictEntry *e = *(d->table + i);
+        for (; e; e = e->next)
+            n++;
+        cost += (double)n * (double)(n + 1) / 2;
+    }
+    return d->size ? cost / (double)d->size : 0;
+}
+static struct dictEntry *dictGetEntry(struct Dict *d, UINT64 h, void *key)
+{
+    if (d->size == 0)
+        return NULL;
+
+    long i = tableIndex(d, h);
+    struct dictEntry *entry = *(d->table + i);
+    UINT64 n = 0;
+    while (entry)
+    {
+        n++;
+        if (entry->hash == h && !d->keyCompare(key, entry->key))
+            break;
+        entry = entry->next;
+    }
+    STATS_WALK(d->stats, n);
+    return entry;
+}
+
+/*
+ * -------------------------------------------------------------- Read-Only Dict
+ */
+
+static long roDictHead(void);
+int roDictBuild(struct Dict *d, const char *path, struct snapshotCodec *key,
+                struct snapshotCodec *val)
+{
+    if (!d || !path || !key || !key->encode || !val || !val->encode)
+    {
+        printError("roDictBuild d, path or codec is NULL\n");
+        return 0;
+    }
+    UINT64 cap = 8;
+    while (cap < 2 * (UINT64)d->size)
+        cap <<= 1;
+    struct roDictSlot *slots = memCalloc(sizeof(struct roDictSlot) * cap);
+    if (!slots)
+    {
+        printError("roDictBuild slots error\n");
+        return 0;
+    }
+    struct snapshotWriter w;
+    if (!snapshotCreate(&w, path, SNAPSHOT_RO_DICT, d->size))
+    {
+        memFree(slots);
+        return 0;
+    }
+
+    // the records follow the slots, which are written last once filled
+    UINT64 head[2] = {cap, RO_DICT_SEED};
+    long off = roDictHead() + (long)(sizeof(struct roDictSlot) * cap);
+    int ok = fwrite(head, sizeof(head), 1, w.f) == 1 && !fseek(w.f, off, SEEK_SET);
+    long i;
+    for (i = 0; ok && d->table && i < d->cap; i++)
+    {
+        struct dictEntry *e = *(d->table + i);
+        for (; ok && e; e = e->next)
+        {
+            long nk = snapshotPut(&w, key, e->key);
+            UINT64 h = nk ? hashBytes(w.buf, nk - sizeof(UINT32), RO_DICT_SEED) : 0;
+            long nv = nk ? snapshotPut(&w, val, e->val) : 0;
+            ok = nk && nv;
+            if (ok)
+            {
+                UINT64 j = h & (cap - 1);
+                while (slots[j].offset)
+                    j = (j + 1) & (cap - 1);
+                slots[j].hash = h;
+                slots[j].offset = off;
+                off += nk + nv;
+            }
+        }
+    }
+    ok = ok && !fseek(w.f, roDictHead(), SEEK_SET) &&
+         fwrite(slots, sizeof(struct roDictSlot), cap, w.f) == cap;
+    memFree(slots);
+    return snapshotCommit(&w, ok);
+}
+struct roDict *roDictOpen(const char *path)
+{
+    if (!path)
+    {
+        printError("roDictOpen path is NULL\n");
+        return NULL;
+    }
+    struct snapshotReader r;
+    if (!snapshotOpen(&r, path, SNAPSHOT_RO_DICT))
+        return NULL;
+    UINT64 head[2] = {0, 0};
+    if (r.len >= roDictHead())
+        memcpy(head, r.p, sizeof(head));
+    UINT64 cap = head[0];
+    // cap is a power of 2 with a free slot and all slots are in the file
+    if (!cap || (cap & (cap - 1)) || cap <= r.count ||
+        cap > (UINT64)(r.len - roDictHead()) / sizeof(struct roDictSlot))
+    {
+        printError("roDictOpen %s cap %lu error\n", path, cap);
+        snapshotClose(&r);
+        return NULL;
+    }
+    struct roDict *d = malloc(sizeof(struct roDict));
+    if (!d)
+    {
+        printError("roDictOpen error\n");
+        snapshotClose(&r);
+        return NULL;
+    }
+#if defined(__linux__) && defined(MADV_RANDOM)
+    if (r.mapped)
+        madvise((void *)r.base, r.len, MADV_RANDOM);
+#endif // __linux__
+    d->base = r.base;
+    d->len = r.len;
+    d->mapped = r.mapped;
+    d->cap = cap;
+    d->count = r.count;
+    d->seed = head[1];
+    d->slots = (const struct roDictSlot *)(r.base + roDictHead());
+    return d;
+}
+void roDictClose(struct roDict *d)
+{
+    if (d)
+    {
+        snapshotUnmap(d->base, d->len, d->mapped);
+        free(d);
+    }
+}
+const void *roDictGet(struct roDict *d, const void *key, long keyLen, long *valLen)
+{
+    if (!d || !key)
+    {
+        printError("roDictGet d or key is NULL\n");
+        return NULL;
+    }
+    UINT64 h = hashBytes(key, keyLen, d->seed);
+    UINT64 i = h & (d->cap - 1);
+    UINT64 n;
+    for (n = 0; n < d->cap && d->slots[i].offset; n++, i = (i + 1) & (d->cap - 1))
+    {
+        const struct roDictSlot *s = d->slots + i;
+        UINT32 kl, vl;
+        // offsets come from the file, every length is checked against its size
+        if (s->hash != h || s->offset > (UINT64)d->len - 2 * sizeof(UINT32))
+            continue;
+        const UINT8 *p = d->base + s->offset;
+        memcpy(&kl, p, sizeof(kl));
+        if (kl != keyLen || (UINT64)(d->base + d->len - p) < 2 * sizeof(UINT32) + kl)
+            continue;
+        if (memcmp(p + sizeof(kl), key, kl))
+            continue;
+        p += sizeof(kl) + kl;
+        memcpy(&vl, p, sizeof(vl));
+        if ((UINT64)(d->base + d->len - p) < sizeof(vl) + vl)
+            return NULL;
+        if (valLen)
+            *valLen = vl;
+        return p + sizeof(vl);
+    }
+    return NULL;
+}
+long roDictSize(struct roDict *d)
+{
+    return d ? (long)d->count : 0;
+}
+static long roDictHead(void)
+{
+    // the snapshot header then cap and seed
+    return sizeof(struct snapshotHeader) + 2 * sizeof(UINT64);
+}
+
+/*
+ * ---------------------------------------------------------------- Perfect Hash
+ */
+
+#define MPH_PILOTS 65536
+
+static UINT64 mphDictHash(struct mphDict *m, void *key);
+static long mphDictBucket(struct mphDict *m, UINT64 h);
+static long mphDictPos(struct mphDict *m, UINT64 h2, long pilot);
+static int mphDictBuild(struct mphDict *m, struct mphDictSlot *els, UINT64 *raw);
+static int mphDictRawCompare(const void *a, const void *b);
+struct mphDict *mphDictNew(struct Dict *d)
+{
+    if (!d)
+    {
+        printError("mphDictNew d is NULL\n");
+        return NULL;
+    }
+    if (d->size >= INT_MAX / 2)
+    {
+        printError("mphDictNew d is too large\n");
+        return NULL;
+    }
+    struct mphDict *m = calloc(1, sizeof(struct mphDict));
+    struct mphDictSlot *els = malloc(sizeof(struct mphDictSlot) * (d->size + 1));
+    UINT64 *raw = malloc(sizeof(UINT64) * (d->size + 1));
+    UINT64 *sorted = malloc(sizeof(UINT64) * (d->size + 1));
+    if (!m || !els || !raw || !sorted)
+        goto newError;
+    m->size = d->size;
+    m->cap = m->size + m->size / MPH_SLACK + 1;
+    m->buckets = m->size / MPH_LAMBDA + 2;
+    m->keyHash = d->keyHash;
+    m->keyHash64 = d->keyHash64;
+    m->keyCompare = d->keyCompare;
+    m->pilots = calloc(m->buckets, sizeof(UINT16));
+    m->remap = calloc(m->cap - m->size, sizeof(UINT32));
+    m->slots = memCalloc(sizeof(struct mphDictSlot) * (m->size + 1));
+    if (!m->pilots || !m->remap || !m->slots)
+        goto newError;
+
+    // the Dict keeps the raw hash of every entry
+    long n = 0;
+    long i;
+    for (i = 0; d->table && i < d->cap; i++)
+    {
+        struct dictEntry *e = *(d->table + i);
+        for (; e; e = e->next, n++)
+        {
+            els[n].key = e->key;
+            els[n].val = e->val;
+            raw[n] = e->hash;
+        }
+    }
+    // equal raw hashes stay equal under every seed
+    memcpy(sorted, raw, sizeof(UINT64) * n);
+    qsort(sorted, n, sizeof(UINT64), mphDictRawCompare);
+    for (i = 1; i < n; i++)
+    {
+        if (sorted[i] == sorted[i - 1])
+        {
+            printError("mphDictNew keyHash collides\n");
+            goto newError;
+        }
+    }
+
+    int t;
+    for (t = 0; t < MPH_TRIES; t++)
+    {
+        m->seed = hashMix64((UINT64)t + 1);
+        if (mphDictBuild(m, els, raw))
+        {
+            free(els);
+            free(raw);
+            free(sorted);
+            return m;
+        }
+    }
+    printError("mphDictNew no pilot fits\n");
+newError:
+    free(els);
+    free(raw);
+    free(sorted);
+    mphDictFree(m);
+    return NULL;
+}
+void mphDictFree(struct mphDict *m)
+{
+    if (m)
+    {
+        free(m->pilots);
+        free(m->remap);
+        memFree(m->slots);
+        free(m);
+    }
+}
+void *mphDictGet(struct mphDict *m, void *key)
+{
+    if (!m || !key)
+    {
+        printError("mphDictGet m or key is NULL\n");
+        return NULL;
+    }
+    if (!m->size)
+        return NULL;
+    UINT64 h = hashMix64(mphDictHash(m, key) ^ m->seed);
+    long p = mphDictPos(m, hashMix64(h), m->pilots[mphDictBucket(m, h)]);
+    if (p >= m->size)
+        p = m->remap[p - m->size];
+    struct mphDictSlot *s = m->slots + p;
+    // any key maps to some slot, the compare rejects the absent ones
+    return m->keyCompare(key, s->key) ? NULL : s->val;
+}
+long mphDictSize(struct mphDict *m)
+{
+    return m ? m->size : 0;
+}
+static UINT64 mphDictHash(struct mphDict *m, void *key)
+{
+    // the same raw hash as the Dict entry
+    return m->keyHash64 ? m->keyHash64(key) : (UINT64)(UINT32)m->keyHash(key);
+}
+static long mphDictBucket(struct mphDict *m, UINT64 h)
+{
+    // 60% of the keys go to 30% of the buckets, the dense buckets are placed
+    // first while the table is still empty
+    long p1 = m->buckets * 3 / 10 + 1;
+    if (h < 0x999999999999999AUL)
+        return (long)(h % (UINT64)p1);
+    return p1 + (long)(h % (UINT64)(m->buckets - p1));
+}
+static long mphDictPos(struct mphDict *m, UINT64 h2, long pilot)
+{
+    return (long)((h2 ^ hashMix64((UINT64)pilot ^ m->seed)) % (UINT64)m->cap);
+}
+static int mphDictBuild(struct mphDict *m, struct mphDictSlot *els, UINT64 *raw)
+{
+    long n = m->size;
+    UINT64 *h = malloc(sizeof(UINT64) * (n + 1));
+    long *start = calloc(m->buckets + 1, sizeof(long));
+    long *order = malloc(sizeof(long) * (n + 1));
+    long *bySize = malloc(sizeof(long) * m->buckets);
+    long *pos = malloc(sizeof(long) * (n + 1));
+    long *count = NULL;
+    struct bitSet *taken = bitSetNew();
+    // size the bits once, bitSet grows only to the highest index set
+    int ok = h && start && order && bySize && pos && taken && bitSetOn(taken, (int)m->cap - 1) &&
+             bitSetOff(taken, (int)m->cap - 1);
+    long i, j, k, b;
+
+    // the keys of bucket b are order[start[b]] .. order[start[b + 1] - 1]
+    long maxSize = 0;
+    for (i = 0; ok && i < n; i++)
+    {
+        h[i] = hashMix64(raw[i] ^ m->seed);
+        start[mphDictBucket(m, h[i]) + 1]++;
+    }
+    for (b = 0; ok && b < m->buckets; b++)
+    {
+        if (start[b + 1] > maxSize)
+            maxSize = start[b + 1];
+        start[b + 1] += start[b];
+        bySize[b] = start[b];
+    }
+    for (i = 0; ok && i < n; i++)
+    {
+        order[bySize[mphDictBucket(m, h[i])]++] = i;
+        h[i] = hashMix64(h[i]);
+    }
+    // the largest buckets first, a counting sort on the size
+    ok = ok && (count = calloc(maxSize + 2, sizeof(long)));
+    for (b = 0; ok && b < m->buckets; b++)
+        count[start[b + 1] - start[b]]++;
+    for (k = maxSize, j = 0; ok && k >= 0; k--)
+    {
+        long c = count[k];
+        count[k] = j;
+        j += c;
+    }
+    for (b = 0; ok && b < m->buckets; b++)
+        bySize[count[start[b + 1] - start[b]]++] = b;
+
+    for (j = 0; ok && j < m->buckets && start[bySize[j] + 1] > start[bySize[j]]; j++)
+    {
+        b = bySize[j];
+        long pilot;
+        for (pilot = 0; pilot < MPH_PILOTS; pilot++)
+        {
+            for (k = start[b]; k < start[b + 1]; k++)
+            {
+                long p = mphDictPos(m, h[order[k]], pilot);
+                long q = start[b];
+                while (q < k && pos[order[q]] != p)
+                    q++;
+                if (q < k || bitSetGet(taken, (int)p))
+                    break;
+                pos[order[k]] = p;
+            }
+            if (k == start[b + 1])
+                break;
+        }
+        ok = pilot < MPH_PILOTS;
+        m->pilots[b] = (UINT16)pilot;
+        for (k = start[b]; ok && k < start[b + 1]; k++)
+            ok = bitSetOn(taken, (int)pos[order[k]]);
+    }
+
+    // the keys placed at size or past it move to the free slots below size
+    long next = 0;
+    for (i = m->size; ok && i < m->cap; i++)
+    {
+        if (!bitSetGet(taken, (int)i))
+            continue;
+        while (bitSetGet(taken, (int)next))
+            next++;
+        m->remap[i - m->size] = (UINT32)next++;
+    }
+    for (i = 0; ok && i < n; i++)
+        m->slots[pos[i] < m->size ? pos[i] : m->remap[pos[i] - m->size]] = els[i];
+
+    free(h);
+    free(start);
+    free(order);
+    free(bySize);
+    free(pos);
+    free(count);
+    bitSetFree(taken);
+    return ok;
+}
+static int mphDictRawCompare(const void *a, const void *b)
+{
+    UINT64 x = *(const UINT64 *)a;
+    UINT64 y = *(const UINT64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * ------------------------------------------------------ Hash Array Mapped Trie
+ */
+
+#define HAMT_BITS 5
+#define HAMT_MASK 31
+#define HAMT_HASH_BITS 64
+
+static UINT64 hamtHash(struct hamt *h, void *key);
+static struct hamtSlot *hamtFind(struct hamt *h, UINT64 hash, void *key);
+static struct hamtNode *hamtNodeNew(int len, UINT32 bitmap);
+static void hamtNodeRelease(struct hamtNode *n);
+static struct hamtNode *hamtNodeEdit(struct hamtNode *n, int i, int op, struct hamtSlot *s);
+static struct hamtNode *hamtNodePair(int shift, struct hamtSlot *a, struct hamtSlot *b);
+static struct hamtNode *hamtNodePut(struct hamt *h, struct hamtNode *n, int shift,
+                                    struct hamtSlot *s, int *added);
+static int hamtNodeRemove(struct hamt *h, struct hamtNode *n, int shift, UINT64 hash,
+                          void *key, struct hamtNode **out);
+static struct hamt *hamtVersion(struct hamt *h, struct hamtNode *root, long size);
+struct hamt *hamtNew(int (*keyHash)(void *), int (*keyCompare)(void *, void *))
+{
+    if (!keyHash || !keyCompare)
+    {
+        printError("hamtNew keyHash or keyCompare is NULL\n");
+        return NULL;
+    }
+    struct hamt *h = malloc(sizeof(struct hamt));
+    if (!h)
+    {
+        printError("hamtNew error\n");
+        return NULL;
+    }
+    h->root = NULL;
+    h->size = 0;
+    h->refs = 1;
+    h->keyHash = keyHash;
+    h->keyCompare = keyCompare;
+    return h;
+}
+struct hamt *hamtRetain(struct hamt *h)
+{
+    if (h)
+        ATOMIC_ADD(&h->refs, 1);
+    return h;
+}
+void hamtFree(struct hamt *h)
+{
+    if (h && ATOMIC_ADD(&h->refs, -1) == 0)
+    {
+        hamtNodeRelease(h->root);
+        free(h);
+    }
+}
+struct hamt *hamtPut(struct hamt *h, void *key, void *val)
+{
+    if (!h || !key)
+    {
+        printError("hamtPut h or key is NULL\n");
+        return NULL;
+    }
+    struct hamtSlot s;
+    s.hash = hamtHash(h, key);
+    s.key = key;
+    s.val = val;
+    int added = 0;
+    struct hamtNode *root;
+    if (h->root)
+        root = hamtNodePut(h, h->root, 0, &s, &added);
+    else
+    {
+        root = hamtNodeNew(1, 1U << (s.hash & HAMT_MASK));
+        if (root)
+            root->slots[0] = s;
+        added = 1;
+    }
+    if (!root)
+        return NULL;
+    return hamtVersion(h, root, h->size + added);
+}
+struct hamt *hamtRemove(struct hamt *h, void *key)
+{
+    if (!h || !key)
+    {
+        printError("hamtRemove h or key is NULL\n");
+        return NULL;
+    }
+    UINT64 hash = hamtHash(h, key);
+    if (!hamtFind(h, hash, key))
+    {
+        if (h->root)
+            ATOMIC_ADD(&h->root->refs, 1);
+        return hamtVersion(h, h->root, h->size);
+    }
+    struct hamtNode *root;
+    if (!hamtNodeRemove(h, h->root, 0, hash, key, &root))
+        return NULL;
+    return hamtVersion(h, root, h->size - 1);
+}
+void *hamtGet(struct hamt *h, void *key)
+{
+    if (!h || !key)
+    {
+        printError("hamtGet h or key is NULL\n");
+        return NULL;
+    }
+    struct hamtSlot *s = hamtFind(h, hamtHash(h, key), key);
+    return s ? s->val : NULL;
+}
+int hamtContainsKey(struct hamt *h, void *key)
+{
+    if (!h || !key)
+    {
+        printError("hamtContainsKey h or key is NULL\n");
+        return 0;
+    }
+    return hamtFind(h, hamtHash(h, key), key) != NULL;
+}
+long hamtSize(struct hamt *h)
+{
+    return h ? h->size : 0;
+}
+static UINT64 hamtHash(struct hamt *h, void *key)
+{
+    return hashMix64((UINT64)(unsigned int)(*h->keyHash)(key));
+}
+static struct hamtSlot *hamtFind(struct hamt *h, UINT64 hash, void *key)
+{
+    struct hamtNode *n = h->root;
+    int shift = 0;
+    while (n)
+    {
+        int i;
+        if (shift >= HAMT_HASH_BITS)
+        {
+            for (i = 0; i < n->len; i++)
+            {
+                if ((*h->keyCompare)(n->slots[i].key, key) == 0)
+                    return n->slots + i;
+            }
+            return NULL;
+        }
+        UINT32 bit = 1U << ((hash >> shift) & HAMT_MASK);
+        if (!(n->bitmap & bit))
+            return NULL;
+        struct hamtSlot *s = n->slots + __builtin_popcount(n->bitmap & (bit - 1));
+        if (s->key)
+            return s->hash == hash && (*h->keyCompare)(s->key, key) == 0 ? s : NULL;
+        n = (struct hamtNode *)s->val;
+        shift += HAMT_BITS;
+    }
+    return NULL;
+}
+static struct hamtNode *hamtNodeNew(int len, UINT32 bitmap)
+{
+    // the slots follow the node in the same allocation
+    struct hamtNode *n = malloc(sizeof(struct hamtNode) + sizeof(struct hamtSlot) * len);
+    if (!n)
+    {
+        printError("hamtNode error\n");
+        return NULL;
+    }
+    n->bitmap = bitmap;
+    n->len = len;
+    n->refs = 1;
+    n->slots = (struct hamtSlot *)(n + 1);
+    return n;
+}
+static void hamtNodeRelease(struct hamtNode *n)
+{
+    if (n && ATOMIC_ADD(&n->refs, -1) == 0)
+    {
+        int i;
+        for (i = 0; i < n->len; i++)
+        {
+            if (!n->slots[i].key)
+                hamtNodeRelease((struct hamtNode *)n->slots[i].val);
+        }
+        free(n);
+    }
+}
+static struct hamtNode *hamtNodeEdit(struct hamtNode *n, int i, int op, struct hamtSlot *s)
+{
+    // copies n with slot i replaced by *s (op 0), *s inserted before slot i
+    // (op 1) or slot i dropped (op -1), the copy shares the children of n and
+    // takes the reference held by *s, the caller fixes the bitmap
+    struct hamtNode *c = hamtNodeNew(n->len + op, n->bitmap);
+    if (!c)
+    {
+        if (s && !s->key)
+            hamtNodeRelease((struct hamtNode *)s->val);
+        return NULL;
+    }
+    int skip = op == 1 ? 0 : 1;
+    memcpy(c->slots, n->slots, sizeof(struct hamtSlot) * i);
+    memcpy(c->slots + i + (op >= 0), n->slots + i + skip,
+           sizeof(struct hamtSlot) * (n->len - i - skip));
+    if (op >= 0)
+        c->slots[i] = *s;
+    int j;
+    for (j = 0; j < c->len; j++)
+    {
+        if (!c->slots[j].key && (op < 0 || j != i))
+            ATOMIC_ADD(&((struct hamtNode *)c->slots[j].val)->refs, 1);
+    }
+    return c;
+}
+static struct hamtNode *hamtNodePair(int shift, struct hamtSlot *a, struct hamtSlot *b)
+{
+    // a node below shift holding two leaves, nested while their hash bits agree
+    struct hamtNode *n;
+    if (shift >= HAMT_HASH_BITS)
+    {
+        n = hamtNodeNew(2, 0);
+        if (!n)
+            return NULL;
+        n->slots[0] = *a;
+        n->slots[1] = *b;
+        return n;
+    }
+    int ia = (int)((a->hash >> shift) & HAMT_MASK);
+    int ib = (int)((b->hash >> shift) & HAMT_MASK);
+    if (ia == ib)
+    {
+        struct hamtNode *child = hamtNodePair(shift + HAMT_BITS, a, b);
+        if (!child)
+            return NULL;
+        n = hamtNodeNew(1, 1U << ia);
+        if (!n)
+        {
+            hamtNodeRelease(child);
+            return NULL;
+        }
+        n->slots[0].hash = 0;
+        n->slots[0].key = NULL;
+        n->slots[0].val = child;
+        return n;
+    }
+    n = hamtNodeNew(2, (1U << ia) | (1U << ib));
+    if (!n)
+        return NULL;
+    n->slots[ia > ib] = *a;
+    n->slots[ia < ib] = *b;
+    return n;
+}
+static struct hamtNode *hamtNodePut(struct hamt *h, struct hamtNode *n, int shift,
+                                    struct hamtSlot *s, int *added)
+{
+    // returns a new reference, n itself is left untouched
+    int i;
+    if (shift >= HAMT_HASH_BITS)
+    {
+        for (i = 0; i < n->len; i++)
+        {
+            if ((*h->keyCompare)(n->slots[i].key, s->key) == 0)
+                return hamtNodeEdit(n, i, 0, s);
+        }
+        *added = 1;
+        return hamtNodeEdit(n, n->len, 1, s);
+    }
+    UINT32 bit = 1U << ((s->hash >> shift) & HAMT_MASK);
+    i = __builtin_popcount(n->bitmap & (bit - 1));
+    struct hamtNode *c;
+    if (!(n->bitmap & bit))
+    {
+        *added = 1;
+        c = hamtNodeEdit(n, i, 1, s);
+        if (c)
+            c->bitmap |= bit;
+        return c;
+    }
+    struct hamtSlot *old = n->slots + i;
+    struct hamtSlot child;
+    child.hash = 0;
+    child.key = NULL;
+    if (!old->key)
+        child.val = hamtNodePut(h, (struct hamtNode *)old->val, shift + HAMT_BITS, s, added);
+    else if (old->hash == s->hash && (*h->keyCompare)(old->key, s->key) == 0)
+        return hamtNodeEdit(n, i, 0, s);
+    else
+    {
+        // two leaves on one slot move down into a new node
+        *added = 1;
+        child.val = hamtNodePair(shift + HAMT_BITS, old, s);
+    }
+    if (!child.val)
+        return NULL;
+    return hamtNodeEdit(n, i, 0, &child);
+}
+static int hamtNodeRemove(struct hamt *h, struct hamtNode *n, int shift, UINT64 hash,
+                          void *key, struct hamtNode **out)
+{
+    // key is in the subtree, *out is NULL when the subtree empties
+    int i;
+    if (shift >= HAMT_HASH_BITS)
+    {
+        for (i = 0; (*h->keyCompare)(n->slots[i].key, key) != 0; i++)
+            ;
+        *out = n->len == 1 ? NULL : hamtNodeEdit(n, i, -1, NULL);
+        return n->len == 1 || *out;
+    }
+    UINT32 bit = 1U << ((hash >> shift) & HAMT_MASK);
+    i = __builtin_popcount(n->bitmap & (bit - 1));
+    struct hamtSlot *s = n->slots + i;
+    struct hamtNode *c = NULL;
+    if (!s->key && !hamtNodeRemove(h, (struct hamtNode *)s->val, shift + HAMT_BITS, hash, key, &c))
+        return 0;
+    if (c && c->len == 1 && c->slots[0].key)
+    {
+        // a child left with a single leaf folds back into this node
+        struct hamtSlot leaf = c->slots[0];
+        hamtNodeRelease(c);
+        *out = hamtNodeEdit(n, i, 0, &leaf);
+        return *out != NULL;
+    }
+    if (c)
+    {
+        struct hamtSlot child;
+        child.hash = 0;
+        child.key = NULL;
+        child.val = c;
+        *out = hamtNodeEdit(n, i, 0, &child);
+        return *out != NULL;
+    }
+    if (n->len == 1)
+    {
+        *out = NULL;
+        return 1;
+    }
+    *out = hamtNodeEdit(n, i, -1, NULL);
+    if (!*out)
+        return 0;
+    (*out)->bitmap &= ~bit;
+    return 1;
+}
+static struct hamt *hamtVersion(struct hamt *h, struct hamtNode *root, long size)
+{
+    struct hamt *v = malloc(sizeof(struct hamt));
+    if (!v)
+    {
+        printError("hamt version error\n");
+        hamtNodeRelease(root);
+        return NULL;
+    }
+    v->root = root;
+    v->size = size;
+    v->refs = 1;
+    v->keyHash = h->keyHash;
+    v->keyCompare = h->keyCompare;
+    return v;
+}
+
+/*
+ * ----------------------------------------------------------------------- Cache
+ */
+
+static int cacheValCompare(void *val1, void *val2);
+static void lruCacheEvict(struct lruCache *c);
+static struct clockCacheSlot *clockCacheVictim(struct clockCache *c);
+struct lruCache *lruCacheNew(int cap, int (*keyHash)(void *), int (*keyCompare)(void *, void *),
+                             void (*evict)(void *, void *, void *), void *arg)
+{
+    if (cap <= 0)
+    {
+        printError("lruCacheNew cap is error\n");
+        return NULL;
+    }
+    struct lruCache *c = malloc(sizeof(struct lruCache));
+    if (!c)
+    {
+        printError("lruCacheNew error\n");
+        return NULL;
+    }
+    c->dict = dictNew(keyHash, keyCompare, cacheValCompare);
+    if (!c->dict)
+    {
+        free(c);
+        return NULL;
+    }
+    iListInit(&c->list);
+    c->cap = cap;
+    c->evict = evict;
+    c->arg = arg;
+    return c;
+}
+void lruCacheFree(struct lruCache *c)
+{
+    // the evict callback is not called for the entries left
+    if (c)
+    {
+        struct iListLink *n = c->list.head;
+        while (n)
+        {
+            struct iListLink *next = n->next;
+            free(containerOf(n, struct lruCacheEntry, link));
+            n = next;
+        }
+        dictFree(c->dict);
+        free(c);
+    }
+}
+int lruCachePut(struct lruCache *c, void *key, void *val)
+{
+    if (!c)
+    {
+        printError("lruCachePut c is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("lruCachePut key is NULL\n");
+        return 0;
+    }
+    UINT64 h = dictHash(c->dict, key);
+    struct dictEntry *de = dictGetEntry(c->dict, h, key);
+    if (de)
+    {
+        struct lruCacheEntry *e = (struct lruCacheEntry *)de->val;
+        e->val = val;
+        iListRemove(&c->list, &e->link);
+        iListAddHead(&c->list, &e->link);
+        return 1;
+    }
+
+    if (c->list.size == c->cap)
+        lruCacheEvict(c);
+    struct lruCacheEntry *e = malloc(sizeof(struct lruCacheEntry));
+    if (!e)
+    {
+        printError("lruCachePut error\n");
+        return 0;
+    }
+    e->key = key;
+    e->val = val;
+    if (!dictPutHash(c->dict, h, key, e))
+    {
+        free(e);
+        return 0;
+    }
+    iListAddHead(&c->list, &e->link);
+    return 1;
+}
+void *lruCacheGet(struct lruCache *c, void *key)
+{
+    if (!c)
+    {
+        printError("lruCacheGet c is NULL\n");
+        return NULL;
+    }
+    if (!key)
+    {
+        printError("lruCacheGet key is NULL\n");
+        return NULL;
+    }
+    struct dictEntry *de = dictGetEntry(c->dict, dictHash(c->dict, key), key);
+    if (!de)
+        return NULL;
+    struct lruCacheEntry *e = (struct lruCacheEntry *)de->val;
+    if (c->list.head != &e->link)
+    {
+        iListRemove(&c->list, &e->link);
+        iListAddHead(&c->list, &e->link);
+    }
+    return e->val;
+}
+int lruCacheRemove(struct lruCache *c, void *key)
+{
+    if (!c)
+    {
+        printError("lruCacheRemove c is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("lruCacheRemove key is NULL\n");
+        return 0;
+    }
+    UINT64 h = dictHash(c->dict, key);
+    struct dictEntry *de = dictGetEntry(c->dict, h, key);
+    if (!de)
+        return 0;
+    struct lruCacheEntry *e = (struct lruCacheEntry *)de->val;
+    dictRemoveHash(c->dict, h, key);
+    iListRemove(&c->list, &e->link);
+    free(e);
+    return 1;
+}
+int lruCacheSize(struct lruCache *c)
+{
+    return c ? c->list.size : 0;
+}
+static int cacheValCompare(void *val1, void *val2)
+{
+    return val1 != val2;
+}
+static void lruCacheEvict(struct lruCache *c)
+{
+    struct lruCacheEntry *e = containerOf(c->list.tail, struct lruCacheEntry, link);
+    iListRemove(&c->list, &e->link);
+    dictRemove(c->dict, e->key);
+    if (c->evict)
+        c->evict(e->key, e->val, c->arg);
+    free(e);
+}
+struct clockCache *clockCacheNew(int cap, int (*keyHash)(void *), int (*keyCompare)(void *, void *),
+                                 void (*evict)(void *, void *, void *), void *arg)
+{
+    if (cap <= 0)
+    {
+        printError("clockCacheNew cap is error\n");
+        return NULL;
+    }
+    struct clockCache *c = malloc(sizeof(struct clockCache));
+    if (!c)
+    {
+        printError("clockCacheNew error\n");
+        return NULL;
+    }
+    c->dict = dictNew(keyHash, keyCompare, cacheValCompare);
+    c->slots = calloc(cap, sizeof(struct clockCacheSlot));
+    c->free = stackNew();
+    if (!c->dict || !c->slots || !c->free)
+    {
+        printError("clockCacheNew error\n");
+        dictFree(c->dict);
+        if (c->slots)
+            free(c->slots);
+        stackFree(c->free);
+        free(c);
+        return NULL;
+    }
+    iListInit(&c->cold);
+    c->cap = cap;
+    c->coldCap = cap / 4 > 0 ? cap / 4 : 1;
+    c->used = 0;
+    c->hand = 0;
+    c->evict = evict;
+    c->arg = arg;
+    return c;
+}
+void clockCacheFree(struct clockCache *c)
+{
+    if (c)
+    {
+        dictFree(c->dict);
+        free(c->slots);
+        stackFree(c->free);
+        free(c);
+    }
+}
+int clockCachePut(struct clockCache *c, void *key, void *val)
+{
+    if (!c)
+    {
+        printError("clockCachePut c is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("clockCachePut key is NULL\n");
+        return 0;
+    }
+    UINT64 h = dictHash(c->dict, key);
+    struct dictEntry *de = dictGetEntry(c->dict, h, key);
+    if (de)
+    {
+        struct clockCacheSlot *slot = (struct clockCacheSlot *)de->val;
+        slot->val = val;
+        slot->ref = 1;
+        return 1;
+    }
+
+    // a free slot first, otherwise the hand picks a victim
+    struct clockCacheSlot *slot;
+    if (stackSize(c->free))
+        slot = (struct clockCacheSlot *)stackPop(c->free);
+    else if (c->used < c->cap)
+        slot = c->slots + c->used++;
+    else
+        slot = clockCacheVictim(c);
+    if (!dictPutHash(c->dict, h, key, slot))
+    {
+        // a victim comes back hot, the hand must see a free slot as cold
+        slot->key = slot->val = NULL;
+        slot->ref = slot->hot = 0;
+        stackPush(c->free, slot);
+        return 0;
+    }
+    slot->key = key;
+    slot->val = val;
+    slot->ref = 0;
+    slot->hot = 0;
+    iListAddTail(&c->cold, &slot->link);
+    return 1;
+}
+void *clockCacheGet(struct clockCache *c, void *key)
+{
+    if (!c)
+    {
+        printError("clockCacheGet c is NULL\n");
+        return NULL;
+    }
+    if (!key)
+    {
+        printError("clockCacheGet key is NULL\n");
+        return NULL;
+    }
+    struct dictEntry *de = dictGetEntry(c->dict, dictHash(c->dict, key), key);
+    if (!de)
+        return NULL;
+    struct clockCacheSlot *slot = (struct clockCacheSlot *)de->val;
+    slot->ref = 1;
+    return slot->val;
+}
+int clockCacheRemove(struct clockCache *c, void *key)
+{
+    if (!c)
+    {
+        printError("clockCacheRemove c is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("clockCacheRemove key is NULL\n");
+        return 0;
+    }
+    UINT64 h = dictHash(c->dict, key);
+    struct dictEntry *de = dictGetEntry(c->dict, h, key);
+    if (!de)
+        return 0;
+    struct clockCacheSlot *slot = (struct clockCacheSlot *)de->val;
+    dictRemoveHash(c->dict, h, key);
+    if (!slot->hot)
+        iListRemove(&c->cold, &slot->link);
+    slot->key = slot->val = NULL;
+    slot->ref = slot->hot = 0;
+    stackPush(c->free, slot);
+    return 1;
+}
+int clockCacheSize(struct clockCache *c)
+{
+    return c ? (int)dictSize(c->dict) : 0;
+}
+static struct clockCacheSlot *clockCacheVictim(struct clockCache *c)
+{
+    // every slot is in use here
+    struct clockCacheSlot *slot;
+    for (;;)
+    {
+        if (c->cold.size && c->cold.size >= c->coldCap)
+        {
+            // the FIFO head is promoted when it was hit, otherwise evicted
+            slot = containerOf(c->cold.head, struct clockCacheSlot, link);
+            iListRemove(&c->cold, &slot->link);
+            if (!slot->ref)
+                break;
+            slot->ref = 0;
+            slot->hot = 1;
+            continue;
+        }
+        // the hand skips cold slots, a referenced hot slot gets a second chance
+        slot = c->slots + c->hand;
+        c->hand = c->hand + 1 == c->cap ? 0 : c->hand + 1;
+        if (!slot->hot)
+            continue;
+        if (!slot->ref)
+            break;
+        slot->ref = 0;
+    }
+    dictRemove(c->dict, slot->key);
+    if (c->evict)
+        c->evict(slot->key, slot->val, c->arg);
+    return slot;
+}
+
+/*
+ * ----------------------------------------------------------------- String Dict
+ */
+
+static UINT64 strDictHash(const char *key, long len);
+static long strDictFind(struct strDict *d, const char *key, long len, UINT64 h);
+static char *strDictSlotKey(struct strDictSlot *s);
+static int strDictResize(struct strDict *d);
+static char *strArenaAlloc(struct strDict *d, long len);
+struct strDict *strDictNew(int intern)
+{
+    struct strDict *d = malloc(sizeof(struct strDict));
+    if (d)
+    {
+        d->table = NULL;
+        // factor = 0.75 = 3:4 = 6:8
+        d->threshold = 6;
+        d->cap = 8;
+        d->size = 0;
+        d->intern = intern;
+        d->arena = NULL;
+        return d;
+    }
+    printError("strDictNew error\n");
+    return NULL;
+}
+void strDictFree(struct strDict *d)
+{
+    if (d)
+    {
+        if (d->table)
+        {
+            long i;
+            if (!d->intern)
+                for (i = 0; i < d->cap; i++)
+                    if ((d->table + i)->hash && (d->table + i)->len > STR_DICT_INLINE)
+                        free((d->table + i)->key.ptr);
+            free(d->table);
+        }
+        struct strArenaBlock *b = d->arena;
+        while (b)
+        {
+            struct strArenaBlock *n = b->next;
+            free(b);
+            b = n;
+        }
+        free(d);
+    }
+}
+int strDictPut(struct strDict *d, const char *key, void *val)
+{
+    if (!d)
+    {
+        printError("strDictPut d is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("strDictPut key is NULL\n");
+        return 0;
+    }
+    if (!d->table)
+    {
+        d->table = calloc(d->cap, sizeof(struct strDictSlot));
+        if (!d->table)
+        {
+            printError("strDictPut init table error\n");
+            return 0;
+        }
+    }
+
+    long len = strlen(key);
+    UINT64 h = strDictHash(key, len);
+    long i = strDictFind(d, key, len, h);
+    if (i >= 0)
+    {
+        (d->table + i)->val = val;
+        return 1;
+    }
+
+    if (d->size == d->threshold && !strDictResize(d))
+    {
+        printError("strDictPut resize error\n");
+        return 0;
+    }
+
+    char *copy = NULL;
+    if (len > STR_DICT_INLINE)
+    {
+        copy = d->intern ? strArenaAlloc(d, len + 1) : malloc(len + 1);
+        if (!copy)
+        {
+            printError("strDictPut key copy error\n");
+            return 0;
+        }
+        memcpy(copy, key, len + 1);
+    }
+
+    i = (long)(h & (UINT64)(d->cap - 1));
+    while ((d->table + i)->hash)
+        i = (i + 1) & (d->cap - 1);
+    struct strDictSlot *slot = d->table + i;
+    slot->hash = h;
+    slot->len = (UINT32)len;
+    memset(slot->prefix, 0, sizeof(slot->prefix));
+    memcpy(slot->prefix, key, len < 4 ? len : 4);
+    if (copy)
+        slot->key.ptr = copy;
+    else
+        memcpy(slot->key.inl, key, len + 1);
+    slot->val = val;
+
+    d->size++;
+    return 1;
+}
+int strDictRemove(struct strDict *d, const char *key)
+{
+    if (!d)
+    {
+        printError("strDictRemove d is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("strDictRemove key is NULL\n");
+        return 0;
+    }
+    if (d->size == 0)
+        return 0;
+
+    long len = strlen(key);
+    long i = strDictFind(d, key, len, strDictHash(key, len));
+    if (i < 0)
+        return 0;
+    if (!d->intern && (d->table + i)->len > STR_DICT_INLINE)
+        free((d->table + i)->key.ptr);
+
+    // backward shift deletion, no tombstone
+    long mask = d->cap - 1;
+    long j = i;
+    for (;;)
+    {
+        j = (j + 1) & mask;
+        struct strDictSlot *s = d->table + j;
+        if (!s->hash)
+            break;
+        long k = (long)(s->hash & (UINT64)mask);
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j))
+        {
+            *(d->table + i) = *s;
+            i = j;
+        }
+    }
+    (d->table + i)->hash = 0;
+
+    d->size--;
+    return 1;
+}
+void *strDictGet(struct strDict *d, const char *key)
+{
+    if (!d)
+    {
+        printError("strDictGet d is NULL\n");
+        return NULL;
+    }
+    if (!key)
+    {
+        printError("strDictGet key is NULL\n");
+        return NULL;
+    }
+    if (d->size == 0)
+        return NULL;
+    long len = strlen(key);
+    long i = strDictFind(d, key, len, strDictHash(key, len));
+    return i >= 0 ? (d->table + i)->val : NULL;
+}
+int strDictContainsKey(struct strDict *d, const char *key)
+{
+    if (!d)
+    {
+        printError("strDictContainsKey d is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("strDictContainsKey key is NULL\n");
+        return 0;
+    }
+    if (d->size == 0)
+        return 0;
+    long len = strlen(key);
+    return strDictFind(d, key, len, strDictHash(key, len)) >= 0;
+}
+long strDictSize(struct strDict *d)
+{
+    return d ? d->size : 0;
+}
+static UINT64 strDictHash(const char *key, long len)
+{
+    // 0 marks an empty slot
+    UINT64 h = hashBytes(key, len, 0);
+    return h ? h : 1;
+}
+static long strDictFind(struct strDict *d, const char *key, long len, UINT64 h)
+{
+    char prefix[4] = {0, 0, 0, 0};
+    memcpy(prefix, key, len < 4 ? len : 4);
+
+    long mask = d->cap - 1;
+    long i = (long)(h & (UINT64)mask);
+    for (;;)
+    {
+        struct strDictSlot *s = d->table + i;
+        if (!s->hash)
+            return -1;
+        // hash, length and prefix live in the slot, memcmp only on a likely hit
+        if (s->hash == h && s->len == len && !memcmp(s->prefix, prefix, 4) &&
+            (len <= 4 || !memcmp(strDictSlotKey(s) + 4, key + 4, len - 4)))
+            return i;
+        i = (i + 1) & mask;
+    }
+}
+static char *strDictSlotKey(struct strDictSlot *s)
+{
+    return s->len > STR_DICT_INLINE ? s->key.ptr : s->key.inl;
+}
+static int strDictResize(struct strDict *d)
+{
+    if (d->cap >= DICT_MAX_CAP)
+        return 0;
+    long newCap = d->cap << 1;
+    struct strDictSlot *newTable = calloc(newCap, sizeof(struct strDictSlot));
+    if (!newTable)
+        return 0;
+    long i;
+    for (i = 0; i < d->cap; i++)
+    {
+        struct strDictSlot *s = d->table + i;
+        if (s->hash)
+        {
+            long j = (long)(s->hash & (UINT64)(newCap - 1));
+            while ((newTable + j)->hash)
+                j = (j + 1) & (newCap - 1);
+            *(newTable + j) = *s;
+        }
+    }
+    free(d->table);
+    d->table = newTable;
+    d->cap = newCap;
+    d->threshold = d->threshold << 1;
+    return 1;
+}
+static char *strArenaAlloc(struct strDict *d, long len)
+{
+    struct strArenaBlock *b = d->arena;
+    if (!b || b->used + len > b->cap)
+    {
+        long cap = len > STR_ARENA_BLOCK ? len : STR_ARENA_BLOCK;
+        b = malloc(sizeof(struct strArenaBlock) + cap);
+        if (!b)
+            return NULL;
+        b->next = d->arena;
+        b->used = 0;
+        b->cap = cap;
+        d->arena = b;
+    }
+    char *p = (char *)(b + 1) + b->used;
+    b->used += len;
+    return p;
+}
+
+/*
+ * ---------------------------------------------------------------- Sharded Dict
+ */
+
+static struct shardedDictShard *shardedDictShardOf(struct shardedDict *sd, UINT64 h);
+struct shardedDict *shardedDictNew(int shards, int (*keyHash)(void *),
+                                   int (*keyCompare)(void *, void *),
+                                   int (*valCompare)(void *, void *))
+{
+    if (!keyHash || !keyCompare || !valCompare)
+    {
+        printError("shardedDictNew callback is NULL\n");
+        return NULL;
+    }
+    if (shards <= 0)
+        shards = SD_SHARDS;
+
+    // round up to a power of two, shard index = top bits of the hash
+    int n = 1;
+    int bits = 0;
+    while (n < shards && n < (1 << 16))
+    {
+        n <<= 1;
+        bits++;
+    }
+
+    struct shardedDict *sd = malloc(sizeof(struct shardedDict));
+    if (!sd)
+    {
+        printError("shardedDictNew error\n");
+        return NULL;
+    }
+    sd->shards = calloc(n, sizeof(struct shardedDictShard));
+    if (!sd->shards)
+    {
+        printError("shardedDictNew error\n");
+        free(sd);
+        return NULL;
+    }
+    sd->n = n;
+    sd->shift = 64 - bits;
+
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        struct shardedDictShard *s = sd->shards + i;
+        s->dict = dictNew(keyHash, keyCompare, valCompare);
+        if (!s->dict || pthread_rwlock_init(&s->lock, NULL))
+        {
+            printError("shardedDictNew shard error\n");
+            if (s->dict)
+                dictFree(s->dict);
+            sd->n = i;
+            shardedDictFree(sd);
+            return NULL;
+        }
+    }
+    return sd;
+}
+void shardedDictFree(struct shardedDict *sd)
+{
+    if (sd)
+    {
+        int i;
+        for (i = 0; i < sd->n; i++)
+        {
+            pthread_rwlock_destroy(&(sd->shards + i)->lock);
+            dictFree((sd->shards + i)->dict);
+        }
+        free(sd->shards);
+        free(sd);
+    }
+}
+int shardedDictPut(struct shardedDict *sd, void *key, void *val)
+{
+    if (!sd)
+    {
+        printError("shardedDictPut sd is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("shardedDictPut key is NULL\n");
+        return 0;
+    }
+    UINT64 h = dictHash(sd->shards->dict, key);
+    struct shardedDictShard *s = shardedDictShardOf(sd, h);
+    pthread_rwlock_wrlock(&s->lock);
+    int r = dictPutHash(s->dict, h, key, val);
+    pthread_rwlock_unlock(&s->lock);
+    return r;
+}
+int shardedDictRemove(struct shardedDict *sd, void *key)
+{
+    if (!sd)
+    {
+        printError("shardedDictRemove sd is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("shardedDictRemove key is NULL\n");
+        return 0;
+    }
+    UINT64 h = dictHash(sd->shards->dict, key);
+    struct shardedDictShard *s = shardedDictShardOf(sd, h);
+    pthread_rwlock_wrlock(&s->lock);
+    int r = dictRemoveHash(s->dict, h, key);
+    pthread_rwlock_unlock(&s->lock);
+    return r;
+}
+void *shardedDictGet(struct shardedDict *sd, void *key)
+{
+    if (!sd)
+    {
+        printError("shardedDictGet sd is NULL\n");
+        return NULL;
+    }
+    if (!key)
+    {
+        printError("shardedDictGet key is NULL\n");
+        return NULL;
+    }
+    UINT64 h = dictHash(sd->shards->dict, key);
+    struct shardedDictShard *s = shardedDictShardOf(sd, h);
+    pthread_rwlock_rdlock(&s->lock);
+    struct dictEntry *entry = dictGetEntry(s->dict, h, key);
+    void *val = entry ? entry->val : NULL;
+    pthread_rwlock_unlock(&s->lock);
+    return val;
+}
+int shardedDictContainsKey(struct shardedDict *sd, void *key)
+{
+    if (!sd)
+    {
+        printError("shardedDictContainsKey sd is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("shardedDictContainsKey key is NULL\n");
+        return 0;
+    }
+    UINT64 h = dictHash(sd->shards->dict, key);
+    struct shardedDictShard *s = shardedDictShardOf(sd, h);
+    pthread_rwlock_rdlock(&s->lock);
+    int r = dictGetEntry(s->dict, h, key) ? 1 : 0;
+    pthread_rwlock_unlock(&s->lock);
+    return r;
+}
+int shardedDictContainsValue(struct shardedDict *sd, void *val)
+{
+    if (!sd)
+    {
+        printError("shardedDictContainsValue sd is NULL\n");
+        return 0;
+    }
+    int i;
+    for (i = 0; i < sd->n; i++)
+    {
+        struct shardedDictShard *s = sd->shards + i;
+        pthread_rwlock_rdlock(&s->lock);
+        int r = dictContainsValue(s->dict, val);
+        pthread_rwlock_unlock(&s->lock);
+        if (r)
+            return 1;
+    }
+    return 0;
+}
+long shardedDictSize(struct shardedDict *sd)
+{
+    if (!sd)
+        return 0;
+    // not a snapshot, every shard is locked one by one
+    long size = 0;
+    int i;
+    for (i = 0; i < sd->n; i++)
+    {
+        struct shardedDictShard *s = sd->shards + i;
+        pthread_rwlock_rdlock(&s->lock);
+        size += dictSize(s->dict);
+        pthread_rwlock_unlock(&s->lock);
+    }
+    return size;
+}
+static struct shardedDictShard *shardedDictShardOf(struct shardedDict *sd, UINT64 h)
+{
+    if (sd->n == 1)
+        return sd->shards;
+    // top bits of the mixed hash, the bucket index uses the low bits
+    return sd->shards + (hash2(h) >> sd->shift);
+}
+
+/*
+ * ----------------------------------------------------------------------- Epoch
+ */
+
+static struct epochThread *epochThreadAcquire(struct epochDomain *e);
+static void epochThreadRelease(void *t);
+static void epochCollect(struct epochDomain *e, struct epochThread *t);
+int epochDomainInit(struct epochDomain *e,
+                    void (*reclaim)(struct epochEntry *, void *), void *arg)
+{
+    if (!e || !reclaim)
+    {
+        printError("epochDomainInit e or reclaim is NULL\n");
+        return 0;
+    }
+    e->epoch = 0;
+    e->threads = NULL;
+    e->reclaim = reclaim;
+    e->arg = arg;
+    if (pthread_key_create(&e->key, epochThreadRelease))
+    {
+        printError("epochDomainInit key error\n");
+        return 0;
+    }
+    return 1;
+}
+void epochDomainDestroy(struct epochDomain *e)
+{
+    // no thread may be inside the domain any more
+    if (!e)
+        return;
+    pthread_key_delete(e->key);
+    struct epochThread *t = e->threads;
+    while (t)
+    {
+        struct epochThread *n = t->next;
+        struct epochEntry *c = t->retired;
+        while (c)
+        {
+            struct epochEntry *cn = c->next;
+            e->reclaim(c, e->arg);
+            c = cn;
+        }
+        free(t);
+        t = n;
+    }
+    e->threads = NULL;
+}
+struct epochThread *epochEnter(struct epochDomain *e)
+{
+    struct epochThread *t = pthread_getspecific(e->key);
+    if (!t)
+    {
+        t = epochThreadAcquire(e);
+        if (!t)
+            return NULL;
+        pthread_setspecific(e->key, t);
+    }
+    if (t->depth++ == 0)
+    {
+        __atomic_store_n(&t->epoch, __atomic_load_n(&e->epoch, __ATOMIC_SEQ_CST),
+                         __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    return t;
+}
+void epochExit(struct epochThread *t)
+{
+    if (t && --t->depth == 0)
+        __atomic_store_n(&t->epoch, (UINT64)-1, __ATOMIC_RELEASE);
+}
+void epochRetire(struct epochDomain *e, struct epochThread *t, struct epochEntry *entry)
+{
+    entry->epoch = __atomic_load_n(&e->epoch, __ATOMIC_SEQ_CST);
+    entry->next = t->retired;
+    t->retired = entry;
+    if (++t->retiredSize >= EPOCH_RETIRE_THRESHOLD)
+        epochCollect(e, t);
+}
+static struct epochThread *epochThreadAcquire(struct epochDomain *e)
+{
+    struct epochThread *t = ATOMIC_LOAD(&e->threads);
+    for (; t; t = t->next)
+    {
+        int unused = 0;
+        if (!ATOMIC_LOAD(&t->inUse) && ATOMIC_CAS(&t->inUse, &unused, 1))
+            return t;
+    }
+
+    t = calloc(1, sizeof(struct epochThread));
+    if (!t)
+    {
+        printError("epochThreadAcquire error\n");
+        return NULL;
+    }
+    t->epoch = (UINT64)-1;
+    t->inUse = 1;
+    t->next = ATOMIC_LOAD(&e->threads);
+    while (!ATOMIC_CAS(&e->threads, &t->next, t))
+        ;
+    return t;
+}
+static void epochThreadRelease(void *p)
+{
+    // thread exit, the retired entries are left to the next owner
+    struct epochThread *t = (struct epochThread *)p;
+    t->depth = 0;
+    __atomic_store_n(&t->epoch, (UINT64)-1, __ATOMIC_RELEASE);
+    ATOMIC_STORE(&t->inUse, 0);
+}
+static void epochCollect(struct epochDomain *e, struct epochThread *t)
+{
+    // advance when every active thread has seen the global epoch
+    UINT64 g = __atomic_load_n(&e->epoch, __ATOMIC_SEQ_CST);
+    struct epochThread *x = ATOMIC_LOAD(&e->threads);
+    for (; x; x = x->next)
+    {
+        UINT64 xe = __atomic_load_n(&x->epoch, __ATOMIC_SEQ_CST);
+        if (xe != (UINT64)-1 && xe != g)
+            break;
+    }
+    if (!x)
+    {
+        UINT64 expected = g;
+        __atomic_compare_exchange_n(&e->epoch, &expected, g + 1, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+    g = __atomic_load_n(&e->epoch, __ATOMIC_SEQ_CST);
+
+    // retired list is newest first, reclaim the tail older than two epochs
+    struct epochEntry **pp = &t->retired;
+    while (*pp && (*pp)->epoch + 2 > g)
+        pp = &(*pp)->next;
+    struct epochEntry *c = *pp;
+    *pp = NULL;
+    while (c)
+    {
+        struct epochEntry *n = c->next;
+        e->reclaim(c, e->arg);
+        t->retiredSize--;
+        c = n;
+    }
+}
+
+/*
+ * -------------------------------------------------------------- Lock-Free Dict
+ */
+
+#define LF_MARK(p) ((struct lfDictNode *)((unsigned long)(p) | 1UL))
+#define LF_UNMARK(p) ((struct lfDictNode *)((unsigned long)(p) & ~1UL))
+#define LF_MARKED(p) ((unsigned long)(p) & 1UL)
+
+static struct lfDictNode *lfDictNodeNew(UINT64 soKey, void *key, void *val);
+static void lfDictNodeReclaim(struct epochEntry *e, void *arg);
+static UINT64 lfDictReverse(UINT64 x);
+static UINT64 lfDictHash(struct lfDict *d, void *key);
+static struct lfDictNode **lfDictBucket(struct lfDict *d, long b);
+static struct lfDictNode *lfDictBucketHead(struct lfDict *d, struct epochThread *t, long b);
+static struct lfDictNode *lfDictFind(struct lfDict *d, struct epochThread *t,
+                                     struct lfDictNode *head, UINT64 soKey, void *key,
+                                     struct lfDictNode **prev, struct lfDictNode **cur);
+struct lfDict *lfDictNew(int (*keyHash)(void *), int (*keyCompare)(void *, void *),
+                         int (*valCompare)(void *, void *))
+{
+    if (!keyHash || !keyCompare || !valCompare)
+    {
+        printError("lfDictNew callback is NULL\n");
+        return NULL;
+    }
+    struct lfDict *d = calloc(1, sizeof(struct lfDict));
+    if (!d)
+    {
+        printError("lfDictNew error\n");
+        return NULL;
+    }
+    d->buckets = 2;
+    d->keyHash = keyHash;
+    d->keyCompare = keyCompare;
+    d->valCompare = valCompare;
+    if (!epochDomainInit(&d->epoch, lfDictNodeReclaim, NULL))
+    {
+        free(d);
+        return NULL;
+    }
+
+    // bucket 0 dummy is the head of the whole split-ordered list
+    struct lfDictNode **b0 = lfDictBucket(d, 0);
+    struct lfDictNode *head = lfDictNodeNew(0, NULL, NULL);
+    if (!b0 || !head)
+    {
+        printError("lfDictNew error\n");
+        if (head)
+            free(head);
+        lfDictFree(d);
+        return NULL;
+    }
+    *b0 = head;
+    return d;
+}
+void lfDictFree(struct lfDict *d)
+{
+    if (d)
+    {
+        epochDomainDestroy(&d->epoch);
+        struct lfDictNode *c = d->segments[0] ? *d->segments[0] : NULL;
+        while (c)
+        {
+            struct lfDictNode *n = LF_UNMARK(c->next);
+            free(c);
+            c = n;
+        }
+        int i;
+        for (i = 0; i < LF_DICT_SEGMENTS; i++)
+            if (d->segments[i])
+                free(d->segments[i]);
+        free(d);
+    }
+}
+int lfDictPut(struct lfDict *d, void *key, void *val)
+{
+    if (!d)
+    {
+        printError("lfDictPut d is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("lfDictPut key is NULL\n");
+        return 0;
+    }
+    struct epochThread *t = epochEnter(&d->epoch);
+    if (!t)
+        return 0;
+
+    UINT64 h = lfDictHash(d, key);
+    UINT64 soKey = lfDictReverse(h | (1UL << 63));
+    long buckets = ATOMIC_LOAD(&d->buckets);
+    struct lfDictNode *head = lfDictBucketHead(d, t, h & (buckets - 1));
+    struct lfDictNode *n = NULL;
+    int r = 0;
+    if (head)
+    {
+        for (;;)
+        {
+            struct lfDictNode *prev, *cur;
+            struct lfDictNode *found = lfDictFind(d, t, head, soKey, key, &prev, &cur);
+            if (found)
+            {
+                // replace, the same as dictPut
+                ATOMIC_STORE(&found->val, val);
+                if (n)
+                    free(n);
+                r = 1;
+                break;
+            }
+            if (!n && !(n = lfDictNodeNew(soKey, key, val)))
+                break;
+            n->next = cur;
+            if (ATOMIC_CAS(&prev->next, &cur, n))
+            {
+                long size = ATOMIC_ADD(&d->size, 1);
+                if (size > buckets * LF_DICT_LOAD && buckets < (1L << 31))
+                    __atomic_compare_exchange_n(&d->buckets, &buckets, buckets << 1, 0,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+                r = 1;
+                break;
             }
         }
     }
-    x->color = RB_BLACK;
-}
-static void rbTreeLeftRotate(struct rbTree *t, struct rbTreeNode *x)
-{
-    struct rbTreeNode *y = r(x);
-    x->right = l(y);
-    if (l(y) != RB_NIL)
-        l(y)->parent = x;
-    y->parent = p(x);
-    if (p(x) == RB_NIL)
-        t->root = y;
-    else if (x == l(p(x)))
-        p(x)->left = y;
-    else
-        p(x)->right = y;
-    y->left = x;
-    x->parent = y;
+    epochExit(t);
+    return r;
 }
-static void rbTreeRightRotate(struct rbTree *t, struct rbTreeNode *x)
+int lfDictRemove(struct lfDict *d, void *key)
 {
-    struct rbTreeNode *y = l(x);
-    x->left = r(y);
-    if (r(y) != RB_NIL)
-        r(y)->parent = x;
-    y->parent = p(x);
-    if (p(x) == RB_NIL)
-        t->root = y;
-    else if (x == r(p(x)))
-        p(x)->right = y;
-    else
-        p(x)->left = y;
-    y->right = x;
-    x->parent = y;
+    if (!d)
+    {
+        printError("lfDictRemove d is NULL\n");
+        return 0;
+    }
+    if (!key)
+    {
+        printError("lfDictRemove key is NULL\n");
+        return 0;
+    }
+    struct epochThread *t = epochEnter(&d->epoch);
+    if (!t)
+        return 0;
+
+    UINT64 h = lfDictHash(d, key);
+    UINT64 soKey = lfDictReverse(h | (1UL << 63));
+    struct lfDictNode *head = lfDictBucketHead(d, t, h & (ATOMIC_LOAD(&d->buckets) - 1));
+    int r = 0;
+    while (head)
+    {
+        struct lfDictNode *prev, *cur;
+        struct lfDictNode *found = lfDictFind(d, t, head, soKey, key, &prev, &cur);
+        if (!found)
+            break;
+        struct lfDictNode *next = ATOMIC_LOAD(&found->next);
+        if (LF_MARKED(next))
+            continue;
+        // logical delete first, then try to unlink, otherwise find will
+        if (ATOMIC_CAS(&found->next, &next, LF_MARK(next)))
+        {
+            ATOMIC_ADD(&d->size, -1);
+            lfDictFind(d, t, head, soKey, key, &prev, &cur);
+            r = 1;
+            break;
+        }
+    }
+    epochExit(t);
+    return r;
 }
-static void rbTreeTransplant(struct rbTree *t, struct rbTreeNode *u, struct rbTreeNode *v)
+void *lfDictGet(struct lfDict *d, void *key)
 {
-    if (p(u) == RB_NIL)
-        t->root = v;
-    else if (u == l(p(u)))
-        p(u)->left = v;
-    else
-        p(u)->right = v;
-    if (v) // xxxx
-        v->parent = p(u);
+    if (!d)
+    {
+        printError("lfDictGet d is NULL\n");
+        return NULL;
+    }
+    if (!key)
+    {
+        printError("lfDictGet key is NULL\n");
+        return NULL;
+    }
+    struct epochThread *t = epochEnter(&d->epoch);
+    if (!t)
+        return NULL;
+
+    UINT64 h = lfDictHash(d, key);
+    UINT64 soKey = lfDictReverse(h | (1UL << 63));
+    struct lfDictNode *head = lfDictBucketHead(d, t, h & (ATOMIC_LOAD(&d->buckets) - 1));
+    void *val = NULL;
+    if (head)
+    {
+        struct lfDictNode *prev, *cur;
+        struct lfDictNode *found = lfDictFind(d, t, head, soKey, key, &prev, &cur);
+        if (found)
+            val = ATOMIC_LOAD(&found->val);
+    }
+    epochExit(t);
+    return val;
 }
-static struct rbTreeNode *rbTreeNodeFindMin(struct rbTreeNode *n)
+int lfDictContainsKey(struct lfDict *d, void *key)
 {
-    while (n && n != RB_NIL)
+    if (!d)
     {
-        if (l(n) && l(n) != RB_NIL)
-            n = l(n);
-        else
-            return n;
+        printError("lfDictContainsKey d is NULL\n");
+        return 0;
     }
-    return NULL;
+    if (!key)
+    {
+        printError("lfDictContainsKey key is NULL\n");
+        return 0;
+    }
+    struct epochThread *t = epochEnter(&d->epoch);
+    if (!t)
+        return 0;
+
+    UINT64 h = lfDictHash(d, key);
+    UINT64 soKey = lfDictReverse(h | (1UL << 63));
+    struct lfDictNode *head = lfDictBucketHead(d, t, h & (ATOMIC_LOAD(&d->buckets) - 1));
+    int r = 0;
+    if (head)
+    {
+        struct lfDictNode *prev, *cur;
+        r = lfDictFind(d, t, head, soKey, key, &prev, &cur) ? 1 : 0;
+    }
+    epochExit(t);
+    return r;
 }
-#ifdef DEBUG
-static void rbTreeCheckParent(struct rbTreeNode *n)
+int lfDictContainsValue(struct lfDict *d, void *val)
 {
-    if (n && n != RB_NIL)
+    if (!d)
     {
-        if (l(n) && l(n) != RB_NIL && p(l(n)) != n)
-            printError("rbTree parent set error\n");
-        if (r(n) && r(n) != RB_NIL && p(r(n)) != n)
-            printError("rbTree parent set error\n");
+        printError("lfDictContainsValue d is NULL\n");
+        return 0;
     }
+    if (!val)
+    {
+        printError("lfDictContainsValue val is NULL\n");
+        return 0;
+    }
+    struct epochThread *t = epochEnter(&d->epoch);
+    if (!t)
+        return 0;
+
+    int r = 0;
+    struct lfDictNode *c = LF_UNMARK(ATOMIC_LOAD(&(*d->segments[0])->next));
+    while (c)
+    {
+        struct lfDictNode *n = ATOMIC_LOAD(&c->next);
+        if ((c->soKey & 1) && !LF_MARKED(n) && !d->valCompare(ATOMIC_LOAD(&c->val), val))
+        {
+            r = 1;
+            break;
+        }
+        c = LF_UNMARK(n);
+    }
+    epochExit(t);
+    return r;
 }
-static void rbTreeCheckKey(struct rbTreeNode *n)
+int lfDictSize(struct lfDict *d)
 {
-    if (n && n != RB_NIL)
+    return d ? (int)ATOMIC_LOAD(&d->size) : 0;
+}
+static struct lfDictNode *lfDictNodeNew(UINT64 soKey, void *key, void *val)
+{
+    struct lfDictNode *n = malloc(sizeof(struct lfDictNode));
+    if (n)
     {
-        if (l(n) && l(n) != RB_NIL && l(n)->key > n->key)
-            printError("rbTree left node error\n");
-        if (r(n) && r(n) != RB_NIL && r(n)->key < n->key)
-            printError("rbTree right node error\n");
+        n->soKey = soKey;
+        n->key = key;
+        n->val = val;
+        n->next = NULL;
+        return n;
     }
+    printError("lfDictNodeNew error\n");
+    return NULL;
 }
-static void rbTreeCheckRedColor(struct rbTreeNode *n)
+static void lfDictNodeReclaim(struct epochEntry *e, void *arg)
 {
-    if (n && n != RB_NIL)
+    // retire is the first member of lfDictNode
+    (void)arg;
+    free((struct lfDictNode *)e);
+}
+static UINT64 lfDictReverse(UINT64 x)
+{
+    x = ((x >> 1) & 0x5555555555555555UL) | ((x & 0x5555555555555555UL) << 1);
+    x = ((x >> 2) & 0x3333333333333333UL) | ((x & 0x3333333333333333UL) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FUL) | ((x & 0x0F0F0F0F0F0F0F0FUL) << 4);
+    x = ((x >> 8) & 0x00FF00FF00FF00FFUL) | ((x & 0x00FF00FF00FF00FFUL) << 8);
+    x = ((x >> 16) & 0x0000FFFF0000FFFFUL) | ((x & 0x0000FFFF0000FFFFUL) << 16);
+    return (x >> 32) | (x << 32);
+}
+static UINT64 lfDictHash(struct lfDict *d, void *key)
+{
+    // bit 63 is taken by the regular node mark
+    return hash2((UINT64)(UINT32)d->keyHash(key)) & ~(1UL << 63);
+}
+static struct lfDictNode **lfDictBucket(struct lfDict *d, long b)
+{
+    // segment 0 holds bucket 0, segment i holds buckets [2^(i-1), 2^i)
+    int seg = 0;
+    long x = b;
+    while (x)
     {
-        if (c(n) == RB_RED)
+        seg++;
+        x >>= 1;
+    }
+    long segSize = seg ? 1L << (seg - 1) : 1;
+    struct lfDictNode **s = ATOMIC_LOAD(&d->segments[seg]);
+    if (!s)
+    {
+        struct lfDictNode **empty = NULL;
+        s = calloc(segSize, sizeof(struct lfDictNode *));
+        if (!s)
         {
-            if (p(n) && p(n) != RB_NIL && c(p(n)) == RB_RED)
-                printError("rbTree color error");
-            if (l(n) && l(n) != RB_NIL && c(l(n)) == RB_RED)
-                printError("rbTree color error");
-            if (r(n) && r(n) != RB_NIL && c(r(n)) == RB_RED)
-                printError("rbTree color error");
+            printError("lfDictBucket segment error\n");
+            return NULL;
+        }
+        if (!ATOMIC_CAS(&d->segments[seg], &empty, s))
+        {
+            free(s);
+            s = empty;
         }
     }
+    return s + (seg ? b - segSize : 0);
 }
-static int rbTreeLeafBlackColorNumber(struct rbTreeNode *n)
+static struct lfDictNode *lfDictBucketHead(struct lfDict *d, struct epochThread *t, long b)
 {
-    int i = 0;
-    while (n && n != RB_NIL)
+    struct lfDictNode **slot = lfDictBucket(d, b);
+    if (!slot)
+        return NULL;
+    struct lfDictNode *head = ATOMIC_LOAD(slot);
+    if (head)
+        return head;
+
+    // lazy init: insert a dummy node after the parent bucket dummy
+    long parent = b;
+    long bit = 1;
+    while (bit <= parent)
+        bit <<= 1;
+    parent &= ~(bit >> 1);
+    struct lfDictNode *parentHead = lfDictBucketHead(d, t, parent);
+    if (!parentHead)
+        return NULL;
+
+    UINT64 soKey = lfDictReverse((UINT64)b);
+    struct lfDictNode *n = NULL;
+    for (;;)
     {
-        if (c(n) == RB_BLACK)
-            i++;
-        n = p(n);
+        struct lfDictNode *prev, *cur;
+        head = lfDictFind(d, t, parentHead, soKey, NULL, &prev, &cur);
+        if (head)
+            break;
+        if (!n && !(n = lfDictNodeNew(soKey, NULL, NULL)))
+            return NULL;
+        n->next = cur;
+        if (ATOMIC_CAS(&prev->next, &cur, n))
+        {
+            head = n;
+            n = NULL;
+            break;
+        }
     }
-    return i;
+    if (n)
+        free(n);
+    ATOMIC_STORE(slot, head);
+    return head;
 }
-void rbTreePrint(struct rbTree *t, void (*printVal)(void *))
+static struct lfDictNode *lfDictFind(struct lfDict *d, struct epochThread *t,
+                                     struct lfDictNode *head, UINT64 soKey, void *key,
+                                     struct lfDictNode **prev, struct lfDictNode **cur)
 {
-    if (t && t->root && t->root != RB_NIL && printVal)
+    // Harris-Michael search: unlink marked nodes on the way, stop at the first
+    // node >= soKey; keys sharing a soKey are scanned, new ones go in front
+    struct lfDictNode *p, *c, *n, *found;
+retry:
+    *prev = NULL;
+    *cur = NULL;
+    found = NULL;
+    p = head;
+    c = LF_UNMARK(ATOMIC_LOAD(&head->next));
+    while (c)
     {
-        struct Stack *stack = stackNew();
-        if (!stack)
-            goto freePointer;
-
-        struct Stack *leafStack = stackNew();
-        if (!leafStack)
-            goto freePointer;
-
-        stackPush(stack, t->root);
-        struct rbTreeNode *printed = NULL;
-        while (stackPeek(stack))
+        n = ATOMIC_LOAD(&c->next);
+        if (LF_MARKED(n))
         {
-            struct rbTreeNode *n = (struct rbTreeNode *)stackPop(stack);
-            struct rbTreeNode *l = n && n->left != RB_NIL ? n->left : NULL;
-            struct rbTreeNode *r = n && n->right != RB_NIL ? n->right : NULL;
-
-            if (!l && !r)
-                stackPush(leafStack, n);
-
-            rbTreeCheckKey(n);
-            rbTreeCheckParent(n);
-            rbTreeCheckRedColor(n);
-
-            if (l)
-            {
-                if (printed && printed->key >= l->key)
-                {
-                    printVal(n->val);
-                    printed = n;
-                    if (r)
-                        stackPush(stack, r);
-                }
-                else
-                {
-                    stackPush(stack, n);
-                    stackPush(stack, l);
-                }
-            }
-            else
-            {
-                printVal(n->val);
-                printed = n;
-                if (r)
-                    stackPush(stack, r);
-            }
+            struct lfDictNode *expected = c;
+            if (!ATOMIC_CAS(&p->next, &expected, LF_UNMARK(n)))
+                goto retry;
+            epochRetire(&d->epoch, t, &c->retire);
+            c = LF_UNMARK(n);
+            continue;
         }
-
-        if (stackSize(leafStack))
+        if (ATOMIC_LOAD(&p->next) != c)
+            goto retry;
+        if (c->soKey > soKey)
+            break;
+        if (c->soKey == soKey)
         {
-            struct rbTreeNode *leaf = (struct rbTreeNode *)stackPeek(leafStack);
-            int blackNumber = rbTreeLeafBlackColorNumber(leaf);
-            if (!blackNumber)
-                printError("rbTree leaf black number error\n");
-            if (stackSize(leafStack) == 1)
-                if (blackNumber != 1)
-                    printError("rbTree leaf black number error\n");
-
-            while (stackPeek(leafStack))
+            if (!*prev)
             {
-                leaf = (struct rbTreeNode *)stackPop(leafStack);
-                if (blackNumber != rbTreeLeafBlackColorNumber(leaf))
-                    printError("rbTree leaf black number error\n");
+                *prev = p;
+                *cur = c;
+            }
+            if (!key || !d->keyCompare(key, c->key))
+            {
+                found = c;
+                break;
             }
         }
-    freePointer:
-        if (stack)
-            stackFree(stack);
-        if (leafStack)
-            stackFree(leafStack);
+        p = c;
+        c = n;
+    }
+    if (!*prev)
+    {
+        *prev = p;
+        *cur = c;
     }
+    return found;
 }
-#endif // DEBUG
 
-/*
- * ------------------------------------------------------------------------ List
- */
-
-static struct listNode *listNodeNew(void *val);
-static void listNodeFree();
-static struct listNode *listGetNode(struct List *l, int i);
-struct List *listNew()
+/*
+ * --------------------------------------------------------- Persistent Avl Tree
+ */
+
+// one per publish, a version may wait in the retire list more than once
+struct pAvlTreeRetire
 {
-    struct List *l = malloc(sizeof(struct List));
-    if (l)
+    struct epochEntry retire;
+    struct pAvlTree *tree;
+};
+
+static struct pAvlTreeNode *pAvlTreeNodeNew(int k, void *v, struct pAvlTreeNode *l,
+                                            struct pAvlTreeNode *r);
+static struct pAvlTreeNode *pAvlTreeNodeRetain(struct pAvlTreeNode *n);
+static void pAvlTreeNodeRelease(struct pAvlTreeNode *n);
+static int pAvlTreeHeight(struct pAvlTreeNode *n);
+static struct pAvlTreeNode *pAvlTreeBalance(int k, void *v, struct pAvlTreeNode *l,
+                                            struct pAvlTreeNode *r);
+static struct pAvlTreeNode *pAvlTreeNodeAdd(struct pAvlTreeNode *n, int k, void *v);
+static int pAvlTreeNodeRemove(struct pAvlTreeNode *n, int k, struct pAvlTreeNode **out);
+static struct pAvlTreeNode *pAvlTreeFind(struct pAvlTreeNode *n, int k);
+static struct pAvlTree *pAvlTreeVersion(struct pAvlTree *p, struct pAvlTreeNode *root, int size);
+static void pAvlTreeReclaim(struct epochEntry *e, void *arg);
+struct pAvlTree *pAvlTreeNew(int (*key)(void *))
+{
+    if (!key)
     {
-        l->head = l->tail = NULL;
-        l->size = 0;
-        return l;
+        printError("pAvlTreeNew key is NULL\n");
+        return NULL;
     }
-    else
+    struct pAvlTree *p = malloc(sizeof(struct pAvlTree));
+    if (!p)
     {
-        printError("listNew error\n");
+        printError("pAvlTreeNew error\n");
         return NULL;
     }
+    p->root = NULL;
+    p->size = 0;
+    p->refs = 1;
+    p->key = key;
+    return p;
 }
-void listFree(struct List *l)
+struct pAvlTree *pAvlTreeRetain(struct pAvlTree *p)
 {
-    if (l)
+    if (p)
+        ATOMIC_ADD(&p->refs, 1);
+    return p;
+}
+void pAvlTreeFree(struct pAvlTree *p)
+{
+    if (p && ATOMIC_ADD(&p->refs, -1) == 0)
     {
-        struct listNode *c = l->head;
-        struct listNode *n = NULL;
-        while (c)
-        {
-            n = c->next;
-            listNodeFree(c);
-            c = n;
-        }
-        free(l);
+        pAvlTreeNodeRelease(p->root);
+        free(p);
     }
 }
-static struct listNode *listNodeNew(void *val)
+struct pAvlTree *pAvlTreeAdd(struct pAvlTree *p, void *el)
 {
-    struct listNode *n = malloc(sizeof(struct listNode));
-    if (n)
+    if (!p)
     {
-        n->prev = n->next = NULL;
-        n->val = val;
-        return n;
+        printError("pAvlTreeAdd p is NULL\n");
+        return NULL;
     }
-    else
+    if (!el)
     {
-        printError("listNodeNew error\n");
+        printError("pAvlTreeAdd el is NULL\n");
         return NULL;
     }
+    int k = (*p->key)(el);
+    int size = p->size + !pAvlTreeFind(p->root, k);
+    struct pAvlTreeNode *root = pAvlTreeNodeAdd(p->root, k, el);
+    if (!root)
+        return NULL;
+    return pAvlTreeVersion(p, root, size);
 }
-static void listNodeFree(struct listNode *n)
-{
-    if (n)
-        free(n);
-}
-int listAdd(struct List *l, void *el)
+struct pAvlTree *pAvlTreeRemove(struct pAvlTree *p, void *el)
 {
-    if (!l)
+    if (!p)
     {
-        printError("listAdd l is NULL\n");
-        return 0;
+        printError("pAvlTreeRemove p is NULL\n");
+        return NULL;
     }
-
-    struct listNode *n = listNodeNew(el);
-    if (!n)
+    if (!el)
     {
-        printError("listNodeNew error\n");
-        return 0;
+        printError("pAvlTreeRemove el is NULL\n");
+        return NULL;
     }
-
-    if (!l->head)
-        l->head = n;
-    if (l->tail)
+    int k = (*p->key)(el);
+    if (!pAvlTreeFind(p->root, k))
+        return pAvlTreeVersion(p, pAvlTreeNodeRetain(p->root), p->size);
+    struct pAvlTreeNode *root;
+    if (!pAvlTreeNodeRemove(p->root, k, &root))
+        return NULL;
+    return pAvlTreeVersion(p, root, p->size - 1);
+}
+void *pAvlTreeSearch(struct pAvlTree *p, void *el)
+{
+    if (!p)
     {
-        n->prev = l->tail;
-        l->tail->next = n;
+        printError("pAvlTreeSearch p is NULL\n");
+        return NULL;
     }
-    l->tail = n;
-
-    l->size++;
-    return 1;
+    if (!el)
+    {
+        printError("pAvlTreeSearch el is NULL\n");
+        return NULL;
+    }
+    struct pAvlTreeNode *n = pAvlTreeFind(p->root, (*p->key)(el));
+    return n ? n->val : NULL;
 }
-int listSet(struct List *l, int i, void *el)
+void *pAvlTreeFindMin(struct pAvlTree *p)
 {
-    if (!l)
+    if (!p || !p->root)
+        return NULL;
+    struct pAvlTreeNode *n = p->root;
+    while (n->left)
+        n = n->left;
+    return n->val;
+}
+void *pAvlTreeFindMax(struct pAvlTree *p)
+{
+    if (!p || !p->root)
+        return NULL;
+    struct pAvlTreeNode *n = p->root;
+    while (n->right)
+        n = n->right;
+    return n->val;
+}
+int pAvlTreeSize(struct pAvlTree *p)
+{
+    return p ? p->size : 0;
+}
+int pAvlTreeCellInit(struct pAvlTreeCell *c, struct pAvlTree *p)
+{
+    if (!c || !p)
     {
-        printError("listAdd l is NULL\n");
+        printError("pAvlTreeCellInit c or p is NULL\n");
         return 0;
     }
-
-    if (i >= l->size)
+    if (!epochDomainInit(&c->epoch, pAvlTreeReclaim, NULL))
         return 0;
-
-    listGetNode(l, i)->val = el;
-
+    // the cell takes the caller's reference
+    c->tree = p;
     return 1;
 }
-int listRemove(struct List *l, int i)
+void pAvlTreeCellDestroy(struct pAvlTreeCell *c)
 {
-    if (!l)
+    // no thread may use the cell any more
+    if (c)
     {
-        printError("listAdd l is NULL\n");
-        return 0;
+        epochDomainDestroy(&c->epoch);
+        pAvlTreeFree(c->tree);
+        c->tree = NULL;
     }
-
-    if (i >= l->size)
-        return 0;
-
-    struct listNode *n = listGetNode(l, i);
-    if (n->prev)
-        n->prev->next = n->next;
-    if (n->next)
-        n->next->prev = n->prev;
-    if (n == l->head)
-        l->head = n->next;
-    if (n == l->tail)
-        l->tail = n->prev;
-
-    listNodeFree(n);
-
-    l->size--;
-    return 1;
 }
-void *listGet(struct List *l, int i)
+struct pAvlTree *pAvlTreeCellGet(struct pAvlTreeCell *c)
 {
-    if (!l)
+    if (!c)
     {
-        printError("listAdd l is NULL\n");
+        printError("pAvlTreeCellGet c is NULL\n");
         return NULL;
     }
-
-    if (i >= l->size)
+    // the epoch keeps the version alive between the load and the retain
+    struct epochThread *t = epochEnter(&c->epoch);
+    if (!t)
         return NULL;
-
-    return listGetNode(l, i)->val;
+    struct pAvlTree *p = pAvlTreeRetain(ATOMIC_LOAD(&c->tree));
+    epochExit(t);
+    return p;
 }
-void *listHead(struct List *l)
+int pAvlTreeCellPublish(struct pAvlTreeCell *c, struct pAvlTree *expected, struct pAvlTree *p)
 {
-    if (!l)
+    if (!c || !expected || !p)
     {
-        printError("listAdd l is NULL\n");
-        return NULL;
+        printError("pAvlTreeCellPublish c, expected or p is NULL\n");
+        return 0;
     }
-    return l->head ? l->head->val : NULL;
+    struct pAvlTreeRetire *r = malloc(sizeof(struct pAvlTreeRetire));
+    if (!r)
+    {
+        printError("pAvlTreeCellPublish error\n");
+        return 0;
+    }
+    struct epochThread *t = epochEnter(&c->epoch);
+    if (!t)
+    {
+        free(r);
+        return 0;
+    }
+    // 0 when another writer published first, the caller rebuilds from the new
+    // version and keeps its reference to p
+    struct pAvlTree *old = expected;
+    if (!ATOMIC_CAS(&c->tree, &old, p))
+    {
+        epochExit(t);
+        free(r);
+        return 0;
+    }
+    r->tree = expected;
+    epochRetire(&c->epoch, t, &r->retire);
+    epochExit(t);
+    return 1;
 }
-void *listTail(struct List *l)
+static struct pAvlTreeNode *pAvlTreeNodeNew(int k, void *v, struct pAvlTreeNode *l,
+                                            struct pAvlTreeNode *r)
 {
-    if (!l)
+    // takes the references to l and r, drops them on failure
+    struct pAvlTreeNode *n = malloc(sizeof(struct pAvlTreeNode));
+    if (!n)
     {
-        printError("listAdd l is NULL\n");
+        printError("pAvlTreeNode error\n");
+        pAvlTreeNodeRelease(l);
+        pAvlTreeNodeRelease(r);
         return NULL;
     }
-    return l->tail ? l->tail->val : NULL;
+    n->left = l;
+    n->right = r;
+    n->key = k;
+    n->val = v;
+    n->refs = 1;
+    n->height = max(pAvlTreeHeight(l), pAvlTreeHeight(r)) + 1;
+    return n;
 }
-int listContains(struct List *l, void *el)
+static struct pAvlTreeNode *pAvlTreeNodeRetain(struct pAvlTreeNode *n)
 {
-    if (!l)
-    {
-        printError("listAdd l is NULL\n");
-        return 0;
-    }
-    if (l->size)
+    if (n)
+        ATOMIC_ADD(&n->refs, 1);
+    return n;
+}
+static void pAvlTreeNodeRelease(struct pAvlTreeNode *n)
+{
+    if (n && ATOMIC_ADD(&n->refs, -1) == 0)
     {
-        struct listNode *n = l->head;
-        while (n)
-        {
-            if (n->val == el)
-                return 1;
-            else
-                n = n->next;
-        }
+        pAvlTreeNodeRelease(n->left);
+        pAvlTreeNodeRelease(n->right);
+        free(n);
     }
-    return 0;
 }
-int listSize(struct List *l)
+static int pAvlTreeHeight(struct pAvlTreeNode *n)
 {
-    return l ? l->size : 0;
+    return n ? n->height : -1;
 }
-static struct listNode *listGetNode(struct List *l, int i)
+static struct pAvlTreeNode *pAvlTreeBalance(int k, void *v, struct pAvlTreeNode *l,
+                                            struct pAvlTreeNode *r)
 {
-    if ((i << 1) < l->size)
+    // builds the node over l and r, rotations copy the few nodes they touch
+    struct pAvlTreeNode *a, *b, *n;
+    if (pAvlTreeHeight(l) - pAvlTreeHeight(r) > 1)
     {
-        struct listNode *n = l->head;
-        int j;
-        for (j = 0; j < i; j++)
-            n = n->next;
+        if (pAvlTreeHeight(l->left) >= pAvlTreeHeight(l->right))
+        {
+            /* left left */
+            b = pAvlTreeNodeNew(k, v, pAvlTreeNodeRetain(l->right), r);
+            n = b ? pAvlTreeNodeNew(l->key, l->val, pAvlTreeNodeRetain(l->left), b) : NULL;
+        }
+        else
+        {
+            /* left right */
+            struct pAvlTreeNode *lr = l->right;
+            a = pAvlTreeNodeNew(l->key, l->val, pAvlTreeNodeRetain(l->left),
+                                pAvlTreeNodeRetain(lr->left));
+            b = pAvlTreeNodeNew(k, v, pAvlTreeNodeRetain(lr->right), r);
+            n = a && b ? pAvlTreeNodeNew(lr->key, lr->val, a, b) : NULL;
+            if (!n && (!a || !b))
+            {
+                pAvlTreeNodeRelease(a);
+                pAvlTreeNodeRelease(b);
+            }
+        }
+        pAvlTreeNodeRelease(l);
         return n;
     }
-    else
+    if (pAvlTreeHeight(r) - pAvlTreeHeight(l) > 1)
     {
-        struct listNode *n = l->tail;
-        int j;
-        for (j = l->size - 1; j > i; j--)
-            n = n->prev;
+        if (pAvlTreeHeight(r->right) >= pAvlTreeHeight(r->left))
+        {
+            /* right right */
+            a = pAvlTreeNodeNew(k, v, l, pAvlTreeNodeRetain(r->left));
+            n = a ? pAvlTreeNodeNew(r->key, r->val, a, pAvlTreeNodeRetain(r->right)) : NULL;
+        }
+        else
+        {
+            /* right left */
+            struct pAvlTreeNode *rl = r->left;
+            a = pAvlTreeNodeNew(k, v, l, pAvlTreeNodeRetain(rl->left));
+            b = pAvlTreeNodeNew(r->key, r->val, pAvlTreeNodeRetain(rl->right),
+                                pAvlTreeNodeRetain(r->right));
+            n = a && b ? pAvlTreeNodeNew(rl->key, rl->val, a, b) : NULL;
+            if (!n && (!a || !b))
+            {
+                pAvlTreeNodeRelease(a);
+                pAvlTreeNodeRelease(b);
+            }
+        }
+        pAvlTreeNodeRelease(r);
         return n;
     }
+    return pAvlTreeNodeNew(k, v, l, r);
 }
-
-/*
- * ------------------------------------------------------------------------ Dict
- */
-
-static struct dictEntry *dictEntryNew(int hash, void *key, void *val);
-static void dictEntryFree(struct dictEntry *e);
-static int hash2(int hash);
-static int tableIndex(int cap, int hash2);
-static int resize(struct Dict *d);
-static void rehash(struct Dict *d);
-static struct dictEntry *dictGetEntry(struct Dict *d, void *key);
-struct Dict *dictNew(int (*keyHash)(void *), int (*keyCompare)(void *, void *),
-                     int (*valCompare)(void *, void *))
+static struct pAvlTreeNode *pAvlTreeNodeAdd(struct pAvlTreeNode *n, int k, void *v)
 {
-    if (!keyHash)
+    // returns a new reference, n itself is left untouched
+    if (!n)
+        return pAvlTreeNodeNew(k, v, NULL, NULL);
+    struct pAvlTreeNode *c;
+    if (k < n->key)
     {
-        printError("dictNew keyHash is NULL\n");
-        return NULL;
+        if (!(c = pAvlTreeNodeAdd(n->left, k, v)))
+            return NULL;
+        return pAvlTreeBalance(n->key, n->val, c, pAvlTreeNodeRetain(n->right));
     }
-    if (!keyCompare)
+    if (k > n->key)
     {
-        printError("dictNew keyCompare is NULL\n");
-        return NULL;
+        if (!(c = pAvlTreeNodeAdd(n->right, k, v)))
+            return NULL;
+        return pAvlTreeBalance(n->key, n->val, pAvlTreeNodeRetain(n->left), c);
     }
-    if (!valCompare)
+    return pAvlTreeNodeNew(k, v, pAvlTreeNodeRetain(n->left), pAvlTreeNodeRetain(n->right));
+}
+static int pAvlTreeNodeRemove(struct pAvlTreeNode *n, int k, struct pAvlTreeNode **out)
+{
+    // k is in the subtree, *out may be NULL when the subtree empties
+    struct pAvlTreeNode *c;
+    if (k < n->key)
     {
-        printError("dictNew valCompare is NULL\n");
-        return NULL;
+        if (!pAvlTreeNodeRemove(n->left, k, &c))
+            return 0;
+        *out = pAvlTreeBalance(n->key, n->val, c, pAvlTreeNodeRetain(n->right));
+        return *out != NULL;
     }
-    struct Dict *d = malloc(sizeof(struct Dict));
-    if (d)
+    if (k > n->key)
     {
-        d->table = NULL;
-        // factor = 0.75 = 3:4 = 6:8
-        d->threshold = 6;
-        d->cap = 8;
-        d->size = 0;
-        d->keyHash = keyHash;
-        d->keyCompare = keyCompare;
-        d->valCompare = valCompare;
-        return d;
+        if (!pAvlTreeNodeRemove(n->right, k, &c))
+            return 0;
+        *out = pAvlTreeBalance(n->key, n->val, pAvlTreeNodeRetain(n->left), c);
+        return *out != NULL;
     }
-    else
+    if (!n->left || !n->right)
     {
-        printError("dictNew error\n");
+        *out = pAvlTreeNodeRetain(n->left ? n->left : n->right);
+        return 1;
+    }
+    // the successor takes the place of n
+    struct pAvlTreeNode *m = n->right;
+    while (m->left)
+        m = m->left;
+    if (!pAvlTreeNodeRemove(n->right, m->key, &c))
+        return 0;
+    *out = pAvlTreeBalance(m->key, m->val, pAvlTreeNodeRetain(n->left), c);
+    return *out != NULL;
+}
+static struct pAvlTreeNode *pAvlTreeFind(struct pAvlTreeNode *n, int k)
+{
+    while (n && n->key != k)
+        n = k < n->key ? n->left : n->right;
+    return n;
+}
+static struct pAvlTree *pAvlTreeVersion(struct pAvlTree *p, struct pAvlTreeNode *root, int size)
+{
+    struct pAvlTree *q = malloc(sizeof(struct pAvlTree));
+    if (!q)
+    {
+        printError("pAvlTree version error\n");
+        pAvlTreeNodeRelease(root);
         return NULL;
     }
+    q->root = root;
+    q->size = size;
+    q->refs = 1;
+    q->key = p->key;
+    return q;
+}
+static void pAvlTreeReclaim(struct epochEntry *e, void *arg)
+{
+    // retire is the first member of pAvlTreeRetire, the cell's reference is
+    // dropped, readers still holding the version keep it alive
+    struct pAvlTreeRetire *r = (struct pAvlTreeRetire *)e;
+    (void)arg;
+    pAvlTreeFree(r->tree);
+    free(r);
 }
-void dictFree(struct Dict *d)
+
+/*
+ * ----------------------------------------------------------------- binary heap
+ */
+
+static int bhp(int i);
+static int bhl(int i);
+static int bhr(int i);
+struct binaryHeap *bhNew(int (*key)(void *))
 {
-    if (d)
+    if (!key)
     {
-        if (d->table)
-        {
-            int i;
-            for (i = 0; i < d->cap; i++)
-            {
-                struct dictEntry *c = *(d->table + i);
-                struct dictEntry *n = NULL;
-                while (c)
-                {
-                    n = c->next;
-                    dictEntryFree(c);
-                    c = n;
-                }
-            }
-
-            free(d->table);
-        }
-        free(d);
+        printError("bhNew key is NULL\n");
+        return NULL;
     }
-}
-static struct dictEntry *dictEntryNew(int hash, void *key, void *val)
-{
-    struct dictEntry *entry = malloc(sizeof(struct dictEntry));
-    if (entry)
+    struct binaryHeap *h = malloc(sizeof(struct binaryHeap));
+    if (h)
     {
-        entry->hash = hash;
-        entry->key = key;
-        entry->val = val;
-        entry->next = NULL;
-        return entry;
+        h->table = NULL;
+        h->cap = 8;
+        h->size = 0;
+        h->key = key;
+        h->grow = growDouble;
+        return h;
     }
     else
     {
-        printError("dictEntryNew error\n");
+        printError("bhNew error\n");
         return NULL;
     }
 }
-static void dictEntryFree(struct dictEntry *entry)
+void bhFree(struct binaryHeap *h)
 {
-    if (entry)
-        free(entry);
+    if (h)
+    {
+        if (h->table)
+            memFree(h->table);
+        free(h);
+    }
 }
-int dictPut(struct Dict *d, void *key, void *val)
+int bhInsert(struct binaryHeap *h, void *el)
 {
-    if (!d)
+    if (!h)
     {
-        printError("dictPut d is NULL\n");
+        printError("bhSearch h is NULL\n");
         return 0;
     }
-    if (!key)
+    if (!el)
     {
-        printError("dictPut key is NULL\n");
+        printError("bhSearch el is NULL\n");
         return 0;
     }
-    if (d->size == 0)
+    if (!h->table)
     {
-        if (d->table == NULL)
+        h->table = memAlloc(sizeof(void *) * h->cap);
+        if (!h->table)
         {
-            d->table = malloc(sizeof(struct dictEntry *) * d->cap);
-            if (d->table)
-            {
-                int i;
-                for (i = 0; i < d->cap; i++)
-                    *(d->table + i) = NULL;
-            }
-            else
-            {
-                printError("dictPut init table error\n");
-                return 0;
-            }
+            printError("bhSearch init table error\n");
+            return 0;
         }
     }
 
-    // maybe replace
-    int h = d->keyHash(key);
-    int i = tableIndex(d->cap, h);
-    struct dictEntry *entry = *(d->table + i);
-    while (entry)
+    // table[0] is unused, so cap - 1 elements fit
+    if (h->size + 1 >= h->cap)
     {
-        if (entry->hash == h && !d->keyCompare(key, entry->key))
+        int newCap = growCap(h->grow, h->cap, h->size + 2);
+        if (newCap < 0)
+            return 0;
+        void **newTable = memRealloc(h->table, sizeof(void *) * newCap);
+        if (!newTable)
         {
-            entry->val = val;
-            return 1;
+            printError("bhInsert error\n");
+            return 0;
         }
-        entry = entry->next;
+        h->cap = newCap;
+        h->table = newTable;
     }
 
-    int recap = 0;
-    if (d->threshold == d->size)
+    int k = h->key(el);
+    int i = h->size + 1;
+    while (i > 1)
     {
-        recap = d->cap < (1 << 30);
-        if (!resize(d))
+        int p = bhp(i);
+        if (k < h->key(*(h->table + p)))
         {
-            printError("resize error\n");
-            return 0;
+            *(h->table + i) = *(h->table + p);
+            i = p;
         }
+        else
+            break;
     }
-
-    if (recap)
+    *(h->table + i) = el;
+    h->size++;
+    return 1;
+}
+struct binaryHeap *bhNewWithCapacity(int (*key)(void *), int cap)
+{
+    if (cap <= 0 || cap == INT_MAX)
     {
-        h = d->keyHash(key);
-        i = tableIndex(d->cap, h);
+        printError("bhNewWithCapacity cap is error\n");
+        return NULL;
     }
-    entry = dictEntryNew(h, key, val);
-    if (!entry)
+    struct binaryHeap *h = bhNew(key);
+    if (h && !bhReserve(h, cap))
     {
-        printError("dictPut error\n");
-        return 0;
+        bhFree(h);
+        return NULL;
     }
-    entry->next = *(d->table + i);
-    *(d->table + i) = entry;
-
-    d->size++;
-    return 1;
+    return h;
 }
-int dictRemove(struct Dict *d, void *key)
+int bhReserve(struct binaryHeap *h, int cap)
 {
-    if (!d)
+    if (!h)
     {
-        printError("dictRemove d is NULL\n");
+        printError("bhReserve h is NULL\n");
         return 0;
     }
-    if (!key)
+    if (cap < 0 || cap == INT_MAX)
     {
-        printError("dictRemove key is NULL\n");
+        printError("bhReserve cap is error\n");
         return 0;
     }
-
-    if (d->size == 0)
-        return 0;
-
-    int h = d->keyHash(key);
-    int i = tableIndex(d->cap, h);
-    struct dictEntry *p = NULL;
-    struct dictEntry *c = *(d->table + i);
-    while (c)
+    cap++;
+    if (h->table && cap <= h->cap)
+        return 1;
+    if (cap < h->cap)
+        cap = h->cap;
+    void **newTable = memRealloc(h->table, sizeof(void *) * cap);
+    if (!newTable)
     {
-        if (c->hash == h && !d->keyCompare(c->key, key))
-        {
-            if (p)
-                p->next = c->next;
-            else
-                *(d->table + i) = c->next;
-            dictEntryFree(c);
-            d->size--;
-            return 1;
-        }
-        p = c;
-        c = c->next;
+        printError("bhReserve error\n");
+        return 0;
     }
-    return 0;
+    h->table = newTable;
+    h->cap = cap;
+    return 1;
 }
-void *dictGet(struct Dict *d, void *key)
+int bhShrinkToFit(struct binaryHeap *h)
 {
-    if (!d)
+    if (!h)
     {
-        printError("dictGet d is NULL\n");
-        return NULL;
+        printError("bhShrinkToFit h is NULL\n");
+        return 0;
     }
-    if (!key)
+    int cap = h->size + 1;
+    if (!h->table || cap == h->cap)
+        return 1;
+    void **newTable = memRealloc(h->table, sizeof(void *) * cap);
+    if (!newTable)
     {
-        printError("dictGet key is NULL\n");
-        return NULL;
+        printError("bhShrinkToFit error\n");
+        return 0;
     }
-    struct dictEntry *entry = dictGetEntry(d, key);
-    return entry ? entry->val : NULL;
+    h->table = newTable;
+    h->cap = cap;
+    return 1;
 }
-int dictContainsKey(struct Dict *d, void *key)
+void bhSetGrowth(struct binaryHeap *h, int (*grow)(int, int))
 {
-    if (!d)
+    if (h)
+        h->grow = grow ? grow : growDouble;
+}
+int bhDeleteMin(struct binaryHeap *h)
+{
+    if (!h)
     {
-        printError("dictGet d is NULL\n");
+        printError("bhSearch h is NULL\n");
         return 0;
     }
-    if (!key)
-    {
-        printError("dictGet key is NULL\n");
+    if (!h->size)
         return 0;
+
+    h->size--;
+
+    if (h->size)
+    {
+        *(h->table + 1) = *(h->table + h->size + 1);
+        int k = h->key(*(h->table + 1));
+        int i = 1;
+        for (;;)
+        {
+            int l = bhl(i);
+            int r = bhr(i);
+            int x;
+            int xk;
+            if (l <= h->size && r <= h->size)
+            {
+                int lk = h->key(*(h->table + l));
+                int rk = h->key(*(h->table + r));
+                x = lk < rk ? l : r;
+                xk = lk < rk ? lk : rk;
+            }
+            else if (l <= h->size)
+            {
+                x = l;
+                xk = h->key(*(h->table + l));
+            }
+            else if (r <= h->size)
+            {
+                x = r;
+                xk = h->key(*(h->table + r));
+            }
+            else
+                break;
+
+            if (k > xk)
+            {
+                void *c = *(h->table + i);
+                *(h->table + i) = *(h->table + x);
+                *(h->table + x) = c;
+                i = x;
+            }
+            else
+                break;
+        }
     }
-    struct dictEntry *entry = dictGetEntry(d, key);
-    return entry ? 1 : 0;
+
+    return 1;
 }
-int dictContainsValue(struct Dict *d, void *val)
+void *bhFindMin(struct binaryHeap *h)
 {
-    if (!d)
+    if (!h)
     {
-        printError("dictGet d is NULL\n");
-        return 0;
+        printError("bhFindMin h is NULL\n");
+        return NULL;
     }
-    if (!val)
+    if (h->size == 0)
+        return NULL;
+    return *(h->table + 1);
+}
+void *bhFindMax(struct binaryHeap *h)
+{
+    if (!h)
     {
-        printError("dictGet val is NULL\n");
-        return 0;
+        printError("bhFindMax h is NULL\n");
+        return NULL;
     }
-    if (d->size == 0)
-        return 0;
-    if (d->table)
+    if (h->size == 0)
+        return NULL;
+    int i = (h->size >> 1) + 1;
+    int maxKey;
+    void *max = NULL;
+    for (; i <= h->size; i++)
     {
-        int i;
-        for (i = 0; i < d->cap; i++)
-        {
-            struct dictEntry *entry = *(d->table + i);
-            while (entry)
+        void *el = *(h->table + i);
+        if (max)
+        {
+            int k = h->key(el);
+            if (k > maxKey)
             {
-                if (!d->valCompare(entry->val, val))
-                    return 1;
-                entry = entry->next;
+                maxKey = k;
+                max = el;
             }
         }
+        else
+        {
+            maxKey = h->key(el);
+            max = el;
+        }
     }
-    return 0;
+    return max;
 }
-int dictSize(struct Dict *d)
+int bhSize(struct binaryHeap *h)
 {
-    return d ? d->size : 0;
+    if (!h)
+    {
+        printError("bhFindMax h is NULL\n");
+        return 0;
+    }
+    return h->size;
 }
 #ifdef DEBUG
-void dictPrint(struct Dict *d, void (*print)(void *, void *))
+void bhPrint(struct binaryHeap *h, void (*print)(void *))
 {
-    if (!d)
+    if (!h)
     {
-        printError("dictPrint d is NULL\n");
+        printError("bhPrint h is NULL\n");
         return;
     }
-    if (d->size)
+    if (h->size)
     {
         int i;
-        for (i = 0; i < d->cap; i++)
+        for (i = 1; i <= h->size; i++)
         {
-            struct dictEntry *entry = *(d->table + i);
-            while (entry)
+            print(*(h->table + i));
+
+            int k = h->key(*(h->table + i));
+
+            int l = bhl(i);
+            if (l <= h->size)
             {
-                print(entry->key, entry->val);
-                entry = entry->next;
+                int lk;
+                if (k > (lk = h->key(*(h->table + l))))
+                {
+                    printf("\n");
+                    printError("bhPrint check left error, k=%d,lk=%d\n", k, lk);
+                    return;
+                }
+            }
+
+            int r = bhr(i);
+            if (r <= h->size)
+            {
+                int rk;
+                if (k > (rk = h->key(*(h->table + r))))
+                {
+                    printf("\n");
+                    printError("bhPrint check right error, k=%d,rk=%d\n", k, rk);
+                    return;
+                }
             }
         }
+        printf("\n");
     }
 }
 #endif // DEBUG
-static int hash2(int hash)
+static int bhp(int i)
 {
-    int hash2 = hash < 0 ? -hash : hash;
-    hash2 = hash2 ^ (hash2 >> 16);
-    return hash2;
+    return i >> 1;
 }
-static int tableIndex(int cap, int hash)
+static int bhl(int i)
 {
-    return hash2(hash) & (cap - 1);
+    return i << 1;
 }
-static int resize(struct Dict *d)
+static int bhr(int i)
 {
-    if (d->cap < (1 << 30))
-    {
-        int newCap = d->cap << 1;
-        int newThreshold = d->threshold << 1;
-
-        struct dictEntry **newTable = realloc(d->table, sizeof(struct dictEntry *) * newCap);
-        if (!newTable)
-        {
-            printError("dict resize error\n");
-            return 0;
-        }
-
-        int i;
-        for (i = d->cap; i < newCap - 1; i++)
-            *(newTable + i) = NULL;
-
-        d->table = newTable;
-        d->threshold = newThreshold;
-        d->cap = newCap;
+    return (i << 1) + 1;
+}
 
-        rehash(d);
+/*
+ * ------------------------------------------------------------------- Skip List
+ */
 
-        return 1;
-    }
-    else if (d->threshold < INT_MAX)
+static struct skipListNode *skipListNodeNew(struct skipList *sl, int maxLevel, int key, void *val);
+static void skipListNodeFree(struct skipList *sl, struct skipListNode *n);
+static int skipListLink(struct skipList *sl, struct skipListNode *n);
+static int skipListUnlink(struct skipList *sl,
+                          struct skipListNode *p, struct skipListNode *c);
+static struct skipListNode *skipListGetCore(struct skipList *sl, int key);
+static int skipListInsertCore(struct skipList *sl, void *el);
+static int skipListDeleteCore(struct skipList *sl, int key);
+static int skipListHeadMaxLevel(struct skipList *sl);
+static int randomLevel(struct skipList *sl);
+struct skipList *skipListNew(int (*key)(void *))
+{
+    if (!key)
     {
-        d->threshold = INT_MAX;
-        return 1;
+        printError("skipListNew key is NULL\n");
+        return 0;
     }
-    else
+    struct skipList *sl = malloc(sizeof(struct skipList));
+    if (sl)
     {
-        printError("dict cap is not enough\n");
-        return 0;
+        sl->time0 = time(0);
+        sl->maxLevel = 0;
+        sl->head = NULL;
+        sl->size = 0;
+        sl->key = key;
+        sl->stats = statsNew();
+        return sl;
     }
+    printError("skipListNew error\n");
+    return NULL;
 }
-static void rehash(struct Dict *d)
+void skipListFree(struct skipList *sl)
 {
-    // cap -1 = 2 ^ 3 - 1 = 111     hash2 = hash & 111
-    // cap -1 = 2 ^ 4 - 1 = 1111    hash2 = hash & 1111
-    // cap -1 = 2 ^ 5 - 1 = 11111   hash2 = hash & 11111
-    // ...
-    int i;
-    for (i = (d->cap >> 1) - 1; i >= 0; i--)
+    if (sl)
     {
-        struct dictEntry *h = *(d->table + i);
-        struct dictEntry *p = NULL;
-        struct dictEntry *c = *(d->table + i);
-        struct dictEntry *n = NULL;
+        struct skipListNode *c = sl->head;
+        struct skipListNode *n = NULL;
         while (c)
         {
-            n = c->next;
-            int j = tableIndex(d->cap, c->hash);
-            if (j == i)
-                p = c;
+            if (c->next)
+                n = *(c->next + 0);
             else
-            {
-                c->next = *(d->table + j);
-                *(d->table + j) = c;
-                if (h == c)
-                    h = *(d->table + i) = n;
-                else
-                    p->next = n;
-            }
+                n = NULL;
+            skipListNodeFree(sl, c);
             c = n;
         }
+        free(sl->stats);
+        free(sl);
     }
 }
-static struct dictEntry *dictGetEntry(struct Dict *d, void *key)
+static struct skipListNode *skipListNodeNew(struct skipList *sl, int maxLevel, int key, void *val)
 {
-    if (d->size == 0)
-        return NULL;
-
-    int h = d->keyHash(key);
-    int i = tableIndex(d->cap, h);
-    struct dictEntry *entry = *(d->table + i);
-    while (entry)
+    struct skipListNode *n = malloc(sizeof(struct skipListNode));
+    if (n)
     {
-        if (entry->hash == h && !d->keyCompare(key, entry->key))
-            return entry;
-        entry = entry->next;
+        n->maxLevel = maxLevel;
+        n->next = calloc(maxLevel + 1, sizeof(struct skipListNode *));
+        if (!n->next)
+            goto newError;
+        n->key = key;
+        n->val = val;
+        STATS_ADD(sl->stats, allocs, 1);
+        return n;
     }
+newError:
+    if (n)
+        free(n);
+    printError("skipListNodeNew error\n");
     return NULL;
 }
-
-/*
- * ----------------------------------------------------------------- binary heap
- */
-
-static int bhp(int i);
-static int bhl(int i);
-static int bhr(int i);
-struct binaryHeap *bhNew(int (*key)(void *))
+static void skipListNodeFree(struct skipList *sl, struct skipListNode *n)
 {
-    if (!key)
-    {
-        printError("bhNew key is NULL\n");
-        return NULL;
-    }
-    struct binaryHeap *h = malloc(sizeof(struct binaryHeap));
-    if (h)
-    {
-        h->table = NULL;
-        h->cap = 8;
-        h->size = 0;
-        h->key = key;
-        return h;
-    }
-    else
+    if (n)
     {
-        printError("bhNew error\n");
-        return NULL;
+        if (n->next)
+            free(n->next);
+        STATS_ADD(sl->stats, frees, 1);
+        free(n);
     }
 }
-void bhFree(struct binaryHeap *h)
+int skipListInsert(struct skipList *sl, void *el)
 {
-    if (h)
+    if (!sl)
     {
-        if (h->table)
-            free(h->table);
-        free(h);
+        printError("skipListInsert sl is NULL\n");
+        return 0;
     }
+    UINT64 t0 = STATS_NOW();
+    int r = skipListInsertCore(sl, el);
+    STATS_RECORD(sl->stats, insert, t0);
+    return r;
 }
-int bhInsert(struct binaryHeap *h, void *el)
+static int skipListInsertCore(struct skipList *sl, void *el)
 {
-    if (!h)
-    {
-        printError("bhSearch h is NULL\n");
-        return 0;
-    }
     if (!el)
     {
-        printError("bhSearch el is NULL\n");
+        printError("skipListInsert el is NULL\n");
         return 0;
     }
-    if (!h->table)
+
+    int key = sl->key(el);
+
+    if (sl->size)
     {
-        h->table = malloc(sizeof(void *) * h->cap);
-        if (!h->table)
+        struct skipListNode *n = skipListGetCore(sl, key);
+        if (n)
         {
-            printError("bhSearch init table error\n");
+            n->val = el;
+            return 1;
+        }
+
+        int level = randomLevel(sl);
+        n = skipListNodeNew(sl, level, key, el);
+        if (!n)
+        {
+            printError("skipListInsert error\n");
             return 0;
         }
-    }
 
-    if ((h->size + 1) == h->cap)
+        return skipListLink(sl, n);
+    }
+    else
     {
-        int newCap = h->cap << 1;
-        void **newTable = realloc(h->table, sizeof(void *) * newCap);
-        if (!newTable)
+        // head node maxLevel is SL_MAX_LEVEL - 1
+        struct skipListNode *n = skipListNodeNew(sl, SL_MAX_LEVEL - 1, key, el);
+        if (!n)
         {
-            printError("bhInsert error\n");
+            printError("skipListInsert error\n");
             return 0;
         }
-        h->cap = newCap;
-        h->table = newTable;
+
+        sl->maxLevel = 0;
+        sl->head = n;
+        sl->size++;
+
+        return 1;
+    }
+}
+static int skipListLink(struct skipList *sl, struct skipListNode *n)
+{
+    int level = n->maxLevel;
+    int key = n->key;
+    void *val = n->val;
+
+    if (key < sl->head->key)
+    {
+        n->key = sl->head->key;
+        n->val = sl->head->val;
+        sl->head->key = key;
+        sl->head->val = val;
+        key = n->key;
+        val = n->val;
     }
 
-    int k = h->key(el);
-    int i = h->size + 1;
-    while (i > 1)
+    // descend from the top level, so a low node does not walk the whole list
+    struct skipListNode *c = sl->head;
+    struct skipListNode *cn = NULL;
+    int i;
+    for (i = max(sl->maxLevel, level); i >= 0; i--)
     {
-        int p = bhp(i);
-        if (k < h->key(*(h->table + p)))
+        while ((cn = *(c->next + i)) && cn->key < key)
+            c = cn;
+        if (i <= level)
         {
-            *(h->table + i) = *(h->table + p);
-            i = p;
+            // do insert [c, n, cn]
+            *(n->next + i) = cn;
+            *(c->next + i) = n;
         }
-        else
-            break;
     }
-    *(h->table + i) = el;
-    h->size++;
+
+    sl->size++;
+
+    sl->maxLevel = skipListHeadMaxLevel(sl);
+
     return 1;
 }
-int bhDeleteMin(struct binaryHeap *h)
+int skipListDelete(struct skipList *sl, int key)
 {
-    if (!h)
+    if (!sl)
     {
-        printError("bhSearch h is NULL\n");
+        printError("skipListDelete sl is NULL\n");
         return 0;
     }
-    if (!h->size)
+    UINT64 t0 = STATS_NOW();
+    int r = skipListDeleteCore(sl, key);
+    STATS_RECORD(sl->stats, remove, t0);
+    return r;
+}
+static int skipListDeleteCore(struct skipList *sl, int key)
+{
+    if (!sl->size)
         return 0;
 
-    h->size--;
-
-    if (h->size)
+    int level = sl->maxLevel;
+    struct skipListNode *p = NULL;
+    struct skipListNode *c = sl->head;
+    struct skipListNode *n = NULL;
+    while (c)
     {
-        *(h->table + 1) = *(h->table + h->size + 1);
-        int k = h->key(*(h->table + 1));
-        int i = 1;
-        for (;;)
+        if (c->key == key)
+            return skipListUnlink(sl, p, c);
+        else if ((n = *(c->next + level)))
         {
-            int l = bhl(i);
-            int r = bhr(i);
-            int x;
-            int xk;
-            if (l <= h->size && r <= h->size)
-            {
-                int lk = h->key(*(h->table + l));
-                int rk = h->key(*(h->table + r));
-                x = lk < rk ? l : r;
-                xk = lk < rk ? lk : rk;
-            }
-            else if (l <= h->size)
+            if (n->key < key)
             {
-                x = l;
-                xk = h->key(*(h->table + l));
+                p = c;
+                c = n;
             }
-            else if (r <= h->size)
+            else if (n->key > key)
             {
-                x = r;
-                xk = h->key(*(h->table + r));
+                if (level)
+                    level--;
+                else
+                    return 0;
             }
             else
-                break;
+                return skipListUnlink(sl, c, n);
+        }
+        else
+        {
+            if (level)
+                level--;
+            else
+                return 0;
+        }
+    }
+    return 0;
+}
+static int skipListUnlink(struct skipList *sl,
+                          struct skipListNode *p, struct skipListNode *c)
+{
+    if (sl->size == 1)
+    {
+        skipListNodeFree(sl, c);
+        sl->head = NULL;
+    }
+    else
+    {
+        if (c == sl->head)
+        {
+            struct skipListNode *n = *(c->next + 0);
 
-            if (k > xk)
+            c->key = n->key;
+            c->val = n->val;
+
+            p = c; // c is a head node, the node n just has one prev node
+            c = n;
+        }
+
+        int i;
+        for (i = c->maxLevel; i >= 0; i--)
+        {
+            struct skipListNode *n = NULL;
+            while (p)
             {
-                void *c = *(h->table + i);
-                *(h->table + i) = *(h->table + x);
-                *(h->table + x) = c;
-                i = x;
+                if ((n = *(p->next + i)) == c)
+                {
+                    *(p->next + i) = *(c->next + i);
+                    break;
+                }
+                else
+                    p = n;
             }
-            else
-                break;
         }
+
+        skipListNodeFree(sl, c);
     }
 
+    sl->size--;
+
+    sl->maxLevel = skipListHeadMaxLevel(sl);
+
     return 1;
 }
-void *bhFindMin(struct binaryHeap *h)
+void *skipListGet(struct skipList *sl, int key)
 {
-    if (!h)
+    if (!sl)
     {
-        printError("bhFindMin h is NULL\n");
+        printError("sl is NULL\n");
         return NULL;
     }
-    if (h->size == 0)
+    if (!sl->size)
         return NULL;
-    return *(h->table + 1);
+
+    UINT64 t0 = STATS_NOW();
+    struct skipListNode *n = skipListGetCore(sl, key);
+    STATS_RECORD(sl->stats, lookup, t0);
+    return n ? n->val : NULL;
 }
-void *bhFindMax(struct binaryHeap *h)
+static struct skipListNode *skipListGetCore(struct skipList *sl, int key)
 {
-    if (!h)
-    {
-        printError("bhFindMax h is NULL\n");
-        return NULL;
-    }
-    if (h->size == 0)
+    if (!sl->size)
         return NULL;
-    int i = (h->size >> 1) + 1;
-    int maxKey;
-    void *max = NULL;
-    for (; i <= h->size; i++)
+
+    int level = sl->maxLevel;
+    struct skipListNode *c = sl->head;
+    struct skipListNode *n = NULL;
+    struct skipListNode *found = NULL;
+    UINT64 hops = 0;
+    while (c)
     {
-        void *el = *(h->table + i);
-        if (max)
+        if (c->key == key)
         {
-            int k = h->key(el);
-            if (k > maxKey)
+            found = c;
+            break;
+        }
+        else if ((n = *(c->next + level)))
+        {
+            hops++;
+            if (n->key < key)
+                c = n;
+            else if (n->key > key)
             {
-                maxKey = k;
-                max = el;
+                if (level)
+                    level--;
+                else
+                    break;
+            }
+            else
+            {
+                found = n;
+                break;
             }
         }
         else
         {
-            maxKey = h->key(el);
-            max = el;
+            if (level)
+                level--;
+            else
+                break;
         }
     }
-    return max;
+    STATS_WALK(sl->stats, hops);
+    return found;
 }
-int bhSize(struct binaryHeap *h)
+int skipListSize(struct skipList *sl)
 {
-    if (!h)
+    return sl ? sl->size : 0;
+}
+int skipListSave(struct skipList *sl, const char *path, struct snapshotCodec *el)
+{
+    if (!sl || !path || !snapshotCodecValid(el))
     {
-        printError("bhFindMax h is NULL\n");
+        printError("skipListSave sl, path or codec is NULL\n");
         return 0;
     }
-    return h->size;
+    struct snapshotWriter w;
+    if (!snapshotCreate(&w, path, SNAPSHOT_SKIP_LIST, sl->size))
+        return 0;
+    int ok = 1;
+    struct skipListNode *c = sl->size ? sl->head : NULL;
+    for (; ok && c; c = *(c->next + 0))
+        ok = snapshotPut(&w, el, c->val);
+    return snapshotCommit(&w, ok);
 }
-#ifdef DEBUG
-void bhPrint(struct binaryHeap *h, void (*print)(void *))
+struct opStats *skipListOpStats(struct skipList *sl)
 {
-    if (!h)
+    return sl ? sl->stats : NULL;
+}
+int skipListLoad(struct skipList *sl, const char *path, struct snapshotCodec *el)
+{
+    if (!sl || !path || !snapshotCodecValid(el))
     {
-        printError("bhPrint h is NULL\n");
-        return;
+        printError("skipListLoad sl, path or codec is NULL\n");
+        return 0;
     }
-    if (h->size)
+    if (sl->size)
     {
+        printError("skipListLoad sl is not empty\n");
+        return 0;
+    }
+    struct snapshotReader r;
+    if (!snapshotOpen(&r, path, SNAPSHOT_SKIP_LIST))
+        return 0;
+
+    // sorted records are appended, tails[i] is the last node linked at level i
+    struct skipListNode *tails[SL_MAX_LEVEL];
+    int ok = r.count <= INT_MAX;
+    UINT64 n;
+    for (n = 0; ok && n < r.count; n++)
+    {
+        void *x = NULL;
+        ok = snapshotGet(&r, el, &x) && x;
+        int k = ok ? sl->key(x) : 0;
+        int level = n ? randomLevel(sl) : SL_MAX_LEVEL - 1;
+        struct skipListNode *c = NULL;
+        ok = ok && (!n || k > tails[0]->key) && (c = skipListNodeNew(sl, level, k, x));
+        if (!ok)
+        {
+            snapshotRelease(el, x);
+            break;
+        }
         int i;
-        for (i = 1; i <= h->size; i++)
+        for (i = 0; i <= level; i++)
         {
-            print(*(h->table + i));
+            if (n)
+                *(tails[i]->next + i) = c;
+            tails[i] = c;
+        }
+        if (!n)
+            sl->head = c;
+        sl->size++;
+    }
+    snapshotClose(&r);
+    sl->maxLevel = sl->size ? skipListHeadMaxLevel(sl) : 0;
+    if (!ok)
+        printError("skipListLoad %s record %lu error\n", path, n);
+    return ok;
+}
+static int skipListHeadMaxLevel(struct skipList *sl)
+{
+    if (sl->size)
+    {
+        int maxLevel = 0;
+        while (maxLevel < SL_MAX_LEVEL && *(sl->head->next + maxLevel))
+            maxLevel++;
+        return max(maxLevel - 1, 0);
+    }
+    else
+        return -1;
+}
+static int randomLevel(struct skipList *sl)
+{
+    sl->time0++;
+    srand(sl->time0);
+    int mask = 127;
+    int half = 64;
+    int level = 0;
+    while ((rand() & mask) < half)
+        level++;
+    level = level < SL_MAX_LEVEL ? level : SL_MAX_LEVEL - 1;
+    return level;
+}
+#ifdef DEBUG
+void skipListPrint(struct skipList *sl, void (*print)(void *))
+{
+    if (sl->size)
+    {
+        int level = SL_MAX_LEVEL - 1; // sl->maxLevel;
+        // not include head
+        int levelLinkedNodeTotal[level + 1];
+        // init all element value 0
+        int i;
+        for (i = 0; i < level + 1; i++)
+            levelLinkedNodeTotal[i] = 0;
+
+        struct skipListNode *n = sl->head;
+        while (n)
+        {
+            if (n != sl->head)
+                for (i = 0; i <= n->maxLevel; i++)
+                    levelLinkedNodeTotal[i]++;
+            n = *(n->next + 0);
+        }
 
-            int k = h->key(*(h->table + i));
+        for (i = 0; i < level + 1; i++)
+            printDebug("level %d linked node total: %d\n", i, levelLinkedNodeTotal[i]);
 
-            int l = bhl(i);
-            if (l <= h->size)
+        for (; level >= 0; level--)
+        {
+            printDebug("skipListPrint check level linked node total: %d\n", level);
+
+            int total = 0;
+            struct skipListNode *p = NULL;
+            struct skipListNode *c = sl->head;
+            while (c)
             {
-                int lk;
-                if (k > (lk = h->key(*(h->table + l))))
+                if (c != sl->head)
+                    total++;
+                if (p && p->key > c->key)
                 {
-                    printf("\n");
-                    printError("bhPrint check left error, k=%d,lk=%d\n", k, lk);
+                    printError("skipListPrint linked node sort(prev: %d, curr: %d) error\n",
+                               p->key, c->key);
                     return;
                 }
+                p = c;
+                c = *(c->next + level);
             }
-
-            int r = bhr(i);
-            if (r <= h->size)
+            if (total != levelLinkedNodeTotal[level])
             {
-                int rk;
-                if (k > (rk = h->key(*(h->table + r))))
-                {
-                    printf("\n");
-                    printError("bhPrint check right error, k=%d,rk=%d\n", k, rk);
-                    return;
-                }
+                printError("skipListPrint level: %d, linked node total: %d <> %d error\n",
+                           level, levelLinkedNodeTotal[level], total);
+                return;
             }
         }
-        printf("\n");
     }
 }
 #endif // DEBUG
-static int bhp(int i)
-{
-    return i >> 1;
-}
-static int bhl(int i)
-{
-    return i << 1;
-}
-static int bhr(int i)
-{
-    return (i << 1) + 1;
-}
 
 /*
- * ------------------------------------------------------------------- Skip List
+ * --------------------------------------------------------------------- Bit Set
  */
 
-static struct skipListNode *skipListNodeNew(int maxLevel, int key, void *val);
-static void skipListNodeFree(struct skipListNode *n);
-static int skipListInsertCore(struct skipList *sl, struct skipListNode *n);
-static int skipListDeleteCore(struct skipList *sl,
-                              struct skipListNode *p, struct skipListNode *c);
-static struct skipListNode *skipListGetCore(struct skipList *sl, int key);
-static int skipListHeadMaxLevel(struct skipList *sl);
-static int randomLevel(struct skipList *sl);
-struct skipList *skipListNew(int (*key)(void *))
+static int bitSetIndex(int i);
+static int bitSetBit(int i);
+static int bitSetResize(struct bitSet *bs, int index);
+struct bitSet *bitSetNew()
 {
-    if (!key)
+    struct bitSet *bs = malloc(sizeof(struct bitSet));
+    if (bs)
     {
-        printError("skipListNew key is NULL\n");
-        return 0;
+        bs->size = 0;
+        bs->els = NULL;
+        return bs;
     }
-    struct skipList *sl = malloc(sizeof(struct skipList));
-    if (sl)
+    else
     {
-        sl->time0 = time(0);
-        sl->maxLevel = 0;
-        sl->head = NULL;
-        sl->size = 0;
-        sl->key = key;
-        return sl;
+        printError("bitSetNew error\n");
+        return NULL;
     }
-    printError("skipListNew error\n");
-    return NULL;
 }
-void skipListFree(struct skipList *sl)
+void bitSetFree(struct bitSet *bs)
 {
-    if (sl)
+    if (bs)
     {
-        struct skipListNode *c = sl->head;
-        struct skipListNode *n = NULL;
-        while (c)
-        {
-            if (c->next)
-                n = *(c->next + 0);
-            else
-                n = NULL;
-            skipListNodeFree(c);
-            c = n;
-        }
-        free(sl);
+        if (bs->els)
+            memFree(bs->els);
+        free(bs);
     }
 }
-static struct skipListNode *skipListNodeNew(int maxLevel, int key, void *val)
+int bitSetOn(struct bitSet *bs, int i)
 {
-    struct skipListNode *n = malloc(sizeof(struct skipListNode));
-    if (n)
+    if (!bs)
     {
-        n->maxLevel = maxLevel;
-        n->next = calloc(maxLevel + 1, sizeof(struct skipListNode *));
-        if (!n->next)
-            goto newError;
-        n->key = key;
-        n->val = val;
-        return n;
+        printError("bitSetOn bs is NULL\n");
+        return 0;
     }
-newError:
-    if (n)
-        free(n);
-    printError("skipListNodeNew error\n");
-    return NULL;
+    if (i < 0)
+    {
+        printError("bitSetOn i is error\n");
+        return 0;
+    }
+    int index = bitSetIndex(i);
+    if (!bitSetResize(bs, index))
+    {
+        printError("bitSetOn resize error\n");
+        return 0;
+    }
+    int bit = bitSetBit(i);
+    *(bs->els + index) = (*(bs->els + index)) | (((UINT64)1) << bit);
+    return 1;
 }
-static void skipListNodeFree(struct skipListNode *n)
+int bitSetOff(struct bitSet *bs, int i)
 {
-    if (n)
+    if (!bs)
     {
-        if (n->next)
-            free(n->next);
-        free(n);
+        printError("bitSetOff bs is NULL\n");
+        return 0;
     }
+    if (i < 0)
+    {
+        printError("bitSetOff i is error\n");
+        return 0;
+    }
+    int index = bitSetIndex(i);
+    if (!bitSetResize(bs, index))
+    {
+        printError("bitSetOff resize error\n");
+        return 0;
+    }
+    int bit = bitSetBit(i);
+    *(bs->els + index) = (*(bs->els + index)) & (ULONG_MAX ^ (((UINT64)1) << bit));
+    return 1;
 }
-int skipListInsert(struct skipList *sl, void *el)
+int bitSetGet(struct bitSet *bs, int i)
 {
-    if (!sl)
+    if (!bs)
     {
-        printError("skipListInsert sl is NULL\n");
+        printError("bitSetOff bs is NULL\n");
         return 0;
     }
-    if (!el)
+    if (i < 0)
     {
-        printError("skipListInsert el is NULL\n");
+        printError("bitSetOff i is error\n");
         return 0;
     }
-
-    int key = sl->key(el);
-
-    if (sl->size)
+    int index = bitSetIndex(i);
+    if (index >= bs->size)
+        return 0;
+    int bit = bitSetBit(i);
+    return ((*(bs->els + index)) & (((UINT64)1) << bit)) ? 1 : 0;
+}
+#ifdef DEBUG
+void bitSetPrint(struct bitSet *bs)
+{
+    if (!bs)
+        return;
+    if (!bs->size)
+        return;
+    int i;
+    for (i = 0; i < 64; i++)
     {
-        struct skipListNode *n = skipListGetCore(sl, key);
-        if (n)
-        {
-            n->val = el;
-            return 1;
-        }
-
-        int level = randomLevel(sl);
-        n = skipListNodeNew(level, key, el);
-        if (!n)
+        if (i % 4 == 0)
         {
-            printError("skipListInsert error\n");
-            return 0;
+            if (i < 10)
+                printf("%d    ", i);
+            else
+                printf("%d   ", i);
         }
-
-        return skipListInsertCore(sl, n);
     }
-    else
+    printf("\n");
+    for (i = 0; i < bs->size; i++)
     {
-        // head node maxLevel is SL_MAX_LEVEL - 1
-        struct skipListNode *n = skipListNodeNew(SL_MAX_LEVEL - 1, key, el);
-        if (!n)
+        UINT64 x = *(bs->els + i);
+        int j;
+        for (j = 0; j < 64; j++)
         {
-            printError("skipListInsert error\n");
-            return 0;
+            if ((x & (((UINT64)1) << j)))
+                putchar('1');
+            else
+                putchar('0');
+            if ((j + 1) % 4 == 0)
+                putchar(' ');
         }
-
-        sl->maxLevel = 0;
-        sl->head = n;
-        sl->size++;
-
-        return 1;
+        putchar('\n');
     }
 }
-static int skipListInsertCore(struct skipList *sl, struct skipListNode *n)
+#endif // DEBUG
+static int bitSetIndex(int i)
 {
-    int level = n->maxLevel;
-    int key = n->key;
-    void *val = n->val;
-
-    if (key < sl->head->key)
+    return i / 64;
+}
+static int bitSetBit(int i)
+{
+    return i % 64;
+}
+static int bitSetResize(struct bitSet *bs, int index)
+{
+    int newSize = index + 1;
+    if (newSize > INT_MAX)
     {
-        n->key = sl->head->key;
-        n->val = sl->head->val;
-        sl->head->key = key;
-        sl->head->val = val;
-        key = n->key;
-        val = n->val;
+        printError("bitSetResize index is too large\n");
+        return 0;
     }
-
-    // do insert sl node
-    struct skipListNode *c = sl->head;
-    struct skipListNode *cn = NULL;
-    while (c && level >= 0)
+    if (newSize <= bs->size)
+        return 1;
+    if (bs->els)
     {
-        if (c->key < key)
+        UINT64 *newEls = (UINT64 *)memRealloc(bs->els, sizeof(UINT64) * newSize);
+        if (newEls)
         {
-            if ((cn = *(c->next + level)))
-            {
-                if (cn->key > key)
-                {
-                    // do insert [c, n, cn]
-                    *(c->next + level) = n;
-                    *(n->next + level) = cn;
-                    level--;
-                }
-                else
-                    c = cn;
-            }
-            else
+            if (newSize > bs->size)
             {
-                // do insert [c, n]
-                *(c->next + level) = n;
-                level--;
+                int i;
+                for (i = bs->size; i < newSize; i++)
+                    *(newEls + i) = 0;
             }
+            bs->els = newEls;
+            bs->size = newSize;
+            return 1;
+        }
+    }
+    else
+    {
+        bs->els = memCalloc(sizeof(UINT64) * newSize);
+        if (bs->els)
+        {
+            bs->size = newSize;
+            return 1;
         }
-        else
-            break;
     }
 
-    sl->size++;
+    printError("bitSetResize error\n");
+    return 0;
+}
 
-    sl->maxLevel = skipListHeadMaxLevel(sl);
+/*
+ * ---------------------------------------------------------------------- Filter
+ */
 
-    return 1;
+#define BLOOM_BLOCK_WORDS 8 // 512 bits, one cache line
+#define CUCKOO_SLOTS 4
+
+static double filterLog2(double x);
+static void bloomFilterMask(struct bloomFilter *f, UINT64 hash, UINT64 *mask);
+static UINT64 *bloomFilterBlock(struct bloomFilter *f, UINT64 hash);
+static void cuckooFilterIndex(struct cuckooFilter *f, UINT64 hash, UINT32 *fp, long *i1, long *i2);
+static long cuckooFilterAlt(struct cuckooFilter *f, long i, UINT32 fp);
+static UINT32 cuckooFilterGet(struct cuckooFilter *f, long i, int s);
+static void cuckooFilterSet(struct cuckooFilter *f, long i, int s, UINT32 fp);
+static int cuckooFilterPut(struct cuckooFilter *f, long i, UINT32 fp);
+static int cuckooFilterFind(struct cuckooFilter *f, long i, UINT32 fp);
+static int cuckooFilterInsert(struct cuckooFilter *f, long i, UINT32 fp);
+struct bloomFilter *bloomFilterNew(long n, double fpr)
+{
+    if (n < 1 || !(fpr > 0 && fpr < 1))
+    {
+        printError("bloomFilterNew n %ld or fpr %f is error\n", n, fpr);
+        return NULL;
+    }
+    // 1.44 log2(1 / fpr) bits per key for a plain Bloom filter, the keys crowd
+    // some blocks and the crowded ones dominate at a low fpr, so the headroom
+    // grows with log2(1 / fpr), 13% at 1% and 27% at 0.01%
+    double lg = filterLog2(1 / fpr);
+    double bits = (double)n * 1.44 * lg * (1 + lg / 50);
+    long blocks = (long)(bits / (BLOOM_BLOCK_WORDS * 64)) + 1;
+    if (blocks > INT_MAX / (BLOOM_BLOCK_WORDS * 64) - 1)
+    {
+        printError("bloomFilterNew n %ld is too large\n", n);
+        return NULL;
+    }
+    struct bloomFilter *f = malloc(sizeof(struct bloomFilter));
+    struct bitSet *bs = bitSetNew();
+    // one spare block to align the first one on a cache line
+    int last = (int)((blocks + 1) * BLOOM_BLOCK_WORDS * 64 - 1);
+    if (!f || !bs || !bitSetOn(bs, last) || !bitSetOff(bs, last))
+    {
+        printError("bloomFilterNew error\n");
+        free(f);
+        bitSetFree(bs);
+        return NULL;
+    }
+    f->bits = bs;
+    f->blocks = blocks;
+    f->first = (int)(((CACHE_LINE - ((size_t)bs->els & (CACHE_LINE - 1))) & (CACHE_LINE - 1)) /
+                     sizeof(UINT64));
+    f->k = (int)(lg + 0.5);
+    f->k = f->k < 1 ? 1 : f->k > 16 ? 16 : f->k;
+    return f;
 }
-int skipListDelete(struct skipList *sl, int key)
+void bloomFilterFree(struct bloomFilter *f)
 {
-    if (!sl)
+    if (f)
     {
-        printError("skipListDelete sl is NULL\n");
+        bitSetFree(f->bits);
+        free(f);
+    }
+}
+int bloomFilterAdd(struct bloomFilter *f, UINT64 hash)
+{
+    if (!f)
+    {
+        printError("bloomFilterAdd f is NULL\n");
         return 0;
     }
-
-    if (!sl->size)
+    UINT64 mask[BLOOM_BLOCK_WORDS];
+    bloomFilterMask(f, hash, mask);
+    UINT64 *b = bloomFilterBlock(f, hash);
+    int i;
+    for (i = 0; i < BLOOM_BLOCK_WORDS; i++)
+        b[i] |= mask[i];
+    return 1;
+}
+int bloomFilterContains(struct bloomFilter *f, UINT64 hash)
+{
+    if (!f)
+    {
+        printError("bloomFilterContains f is NULL\n");
         return 0;
-
-    int level = sl->maxLevel;
-    struct skipListNode *p = NULL;
-    struct skipListNode *c = sl->head;
-    struct skipListNode *n = NULL;
-    while (c)
+    }
+    UINT64 mask[BLOOM_BLOCK_WORDS];
+    bloomFilterMask(f, hash, mask);
+    UINT64 *b = bloomFilterBlock(f, hash);
+    int i;
+    for (i = 0; i < BLOOM_BLOCK_WORDS; i++)
     {
-        if (c->key == key)
-            return skipListDeleteCore(sl, p, c);
-        else if ((n = *(c->next + level)))
-        {
-            if (n->key < key)
-            {
-                p = c;
-                c = n;
-            }
-            else if (n->key > key)
-            {
-                if (level)
-                    level--;
-                else
-                    return 0;
-            }
-            else
-                return skipListDeleteCore(sl, c, n);
-        }
-        else
-        {
-            if (level)
-                level--;
-            else
-                return 0;
-        }
+        if ((b[i] & mask[i]) != mask[i])
+            return 0;
     }
-    return 0;
+    return 1;
 }
-static int skipListDeleteCore(struct skipList *sl,
-                              struct skipListNode *p, struct skipListNode *c)
+int bloomFilterContainsBatch(struct bloomFilter *f, const UINT64 *hashes, int n, UINT8 *maybe)
 {
-    if (sl->size == 1)
+    if (!f || !hashes || !maybe)
     {
-        skipListNodeFree(c);
-        sl->head = NULL;
+        printError("bloomFilterContainsBatch f, hashes or maybe is NULL\n");
+        return 0;
     }
-    else
+    int found = 0;
+    int i, j;
+    for (i = 0; i < n; i += FILTER_BATCH)
     {
-        if (c == sl->head)
-        {
-            struct skipListNode *n = *(c->next + 0);
-
-            c->key = n->key;
-            c->val = n->val;
-
-            p = c; // c is a head node, the node n just has one prev node
-            c = n;
-        }
-
-        int i;
-        for (i = c->maxLevel; i >= 0; i--)
-        {
-            struct skipListNode *n = NULL;
-            while (p)
-            {
-                if ((n = *(p->next + i)) == c)
-                {
-                    *(p->next + i) = *(c->next + i);
-                    break;
-                }
-                else
-                    p = n;
-            }
-        }
-
-        skipListNodeFree(c);
+        int m = n - i < FILTER_BATCH ? n - i : FILTER_BATCH;
+        // one line per key, fetch the group before testing it
+        for (j = 0; j < m; j++)
+            PREFETCH(bloomFilterBlock(f, hashes[i + j]));
+        for (j = 0; j < m; j++)
+            found += maybe[i + j] = (UINT8)bloomFilterContains(f, hashes[i + j]);
     }
-
-    sl->size--;
-
-    sl->maxLevel = skipListHeadMaxLevel(sl);
-
-    return 1;
+    return found;
 }
-void *skipListGet(struct skipList *sl, int key)
+struct cuckooFilter *cuckooFilterNew(long n, double fpr)
 {
-    if (!sl)
+    if (n < 1 || !(fpr > 0 && fpr < 1))
     {
-        printError("sl is NULL\n");
+        printError("cuckooFilterNew n %ld or fpr %f is error\n", n, fpr);
         return NULL;
     }
-    if (!sl->size)
+    // 2 buckets of 4 slots are checked, fpr is about 8 / 2 ^ fpBits, 32 bits
+    // are the most a slot holds
+    if (fpr < 8 / 4294967296.0)
+    {
+        printError("cuckooFilterNew fpr %g is below 8 / 2 ^ 32\n", fpr);
         return NULL;
-
-    struct skipListNode *n = skipListGetCore(sl, key);
-    return n ? n->val : NULL;
-}
-static struct skipListNode *skipListGetCore(struct skipList *sl, int key)
-{
-    if (!sl->size)
+    }
+    int fpBits = 8;
+    while (fpBits < 32 && 8 / (double)(1UL << fpBits) > fpr)
+        fpBits <<= 1;
+    // at most 95% full
+    long buckets = 1;
+    while (buckets * CUCKOO_SLOTS * 95 / 100 < n)
+        buckets <<= 1;
+    if (buckets > INT_MAX / (CUCKOO_SLOTS * fpBits))
+    {
+        printError("cuckooFilterNew n %ld is too large\n", n);
         return NULL;
-
-    int level = sl->maxLevel;
-    struct skipListNode *c = sl->head;
-    struct skipListNode *n = NULL;
-    while (c)
+    }
+    struct cuckooFilter *f = malloc(sizeof(struct cuckooFilter));
+    struct bitSet *bs = bitSetNew();
+    int last = (int)(buckets * CUCKOO_SLOTS * fpBits - 1);
+    if (!f || !bs || !bitSetOn(bs, last) || !bitSetOff(bs, last))
     {
-        if (c->key == key)
-            return c;
-        else if ((n = *(c->next + level)))
-        {
-            if (n->key < key)
-                c = n;
-            else if (n->key > key)
-            {
-                if (level)
-                    level--;
-                else
-                    return NULL;
-            }
-            else
-                return n;
-        }
-        else
-        {
-            if (level)
-                level--;
-            else
-                return NULL;
-        }
+        printError("cuckooFilterNew error\n");
+        free(f);
+        bitSetFree(bs);
+        return NULL;
     }
-    return NULL;
+    f->bits = bs;
+    f->buckets = buckets;
+    f->fpBits = fpBits;
+    f->size = 0;
+    f->seed = 0x9E3779B97F4A7C15UL;
+    f->stashed = 0;
+    f->stashFp = 0;
+    f->stashBucket = 0;
+    return f;
 }
-int skipListSize(struct skipList *sl)
+void cuckooFilterFree(struct cuckooFilter *f)
 {
-    return sl ? sl->size : 0;
+    if (f)
+    {
+        bitSetFree(f->bits);
+        free(f);
+    }
 }
-static int skipListHeadMaxLevel(struct skipList *sl)
+int cuckooFilterAdd(struct cuckooFilter *f, UINT64 hash)
 {
-    if (sl->size)
+    if (!f)
     {
-        int maxLevel = 0;
-        while (maxLevel < SL_MAX_LEVEL && *(sl->head->next + maxLevel))
-            maxLevel++;
-        return max(maxLevel - 1, 0);
+        printError("cuckooFilterAdd f is NULL\n");
+        return 0;
     }
-    else
-        return -1;
+    if (f->stashed)
+        return 0;
+    UINT32 fp;
+    long i1, i2;
+    cuckooFilterIndex(f, hash, &fp, &i1, &i2);
+    f->size++;
+    if (cuckooFilterPut(f, i1, fp) || cuckooFilterPut(f, i2, fp))
+        return 1;
+    cuckooFilterInsert(f, hash & 1 ? i1 : i2, fp);
+    return 1;
 }
-static int randomLevel(struct skipList *sl)
+int cuckooFilterRemove(struct cuckooFilter *f, UINT64 hash)
 {
-    sl->time0++;
-    srand(sl->time0);
-    int mask = 127;
-    int half = 64;
-    int level = 0;
-    while ((rand() & mask) < half)
-        level++;
-    level = level < SL_MAX_LEVEL ? level : SL_MAX_LEVEL - 1;
-    return level;
+    if (!f)
+    {
+        printError("cuckooFilterRemove f is NULL\n");
+        return 0;
+    }
+    UINT32 fp;
+    long i1, i2;
+    cuckooFilterIndex(f, hash, &fp, &i1, &i2);
+    int s = cuckooFilterFind(f, i1, fp);
+    long i = i1;
+    if (s < 0)
+        s = cuckooFilterFind(f, i = i2, fp);
+    if (s >= 0)
+        cuckooFilterSet(f, i, s, 0);
+    else if (f->stashed && f->stashFp == fp && (f->stashBucket == i1 || f->stashBucket == i2))
+        f->stashed = 0;
+    else
+        return 0;
+    f->size--;
+    // a slot is free now, the stashed victim may fit again
+    if (f->stashed)
+    {
+        f->stashed = 0;
+        cuckooFilterInsert(f, f->stashBucket, f->stashFp);
+    }
+    return 1;
 }
-#ifdef DEBUG
-void skipListPrint(struct skipList *sl, void (*print)(void *))
+int cuckooFilterContains(struct cuckooFilter *f, UINT64 hash)
 {
-    if (sl->size)
+    if (!f)
     {
-        int level = SL_MAX_LEVEL - 1; // sl->maxLevel;
-        // not include head
-        int levelLinkedNodeTotal[level + 1];
-        // init all element value 0
-        int i;
-        for (i = 0; i < level + 1; i++)
-            levelLinkedNodeTotal[i] = 0;
-
-        struct skipListNode *n = sl->head;
-        while (n)
-        {
-            if (n != sl->head)
-                for (i = 0; i <= n->maxLevel; i++)
-                    levelLinkedNodeTotal[i]++;
-            n = *(n->next + 0);
-        }
-
-        for (i = 0; i < level + 1; i++)
-            printDebug("level %d linked node total: %d\n", i, levelLinkedNodeTotal[i]);
-
-        for (; level >= 0; level--)
-        {
-            printDebug("skipListPrint check level linked node total: %d\n", level);
-
-            int total = 0;
-            struct skipListNode *p = NULL;
-            struct skipListNode *c = sl->head;
-            while (c)
-            {
-                if (c != sl->head)
-                    total++;
-                if (p && p->key > c->key)
-                {
-                    printError("skipListPrint linked node sort(prev: %d, curr: %d) error\n",
-                               p->key, c->key);
-                    return;
-                }
-                p = c;
-                c = *(c->next + level);
-            }
-            if (total != levelLinkedNodeTotal[level])
-            {
-                printError("skipListPrint level: %d, linked node total: %d <> %d error\n",
-                           level, levelLinkedNodeTotal[level], total);
-                return;
-            }
+        printError("cuckooFilterContains f is NULL\n");
+        return 0;
+    }
+    UINT32 fp;
+    long i1, i2;
+    cuckooFilterIndex(f, hash, &fp, &i1, &i2);
+    return cuckooFilterFind(f, i1, fp) >= 0 || cuckooFilterFind(f, i2, fp) >= 0 ||
+           (f->stashed && f->stashFp == fp && (f->stashBucket == i1 || f->stashBucket == i2));
+}
+int cuckooFilterContainsBatch(struct cuckooFilter *f, const UINT64 *hashes, int n, UINT8 *maybe)
+{
+    if (!f || !hashes || !maybe)
+    {
+        printError("cuckooFilterContainsBatch f, hashes or maybe is NULL\n");
+        return 0;
+    }
+    long bucketBits = CUCKOO_SLOTS * f->fpBits;
+    int found = 0;
+    int i, j;
+    for (i = 0; i < n; i += FILTER_BATCH)
+    {
+        int m = n - i < FILTER_BATCH ? n - i : FILTER_BATCH;
+        for (j = 0; j < m; j++)
+        {
+            UINT32 fp;
+            long i1, i2;
+            cuckooFilterIndex(f, hashes[i + j], &fp, &i1, &i2);
+            PREFETCH(f->bits->els + (i1 * bucketBits >> 6));
+            PREFETCH(f->bits->els + (i2 * bucketBits >> 6));
         }
+        for (j = 0; j < m; j++)
+            found += maybe[i + j] = (UINT8)cuckooFilterContains(f, hashes[i + j]);
     }
+    return found;
+}
+long cuckooFilterSize(struct cuckooFilter *f)
+{
+    return f ? f->size : 0;
+}
+static double filterLog2(double x)
+{
+    double r = 0;
+    while (x >= 2)
+    {
+        x /= 2;
+        r++;
+    }
+    while (x < 1)
+    {
+        x *= 2;
+        r--;
+    }
+    // x is in [1, 2), x - 1 is within 0.09 of log2(x)
+    return r + x - 1;
+}
+static void bloomFilterMask(struct bloomFilter *f, UINT64 hash, UINT64 *mask)
+{
+    // k bit positions from one hash, the top 9 bits of each step of a 64-bit
+    // LCG pick a bit of the block
+    UINT64 g = hashMix64(hash);
+    int i;
+    for (i = 0; i < BLOOM_BLOCK_WORDS; i++)
+        mask[i] = 0;
+    for (i = 0; i < f->k; i++)
+    {
+        UINT32 bit = (UINT32)(g >> 55);
+        mask[bit >> 6] |= 1UL << (bit & 63);
+        g = g * 0x9E3779B97F4A7C15UL + 0x632BE59BD9B4E019UL;
+    }
+}
+static UINT64 *bloomFilterBlock(struct bloomFilter *f, UINT64 hash)
+{
+    return f->bits->els + f->first + (long)(hash % (UINT64)f->blocks) * BLOOM_BLOCK_WORDS;
+}
+static void cuckooFilterIndex(struct cuckooFilter *f, UINT64 hash, UINT32 *fp, long *i1, long *i2)
+{
+    // mixed first as the Bloom filter does, small or patterned hashes would all
+    // share a fingerprint, the low bits pick the bucket, the high bits are the
+    // fingerprint, 0 marks empty
+    hash = hashMix64(hash);
+    UINT32 x = (UINT32)(hash >> 32);
+    if (f->fpBits < 32)
+        x &= (1U << f->fpBits) - 1;
+    *fp = x ? x : 1;
+    *i1 = (long)(hash & (UINT64)(f->buckets - 1));
+    *i2 = cuckooFilterAlt(f, *i1, *fp);
+}
+static long cuckooFilterAlt(struct cuckooFilter *f, long i, UINT32 fp)
+{
+    // an xor, the alternate of the alternate is the bucket itself
+    return i ^ (long)(hashMix64(fp) & (UINT64)(f->buckets - 1));
+}
+static UINT32 cuckooFilterGet(struct cuckooFilter *f, long i, int s)
+{
+    long bit = (i * CUCKOO_SLOTS + s) * f->fpBits;
+    UINT64 m = f->fpBits < 32 ? (1UL << f->fpBits) - 1 : 0xFFFFFFFFUL;
+    return (UINT32)((*(f->bits->els + (bit >> 6)) >> (bit & 63)) & m);
+}
+static void cuckooFilterSet(struct cuckooFilter *f, long i, int s, UINT32 fp)
+{
+    // fpBits divides 64, a fingerprint never spans two words
+    long bit = (i * CUCKOO_SLOTS + s) * f->fpBits;
+    UINT64 m = f->fpBits < 32 ? (1UL << f->fpBits) - 1 : 0xFFFFFFFFUL;
+    UINT64 *w = f->bits->els + (bit >> 6);
+    *w = (*w & ~(m << (bit & 63))) | ((UINT64)fp << (bit & 63));
+}
+static int cuckooFilterPut(struct cuckooFilter *f, long i, UINT32 fp)
+{
+    int s = cuckooFilterFind(f, i, 0);
+    if (s < 0)
+        return 0;
+    cuckooFilterSet(f, i, s, fp);
+    return 1;
+}
+static int cuckooFilterFind(struct cuckooFilter *f, long i, UINT32 fp)
+{
+    int s;
+    for (s = 0; s < CUCKOO_SLOTS; s++)
+    {
+        if (cuckooFilterGet(f, i, s) == fp)
+            return s;
+    }
+    return -1;
+}
+static int cuckooFilterInsert(struct cuckooFilter *f, long i, UINT32 fp)
+{
+    int n;
+    for (n = 0; n < CUCKOO_MAX_KICKS; n++)
+    {
+        if (cuckooFilterPut(f, i, fp))
+            return 1;
+        // kick a random fingerprint to its other bucket
+        f->seed ^= f->seed << 13;
+        f->seed ^= f->seed >> 7;
+        f->seed ^= f->seed << 17;
+        int s = (int)(f->seed % CUCKOO_SLOTS);
+        UINT32 old = cuckooFilterGet(f, i, s);
+        cuckooFilterSet(f, i, s, fp);
+        fp = old;
+        i = cuckooFilterAlt(f, i, fp);
+    }
+    f->stashed = 1;
+    f->stashFp = fp;
+    f->stashBucket = i;
+    return 0;
 }
-#endif // DEBUG
 
 /*
- * --------------------------------------------------------------------- Bit Set
+ * ---------------------------------------------------------------------- Sketch
  */
 
-static int bitSetIndex(int i);
-static int bitSetBit(int i);
-static int bitSetResize(struct bitSet *bs, int index);
-struct bitSet *bitSetNew()
+#define HLL_MIN_P 4
+#define HLL_MAX_P 18
+
+static int hyperLogLogSet(struct hyperLogLog *h, UINT32 reg, int rank);
+static int hyperLogLogDense(struct hyperLogLog *h);
+static void hyperLogLogMax(UINT8 *a, const UINT8 *b, long m);
+static double sketchLog(double x);
+static void topKSiftUp(struct topK *t, int i);
+static void topKSiftDown(struct topK *t, int i);
+static void topKSwap(struct topK *t, int i, int j);
+static int topKValCompare(void *a, void *b);
+static int topKCountCompare(const void *a, const void *b);
+struct hyperLogLog *hyperLogLogNew(int p)
 {
-    struct bitSet *bs = malloc(sizeof(struct bitSet));
-    if (bs)
+    if (p < HLL_MIN_P || p > HLL_MAX_P)
     {
-        bs->size = 0;
-        bs->els = NULL;
-        return bs;
+        printError("hyperLogLogNew p %d is not in [%d, %d]\n", p, HLL_MIN_P, HLL_MAX_P);
+        return NULL;
     }
-    else
+    struct hyperLogLog *h = malloc(sizeof(struct hyperLogLog));
+    if (!h)
     {
-        printError("bitSetNew error\n");
+        printError("hyperLogLogNew error\n");
         return NULL;
     }
+    h->p = p;
+    h->sparse = 1;
+    h->size = 0;
+    h->cap = 0;
+    h->list = NULL;
+    h->regs = NULL;
+    return h;
 }
-void bitSetFree(struct bitSet *bs)
+void hyperLogLogFree(struct hyperLogLog *h)
 {
-    if (bs)
+    if (h)
     {
-        if (bs->els)
-            free(bs->els);
-        free(bs);
+        free(h->list);
+        memFree(h->regs);
+        free(h);
     }
 }
-int bitSetOn(struct bitSet *bs, int i)
+int hyperLogLogAdd(struct hyperLogLog *h, UINT64 hash)
 {
-    if (!bs)
+    if (!h)
     {
-        printError("bitSetOn bs is NULL\n");
+        printError("hyperLogLogAdd h is NULL\n");
         return 0;
     }
-    if (i < 0)
+    // the top p bits pick the register, the rank is 1 + the leading zeros of
+    // the rest, a guard bit keeps it at most 64 - p + 1
+    UINT32 reg = (UINT32)(hash >> (64 - h->p));
+    UINT64 w = (hash << h->p) | (1UL << (h->p - 1));
+    return hyperLogLogSet(h, reg, __builtin_clzl(w) + 1);
+}
+long hyperLogLogCount(struct hyperLogLog *h)
+{
+    if (!h)
     {
-        printError("bitSetOn i is error\n");
+        printError("hyperLogLogCount h is NULL\n");
         return 0;
     }
-    int index = bitSetIndex(i);
-    if (!bitSetResize(bs, index))
+    long m = 1L << h->p;
+    long zeros = m;
+    double sum = 0;
+    long i;
+    if (h->sparse)
     {
-        printError("bitSetOn resize error\n");
-        return 0;
+        for (i = 0; i < h->size; i++)
+            sum += 1.0 / (double)(1UL << (h->list[i] & 0xFF));
+        zeros -= h->size;
+        sum += zeros;
     }
-    int bit = bitSetBit(i);
-    *(bs->els + index) = (*(bs->els + index)) | (((UINT64)1) << bit);
-    return 1;
+    else
+    {
+        for (i = 0; i < m; i++)
+        {
+            sum += 1.0 / (double)(1UL << h->regs[i]);
+            zeros -= h->regs[i] != 0;
+        }
+    }
+    double alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709 : 0.7213 / (1 + 1.079 / m);
+    double e = alpha * m * m / sum;
+    // linear counting while registers are still empty
+    if (e <= 2.5 * m && zeros)
+        e = m * sketchLog((double)m / (double)zeros);
+    return (long)(e + 0.5);
 }
-int bitSetOff(struct bitSet *bs, int i)
+int hyperLogLogMerge(struct hyperLogLog *dst, struct hyperLogLog *src)
 {
-    if (!bs)
+    if (!dst || !src)
     {
-        printError("bitSetOff bs is NULL\n");
+        printError("hyperLogLogMerge dst or src is NULL\n");
         return 0;
     }
-    if (i < 0)
+    if (dst->p != src->p)
     {
-        printError("bitSetOff i is error\n");
+        printError("hyperLogLogMerge p %d and %d differ\n", dst->p, src->p);
         return 0;
     }
-    int index = bitSetIndex(i);
-    if (!bitSetResize(bs, index))
+    long i;
+    if (src->sparse)
     {
-        printError("bitSetOff resize error\n");
+        for (i = 0; i < src->size; i++)
+        {
+            if (!hyperLogLogSet(dst, src->list[i] >> 8, src->list[i] & 0xFF))
+                return 0;
+        }
+        return 1;
+    }
+    if (dst->sparse && !hyperLogLogDense(dst))
         return 0;
+    hyperLogLogMax(dst->regs, src->regs, 1L << dst->p);
+    return 1;
+}
+struct countMinSketch *countMinSketchNew(double eps, double delta)
+{
+    if (!(eps > 0 && eps < 1) || !(delta > 0 && delta < 1))
+    {
+        printError("countMinSketchNew eps %f or delta %f is error\n", eps, delta);
+        return NULL;
     }
-    int bit = bitSetBit(i);
-    *(bs->els + index) = (*(bs->els + index)) & (ULONG_MAX ^ (((UINT64)1) << bit));
+    // width e / eps, depth ln(1 / delta)
+    long width = 1;
+    while (width < 2.718281828 / eps)
+        width <<= 1;
+    int depth = (int)sketchLog(1 / delta) + 1;
+    struct countMinSketch *s = malloc(sizeof(struct countMinSketch));
+    UINT64 *counts = memCalloc(sizeof(UINT64) * width * depth);
+    if (!s || !counts)
+    {
+        printError("countMinSketchNew error\n");
+        free(s);
+        memFree(counts);
+        return NULL;
+    }
+    s->width = width;
+    s->depth = depth;
+    s->total = 0;
+    s->counts = counts;
+    return s;
+}
+void countMinSketchFree(struct countMinSketch *s)
+{
+    if (s)
+    {
+        memFree(s->counts);
+        free(s);
+    }
+}
+int countMinSketchAdd(struct countMinSketch *s, UINT64 hash, UINT64 n)
+{
+    if (!s)
+    {
+        printError("countMinSketchAdd s is NULL\n");
+        return 0;
+    }
+    // one column per row by double hashing
+    UINT64 g = hashMix64(hash);
+    UINT64 h1 = g & 0xFFFFFFFFUL;
+    UINT64 h2 = (g >> 32) | 1;
+    int r;
+    for (r = 0; r < s->depth; r++)
+        s->counts[r * s->width + (long)((h1 + r * h2) & (UINT64)(s->width - 1))] += n;
+    s->total += n;
     return 1;
 }
-int bitSetGet(struct bitSet *bs, int i)
+UINT64 countMinSketchEstimate(struct countMinSketch *s, UINT64 hash)
 {
-    if (!bs)
+    if (!s)
     {
-        printError("bitSetOff bs is NULL\n");
+        printError("countMinSketchEstimate s is NULL\n");
         return 0;
     }
-    if (i < 0)
+    UINT64 g = hashMix64(hash);
+    UINT64 h1 = g & 0xFFFFFFFFUL;
+    UINT64 h2 = (g >> 32) | 1;
+    UINT64 min = s->total;
+    int r;
+    for (r = 0; r < s->depth; r++)
     {
-        printError("bitSetOff i is error\n");
+        UINT64 c = s->counts[r * s->width + (long)((h1 + r * h2) & (UINT64)(s->width - 1))];
+        if (c < min)
+            min = c;
+    }
+    return min;
+}
+int countMinSketchMerge(struct countMinSketch *dst, struct countMinSketch *src)
+{
+    if (!dst || !src)
+    {
+        printError("countMinSketchMerge dst or src is NULL\n");
         return 0;
     }
-    int index = bitSetIndex(i);
-    if (index >= bs->size)
+    if (dst->width != src->width || dst->depth != src->depth)
+    {
+        printError("countMinSketchMerge shapes differ\n");
         return 0;
-    int bit = bitSetBit(i);
-    return ((*(bs->els + index)) & (((UINT64)1) << bit)) ? 1 : 0;
+    }
+    long i;
+    for (i = 0; i < dst->width * dst->depth; i++)
+        dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    return 1;
 }
-#ifdef DEBUG
-void bitSetPrint(struct bitSet *bs)
+struct topK *topKNew(int k, int (*keyHash)(void *), int (*keyCompare)(void *, void *))
 {
-    if (!bs)
-        return;
-    if (!bs->size)
-        return;
-    int i;
-    for (i = 0; i < 64; i++)
+    if (k < 1 || !keyHash || !keyCompare)
     {
-        if (i % 4 == 0)
-        {
-            if (i < 10)
-                printf("%d    ", i);
-            else
-                printf("%d   ", i);
-        }
+        printError("topKNew k %d, keyHash or keyCompare is error\n", k);
+        return NULL;
     }
-    printf("\n");
-    for (i = 0; i < bs->size; i++)
+    struct topK *t = malloc(sizeof(struct topK));
+    if (!t)
     {
-        UINT64 x = *(bs->els + i);
-        int j;
-        for (j = 0; j < 64; j++)
-        {
-            if ((x & (((UINT64)1) << j)))
-                putchar('1');
-            else
-                putchar('0');
-            if ((j + 1) % 4 == 0)
-                putchar(' ');
-        }
-        putchar('\n');
+        printError("topKNew error\n");
+        return NULL;
+    }
+    t->k = k;
+    t->size = 0;
+    t->counters = calloc(k, sizeof(struct topKCounter));
+    t->heap = malloc(sizeof(struct topKCounter *) * k);
+    t->index = dictNew(keyHash, keyCompare, topKValCompare);
+    if (!t->counters || !t->heap || !t->index)
+    {
+        printError("topKNew error\n");
+        topKFree(t);
+        return NULL;
     }
+    return t;
 }
-#endif // DEBUG
-static int bitSetIndex(int i)
+void topKFree(struct topK *t)
 {
-    return i / 64;
+    if (t)
+    {
+        free(t->counters);
+        free(t->heap);
+        dictFree(t->index);
+        free(t);
+    }
 }
-static int bitSetBit(int i)
+int topKAdd(struct topK *t, void *key, UINT64 n)
 {
-    return i % 64;
+    if (!t || !key)
+    {
+        printError("topKAdd t or key is NULL\n");
+        return 0;
+    }
+    struct topKCounter *c = dictGet(t->index, key);
+    if (c)
+    {
+        // a larger count moves down the min-heap
+        c->count += n;
+        topKSiftDown(t, c->pos);
+        return 1;
+    }
+    // indexed first, a failed put leaves every counter as it was
+    c = t->size < t->k ? t->counters + t->size : t->heap[0];
+    if (!dictPut(t->index, key, c))
+        return 0;
+    if (t->size < t->k)
+    {
+        c->pos = t->size;
+        c->count = n;
+        c->error = 0;
+        t->heap[t->size++] = c;
+        c->key = key;
+        topKSiftUp(t, c->pos);
+    }
+    else
+    {
+        // the smallest counter takes the key over, its count bounds how often
+        // the key may have been seen before
+        dictRemove(t->index, c->key);
+        c->key = key;
+        c->error = c->count;
+        c->count += n;
+        topKSiftDown(t, 0);
+    }
+    return 1;
 }
-static int bitSetResize(struct bitSet *bs, int index)
+int topKList(struct topK *t, struct topKCounter *out)
 {
-    int newSize = index + 1;
-    if (newSize > INT_MAX)
+    if (!t || !out)
     {
-        printError("bitSetResize index is too large\n");
+        printError("topKList t or out is NULL\n");
         return 0;
     }
-    if (newSize <= bs->size)
+    memcpy(out, t->counters, sizeof(struct topKCounter) * t->size);
+    qsort(out, t->size, sizeof(struct topKCounter), topKCountCompare);
+    return t->size;
+}
+static int hyperLogLogSet(struct hyperLogLog *h, UINT32 reg, int rank)
+{
+    if (!h->sparse)
+    {
+        if (h->regs[reg] < rank)
+            h->regs[reg] = (UINT8)rank;
         return 1;
-    if (bs->els)
+    }
+    long lo = 0;
+    long hi = h->size;
+    while (lo < hi)
     {
-        UINT64 *newEls = (UINT64 *)realloc(bs->els, sizeof(UINT64) * newSize);
-        if (newEls)
-        {
-            if (newSize > bs->size)
-            {
-                int i;
-                for (i = bs->size; i < newSize; i++)
-                    *(bs->els + i) = 0;
-            }
-            bs->els = newEls;
-            bs->size = newSize;
-            return 1;
-        }
+        long mid = lo + (hi - lo) / 2;
+        if ((h->list[mid] >> 8) < reg)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    else
+    if (lo < h->size && (h->list[lo] >> 8) == reg)
     {
-        bs->els = calloc(newSize, sizeof(UINT64));
-        if (bs->els)
+        if ((int)(h->list[lo] & 0xFF) < rank)
+            h->list[lo] = reg << 8 | rank;
+        return 1;
+    }
+    // an entry takes 4 bytes, past a quarter of the registers dense is smaller
+    if (h->size >= (1L << h->p) / 4)
+        return hyperLogLogDense(h) && hyperLogLogSet(h, reg, rank);
+    if (h->size == h->cap)
+    {
+        long cap = h->cap ? h->cap << 1 : 16;
+        UINT32 *list = realloc(h->list, sizeof(UINT32) * cap);
+        if (!list)
         {
-            bs->size = newSize;
-            return 1;
+            printError("hyperLogLogAdd error\n");
+            return 0;
         }
+        h->list = list;
+        h->cap = cap;
     }
-
-    printError("bitSetResize error\n");
-    return 0;
+    memmove(h->list + lo + 1, h->list + lo, sizeof(UINT32) * (h->size - lo));
+    h->list[lo] = reg << 8 | rank;
+    h->size++;
+    return 1;
+}
+static int hyperLogLogDense(struct hyperLogLog *h)
+{
+    UINT8 *regs = memCalloc(1L << h->p);
+    if (!regs)
+    {
+        printError("hyperLogLog dense error\n");
+        return 0;
+    }
+    long i;
+    for (i = 0; i < h->size; i++)
+        regs[h->list[i] >> 8] = (UINT8)(h->list[i] & 0xFF);
+    free(h->list);
+    h->list = NULL;
+    h->size = h->cap = 0;
+    h->regs = regs;
+    h->sparse = 0;
+    return 1;
+}
+static void hyperLogLogMax(UINT8 *a, const UINT8 *b, long m)
+{
+    // ranks stay below 128, so (x | 0x80) - y per byte never borrows and its top
+    // bit is set where x >= y, 8 registers a step and the loop vectorizes
+    const UINT64 high = 0x8080808080808080UL;
+    long i;
+    for (i = 0; i < m; i += 8)
+    {
+        UINT64 x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        UINT64 ge = ((((x | high) - y) & high) >> 7) * 0xFF;
+        x = (x & ge) | (y & ~ge);
+        memcpy(a + i, &x, 8);
+    }
+}
+static double sketchLog(double x)
+{
+    // x = 2 ^ e * f with f in [1, 2), ln f = 2 atanh((f - 1) / (f + 1))
+    int e = 0;
+    while (x >= 2)
+    {
+        x /= 2;
+        e++;
+    }
+    while (x < 1)
+    {
+        x *= 2;
+        e--;
+    }
+    double y = (x - 1) / (x + 1);
+    double term = y;
+    double sum = 0;
+    int i;
+    for (i = 1; i < 40; i += 2)
+    {
+        sum += term / i;
+        term *= y * y;
+    }
+    return 2 * sum + e * 0.6931471805599453;
+}
+static void topKSiftUp(struct topK *t, int i)
+{
+    while (i > 0 && t->heap[(i - 1) / 2]->count > t->heap[i]->count)
+    {
+        topKSwap(t, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+static void topKSiftDown(struct topK *t, int i)
+{
+    for (;;)
+    {
+        int l = 2 * i + 1;
+        int m = i;
+        if (l < t->size && t->heap[l]->count < t->heap[m]->count)
+            m = l;
+        if (l + 1 < t->size && t->heap[l + 1]->count < t->heap[m]->count)
+            m = l + 1;
+        if (m == i)
+            return;
+        topKSwap(t, i, m);
+        i = m;
+    }
+}
+static void topKSwap(struct topK *t, int i, int j)
+{
+    struct topKCounter *c = t->heap[i];
+    t->heap[i] = t->heap[j];
+    t->heap[j] = c;
+    t->heap[i]->pos = i;
+    t->heap[j]->pos = j;
+}
+static int topKValCompare(void *a, void *b)
+{
+    return a != b;
+}
+static int topKCountCompare(const void *a, const void *b)
+{
+    UINT64 x = ((const struct topKCounter *)a)->count;
+    UINT64 y = ((const struct topKCounter *)b)->count;
+    return x < y ? 1 : x > y ? -1 : 0;
 }
@@ -1,6 +1,9 @@
 #ifndef MYCDATA_H_
 #define MYCDATA_H_
 
+#include <stddef.h>
+#include <pthread.h>
+
 #ifndef INT8
 #define INT8 char
 #endif // INT8
@@ -33,6 +36,18 @@
 #define UINT64 unsigned long int
 #endif // UINT64
 
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif // CACHE_LINE
+
+#ifndef UNUSED
+#ifdef __GNUC__
+#define UNUSED __attribute__((unused))
+#else
+#define UNUSED
+#endif // __GNUC__
+#endif // UNUSED
+
 /*
  * --------------------------------------------------------------- Print Message
  */
@@ -42,6 +57,138 @@ void printWarn(const char *msg, ...);
 void printInfo(const char *msg, ...);
 void printDebug(const char *msg, ...);
 
+/*
+ * ------------------------------------------------------------------------ Hash
+ */
+
+UINT64 hashMix64(UINT64 x);
+UINT64 hashBytes(const void *p, long len, UINT64 seed);
+
+/*
+ * ---------------------------------------------------------------------- Growth
+ */
+
+/*
+ * a growth policy gets the current cap and the count needed and returns the new
+ * cap, at least need, growHugePage grows a large array one huge page at a time
+ */
+
+#ifndef GROW_HUGE_PAGE
+#define GROW_HUGE_PAGE (2L << 20)
+#endif // GROW_HUGE_PAGE
+
+int growDouble(int cap, int need);
+int growHalf(int cap, int need);
+int growHugePage(int cap, int need);
+
+/*
+ * ---------------------------------------------------------------------- Memory
+ */
+
+/*
+ * the large arrays (Dict table, binaryHeap table, Stack, Queue and bitSet
+ * elements) come from memAlloc, on linux an array of at least the mmap threshold
+ * is mmap'ed with MADV_HUGEPAGE and grown with mremap, 0 (the default) keeps
+ * every array on malloc
+ */
+
+#ifndef MEM_MMAP_THRESHOLD
+#define MEM_MMAP_THRESHOLD 0
+#endif // MEM_MMAP_THRESHOLD
+
+void memSetMmapThreshold(size_t bytes);
+void *memAlloc(size_t size);
+void *memCalloc(size_t size);
+void *memRealloc(void *p, size_t size);
+void memFree(void *p);
+
+/*
+ * ----------------------------------------------------------------------- Stats
+ */
+
+/*
+ * build with -D MYCDATA_STATS to count node allocations, resizes, rotations and
+ * chain or level walks and to time put/get/remove, every dict, avl tree, rb
+ * tree and skip list keeps its own counters, read them with dictOpStats,
+ * avlTreeOpStats, rbTreeOpStats or skipListOpStats, without the flag nothing is
+ * counted and those return NULL
+ */
+
+// log-linear buckets, 2 ^ STATS_SUB_BITS per power of 2
+#ifndef STATS_SUB_BITS
+#define STATS_SUB_BITS 3
+#endif // STATS_SUB_BITS
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+
+struct statsHistogram
+{
+    UINT64 count;
+    // ns
+    UINT64 sum;
+    UINT64 max;
+    UINT64 buckets[STATS_BUCKETS];
+};
+struct opStats
+{
+    UINT64 allocs;
+    UINT64 frees;
+    UINT64 resizes;
+    UINT64 rotations;
+    // dict chain walks, skip list searches
+    UINT64 walks;
+    // entries visited, skip list hops
+    UINT64 steps;
+    // longest walk
+    UINT64 maxSteps;
+    struct statsHistogram insert;
+    struct statsHistogram lookup;
+    struct statsHistogram remove;
+};
+void statsReset(struct opStats *s);
+UINT64 statsPercentile(struct statsHistogram *h, double q);
+void statsDump(struct opStats *s, const char *name);
+
+/*
+ * -------------------------------------------------------------------- Snapshot
+ */
+
+/*
+ * xxxSave writes a versioned binary file in native byte order, the header then a
+ * length prefixed record per element (key then val for a Dict, trees and skip list
+ * in key order), xxxLoad maps the file and bulk builds an empty container, the
+ * Dict table is sized once and the trees and skip list are linked straight from
+ * the sorted records, on error it keeps the records read so far, a header whose
+ * count cannot fit in the file is rejected before anything is sized from it
+ * encode writes x into buf when it fits in cap and returns its size either way,
+ * -1 on error, decode rebuilds an element from len bytes at buf, release, when
+ * not NULL, takes back a decoded element the load rejects
+ */
+
+#define SNAPSHOT_MAGIC 0x4443594DU // "MYCD"
+#define SNAPSHOT_VERSION 1
+
+#define SNAPSHOT_DICT 1
+#define SNAPSHOT_AVL_TREE 2
+#define SNAPSHOT_RB_TREE 3
+#define SNAPSHOT_SKIP_LIST 4
+#define SNAPSHOT_RO_DICT 5
+
+struct snapshotHeader
+{
+    UINT32 magic;
+    UINT32 version;
+    UINT32 type;
+    UINT32 reserved;
+    UINT64 count;
+};
+struct snapshotCodec
+{
+    long (*encode)(void *x, void *buf, long cap, void *arg);
+    void *(*decode)(const void *buf, long len, void *arg);
+    void *arg;
+    void (*release)(void *x, void *arg);
+};
+
 /*
  * ----------------------------------------------------------------------- Stack
  */
@@ -51,8 +198,13 @@ struct Stack
     void **els;
     int cap;
     int size;
+    int (*grow)(int cap, int need);
 };
 struct Stack *stackNew();
+struct Stack *stackNewWithCapacity(int cap);
+int stackReserve(struct Stack *p, int cap);
+int stackShrinkToFit(struct Stack *p);
+void stackSetGrowth(struct Stack *p, int (*grow)(int, int));
 void stackFree(struct Stack *p);
 int stackPush(struct Stack *p, void *el);
 void *stackPop(struct Stack *p);
@@ -64,6 +216,11 @@ void stackClear(struct Stack *p);
  * ----------------------------------------------------------------------- Queue
  */
 
+/*
+ * cap is a power of 2, head is the first element and tail the next free slot, a
+ * growth policy result is rounded up to a power of 2
+ */
+
 struct Queue
 {
     void **els;
@@ -71,15 +228,140 @@ struct Queue
     int size;
     int head;
     int tail;
+    int (*grow)(int cap, int need);
 };
 struct Queue *queueNew();
+struct Queue *queueNewWithCapacity(int cap);
+int queueReserve(struct Queue *p, int cap);
+int queueShrinkToFit(struct Queue *p);
+void queueSetGrowth(struct Queue *p, int (*grow)(int, int));
 void queueFree(struct Queue *p);
 int queueOffer(struct Queue *p, void *el);
 void *queuePoll(struct Queue *p);
+int queueOfferBatch(struct Queue *p, void **els, int n);
+int queuePollBatch(struct Queue *p, void **els, int n);
 void *queuePeek(struct Queue *p);
 int queueSize(struct Queue *p);
 void queueClear(struct Queue *p);
 
+/*
+ * ------------------------------------------------------------------ Ring Queue
+ */
+
+/*
+ * bounded lock-free rings, cap is rounded up to a power of 2, offer returns 0 when
+ * full and poll returns NULL when empty
+ * spscRing: one producer and one consumer, each keeps a cached copy of the other
+ * index so the shared line is read only when the ring looks full or empty
+ * mpmcRing: any number of producers and consumers, every cell carries a sequence
+ * number (Vyukov), a position is claimed with one CAS
+ */
+
+struct spscRing
+{
+    void **els;
+    UINT64 mask;
+    char pad0[CACHE_LINE];
+    UINT64 head;
+    UINT64 tailCache;
+    char pad1[CACHE_LINE];
+    UINT64 tail;
+    UINT64 headCache;
+    char pad2[CACHE_LINE];
+};
+struct spscRing *spscRingNew(int cap);
+void spscRingFree(struct spscRing *r);
+int spscRingOffer(struct spscRing *r, void *el);
+void *spscRingPoll(struct spscRing *r);
+int spscRingOfferBatch(struct spscRing *r, void **els, int n);
+int spscRingPollBatch(struct spscRing *r, void **els, int n);
+int spscRingSize(struct spscRing *r);
+
+struct mpmcRingCell
+{
+    UINT64 seq;
+    void *el;
+};
+struct mpmcRing
+{
+    struct mpmcRingCell *cells;
+    UINT64 mask;
+    char pad0[CACHE_LINE];
+    UINT64 tail;
+    char pad1[CACHE_LINE];
+    UINT64 head;
+    char pad2[CACHE_LINE];
+};
+struct mpmcRing *mpmcRingNew(int cap);
+void mpmcRingFree(struct mpmcRing *r);
+int mpmcRingOffer(struct mpmcRing *r, void *el);
+void *mpmcRingPoll(struct mpmcRing *r);
+int mpmcRingOfferBatch(struct mpmcRing *r, void **els, int n);
+int mpmcRingPollBatch(struct mpmcRing *r, void **els, int n);
+int mpmcRingSize(struct mpmcRing *r);
+
+/*
+ * ---------------------------------------------------------------- Work Stealing
+ */
+
+/*
+ * Chase-Lev deque, the owner pushes and pops at the bottom like a Stack, thieves
+ * steal at the top like a Queue, the array grows and the old one is kept until
+ * wsDequeFree since a thief may still read it
+ */
+
+struct wsDequeArray
+{
+    long cap;
+    void **els;
+};
+struct wsDeque
+{
+    long top;
+    char pad0[CACHE_LINE];
+    long bottom;
+    struct wsDequeArray *array;
+    struct Stack *retired;
+    char pad1[CACHE_LINE];
+};
+struct wsDeque *wsDequeNew(int cap);
+void wsDequeFree(struct wsDeque *d);
+int wsDequePush(struct wsDeque *d, void *el);
+void *wsDequePop(struct wsDeque *d);
+void *wsDequeSteal(struct wsDeque *d);
+long wsDequeSize(struct wsDeque *d);
+
+/*
+ * each worker runs the tasks of its own deque, then the shared queue, then steals,
+ * a task submitted from a worker goes to that worker's deque
+ */
+
+struct threadPoolWorker
+{
+    struct threadPool *pool;
+    struct wsDeque *deque;
+    pthread_t tid;
+    unsigned int seed;
+};
+struct threadPool
+{
+    struct threadPoolWorker *workers;
+    int n;
+    struct Queue *queue;
+    long queued;
+    long pending;
+    int idle;
+    int stop;
+    pthread_key_t key;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+};
+struct threadPool *threadPoolNew(int n);
+void threadPoolFree(struct threadPool *pool);
+int threadPoolSubmit(struct threadPool *pool, void (*fn)(void *), void *arg);
+void threadPoolWait(struct threadPool *pool);
+
 /*
  * -------------------------------------------------------------------- Avl Tree
  */
@@ -95,6 +377,8 @@ struct avlTree
     struct avlTreeNode *root;
     int size;
     int (*key)(void *);
+    // counters of this container, NULL unless built with MYCDATA_STATS
+    struct opStats *stats;
 };
 struct avlTree *avlTreeNew(int (*key)(void *));
 void avlTreeFree(struct avlTree *p);
@@ -103,6 +387,9 @@ int avlTreeRemove(struct avlTree *p, void *el);
 void *avlTreeSearch(struct avlTree *p, void *el);
 void *avlTreeFindMin(struct avlTree *p);
 void *avlTreeFindMax(struct avlTree *p);
+int avlTreeSave(struct avlTree *p, const char *path, struct snapshotCodec *el);
+int avlTreeLoad(struct avlTree *p, const char *path, struct snapshotCodec *el);
+struct opStats *avlTreeOpStats(struct avlTree *p);
 #ifdef DEBUG
 void avlTreePrint(struct avlTree *p, void (*printVal)(void *));
 #endif // DEBUG
@@ -135,6 +422,8 @@ struct rbTree
     struct rbTreeNode *root;
     int size;
     int (*key)(void *);
+    // counters of this container, NULL unless built with MYCDATA_STATS
+    struct opStats *stats;
 };
 struct rbTree *rbTreeNew(int (*key)(void *));
 void rbTreeFree(struct rbTree *t);
@@ -143,8 +432,11 @@ int rbTreeDelete(struct rbTree *t, void *el);
 void *rbTreeSearch(struct rbTree *t, void *el);
 void *rbTreeFindMin(struct rbTree *t);
 void *rbTreeFindMax(struct rbTree *t);
+int rbTreeSave(struct rbTree *t, const char *path, struct snapshotCodec *el);
+int rbTreeLoad(struct rbTree *t, const char *path, struct snapshotCodec *el);
+struct opStats *rbTreeOpStats(struct rbTree *t);
 static struct rbTreeNode RB_NIL2;
-static struct rbTreeNode *RB_NIL = &RB_NIL2;
+static struct rbTreeNode *RB_NIL UNUSED = &RB_NIL2;
 #ifdef DEBUG
 void rbTreePrint(struct rbTree *t, void (*printVal)(void *));
 #endif // DEBUG
@@ -164,6 +456,9 @@ struct List
     struct listNode *head;
     struct listNode *tail;
     int size;
+    // optional, open addressing set of nodes keyed by the val pointer
+    struct listNode **index;
+    int indexCap;
 };
 struct List *listNew();
 void listFree(struct List *l);
@@ -175,14 +470,191 @@ void *listHead(struct List *l);
 void *listTail(struct List *l);
 int listContains(struct List *l, void *el);
 int listSize(struct List *l);
+int listIndexOn(struct List *l);
+int listRemoveValue(struct List *l, void *el);
+
+/*
+ * ------------------------------------------------------------------- Intrusive
+ */
+
+/* the link lives inside the user struct, containerOf gets the struct back */
+
+#ifndef containerOf
+#define containerOf(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#endif // containerOf
+
+struct iListLink
+{
+    struct iListLink *prev;
+    struct iListLink *next;
+};
+struct iList
+{
+    struct iListLink *head;
+    struct iListLink *tail;
+    int size;
+};
+void iListInit(struct iList *l);
+void iListAddHead(struct iList *l, struct iListLink *n);
+void iListAddTail(struct iList *l, struct iListLink *n);
+void iListInsertBefore(struct iList *l, struct iListLink *at, struct iListLink *n);
+void iListRemove(struct iList *l, struct iListLink *n);
+struct iListLink *iListHead(struct iList *l);
+struct iListLink *iListTail(struct iList *l);
+int iListSize(struct iList *l);
+
+struct irbNode
+{
+    struct irbNode *parent;
+    struct irbNode *left;
+    struct irbNode *right;
+    int color;
+};
+struct irbTree
+{
+    struct irbNode *root;
+    int size;
+    int (*compare)(struct irbNode *, struct irbNode *);
+};
+void irbTreeInit(struct irbTree *t, int (*compare)(struct irbNode *, struct irbNode *));
+struct irbNode *irbTreeInsert(struct irbTree *t, struct irbNode *n);
+void irbTreeDelete(struct irbTree *t, struct irbNode *n);
+struct irbNode *irbTreeSearch(struct irbTree *t, struct irbNode *key);
+struct irbNode *irbTreeFindMin(struct irbTree *t);
+struct irbNode *irbTreeFindMax(struct irbTree *t);
+struct irbNode *irbTreeNext(struct irbNode *n);
+struct irbNode *irbTreePrev(struct irbNode *n);
+
+struct iavlNode
+{
+    struct iavlNode *parent;
+    struct iavlNode *left;
+    struct iavlNode *right;
+    int height;
+};
+struct iavlTree
+{
+    struct iavlNode *root;
+    int size;
+    int (*compare)(struct iavlNode *, struct iavlNode *);
+};
+void iavlTreeInit(struct iavlTree *t, int (*compare)(struct iavlNode *, struct iavlNode *));
+struct iavlNode *iavlTreeInsert(struct iavlTree *t, struct iavlNode *n);
+void iavlTreeDelete(struct iavlTree *t, struct iavlNode *n);
+struct iavlNode *iavlTreeSearch(struct iavlTree *t, struct iavlNode *key);
+struct iavlNode *iavlTreeFindMin(struct iavlTree *t);
+struct iavlNode *iavlTreeFindMax(struct iavlTree *t);
+struct iavlNode *iavlTreeNext(struct iavlNode *n);
+struct iavlNode *iavlTreePrev(struct iavlNode *n);
+
+/*
+ * --------------------------------------------------------------- Unrolled List
+ */
+
+/* linked list of small arrays, 13 values make a 128 bytes node */
+
+#ifndef UL_NODE_CAP
+#define UL_NODE_CAP 13
+#endif // UL_NODE_CAP
+
+struct unrolledListNode
+{
+    struct unrolledListNode *prev;
+    struct unrolledListNode *next;
+    int size;
+    void *vals[UL_NODE_CAP];
+};
+struct unrolledList
+{
+    struct unrolledListNode *head;
+    struct unrolledListNode *tail;
+    int size;
+};
+struct unrolledList *unrolledListNew();
+void unrolledListFree(struct unrolledList *l);
+int unrolledListAdd(struct unrolledList *l, void *el);
+int unrolledListSet(struct unrolledList *l, int i, void *el);
+int unrolledListRemove(struct unrolledList *l, int i);
+void *unrolledListGet(struct unrolledList *l, int i);
+void *unrolledListHead(struct unrolledList *l);
+void *unrolledListTail(struct unrolledList *l);
+int unrolledListContains(struct unrolledList *l, void *el);
+int unrolledListSize(struct unrolledList *l);
+
+/*
+ * ------------------------------------------------------------------ Treap List
+ */
+
+/* implicit treap, position is the left subtree size, O(log n) get set insert remove */
+
+struct treapListNode
+{
+    struct treapListNode *left;
+    struct treapListNode *right;
+    UINT32 priority;
+    int size;
+    void *val;
+};
+struct treapList
+{
+    struct treapListNode *root;
+    UINT32 seed;
+};
+struct treapList *treapListNew();
+void treapListFree(struct treapList *l);
+int treapListAdd(struct treapList *l, void *el);
+int treapListInsert(struct treapList *l, int i, void *el);
+int treapListSet(struct treapList *l, int i, void *el);
+int treapListRemove(struct treapList *l, int i);
+void *treapListGet(struct treapList *l, int i);
+void *treapListHead(struct treapList *l);
+void *treapListTail(struct treapList *l);
+int treapListContains(struct treapList *l, void *el);
+int treapListSize(struct treapList *l);
 
 /*
  * ------------------------------------------------------------------------ Dict
  */
 
+#ifndef DICT_BATCH
+#define DICT_BATCH 16
+#endif // DICT_BATCH
+
+// the table takes sizeof(void *) * cap bytes, that must not wrap a size_t
+#ifndef DICT_MAX_CAP
+#define DICT_MAX_CAP (1L << 60)
+#endif // DICT_MAX_CAP
+
+#ifndef DICT_LOAD_FACTOR
+#define DICT_LOAD_FACTOR 0.75f
+#endif // DICT_LOAD_FACTOR
+
+/*
+ * the bucket index is the low bits of the key hash, mixed by hashMix64 by
+ * default, DICT_MIX_NONE uses the hash as it is and suits hashes that are
+ * already uniform, each resize checks the chains and a Dict whose hash
+ * clusters more than DICT_CLUSTER_FACTOR times the uniform lookup cost
+ * switches to hashMix64, or warns when it mixes already
+ */
+
+#define DICT_MIX_NONE 0
+#define DICT_MIX_64 1
+
+#ifndef DICT_CLUSTER_FACTOR
+#define DICT_CLUSTER_FACTOR 4
+#endif // DICT_CLUSTER_FACTOR
+
+#ifndef DICT_CLUSTER_MIN
+#define DICT_CLUSTER_MIN 64
+#endif // DICT_CLUSTER_MIN
+
+#ifndef DICT_STATS_CHAINS
+#define DICT_STATS_CHAINS 16
+#endif // DICT_STATS_CHAINS
+
 struct dictEntry
 {
-    int hash;
+    UINT64 hash;
     void *key;
     void *val;
     struct dictEntry *next;
@@ -190,26 +662,468 @@ struct dictEntry
 struct Dict
 {
     struct dictEntry **table;
-    int threshold;
-    int cap;
-    int size;
+    long threshold;
+    long cap;
+    long size;
+    float loadFactor;
+    int mix;
+    int warned;
     int (*keyHash)(void *);
+    UINT64 (*keyHash64)(void *);
     int (*keyCompare)(void *, void *);
     int (*valCompare)(void *, void *);
+    // counters of this container, NULL unless built with MYCDATA_STATS
+    struct opStats *stats;
 };
 struct Dict *dictNew(int (*keyHash)(void *), int (*keyCompare)(void *, void *),
                      int (*valCompare)(void *, void *));
+struct Dict *dictNew64(UINT64 (*keyHash64)(void *), int (*keyCompare)(void *, void *),
+                       int (*valCompare)(void *, void *));
 void dictFree(struct Dict *d);
 int dictPut(struct Dict *d, void *key, void *val);
 int dictRemove(struct Dict *d, void *key);
 void *dictGet(struct Dict *d, void *key);
 int dictContainsKey(struct Dict *d, void *key);
 int dictContainsValue(struct Dict *d, void *val);
-int dictSize(struct Dict *d);
+long dictSize(struct Dict *d);
+int dictGetBatch(struct Dict *d, void **keys, void **vals, int n);
+int dictPutBatch(struct Dict *d, void **keys, void **vals, int n);
+int dictSetLoadFactor(struct Dict *d, float loadFactor);
+int dictSetMixer(struct Dict *d, int mix);
+
+struct dictStats
+{
+    long size;
+    long cap;
+    double load;
+    // buckets by chain length, the last one holds the longer
+    long chains[DICT_STATS_CHAINS];
+    long maxChain;
+    // over the non-empty buckets
+    double meanChain;
+    // entries compared by a lookup of a present key
+    double hitCost;
+    // entries compared by a lookup of an absent key
+    double missCost;
+};
+int dictStats(struct Dict *d, struct dictStats *s);
+struct opStats *dictOpStats(struct Dict *d);
+int dictSave(struct Dict *d, const char *path, struct snapshotCodec *key,
+             struct snapshotCodec *val);
+int dictLoad(struct Dict *d, const char *path, struct snapshotCodec *key,
+             struct snapshotCodec *val);
 #ifdef DEBUG
 void dictPrint(struct Dict *d, void (*print)(void *, void *));
 #endif // DEBUG
 
+/*
+ * -------------------------------------------------------------- Read-Only Dict
+ */
+
+/*
+ * a Dict written as a file that is mmap'ed and queried in place, nothing is
+ * decoded and every process opening it shares the page cache pages
+ * the snapshot header, cap and seed, cap open addressing slots of hash and
+ * record offset (0 is empty, linear probing, load at most 1/2), then the records
+ * of key length and bytes and val length and bytes, keys are hashed by hashBytes
+ * over their encoded bytes, roDictGet returns the val bytes inside the mapping
+ */
+
+#ifndef RO_DICT_SEED
+#define RO_DICT_SEED 0x9E3779B97F4A7C15UL
+#endif // RO_DICT_SEED
+
+struct roDictSlot
+{
+    UINT64 hash;
+    UINT64 offset;
+};
+struct roDict
+{
+    const UINT8 *base;
+    long len;
+    int mapped;
+    UINT64 cap;
+    UINT64 count;
+    UINT64 seed;
+    const struct roDictSlot *slots;
+};
+int roDictBuild(struct Dict *d, const char *path, struct snapshotCodec *key,
+                struct snapshotCodec *val);
+struct roDict *roDictOpen(const char *path);
+void roDictClose(struct roDict *d);
+const void *roDictGet(struct roDict *d, const void *key, long keyLen, long *valLen);
+long roDictSize(struct roDict *d);
+
+/*
+ * ---------------------------------------------------------------- Perfect Hash
+ */
+
+/*
+ * a minimal perfect hash over the final keys of a Dict (PTHash), keys are split
+ * into size / MPH_LAMBDA buckets and each bucket gets the 16-bit pilot that moves
+ * all its keys to free slots, about 3.2 bits per key, the table has one spare
+ * slot per MPH_SLACK keys and a key landing past size is remapped to a free slot,
+ * the entries sit in one dense array, a lookup is one slot and one keyCompare
+ */
+
+#ifndef MPH_LAMBDA
+#define MPH_LAMBDA 5
+#endif // MPH_LAMBDA
+
+#ifndef MPH_SLACK
+#define MPH_SLACK 50
+#endif // MPH_SLACK
+
+#ifndef MPH_TRIES
+#define MPH_TRIES 16
+#endif // MPH_TRIES
+
+struct mphDictSlot
+{
+    void *key;
+    void *val;
+};
+struct mphDict
+{
+    long size;
+    long cap;
+    long buckets;
+    UINT64 seed;
+    UINT16 *pilots;
+    UINT32 *remap;
+    struct mphDictSlot *slots;
+    int (*keyHash)(void *);
+    UINT64 (*keyHash64)(void *);
+    int (*keyCompare)(void *, void *);
+};
+struct mphDict *mphDictNew(struct Dict *d);
+void mphDictFree(struct mphDict *m);
+void *mphDictGet(struct mphDict *m, void *key);
+long mphDictSize(struct mphDict *m);
+
+/*
+ * ------------------------------------------------------ Hash Array Mapped Trie
+ */
+
+/*
+ * persistent map, Bagwell's hash array mapped trie, each node branches 32 ways
+ * on 5 bits of the mixed key hash and keeps only its used slots, the bitmap
+ * popcount below a slot's bit gives its index,
+ * hamtPut and hamtRemove copy the path from the root and return a new map that
+ * shares every other node with the old one, maps and nodes are reference
+ * counted so a reader keeps a snapshot alive with hamtRetain,
+ * keys whose 64 bit hashes collide share a node that is scanned in order
+ */
+
+struct hamtSlot
+{
+    UINT64 hash;
+    // NULL when val is a child node
+    void *key;
+    void *val;
+};
+struct hamtNode
+{
+    // 0 in a collision node
+    UINT32 bitmap;
+    int len;
+    int refs;
+    struct hamtSlot *slots;
+};
+struct hamt
+{
+    struct hamtNode *root;
+    long size;
+    int refs;
+    int (*keyHash)(void *);
+    int (*keyCompare)(void *, void *);
+};
+struct hamt *hamtNew(int (*keyHash)(void *), int (*keyCompare)(void *, void *));
+struct hamt *hamtRetain(struct hamt *h);
+void hamtFree(struct hamt *h);
+struct hamt *hamtPut(struct hamt *h, void *key, void *val);
+struct hamt *hamtRemove(struct hamt *h, void *key);
+void *hamtGet(struct hamt *h, void *key);
+int hamtContainsKey(struct hamt *h, void *key);
+long hamtSize(struct hamt *h);
+
+/*
+ * ----------------------------------------------------------------------- Cache
+ */
+
+/*
+ * bounded caches on Dict, LRU keeps an intrusive recency list, CLOCK keeps a ref
+ * bit per slot, a new key waits in a FIFO (2Q A1in) until hit again, so a scan
+ * does not flush the hot slots
+ */
+
+struct lruCacheEntry
+{
+    struct iListLink link;
+    void *key;
+    void *val;
+};
+struct lruCache
+{
+    struct Dict *dict;
+    struct iList list;
+    int cap;
+    void (*evict)(void *key, void *val, void *arg);
+    void *arg;
+};
+struct lruCache *lruCacheNew(int cap, int (*keyHash)(void *), int (*keyCompare)(void *, void *),
+                             void (*evict)(void *, void *, void *), void *arg);
+void lruCacheFree(struct lruCache *c);
+int lruCachePut(struct lruCache *c, void *key, void *val);
+void *lruCacheGet(struct lruCache *c, void *key);
+int lruCacheRemove(struct lruCache *c, void *key);
+int lruCacheSize(struct lruCache *c);
+
+struct clockCacheSlot
+{
+    struct iListLink link;
+    void *key;
+    void *val;
+    int ref;
+    int hot;
+};
+struct clockCache
+{
+    struct Dict *dict;
+    struct clockCacheSlot *slots;
+    struct Stack *free;
+    struct iList cold;
+    int cap;
+    int coldCap;
+    int used;
+    int hand;
+    void (*evict)(void *key, void *val, void *arg);
+    void *arg;
+};
+struct clockCache *clockCacheNew(int cap, int (*keyHash)(void *), int (*keyCompare)(void *, void *),
+                                 void (*evict)(void *, void *, void *), void *arg);
+void clockCacheFree(struct clockCache *c);
+int clockCachePut(struct clockCache *c, void *key, void *val);
+void *clockCacheGet(struct clockCache *c, void *key);
+int clockCacheRemove(struct clockCache *c, void *key);
+int clockCacheSize(struct clockCache *c);
+
+/*
+ * ----------------------------------------------------------------- String Dict
+ */
+
+/* string keys, open addressing with linear probing, short keys in the slot */
+
+#ifndef STR_DICT_INLINE
+#define STR_DICT_INLINE 23
+#endif // STR_DICT_INLINE
+
+#ifndef STR_ARENA_BLOCK
+#define STR_ARENA_BLOCK 65536
+#endif // STR_ARENA_BLOCK
+
+struct strArenaBlock
+{
+    struct strArenaBlock *next;
+    long used;
+    long cap;
+};
+struct strDictSlot
+{
+    UINT64 hash;
+    UINT32 len;
+    char prefix[4];
+    union
+    {
+        char inl[STR_DICT_INLINE + 1];
+        char *ptr;
+    } key;
+    void *val;
+};
+struct strDict
+{
+    struct strDictSlot *table;
+    long threshold;
+    long cap;
+    long size;
+    int intern;
+    struct strArenaBlock *arena;
+};
+struct strDict *strDictNew(int intern);
+void strDictFree(struct strDict *d);
+int strDictPut(struct strDict *d, const char *key, void *val);
+int strDictRemove(struct strDict *d, const char *key);
+void *strDictGet(struct strDict *d, const char *key);
+int strDictContainsKey(struct strDict *d, const char *key);
+long strDictSize(struct strDict *d);
+
+/*
+ * ---------------------------------------------------------------- Sharded Dict
+ */
+
+/* N independent Dict, each with its own reader-writer lock */
+
+#ifndef SD_SHARDS
+#define SD_SHARDS 16
+#endif // SD_SHARDS
+
+struct shardedDictShard
+{
+    pthread_rwlock_t lock;
+    struct Dict *dict;
+    char pad[CACHE_LINE];
+};
+struct shardedDict
+{
+    struct shardedDictShard *shards;
+    int shift;
+    int n;
+};
+struct shardedDict *shardedDictNew(int shards, int (*keyHash)(void *),
+                                   int (*keyCompare)(void *, void *),
+                                   int (*valCompare)(void *, void *));
+void shardedDictFree(struct shardedDict *sd);
+int shardedDictPut(struct shardedDict *sd, void *key, void *val);
+int shardedDictRemove(struct shardedDict *sd, void *key);
+void *shardedDictGet(struct shardedDict *sd, void *key);
+int shardedDictContainsKey(struct shardedDict *sd, void *key);
+int shardedDictContainsValue(struct shardedDict *sd, void *val);
+long shardedDictSize(struct shardedDict *sd);
+
+/*
+ * ----------------------------------------------------------------------- Epoch
+ */
+
+/*
+ * epoch based reclamation, entries are reclaimed two epochs after retire,
+ * every domain holds its own pthread key, so at most PTHREAD_KEYS_MAX domains,
+ * and with them lfDicts and cells, can be live at once
+ */
+
+#ifndef EPOCH_RETIRE_THRESHOLD
+#define EPOCH_RETIRE_THRESHOLD 64
+#endif // EPOCH_RETIRE_THRESHOLD
+
+struct epochEntry
+{
+    struct epochEntry *next;
+    UINT64 epoch;
+};
+struct epochThread
+{
+    UINT64 epoch;
+    int depth;
+    int inUse;
+    struct epochEntry *retired;
+    int retiredSize;
+    struct epochThread *next;
+    char pad[CACHE_LINE];
+};
+struct epochDomain
+{
+    UINT64 epoch;
+    struct epochThread *threads;
+    pthread_key_t key;
+    void (*reclaim)(struct epochEntry *, void *);
+    void *arg;
+};
+int epochDomainInit(struct epochDomain *e,
+                    void (*reclaim)(struct epochEntry *, void *), void *arg);
+void epochDomainDestroy(struct epochDomain *e);
+struct epochThread *epochEnter(struct epochDomain *e);
+void epochExit(struct epochThread *t);
+void epochRetire(struct epochDomain *e, struct epochThread *t, struct epochEntry *entry);
+
+/*
+ * -------------------------------------------------------------- Lock-Free Dict
+ */
+
+/* split-ordered list, Shalev & Shavit, nodes are reclaimed by epoch */
+
+#ifndef LF_DICT_LOAD
+#define LF_DICT_LOAD 2
+#endif // LF_DICT_LOAD
+
+#ifndef LF_DICT_SEGMENTS
+#define LF_DICT_SEGMENTS 32
+#endif // LF_DICT_SEGMENTS
+
+struct lfDictNode
+{
+    struct epochEntry retire;
+    UINT64 soKey;
+    void *key;
+    void *val;
+    struct lfDictNode *next;
+};
+struct lfDict
+{
+    struct lfDictNode **segments[LF_DICT_SEGMENTS];
+    long buckets;
+    long size;
+    struct epochDomain epoch;
+    int (*keyHash)(void *);
+    int (*keyCompare)(void *, void *);
+    int (*valCompare)(void *, void *);
+};
+struct lfDict *lfDictNew(int (*keyHash)(void *), int (*keyCompare)(void *, void *),
+                         int (*valCompare)(void *, void *));
+void lfDictFree(struct lfDict *d);
+int lfDictPut(struct lfDict *d, void *key, void *val);
+int lfDictRemove(struct lfDict *d, void *key);
+void *lfDictGet(struct lfDict *d, void *key);
+int lfDictContainsKey(struct lfDict *d, void *key);
+int lfDictContainsValue(struct lfDict *d, void *val);
+int lfDictSize(struct lfDict *d);
+
+/*
+ * --------------------------------------------------------- Persistent Avl Tree
+ */
+
+/*
+ * immutable avl tree, an update copies the path from the root and shares the
+ * rest, each call returns a new version and leaves the old one readable,
+ * nodes and versions are reference counted,
+ * a cell publishes versions to readers without locks, a replaced version is
+ * released through the epoch domain once no reader can still be loading it,
+ * publish takes one reference to p, so a version may be published again with
+ * another reference while an earlier replacement still waits to be released
+ */
+
+struct pAvlTreeNode
+{
+    struct pAvlTreeNode *left, *right;
+    int key, height;
+    int refs;
+    void *val;
+};
+struct pAvlTree
+{
+    struct pAvlTreeNode *root;
+    int size;
+    int refs;
+    int (*key)(void *);
+};
+struct pAvlTreeCell
+{
+    struct pAvlTree *tree;
+    struct epochDomain epoch;
+};
+struct pAvlTree *pAvlTreeNew(int (*key)(void *));
+struct pAvlTree *pAvlTreeRetain(struct pAvlTree *p);
+void pAvlTreeFree(struct pAvlTree *p);
+struct pAvlTree *pAvlTreeAdd(struct pAvlTree *p, void *el);
+struct pAvlTree *pAvlTreeRemove(struct pAvlTree *p, void *el);
+void *pAvlTreeSearch(struct pAvlTree *p, void *el);
+void *pAvlTreeFindMin(struct pAvlTree *p);
+void *pAvlTreeFindMax(struct pAvlTree *p);
+int pAvlTreeSize(struct pAvlTree *p);
+int pAvlTreeCellInit(struct pAvlTreeCell *c, struct pAvlTree *p);
+void pAvlTreeCellDestroy(struct pAvlTreeCell *c);
+struct pAvlTree *pAvlTreeCellGet(struct pAvlTreeCell *c);
+int pAvlTreeCellPublish(struct pAvlTreeCell *c, struct pAvlTree *expected, struct pAvlTree *p);
+
 /*
  * ----------------------------------------------------------------- binary heap
  */
@@ -220,8 +1134,13 @@ struct binaryHeap
     int cap;
     int size;
     int (*key)(void *);
+    int (*grow)(int cap, int need);
 };
 struct binaryHeap *bhNew(int (*key)(void *));
+struct binaryHeap *bhNewWithCapacity(int (*key)(void *), int cap);
+int bhReserve(struct binaryHeap *h, int cap);
+int bhShrinkToFit(struct binaryHeap *h);
+void bhSetGrowth(struct binaryHeap *h, int (*grow)(int, int));
 void bhFree(struct binaryHeap *h);
 int bhInsert(struct binaryHeap *h, void *el);
 int bhDeleteMin(struct binaryHeap *h);
@@ -254,6 +1173,8 @@ struct skipList
     struct skipListNode *head;
     int size;
     int (*key)(void *);
+    // counters of this container, NULL unless built with MYCDATA_STATS
+    struct opStats *stats;
 };
 struct skipList *skipListNew(int (*key)(void *));
 void skipListFree(struct skipList *sl);
@@ -261,6 +1182,9 @@ int skipListInsert(struct skipList *sl, void *el);
 int skipListDelete(struct skipList *sl, int key);
 void *skipListGet(struct skipList *sl, int key);
 int skipListSize(struct skipList *sl);
+int skipListSave(struct skipList *sl, const char *path, struct snapshotCodec *el);
+struct opStats *skipListOpStats(struct skipList *sl);
+int skipListLoad(struct skipList *sl, const char *path, struct snapshotCodec *el);
 #ifdef DEBUG
 void skipListPrint(struct skipList *sl, void (*print)(void *));
 #endif // DEBUG
@@ -283,4 +1207,135 @@ int bitSetGet(struct bitSet *bs, int i);
 void bitSetPrint(struct bitSet *bs);
 #endif // DEBUG
 
+/*
+ * ---------------------------------------------------------------------- Filter
+ */
+
+/*
+ * membership filters on a bitSet, fed with a 64-bit hash of the key (hashBytes,
+ * hashMix64 or a keyHash64), contains returns 0 when the key was never added and
+ * 1 when it may have been, the batch probes prefetch FILTER_BATCH slots ahead
+ * and set maybe[i] for every hash, returning how many may be present
+ * bloomFilter: blocked, all k bits of a key in one 512-bit cache line
+ * cuckooFilter: 4 fingerprints per bucket, each key in one of two buckets,
+ * supports remove of a key that was added, add returns 0 once full, the
+ * fingerprint is only 8, 16 or 32 bits, the smallest with 8 / 2 ^ bits <= fpr,
+ * so a 1% target takes 16 bits where about 10 would do, a target below
+ * 8 / 2 ^ 32 is refused
+ * both filters mix the hash first, any keyHash64 including small integers is fine
+ */
+
+#ifndef FILTER_BATCH
+#define FILTER_BATCH 16
+#endif // FILTER_BATCH
+
+#ifndef CUCKOO_MAX_KICKS
+#define CUCKOO_MAX_KICKS 500
+#endif // CUCKOO_MAX_KICKS
+
+struct bloomFilter
+{
+    struct bitSet *bits;
+    long blocks;
+    // word of the first block, blocks are cache line aligned
+    int first;
+    int k;
+};
+struct bloomFilter *bloomFilterNew(long n, double fpr);
+void bloomFilterFree(struct bloomFilter *f);
+int bloomFilterAdd(struct bloomFilter *f, UINT64 hash);
+int bloomFilterContains(struct bloomFilter *f, UINT64 hash);
+int bloomFilterContainsBatch(struct bloomFilter *f, const UINT64 *hashes, int n, UINT8 *maybe);
+
+struct cuckooFilter
+{
+    struct bitSet *bits;
+    long buckets;
+    int fpBits;
+    long size;
+    UINT64 seed;
+    // the victim of a failed add, kept so no key is lost
+    int stashed;
+    UINT32 stashFp;
+    long stashBucket;
+};
+struct cuckooFilter *cuckooFilterNew(long n, double fpr);
+void cuckooFilterFree(struct cuckooFilter *f);
+int cuckooFilterAdd(struct cuckooFilter *f, UINT64 hash);
+int cuckooFilterRemove(struct cuckooFilter *f, UINT64 hash);
+int cuckooFilterContains(struct cuckooFilter *f, UINT64 hash);
+int cuckooFilterContainsBatch(struct cuckooFilter *f, const UINT64 *hashes, int n, UINT8 *maybe);
+long cuckooFilterSize(struct cuckooFilter *f);
+
+/*
+ * ---------------------------------------------------------------------- Sketch
+ */
+
+/*
+ * streaming summaries fed with a 64-bit hash of the item, sketches of the same
+ * shape merge, so every thread can keep its own and merge them at the end
+ * hyperLogLog: 2 ^ p registers, standard error 1.04 / sqrt(2 ^ p), 0.81% at the
+ * default 14, a sorted list of (register, rank) until it would outgrow the
+ * dense byte registers
+ * countMinSketch: estimate never below the true count, above it by at most eps
+ * of the total with probability 1 - delta
+ * topK: space-saving over k counters, a min-heap finds the counter to take over,
+ * count - error is a lower bound of the true count
+ */
+
+#ifndef HLL_PRECISION
+#define HLL_PRECISION 14
+#endif // HLL_PRECISION
+
+struct hyperLogLog
+{
+    int p;
+    int sparse;
+    // sparse entries
+    long size;
+    long cap;
+    // register << 8 | rank, sorted
+    UINT32 *list;
+    UINT8 *regs;
+};
+struct hyperLogLog *hyperLogLogNew(int p);
+void hyperLogLogFree(struct hyperLogLog *h);
+int hyperLogLogAdd(struct hyperLogLog *h, UINT64 hash);
+long hyperLogLogCount(struct hyperLogLog *h);
+int hyperLogLogMerge(struct hyperLogLog *dst, struct hyperLogLog *src);
+
+struct countMinSketch
+{
+    long width;
+    int depth;
+    UINT64 total;
+    UINT64 *counts;
+};
+struct countMinSketch *countMinSketchNew(double eps, double delta);
+void countMinSketchFree(struct countMinSketch *s);
+int countMinSketchAdd(struct countMinSketch *s, UINT64 hash, UINT64 n);
+UINT64 countMinSketchEstimate(struct countMinSketch *s, UINT64 hash);
+int countMinSketchMerge(struct countMinSketch *dst, struct countMinSketch *src);
+
+struct topKCounter
+{
+    void *key;
+    UINT64 count;
+    UINT64 error;
+    // in the heap
+    int pos;
+};
+struct topK
+{
+    int k;
+    int size;
+    struct topKCounter *counters;
+    struct topKCounter **heap;
+    struct Dict *index;
+};
+struct topK *topKNew(int k, int (*keyHash)(void *), int (*keyCompare)(void *, void *));
+void topKFree(struct topK *t);
+int topKAdd(struct topK *t, void *key, UINT64 n);
+int topKList(struct topK *t, struct topKCounter *out);
+
 #endif // MYCDATA_H_
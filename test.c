@@ -1,34 +1,84 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include "mycdata.h"
 
 void test_print();
 void test_stack();
 void test_queue();
+void test_queueBatch();
+void test_ring();
+void test_workStealing();
 void test_avlTree();
 void test_avlTree2();
 void test_rbTree();
 void test_rbTree2();
 void test_list();
+void test_intrusive();
+void test_listIndex();
+void test_unrolledList();
+void test_treapList();
 void test_dict();
+void test_dict64();
+void test_dictBatch();
+void test_dictStats();
+void test_strDict();
+void test_cache();
+void test_shardedDict();
+void test_lfDict();
+void test_pAvlTree();
 void test_binaryHeap();
+void test_growth();
+void test_memory();
 void test_skipList();
+void test_stats();
+void test_snapshot();
+void test_roDict();
+void test_mphDict();
+void test_hamt();
 void test_bitSet();
+void test_filter();
+void test_sketch();
 
 int main(int argc, char **argv)
 {
     test_print();
     test_stack();
     test_queue();
+    test_queueBatch();
+    test_ring();
+    test_workStealing();
     test_avlTree();
     test_avlTree2();
     test_rbTree();
     test_rbTree2();
     test_list();
+    test_intrusive();
+    test_listIndex();
+    test_unrolledList();
+    test_treapList();
     test_dict();
+    test_dict64();
+    test_dictBatch();
+    test_dictStats();
+    test_strDict();
+    test_cache();
+    test_shardedDict();
+    test_lfDict();
+    test_pAvlTree();
     test_binaryHeap();
+    test_growth();
+    test_memory();
     test_skipList();
+    test_stats();
+    test_snapshot();
+    test_roDict();
+    test_mphDict();
+    test_hamt();
     test_bitSet();
+    test_filter();
+    test_sketch();
 }
 
 void test_print()
@@ -142,6 +192,369 @@ void test_avlTreePrintfInt(void *val)
 {
     printf("%d ", *(int *)val);
 }
+struct test_ringArg
+{
+    struct spscRing *spsc;
+    struct mpmcRing *mpmc;
+    int *a;
+    int *seen;
+    int from;
+    int to;
+};
+void *test_ringProducer(void *p)
+{
+    struct test_ringArg *arg = (struct test_ringArg *)p;
+    void *batch[8];
+    int i = arg->from;
+    while (i < arg->to)
+    {
+        int n = 0;
+        while (n < 8 && i + n < arg->to)
+        {
+            batch[n] = &arg->a[i + n];
+            n++;
+        }
+        int done = arg->spsc ? spscRingOfferBatch(arg->spsc, batch, n) : mpmcRingOfferBatch(arg->mpmc, batch, n);
+        i += done;
+    }
+    return NULL;
+}
+void *test_ringConsumer(void *p)
+{
+    struct test_ringArg *arg = (struct test_ringArg *)p;
+    void *batch[8];
+    int count = arg->to - arg->from, last = -1;
+    while (count > 0)
+    {
+        int n = count < 8 ? count : 8;
+        n = arg->spsc ? spscRingPollBatch(arg->spsc, batch, n) : mpmcRingPollBatch(arg->mpmc, batch, n);
+        int i;
+        for (i = 0; i < n; i++)
+        {
+            int v = *(int *)batch[i];
+            // a single producer keeps its order
+            if (arg->spsc && v != last + 1)
+                arg->seen[0] = -1;
+            last = v;
+            __atomic_add_fetch(&arg->seen[v + 1], 1, __ATOMIC_RELAXED);
+        }
+        count -= n;
+    }
+    return NULL;
+}
+void test_queueBatch()
+{
+    struct Queue *queue = queueNew();
+    if (!queue)
+    {
+        printError("queueNew error\n");
+        return;
+    }
+
+    // values go in and come out in order across growth and wrap around
+    const int len = 100000;
+    int *nums = malloc(sizeof(int) * len);
+    void *buf[64];
+    if (!nums)
+    {
+        printError("malloc nums error\n");
+        goto freePointer;
+    }
+    int i, in = 0, out = 0;
+    for (i = 0; i < len; i++)
+        nums[i] = i;
+    srand(7);
+    while (out < len)
+    {
+        int n = rand() % 64 + 1, k;
+        switch (rand() % 4)
+        {
+        case 0:                                        // offer one
+            if (in < len && !queueOffer(queue, &nums[in++]))
+            {
+                printError("queueOffer error\n");
+                goto freePointer;
+            }
+            break;
+        case 1:                                        // offer a batch
+            if (n > len - in)
+                n = len - in;
+            for (k = 0; k < n; k++)
+                buf[k] = &nums[in + k];
+            if (queueOfferBatch(queue, buf, n) != n)
+            {
+                printError("queueOfferBatch error\n");
+                goto freePointer;
+            }
+            in += n;
+            break;
+        case 2:                                        // poll one
+            if (out < in && *(int *)queuePoll(queue) != out++)
+            {
+                printError("queuePoll %d error\n", out - 1);
+                goto freePointer;
+            }
+            break;
+        default:                                       // poll a batch, slower than offer
+            n = queuePollBatch(queue, buf, n / 2 + 1);
+            for (k = 0; k < n; k++)
+            {
+                if (*(int *)buf[k] != out++)
+                {
+                    printError("queuePollBatch %d error\n", out - 1);
+                    goto freePointer;
+                }
+            }
+            break;
+        }
+        if (queueSize(queue) != in - out || (queue->cap & (queue->cap - 1)))
+        {
+            printError("queueSize %d error\n", queueSize(queue));
+            goto freePointer;
+        }
+    }
+
+freePointer:
+    if (nums)
+        free(nums);
+    queueFree(queue);
+}
+
+void test_ring()
+{
+    const int len = 200000;
+    int *a = malloc(sizeof(int) * len);
+    int *seen = calloc(len + 1, sizeof(int));
+    struct spscRing *spsc = spscRingNew(100);
+    struct mpmcRing *mpmc = mpmcRingNew(100);
+    if (!a || !seen || !spsc || !mpmc)
+    {
+        printError("test_ring new error\n");
+        goto freePointer;
+    }
+    int i;
+    for (i = 0; i < len; i++)
+        a[i] = i;
+
+    // cap is rounded up to 128
+    for (i = 0; i < 128; i++)
+    {
+        if (!spscRingOffer(spsc, &a[i]) || !mpmcRingOffer(mpmc, &a[i]))
+        {
+            printError("ringOffer %d error\n", i);
+            goto freePointer;
+        }
+    }
+    if (spscRingOffer(spsc, &a[0]) || mpmcRingOffer(mpmc, &a[0]) || spscRingSize(spsc) != 128 || mpmcRingSize(mpmc) != 128)
+    {
+        printError("ring full error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < 128; i++)
+    {
+        if (spscRingPoll(spsc) != &a[i] || mpmcRingPoll(mpmc) != &a[i])
+        {
+            printError("ringPoll %d error\n", i);
+            goto freePointer;
+        }
+    }
+    if (spscRingPoll(spsc) || mpmcRingPoll(mpmc) || spscRingSize(spsc) || mpmcRingSize(mpmc))
+    {
+        printError("ring empty error\n");
+        goto freePointer;
+    }
+
+    pthread_t tids[4];
+    struct test_ringArg args[4];
+    memset(args, 0, sizeof(args));
+    args[0].spsc = args[1].spsc = spsc;
+    args[0].a = args[1].a = a;
+    args[0].seen = args[1].seen = seen;
+    args[0].to = args[1].to = len;
+    pthread_create(&tids[0], NULL, test_ringProducer, &args[0]);
+    pthread_create(&tids[1], NULL, test_ringConsumer, &args[1]);
+    pthread_join(tids[0], NULL);
+    pthread_join(tids[1], NULL);
+    for (i = 0; i <= len; i++)
+    {
+        if (seen[i] != (i > 0))
+        {
+            printError("spscRing thread %d error\n", i - 1);
+            goto freePointer;
+        }
+    }
+
+    // two producers and two consumers, each value must be seen once
+    memset(seen, 0, sizeof(int) * (len + 1));
+    memset(args, 0, sizeof(args));
+    for (i = 0; i < 4; i++)
+    {
+        args[i].mpmc = mpmc;
+        args[i].a = a;
+        args[i].seen = seen;
+        args[i].from = i % 2 == 0 ? 0 : len / 2;
+        args[i].to = i % 2 == 0 ? len / 2 : len;
+    }
+    for (i = 0; i < 4; i++)
+        pthread_create(&tids[i], NULL, i < 2 ? test_ringProducer : test_ringConsumer, &args[i]);
+    for (i = 0; i < 4; i++)
+        pthread_join(tids[i], NULL);
+    for (i = 1; i <= len; i++)
+    {
+        if (seen[i] != 1)
+        {
+            printError("mpmcRing thread %d error\n", i - 1);
+            goto freePointer;
+        }
+    }
+
+freePointer:
+    if (a)
+        free(a);
+    if (seen)
+        free(seen);
+    spscRingFree(spsc);
+    mpmcRingFree(mpmc);
+}
+
+struct test_wsArg
+{
+    struct wsDeque *d;
+    int *seen;
+    int done;
+};
+void *test_wsThief(void *p)
+{
+    struct test_wsArg *arg = (struct test_wsArg *)p;
+    for (;;)
+    {
+        int done = __atomic_load_n(&arg->done, __ATOMIC_ACQUIRE);
+        int *el = (int *)wsDequeSteal(arg->d);
+        if (el)
+            __atomic_add_fetch(&arg->seen[*el], 1, __ATOMIC_RELAXED);
+        else if (done)
+            return NULL;
+    }
+}
+struct test_wsSum
+{
+    struct threadPool *pool;
+    long lo;
+    long hi;
+    long *sum;
+    int owned;
+};
+void test_wsSumTask(void *p)
+{
+    struct test_wsSum *t = (struct test_wsSum *)p;
+    if (t->hi - t->lo > 1000)
+    {
+        // split in two, both halves go to this worker's deque
+        int i;
+        for (i = 0; i < 2; i++)
+        {
+            struct test_wsSum *half = malloc(sizeof(struct test_wsSum));
+            *half = *t;
+            half->owned = 1;
+            if (i == 0)
+                half->hi = t->lo + (t->hi - t->lo) / 2;
+            else
+                half->lo = t->lo + (t->hi - t->lo) / 2;
+            threadPoolSubmit(t->pool, test_wsSumTask, half);
+        }
+    }
+    else
+    {
+        long i, sum = 0;
+        for (i = t->lo; i < t->hi; i++)
+            sum += i;
+        __atomic_add_fetch(t->sum, sum, __ATOMIC_RELAXED);
+    }
+    if (t->owned)
+        free(t);
+}
+void test_workStealing()
+{
+    const int len = 100000;
+    int *nums = malloc(sizeof(int) * len);
+    int *seen = calloc(len, sizeof(int));
+    struct wsDeque *d = wsDequeNew(4);
+    struct threadPool *pool = NULL;
+    if (!nums || !seen || !d)
+    {
+        printError("test_workStealing new error\n");
+        goto freePointer;
+    }
+    int i;
+    for (i = 0; i < len; i++)
+        nums[i] = i;
+
+    // the owner pushes and pops while three thieves steal
+    pthread_t tids[3];
+    struct test_wsArg arg;
+    arg.d = d;
+    arg.seen = seen;
+    arg.done = 0;
+    for (i = 0; i < 3; i++)
+        pthread_create(&tids[i], NULL, test_wsThief, &arg);
+    int *el;
+    for (i = 0; i < len; i++)
+    {
+        if (!wsDequePush(d, &nums[i]))
+            printError("wsDequePush %d error\n", i);
+        if (i % 3 == 0 && (el = (int *)wsDequePop(d)) != NULL)
+            __atomic_add_fetch(&seen[*el], 1, __ATOMIC_RELAXED);
+    }
+    while ((el = (int *)wsDequePop(d)) != NULL)
+        __atomic_add_fetch(&seen[*el], 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&arg.done, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < 3; i++)
+        pthread_join(tids[i], NULL);
+    for (i = 0; i < len; i++)
+    {
+        if (seen[i] != 1)
+        {
+            printError("wsDeque %d seen %d error\n", i, seen[i]);
+            goto freePointer;
+        }
+    }
+    if (wsDequeSize(d) != 0 || wsDequePop(d) || wsDequeSteal(d))
+    {
+        printError("wsDeque empty error\n");
+        goto freePointer;
+    }
+
+    // a recursive sum, the split tasks spread by stealing
+    pool = threadPoolNew(4);
+    if (!pool)
+    {
+        printError("threadPoolNew error\n");
+        goto freePointer;
+    }
+    long sum = 0;
+    struct test_wsSum root;
+    root.pool = pool;
+    root.lo = 0;
+    root.hi = 1000000;
+    root.sum = &sum;
+    root.owned = 0;
+    threadPoolSubmit(pool, test_wsSumTask, &root);
+    threadPoolWait(pool);
+    if (sum != 999999L * 1000000L / 2)
+    {
+        printError("threadPool sum %ld error\n", sum);
+        goto freePointer;
+    }
+
+freePointer:
+    if (nums)
+        free(nums);
+    if (seen)
+        free(seen);
+    wsDequeFree(d);
+    threadPoolFree(pool);
+}
+
 void test_avlTree()
 {
     struct avlTree *tree = avlTreeNew(&test_avlTreeIntKey);
@@ -498,108 +911,501 @@ freePointer:
         listFree(l);
 }
 
-int dictKeyHash(void *key)
+struct test_item
 {
-    return *(int *)key;
+    int key;
+    struct iListLink link;
+    struct irbNode rb;
+    struct iavlNode avl;
+};
+int test_itemRbCompare(struct irbNode *a, struct irbNode *b)
+{
+    return containerOf(a, struct test_item, rb)->key - containerOf(b, struct test_item, rb)->key;
 }
-int dictKeyCompare(void *key1, void *key2)
+int test_itemAvlCompare(struct iavlNode *a, struct iavlNode *b)
 {
-    if (key1 == key2)
-        return 0;
-    return (*(int *)key1) - (*(int *)key2);
+    return containerOf(a, struct test_item, avl)->key - containerOf(b, struct test_item, avl)->key;
 }
-int dictValCompare(void *val1, void *val2)
+int test_irbBlackHeight(struct irbNode *n)
 {
-    if (val1 == val2)
-        return 0;
-    return (*(int *)val1) - (*(int *)val2);
+    // -1 on a broken tree
+    if (!n)
+        return 1;
+    if (n->color == RB_RED && ((n->left && n->left->color == RB_RED) || (n->right && n->right->color == RB_RED)))
+        return -1;
+    if ((n->left && n->left->parent != n) || (n->right && n->right->parent != n))
+        return -1;
+    int l = test_irbBlackHeight(n->left);
+    int r = test_irbBlackHeight(n->right);
+    if (l < 0 || l != r)
+        return -1;
+    return l + (n->color == RB_BLACK);
 }
-void dictEntryPrint(void *key, void *val)
+int test_iavlHeight(struct iavlNode *n)
 {
-    if (key)
-    {
-        printf("k: %d", *(int *)key);
-    }
-    if (val)
-    {
-        printf(" val: %d", *(int *)val);
-    }
-    printf("\n");
+    // -1 on a broken tree
+    if (!n)
+        return 0;
+    if ((n->left && n->left->parent != n) || (n->right && n->right->parent != n))
+        return -1;
+    int l = test_iavlHeight(n->left);
+    int r = test_iavlHeight(n->right);
+    if (l < 0 || r < 0 || l - r > 1 || r - l > 1 || n->height != (l > r ? l : r) + 1)
+        return -1;
+    return n->height;
 }
-void test_dict()
+void test_intrusive()
 {
-    struct Dict *dict = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
-    if (!dict)
+    const int len = 5000;
+    struct test_item *items = malloc(sizeof(struct test_item) * len);
+    if (!items)
     {
-        printError("dictNew error\n");
+        printError("malloc items error\n");
         return;
     }
 
-    int len = 100;
-    int a[len];
-    int i;
-    for (i = 0; i < len; i++)
-        a[i] = i;
+    struct iList l;
+    struct irbTree rb;
+    struct iavlTree avl;
+    iListInit(&l);
+    irbTreeInit(&rb, test_itemRbCompare);
+    iavlTreeInit(&avl, test_itemAvlCompare);
 
-    // add
+    // keys are a permutation of 0..len-1
+    int i;
     for (i = 0; i < len; i++)
     {
-        int *val = (int *)dictGet(dict, &a[i]);
-        if (val)
+        items[i].key = (int)((i * 2971L) % len);
+        iListAddTail(&l, &items[i].link);
+        if (irbTreeInsert(&rb, &items[i].rb) || iavlTreeInsert(&avl, &items[i].avl))
         {
-            printError("dict error\n");
+            printError("intrusive insert error\n");
             goto freePointer;
         }
+    }
+    struct test_item probe;
+    probe.key = items[0].key;
+    if (irbTreeInsert(&rb, &probe.rb) != &items[0].rb || iavlTreeInsert(&avl, &probe.avl) != &items[0].avl)
+    {
+        printError("intrusive insert duplicate error\n");
+        goto freePointer;
+    }
 
-        if (!dictPut(dict, &a[i], &a[i]))
+    // remove the odd keys everywhere
+    for (i = 0; i < len; i++)
+    {
+        if (items[i].key & 1)
         {
-            printError("dictPut error\n");
-            goto freePointer;
+            iListRemove(&l, &items[i].link);
+            irbTreeDelete(&rb, &items[i].rb);
+            iavlTreeDelete(&avl, &items[i].avl);
         }
+    }
+    if (iListSize(&l) != len / 2 || rb.size != len / 2 || avl.size != len / 2)
+    {
+        printError("intrusive size error\n");
+        goto freePointer;
+    }
+    if (test_irbBlackHeight(rb.root) < 0 || rb.root->color != RB_BLACK || test_iavlHeight(avl.root) < 0)
+    {
+        printError("intrusive tree shape error\n");
+        goto freePointer;
+    }
 
-        val = (int *)dictGet(dict, &a[i]);
-        if (!val || *val != a[i])
+    // in order walk gives 0, 2, 4, ...
+    struct irbNode *rn = irbTreeFindMin(&rb);
+    struct iavlNode *an = iavlTreeFindMin(&avl);
+    for (i = 0; i < len; i += 2)
+    {
+        if (!rn || !an || containerOf(rn, struct test_item, rb)->key != i ||
+            containerOf(an, struct test_item, avl)->key != i)
         {
-            printError("dictGet error\n");
+            printError("intrusive order %d error\n", i);
             goto freePointer;
         }
+        rn = irbTreeNext(rn);
+        an = iavlTreeNext(an);
+    }
+    if (rn || an)
+    {
+        printError("intrusive order end error\n");
+        goto freePointer;
+    }
+    probe.key = 7;
+    if (irbTreeSearch(&rb, &probe.rb) || iavlTreeSearch(&avl, &probe.avl))
+    {
+        printError("intrusive search error\n");
+        goto freePointer;
+    }
+    probe.key = 8;
+    rn = irbTreeSearch(&rb, &probe.rb);
+    an = iavlTreeSearch(&avl, &probe.avl);
+    if (!rn || !an || containerOf(rn, struct test_item, rb) != containerOf(an, struct test_item, avl))
+    {
+        printError("intrusive search error\n");
+        goto freePointer;
     }
 
-    for (i = 0; i < len; i++)
+    struct iListLink *ln = iListHead(&l);
+    for (i = 0; ln; ln = ln->next)
+        i++;
+    if (i != len / 2 || containerOf(iListTail(&l), struct test_item, link)->key & 1)
     {
-        if (!dictContainsKey(dict, &a[i]))
-        {
-            printError("dictContainsKey error\n");
-            goto freePointer;
-        }
-        if (!dictContainsValue(dict, &a[i]))
-        {
-            printError("dictContainsValue error\n");
-            goto freePointer;
-        }
+        printError("iList walk error\n");
+        goto freePointer;
     }
 
-    // replace
-    for (i = 1; i < len / 2; i++)
+freePointer:
+    free(items);
+}
+
+void test_listIndex()
+{
+    struct List *l = listNew();
+    if (!l)
     {
-        int *val = (int *)dictGet(dict, &a[i]);
-        if (!val || *val != a[i])
+        printError("listNew error\n");
+        return;
+    }
+
+    const int len = 10000;
+    int *nums = malloc(sizeof(int) * len);
+    if (!nums)
+    {
+        printError("malloc nums error\n");
+        goto freePointer;
+    }
+    int i;
+    for (i = 0; i < len; i++)
+    {
+        nums[i] = i;
+        if (i == len / 2 && !listIndexOn(l))
         {
-            printError("dict error\n");
+            printError("listIndexOn error\n");
             goto freePointer;
         }
-
-        // replace
-        if (!dictPut(dict, &a[i], &a[i * 2]))
+        listAdd(l, &nums[i]);
+    }
+    for (i = 0; i < len; i++)
+    {
+        if (!listContains(l, &nums[i]))
         {
-            printError("dictPut error\n");
+            printError("listContains %d error\n", i);
             goto freePointer;
         }
+    }
 
-        val = (int *)dictGet(dict, &a[i]);
-        if (!val || *val != a[i * 2])
+    // by value, by position and set keep the index in step
+    for (i = 0; i < len; i += 2)
+    {
+        if (!listRemoveValue(l, &nums[i]) || listContains(l, &nums[i]))
         {
-            printError("dictGet error\n");
+            printError("listRemoveValue %d error\n", i);
+            goto freePointer;
+        }
+    }
+    if (listSize(l) != len / 2 || listRemoveValue(l, &nums[0]))
+    {
+        printError("listRemoveValue error\n");
+        goto freePointer;
+    }
+    listRemove(l, 0);
+    if (listContains(l, &nums[1]) || *(int *)listHead(l) != 3)
+    {
+        printError("listRemove error\n");
+        goto freePointer;
+    }
+    listSet(l, 0, &nums[0]);
+    if (listContains(l, &nums[3]) || !listContains(l, &nums[0]))
+    {
+        printError("listSet error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < listSize(l); i++)
+    {
+        if (*(int *)listGet(l, i) != (i ? i * 2 + 3 : 0))
+        {
+            printError("listGet %d error\n", i);
+            goto freePointer;
+        }
+    }
+
+    // with equal values the first one goes, as without the index
+    listAdd(l, &nums[2]);
+    listAdd(l, &nums[1]);
+    listAdd(l, &nums[2]);
+    int size = listSize(l);
+    listSet(l, 1, &nums[2]);
+    if (!listRemoveValue(l, &nums[2]) || listGet(l, 0) != &nums[0] ||
+        listGet(l, 1) != &nums[7] || listGet(l, size - 2) != &nums[2] ||
+        listGet(l, size - 3) != &nums[1] || listGet(l, size - 4) != &nums[2])
+    {
+        printError("listRemoveValue duplicates error\n");
+        goto freePointer;
+    }
+
+freePointer:
+    if (nums)
+        free(nums);
+    listFree(l);
+}
+
+void test_unrolledList()
+{
+    struct unrolledList *l = unrolledListNew();
+    if (!l)
+    {
+        printError("unrolledListNew error\n");
+        return;
+    }
+
+    const int len = 1000;
+    int nums[1000];
+    int i;
+    for (i = 0; i < len; i++)
+    {
+        nums[i] = i;
+        unrolledListAdd(l, &nums[i]);
+        if (unrolledListSize(l) != i + 1 || *(int *)unrolledListTail(l) != i ||
+            *(int *)unrolledListHead(l) != 0)
+        {
+            printError("unrolledListAdd error\n");
+            goto freePointer;
+        }
+    }
+    for (i = 0; i < len; i++)
+    {
+        if (*(int *)unrolledListGet(l, i) != i || !unrolledListContains(l, &nums[i]))
+        {
+            printError("unrolledListGet error\n");
+            goto freePointer;
+        }
+    }
+
+    unrolledListSet(l, 500, &nums[0]);
+    if (*(int *)unrolledListGet(l, 500) != 0)
+    {
+        printError("unrolledListSet error\n");
+        goto freePointer;
+    }
+    unrolledListSet(l, 500, &nums[500]);
+
+    // remove every third element, the rest keeps its order
+    int size = len;
+    for (i = len - 1; i >= 0; i -= 3)
+    {
+        if (!unrolledListRemove(l, i) || unrolledListSize(l) != --size)
+        {
+            printError("unrolledListRemove error\n");
+            goto freePointer;
+        }
+    }
+    int j = 0;
+    for (i = 0; i < len; i++)
+    {
+        if ((len - 1 - i) % 3 == 0)
+        {
+            if (unrolledListContains(l, &nums[i]))
+            {
+                printError("unrolledListRemove error\n");
+                goto freePointer;
+            }
+            continue;
+        }
+        if (*(int *)unrolledListGet(l, j++) != i)
+        {
+            printError("unrolledListGet after remove error\n");
+            goto freePointer;
+        }
+    }
+    while (unrolledListSize(l))
+        unrolledListRemove(l, unrolledListSize(l) / 2);
+    if (unrolledListHead(l) || unrolledListTail(l) || unrolledListGet(l, 0))
+    {
+        printError("unrolledListRemove all error\n");
+        goto freePointer;
+    }
+
+freePointer:
+    unrolledListFree(l);
+}
+
+void test_treapList()
+{
+    struct treapList *l = treapListNew();
+    struct List *ref = listNew();
+    if (!l || !ref)
+    {
+        printError("treapListNew error\n");
+        goto freePointer;
+    }
+
+    // random positional edits, checked against List
+    const int len = 2000;
+    int nums[2000];
+    int i;
+    for (i = 0; i < len; i++)
+        nums[i] = i;
+    srand(1);
+    for (i = 0; i < len; i++)
+    {
+        int at = rand() % (listSize(ref) + 1);
+        if (!treapListInsert(l, at, &nums[i]))
+        {
+            printError("treapListInsert error\n");
+            goto freePointer;
+        }
+        // List has no insert, rebuild the tail
+        listAdd(ref, &nums[i]);
+        int j;
+        for (j = listSize(ref) - 1; j > at; j--)
+            listSet(ref, j, listGet(ref, j - 1));
+        listSet(ref, at, &nums[i]);
+    }
+    for (i = 0; i < len / 2; i++)
+    {
+        int at = rand() % listSize(ref);
+        treapListRemove(l, at);
+        listRemove(ref, at);
+        at = rand() % listSize(ref);
+        treapListSet(l, at, &nums[i]);
+        listSet(ref, at, &nums[i]);
+    }
+    if (treapListSize(l) != listSize(ref) || treapListHead(l) != listHead(ref) ||
+        treapListTail(l) != listTail(ref))
+    {
+        printError("treapListSize error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < listSize(ref); i++)
+    {
+        if (treapListGet(l, i) != listGet(ref, i))
+        {
+            printError("treapListGet %d error\n", i);
+            goto freePointer;
+        }
+    }
+    for (i = 0; i < len; i++)
+    {
+        if (treapListContains(l, &nums[i]) != listContains(ref, &nums[i]))
+        {
+            printError("treapListContains %d error\n", i);
+            goto freePointer;
+        }
+    }
+    if (treapListGet(l, -1) || treapListGet(l, treapListSize(l)) || treapListRemove(l, treapListSize(l)))
+    {
+        printError("treapList bound error\n");
+        goto freePointer;
+    }
+
+freePointer:
+    treapListFree(l);
+    listFree(ref);
+}
+
+int dictKeyHash(void *key)
+{
+    return *(int *)key;
+}
+int dictKeyCompare(void *key1, void *key2)
+{
+    if (key1 == key2)
+        return 0;
+    return (*(int *)key1) - (*(int *)key2);
+}
+int dictValCompare(void *val1, void *val2)
+{
+    if (val1 == val2)
+        return 0;
+    return (*(int *)val1) - (*(int *)val2);
+}
+void dictEntryPrint(void *key, void *val)
+{
+    if (key)
+    {
+        printf("k: %d", *(int *)key);
+    }
+    if (val)
+    {
+        printf(" val: %d", *(int *)val);
+    }
+    printf("\n");
+}
+void test_dict()
+{
+    struct Dict *dict = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    if (!dict)
+    {
+        printError("dictNew error\n");
+        return;
+    }
+
+    int len = 100;
+    int a[len];
+    int i;
+    for (i = 0; i < len; i++)
+        a[i] = i;
+
+    // add
+    for (i = 0; i < len; i++)
+    {
+        int *val = (int *)dictGet(dict, &a[i]);
+        if (val)
+        {
+            printError("dict error\n");
+            goto freePointer;
+        }
+
+        if (!dictPut(dict, &a[i], &a[i]))
+        {
+            printError("dictPut error\n");
+            goto freePointer;
+        }
+
+        val = (int *)dictGet(dict, &a[i]);
+        if (!val || *val != a[i])
+        {
+            printError("dictGet error\n");
+            goto freePointer;
+        }
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        if (!dictContainsKey(dict, &a[i]))
+        {
+            printError("dictContainsKey error\n");
+            goto freePointer;
+        }
+        if (!dictContainsValue(dict, &a[i]))
+        {
+            printError("dictContainsValue error\n");
+            goto freePointer;
+        }
+    }
+
+    // replace
+    for (i = 1; i < len / 2; i++)
+    {
+        int *val = (int *)dictGet(dict, &a[i]);
+        if (!val || *val != a[i])
+        {
+            printError("dict error\n");
+            goto freePointer;
+        }
+
+        // replace
+        if (!dictPut(dict, &a[i], &a[i * 2]))
+        {
+            printError("dictPut error\n");
+            goto freePointer;
+        }
+
+        val = (int *)dictGet(dict, &a[i]);
+        if (!val || *val != a[i * 2])
+        {
+            printError("dictGet error\n");
             goto freePointer;
         }
     }
@@ -697,262 +1503,1929 @@ freePointer:
     dictFree(dict);
 }
 
-int bhKey(void *el)
+UINT64 dictStrHash(void *key)
 {
-    return el ? (*(int *)el) : -1;
+    return hashBytes(key, strlen((char *)key), 0);
 }
-void bhPrintInt(void *el)
+int dictStrCompare(void *key1, void *key2)
 {
-    printf("%d ", el ? (*(int *)el) : -1);
+    return strcmp((char *)key1, (char *)key2);
 }
-void test_binaryHeap()
+void test_dict64()
 {
-    struct binaryHeap *h = bhNew(bhKey);
-    if (!h)
+    struct Dict *dict = dictNew64(dictStrHash, dictStrCompare, dictValCompare);
+    struct Dict *dict2 = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    if (!dict || !dict2)
     {
-        printError("bhNew error\n");
-        return;
+        printError("dictNew64 error\n");
+        goto freePointer;
     }
 
-    // insert
-
-    int len = 11;
-    int a[] = {13, 14, 16, 19, 21, 19, 68, 65, 26, 32, 31};
+    // keys of every length up to 99 bytes, all hash code paths of hashBytes
+    const int len = 100;
+    char keys[100][100];
+    int a[100];
     int i;
     for (i = 0; i < len; i++)
     {
-        if (!bhInsert(h, &a[i]))
+        memset(keys[i], 'k', i);
+        keys[i][i] = '\0';
+        a[i] = i;
+        if (!dictPut(dict, keys[i], &a[i]))
         {
-            printError("bhInsert error\n");
+            printError("dictPut error\n");
             goto freePointer;
         }
-        bhPrint(h, bhPrintInt);
     }
-
-    if (bhSize(h) != len)
+    if (dictSize(dict) != len)
     {
-        printError("bhSize error\n");
+        printError("dictSize error\n");
         goto freePointer;
     }
-
-    if ((*(int *)bhFindMin(h)) != 13)
+    for (i = 0; i < len; i++)
     {
-        printError("bhFindMin error\n");
-        goto freePointer;
+        char key[100];
+        strcpy(key, keys[i]);
+        int *val = (int *)dictGet(dict, key);
+        if (!val || *val != i)
+        {
+            printError("dictGet %d error\n", i);
+            goto freePointer;
+        }
     }
-    if ((*(int *)bhFindMax(h)) != 68)
+    if (hashBytes("abc", 3, 0) == hashBytes("abd", 3, 0) || hashBytes("abc", 3, 0) == hashBytes("abc", 3, 1))
     {
-        printError("bhFindMax error\n");
+        printError("hashBytes error\n");
         goto freePointer;
     }
 
-    // delete
-
-    if (!bhDeleteMin(h))
+    // wyhash final version 3 reference vectors, the seed is the index
+    const char *vectors[] = {"", "a", "abc", "message digest", "abcdefghijklmnopqrstuvwxyz",
+                             "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+                             "1234567890123456789012345678901234567890"
+                             "1234567890123456789012345678901234567890"};
+    UINT64 expects[] = {0x42bc986dc5eec4d3UL, 0x84508dc903c31551UL, 0x0bc54887cfc9ecb1UL,
+                        0x6e2ff3298208a67cUL, 0x9a64e42e897195b9UL, 0x9199383239c32554UL,
+                        0x7c1ccf6bba30f5a5UL};
+    for (i = 0; i < 7; i++)
     {
-        printError("bhDeleteMin error\n");
+        if (hashBytes(vectors[i], strlen(vectors[i]), i) != expects[i])
+        {
+            printError("hashBytes vector %d error\n", i);
+            goto freePointer;
+        }
+    }
+
+    // negative hash codes, INT_MIN used to collapse with 0
+    int keys2[] = {INT_MIN, 0, -1, 1, INT_MAX, INT_MIN + 1};
+    for (i = 0; i < 6; i++)
+        dictPut(dict2, &keys2[i], &keys2[i]);
+    for (i = 0; i < 6; i++)
+    {
+        int *val = (int *)dictGet(dict2, &keys2[i]);
+        if (!val || *val != keys2[i])
+        {
+            printError("dictGet %d error\n", keys2[i]);
+            goto freePointer;
+        }
+    }
+    if (dictSize(dict2) != 6 || !dictRemove(dict2, &keys2[0]) || dictContainsKey(dict2, &keys2[0]))
+    {
+        printError("dictRemove error\n");
         goto freePointer;
     }
 
-    bhPrint(h, bhPrintInt);
+freePointer:
+    dictFree(dict);
+    dictFree(dict2);
+}
 
-    if (bhSize(h) != len - 1)
+void test_dictBatch()
+{
+    struct Dict *dict = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    if (!dict)
     {
-        printError("bhSize error\n");
+        printError("dictNew error\n");
+        return;
+    }
+
+    const int len = 10000;
+    int *a = malloc(sizeof(int) * len);
+    void **keys = malloc(sizeof(void *) * len);
+    void **vals = malloc(sizeof(void *) * len);
+    if (!a || !keys || !vals)
+    {
+        printError("malloc error\n");
         goto freePointer;
     }
+    int i;
+    for (i = 0; i < len; i++)
+    {
+        a[i] = i;
+        keys[i] = &a[i];
+        vals[i] = &a[i];
+    }
 
-    if ((*(int *)bhFindMin(h)) != 14)
+    // the first half, then everything, the first half is replaced
+    if (dictPutBatch(dict, keys, vals, len / 2) != len / 2 || dictSize(dict) != len / 2)
     {
-        printError("bhFindMin error\n");
+        printError("dictPutBatch error\n");
         goto freePointer;
     }
-    if ((*(int *)bhFindMax(h)) != 68)
+    for (i = 0; i < len / 2; i++)
+        vals[i] = &a[len - 1 - i];
+    if (dictPutBatch(dict, keys, vals, len) != len || dictSize(dict) != len)
     {
-        printError("bhFindMax error\n");
+        printError("dictPutBatch error\n");
         goto freePointer;
     }
 
-    // insert
-    int oldLen = len;
+    for (i = 0; i < len; i++)
+        vals[i] = NULL;
+    if (dictGetBatch(dict, keys, vals, len) != len)
+    {
+        printError("dictGetBatch error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < len; i++)
+    {
+        int expect = i < len / 2 ? len - 1 - i : i;
+        if (!vals[i] || *(int *)vals[i] != expect || vals[i] != dictGet(dict, keys[i]))
+        {
+            printError("dictGetBatch %d error\n", i);
+            goto freePointer;
+        }
+    }
 
-    len = 1000000;
-    int *b = malloc(sizeof(int) * len);
+    for (i = 0; i < len; i += 2)
+        dictRemove(dict, keys[i]);
+    if (dictGetBatch(dict, keys, vals, len) != len / 2)
+    {
+        printError("dictGetBatch error\n");
+        goto freePointer;
+    }
     for (i = 0; i < len; i++)
     {
-        *(b + i) = (i & 1) ? len - i : i;
-        bhInsert(h, b + i);
+        if ((i & 1) ? !vals[i] : vals[i] != NULL)
+        {
+            printError("dictGetBatch %d error\n", i);
+            goto freePointer;
+        }
     }
 
-    bhPrint(h, bhPrintInt);
+    // a NULL key stops the batch before its group, like dictPutBatch
+    keys[DICT_BATCH + 1] = NULL;
+    i = dictGetBatch(dict, keys, vals, len);
+    keys[DICT_BATCH + 1] = &a[DICT_BATCH + 1];
+    if (i != DICT_BATCH / 2)
+    {
+        printError("dictGetBatch NULL key %d error\n", i);
+        goto freePointer;
+    }
 
-    if (bhSize(h) != oldLen + len - 1)
+freePointer:
+    if (a)
+        free(a);
+    if (keys)
+        free(keys);
+    if (vals)
+        free(vals);
+    dictFree(dict);
+}
+
+int dictShiftHash(void *key)
+{
+    // only the high bits vary, every key lands in bucket 0 unmixed
+    return *(int *)key << 16;
+}
+int dictSameHash(void *key)
+{
+    (void)key;
+    return 7;
+}
+void test_dictStats()
+{
+    const int len = 1000;
+    int nums[1000];
+    struct dictStats st;
+    struct Dict *shift = dictNew(dictShiftHash, dictKeyCompare, dictValCompare);
+    struct Dict *same = dictNew(dictSameHash, dictKeyCompare, dictValCompare);
+    struct Dict *dict = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    if (!shift || !same || !dict)
     {
-        printError("bhSize error\n");
+        printError("test_dictStats new error\n");
         goto freePointer;
     }
+    dictSetMixer(shift, DICT_MIX_NONE);
+    dictSetMixer(dict, DICT_MIX_NONE);
+    dictSetLoadFactor(dict, 2);
+    int i;
+    for (i = 0; i < len; i++)
+    {
+        nums[i] = i;
+        if (!dictPut(shift, &nums[i], &nums[i]) || !dictPut(same, &nums[i], &nums[i]) ||
+            !dictPut(dict, &nums[i], &nums[i]))
+        {
+            printError("test_dictStats put %d error\n", i);
+            goto freePointer;
+        }
+    }
 
-    if ((*(int *)bhFindMin(h)) != 0)
+    // the clustered hash switched to hashMix64 on a resize
+    dictStats(shift, &st);
+    if (shift->mix != DICT_MIX_64 || st.maxChain > 16 || st.hitCost > 4)
     {
-        printError("bhFindMin error\n");
+        printError("test_dictStats shift mix %d maxChain %ld error\n", shift->mix, st.maxChain);
         goto freePointer;
     }
-    if ((*(int *)bhFindMax(h)) != (len - 1))
+    // equal hashes only warn
+    dictStats(same, &st);
+    if (!same->warned || st.maxChain != len || st.chains[DICT_STATS_CHAINS - 1] != 1)
     {
-        printError("bhFindMax error\n");
+        printError("test_dictStats same maxChain %ld error\n", st.maxChain);
+        goto freePointer;
+    }
+    // identity keys over a power of 2 table fill every bucket evenly
+    dictStats(dict, &st);
+    if (dict->mix != DICT_MIX_NONE || st.load > 2 || st.cap != 512 || st.maxChain != 2)
+    {
+        printError("test_dictStats load %f cap %ld error\n", st.load, st.cap);
+        goto freePointer;
+    }
+    long buckets = 0;
+    long entries = 0;
+    for (i = 0; i < DICT_STATS_CHAINS; i++)
+    {
+        buckets += st.chains[i];
+        entries += st.chains[i] * i;
+    }
+    if (buckets != st.cap || entries != st.size)
+    {
+        printError("test_dictStats chains error\n");
+        goto freePointer;
+    }
+    // a lower factor grows the table at once
+    dictSetLoadFactor(dict, 0.5f);
+    dictStats(dict, &st);
+    if (st.load >= 0.5 || st.hitCost != 1)
+    {
+        printError("test_dictStats lower load %f error\n", st.load);
         goto freePointer;
     }
+    for (i = 0; i < len; i++)
+    {
+        if (dictGet(shift, &nums[i]) != &nums[i] || dictGet(same, &nums[i]) != &nums[i] ||
+            dictGet(dict, &nums[i]) != &nums[i])
+        {
+            printError("test_dictStats get %d error\n", i);
+            goto freePointer;
+        }
+    }
 
-    // delete
+freePointer:
+    dictFree(shift);
+    dictFree(same);
+    dictFree(dict);
+}
 
-    if (!bhDeleteMin(h))
+void test_strDict()
+{
+    int intern;
+    for (intern = 0; intern < 2; intern++)
     {
-        printError("bhDeleteMin error\n");
+        struct strDict *d = strDictNew(intern);
+        if (!d)
+        {
+            printError("strDictNew error\n");
+            return;
+        }
+
+        // short keys are inline, every 7th key is longer than 23 bytes
+        const int len = 5000;
+        int a[5000];
+        char key[64];
+        int i;
+        for (i = 0; i < len; i++)
+        {
+            a[i] = i;
+            sprintf(key, i % 7 ? "id%d" : "a-rather-long-identifier-%d", i);
+            if (!strDictPut(d, key, &a[i]))
+            {
+                printError("strDictPut error\n");
+                goto freePointer;
+            }
+        }
+        if (strDictSize(d) != len)
+        {
+            printError("strDictSize error\n");
+            goto freePointer;
+        }
+        for (i = 0; i < len; i++)
+        {
+            sprintf(key, i % 7 ? "id%d" : "a-rather-long-identifier-%d", i);
+            int *val = (int *)strDictGet(d, key);
+            if (!val || *val != i)
+            {
+                printError("strDictGet %s error\n", key);
+                goto freePointer;
+            }
+        }
+
+        // replace, then remove the odd keys
+        if (!strDictPut(d, "id1", &a[2]) || *(int *)strDictGet(d, "id1") != 2 || strDictSize(d) != len)
+        {
+            printError("strDictPut replace error\n");
+            goto freePointer;
+        }
+        for (i = 1; i < len; i += 2)
+        {
+            sprintf(key, i % 7 ? "id%d" : "a-rather-long-identifier-%d", i);
+            if (!strDictRemove(d, key) || strDictContainsKey(d, key))
+            {
+                printError("strDictRemove %s error\n", key);
+                goto freePointer;
+            }
+        }
+        for (i = 0; i < len; i++)
+        {
+            sprintf(key, i % 7 ? "id%d" : "a-rather-long-identifier-%d", i);
+            if (strDictContainsKey(d, key) != !(i & 1))
+            {
+                printError("strDictContainsKey %s error\n", key);
+                goto freePointer;
+            }
+        }
+        if (strDictSize(d) != len / 2 || strDictGet(d, "") || strDictGet(d, "id"))
+        {
+            printError("strDictSize error\n");
+            goto freePointer;
+        }
+
+    freePointer:
+        strDictFree(d);
+    }
+}
+
+struct test_shardedDictArg
+{
+    struct shardedDict *sd;
+    int *a;
+    int from;
+    int to;
+    int error;
+};
+void *test_shardedDictWorker(void *p)
+{
+    struct test_shardedDictArg *arg = (struct test_shardedDictArg *)p;
+    int i;
+    for (i = arg->from; i < arg->to; i++)
+    {
+        if (!shardedDictPut(arg->sd, &arg->a[i], &arg->a[i]))
+            arg->error++;
+        int *val = (int *)shardedDictGet(arg->sd, &arg->a[i]);
+        if (!val || *val != arg->a[i])
+            arg->error++;
+    }
+    for (i = arg->from; i < arg->to; i += 2)
+    {
+        if (!shardedDictRemove(arg->sd, &arg->a[i]))
+            arg->error++;
+        if (shardedDictContainsKey(arg->sd, &arg->a[i]))
+            arg->error++;
+    }
+    return NULL;
+}
+void test_cacheEvict(void *key, void *val, void *arg)
+{
+    int *evicted = (int *)arg;
+    (void)val;
+    evicted[*(int *)key] = 1;
+}
+void test_cache()
+{
+    const int cap = 100, len = 1000;
+    int keys[1000];
+    int evicted[1000];
+    int i;
+    for (i = 0; i < len; i++)
+        keys[i] = i;
+
+    memset(evicted, 0, sizeof(evicted));
+    struct lruCache *lru = lruCacheNew(cap, dictKeyHash, dictKeyCompare, test_cacheEvict, evicted);
+    struct clockCache *clock = NULL;
+    if (!lru)
+    {
+        printError("lruCacheNew error\n");
+        return;
+    }
+    for (i = 0; i < cap; i++)
+        lruCachePut(lru, &keys[i], &keys[i]);
+    // touch the first half, the second half becomes the least recent
+    for (i = 0; i < cap / 2; i++)
+    {
+        if (lruCacheGet(lru, &keys[i]) != &keys[i])
+        {
+            printError("lruCacheGet %d error\n", i);
+            goto freePointer;
+        }
+    }
+    for (i = cap; i < cap + cap / 2; i++)
+        lruCachePut(lru, &keys[i], &keys[i]);
+    if (lruCacheSize(lru) != cap)
+    {
+        printError("lruCacheSize error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < cap + cap / 2; i++)
+    {
+        int gone = i >= cap / 2 && i < cap;
+        if (evicted[i] != gone || (lruCacheGet(lru, &keys[i]) == NULL) != gone)
+        {
+            printError("lruCache evict %d error\n", i);
+            goto freePointer;
+        }
+    }
+    if (!lruCacheRemove(lru, &keys[0]) || lruCacheRemove(lru, &keys[0]) || lruCacheSize(lru) != cap - 1)
+    {
+        printError("lruCacheRemove error\n");
+        goto freePointer;
+    }
+    if (evicted[0])
+    {
+        printError("lruCacheRemove evict error\n");
         goto freePointer;
     }
 
-    bhPrint(h, bhPrintInt);
+    memset(evicted, 0, sizeof(evicted));
+    clock = clockCacheNew(cap, dictKeyHash, dictKeyCompare, test_cacheEvict, evicted);
+    if (!clock)
+    {
+        printError("clockCacheNew error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < cap; i++)
+        clockCachePut(clock, &keys[i], &keys[i]);
+    for (i = 0; i < cap / 2; i++)
+        clockCacheGet(clock, &keys[i]);
+    // a scan of new keys must not push out the referenced half
+    for (i = cap; i < len; i++)
+    {
+        clockCachePut(clock, &keys[i], &keys[i]);
+        if (clockCacheSize(clock) != cap)
+        {
+            printError("clockCacheSize error\n");
+            goto freePointer;
+        }
+    }
+    for (i = 0; i < cap / 2; i++)
+    {
+        if (evicted[i] || clockCacheGet(clock, &keys[i]) != &keys[i])
+        {
+            printError("clockCache evict %d error\n", i);
+            goto freePointer;
+        }
+    }
+    for (i = cap / 2; i < cap; i++)
+    {
+        if (!evicted[i] || clockCacheGet(clock, &keys[i]))
+        {
+            printError("clockCache keep %d error\n", i);
+            goto freePointer;
+        }
+    }
+    if (!clockCacheRemove(clock, &keys[0]) || clockCacheGet(clock, &keys[0]) || clockCacheSize(clock) != cap - 1)
+    {
+        printError("clockCacheRemove error\n");
+        goto freePointer;
+    }
+    if (!clockCachePut(clock, &keys[0], &keys[1]) || clockCacheGet(clock, &keys[0]) != &keys[1])
+    {
+        printError("clockCachePut error\n");
+        goto freePointer;
+    }
 
-    if (bhSize(h) != oldLen + len - 2)
+freePointer:
+    lruCacheFree(lru);
+    clockCacheFree(clock);
+}
+
+void test_shardedDict()
+{
+    struct shardedDict *sd = shardedDictNew(8, dictKeyHash, dictKeyCompare, dictValCompare);
+    if (!sd)
     {
-        printError("bhSize error\n");
+        printError("shardedDictNew error\n");
+        return;
+    }
+
+    const int threads = 4;
+    const int len = 40000;
+    int *a = malloc(sizeof(int) * len);
+    if (!a)
+    {
+        printError("malloc a error\n");
         goto freePointer;
     }
+    int i;
+    for (i = 0; i < len; i++)
+        a[i] = i;
 
-    if ((*(int *)bhFindMin(h)) != 1)
+    pthread_t tids[4];
+    struct test_shardedDictArg args[4];
+    for (i = 0; i < threads; i++)
     {
-        printError("bhFindMin error\n");
+        args[i].sd = sd;
+        args[i].a = a;
+        args[i].from = len / threads * i;
+        args[i].to = len / threads * (i + 1);
+        args[i].error = 0;
+        pthread_create(&tids[i], NULL, test_shardedDictWorker, &args[i]);
+    }
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(tids[i], NULL);
+        if (args[i].error)
+        {
+            printError("shardedDict thread %d error: %d\n", i, args[i].error);
+            goto freePointer;
+        }
+    }
+
+    if (shardedDictSize(sd) != len / 2)
+    {
+        printError("shardedDictSize error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < len; i++)
+    {
+        int *val = (int *)shardedDictGet(sd, &a[i]);
+        if ((i & 1) ? (!val || *val != a[i]) : val != NULL)
+        {
+            printError("shardedDictGet %d error\n", i);
+            goto freePointer;
+        }
+    }
+    if (!shardedDictContainsValue(sd, &a[1]) || shardedDictContainsValue(sd, &a[0]))
+    {
+        printError("shardedDictContainsValue error\n");
         goto freePointer;
     }
-    if ((*(int *)bhFindMax(h)) != (len - 1))
+
+freePointer:
+    if (a)
+        free(a);
+    shardedDictFree(sd);
+}
+
+struct test_lfDictArg
+{
+    struct lfDict *d;
+    int *a;
+    int from;
+    int to;
+    int error;
+};
+void *test_lfDictWorker(void *p)
+{
+    struct test_lfDictArg *arg = (struct test_lfDictArg *)p;
+    int round;
+    for (round = 0; round < 3; round++)
+    {
+        int i;
+        for (i = arg->from; i < arg->to; i++)
+        {
+            if (!lfDictPut(arg->d, &arg->a[i], &arg->a[i]))
+                arg->error++;
+            int *val = (int *)lfDictGet(arg->d, &arg->a[i]);
+            if (!val || *val != arg->a[i])
+                arg->error++;
+        }
+        // the last round keeps the odd keys
+        for (i = arg->from; i < arg->to; i += 1 + (round == 2))
+        {
+            if (!lfDictRemove(arg->d, &arg->a[i]))
+                arg->error++;
+            if (lfDictContainsKey(arg->d, &arg->a[i]))
+                arg->error++;
+        }
+    }
+    return NULL;
+}
+void test_lfDict()
+{
+    struct lfDict *d = lfDictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    if (!d)
+    {
+        printError("lfDictNew error\n");
+        return;
+    }
+
+    const int threads = 4;
+    const int len = 40000;
+    int *a = malloc(sizeof(int) * len);
+    if (!a)
+    {
+        printError("malloc a error\n");
+        goto freePointer;
+    }
+    int i;
+    for (i = 0; i < len; i++)
+        a[i] = i;
+
+    pthread_t tids[4];
+    struct test_lfDictArg args[4];
+    for (i = 0; i < threads; i++)
+    {
+        args[i].d = d;
+        args[i].a = a;
+        args[i].from = len / threads * i;
+        args[i].to = len / threads * (i + 1);
+        args[i].error = 0;
+        pthread_create(&tids[i], NULL, test_lfDictWorker, &args[i]);
+    }
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(tids[i], NULL);
+        if (args[i].error)
+        {
+            printError("lfDict thread %d error: %d\n", i, args[i].error);
+            goto freePointer;
+        }
+    }
+
+    if (lfDictSize(d) != len / 2)
+    {
+        printError("lfDictSize error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < len; i++)
+    {
+        int *val = (int *)lfDictGet(d, &a[i]);
+        if ((i & 1) ? (!val || *val != a[i]) : val != NULL)
+        {
+            printError("lfDictGet %d error\n", i);
+            goto freePointer;
+        }
+    }
+
+    // replace
+    if (!lfDictPut(d, &a[1], &a[3]) || *(int *)lfDictGet(d, &a[1]) != 3 || lfDictSize(d) != len / 2)
+    {
+        printError("lfDictPut replace error\n");
+        goto freePointer;
+    }
+    if (!lfDictContainsValue(d, &a[3]) || lfDictContainsValue(d, &a[0]))
+    {
+        printError("lfDictContainsValue error\n");
+        goto freePointer;
+    }
+
+freePointer:
+    if (a)
+        free(a);
+    lfDictFree(d);
+}
+
+int test_pAvlTreeCheck(struct pAvlTreeNode *n, int lo, int hi, int *height)
+{
+    // returns the node count, -1 when keys are out of order or unbalanced
+    if (!n)
+    {
+        *height = -1;
+        return 0;
+    }
+    int lh, rh;
+    if (n->key < lo || n->key > hi)
+        return -1;
+    int l = test_pAvlTreeCheck(n->left, lo, n->key - 1, &lh);
+    int r = test_pAvlTreeCheck(n->right, n->key + 1, hi, &rh);
+    if (l < 0 || r < 0 || lh - rh > 1 || rh - lh > 1 || n->height != (lh > rh ? lh : rh) + 1)
+        return -1;
+    *height = n->height;
+    return l + r + 1;
+}
+struct test_pAvlTreeArg
+{
+    struct pAvlTreeCell *cell;
+    int *a;
+    int from;
+    int to;
+    int *done;
+    int reads;
+    int error;
+};
+void *test_pAvlTreeWriter(void *p)
+{
+    struct test_pAvlTreeArg *arg = (struct test_pAvlTreeArg *)p;
+    int i;
+    for (i = arg->from; i < arg->to; i++)
+    {
+        for (;;)
+        {
+            struct pAvlTree *cur = pAvlTreeCellGet(arg->cell);
+            struct pAvlTree *next = pAvlTreeAdd(cur, &arg->a[i]);
+            int ok = next && pAvlTreeCellPublish(arg->cell, cur, next);
+            pAvlTreeFree(cur);
+            if (ok)
+                break;
+            if (!next)
+            {
+                arg->error++;
+                return NULL;
+            }
+            pAvlTreeFree(next);
+        }
+    }
+    __atomic_add_fetch(arg->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+void *test_pAvlTreeReader(void *p)
+{
+    struct test_pAvlTreeArg *arg = (struct test_pAvlTreeArg *)p;
+    while (__atomic_load_n(arg->done, __ATOMIC_ACQUIRE) < 2)
+    {
+        // a snapshot stays whole while writers keep publishing
+        struct pAvlTree *snap = pAvlTreeCellGet(arg->cell);
+        int height;
+        if (!snap || test_pAvlTreeCheck(snap->root, 0, arg->to, &height) != pAvlTreeSize(snap))
+            arg->error++;
+        pAvlTreeFree(snap);
+        arg->reads++;
+    }
+    return NULL;
+}
+void test_pAvlTree()
+{
+    const int len = 2000;
+    int a[2000];
+    struct pAvlTree *v[2001] = {NULL};
+    struct pAvlTreeCell cell, again;
+    int cellInit = 0, againInit = 0;
+    int i, j, height;
+    for (i = 0; i < len; i++)
+        a[i] = i;
+    for (i = len - 1; i > 0; i--)
+    {
+        j = rand() % (i + 1);
+        int t = a[i];
+        a[i] = a[j];
+        a[j] = t;
+    }
+
+    v[0] = pAvlTreeNew(test_avlTreeIntKey);
+    if (!v[0] || pAvlTreeNew(NULL) || pAvlTreeAdd(v[0], NULL) || pAvlTreeRemove(v[0], NULL) ||
+        pAvlTreeSearch(v[0], NULL))
+    {
+        printError("pAvlTreeNew error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < len; i++)
+    {
+        v[i + 1] = pAvlTreeAdd(v[i], &a[i]);
+        if (!v[i + 1])
+        {
+            printError("pAvlTreeAdd %d error\n", i);
+            goto freePointer;
+        }
+    }
+
+    // every old version still holds exactly what it held
+    for (i = 0; i <= len; i += 97)
+    {
+        if (pAvlTreeSize(v[i]) != i ||
+            test_pAvlTreeCheck(v[i]->root, 0, len, &height) != i)
+        {
+            printError("pAvlTree version %d error\n", i);
+            goto freePointer;
+        }
+        for (j = 0; j < len; j++)
+        {
+            int *val = (int *)pAvlTreeSearch(v[i], &a[j]);
+            if (j < i ? !val || *val != a[j] : val != NULL)
+            {
+                printError("pAvlTreeSearch version %d key %d error\n", i, a[j]);
+                goto freePointer;
+            }
+        }
+    }
+    if (*(int *)pAvlTreeFindMin(v[len]) != 0 || *(int *)pAvlTreeFindMax(v[len]) != len - 1)
+    {
+        printError("pAvlTreeFindMin or pAvlTreeFindMax error\n");
+        goto freePointer;
+    }
+
+    // removing from the newest version leaves the older ones alone, a missing
+    // key gives an equal version and a replaced value keeps the size
+    struct pAvlTree *cur = pAvlTreeRetain(v[len]);
+    for (i = 0; i < len; i += 2)
+    {
+        struct pAvlTree *next = pAvlTreeRemove(cur, &i);
+        pAvlTreeFree(cur);
+        cur = next;
+        if (!cur)
+        {
+            printError("pAvlTreeRemove %d error\n", i);
+            goto freePointer;
+        }
+    }
+    int missing = 0;
+    struct pAvlTree *same = pAvlTreeRemove(cur, &missing);
+    struct pAvlTree *replaced = pAvlTreeAdd(cur, &a[0]);
+    int ok = same && replaced && pAvlTreeSize(same) == len / 2 &&
+             pAvlTreeSize(replaced) == len / 2 + !(a[0] & 1) &&
+             test_pAvlTreeCheck(cur->root, 0, len, &height) == len / 2 &&
+             test_pAvlTreeCheck(v[len]->root, 0, len, &height) == len &&
+             pAvlTreeSearch(cur, &missing) == NULL && pAvlTreeSearch(v[len], &missing) != NULL;
+    pAvlTreeFree(same);
+    pAvlTreeFree(replaced);
+    pAvlTreeFree(cur);
+    if (!ok)
+    {
+        printError("pAvlTreeRemove versions error\n");
+        goto freePointer;
+    }
+
+    // two writers publish through a cell while readers take snapshots
+    int keys[2000];
+    for (i = 0; i < len; i++)
+        keys[i] = i;
+    if (!pAvlTreeCellInit(&cell, pAvlTreeNew(test_avlTreeIntKey)))
+    {
+        printError("pAvlTreeCellInit error\n");
+        goto freePointer;
+    }
+    cellInit = 1;
+    int done = 0;
+    pthread_t tids[4];
+    struct test_pAvlTreeArg args[4];
+    for (i = 0; i < 4; i++)
+    {
+        args[i].cell = &cell;
+        args[i].a = keys;
+        args[i].from = i < 2 ? len / 2 * i : 0;
+        args[i].to = i < 2 ? len / 2 * (i + 1) : len;
+        args[i].done = &done;
+        args[i].reads = 0;
+        args[i].error = 0;
+        pthread_create(&tids[i], NULL, i < 2 ? test_pAvlTreeWriter : test_pAvlTreeReader,
+                       &args[i]);
+    }
+    for (i = 0; i < 4; i++)
+        pthread_join(tids[i], NULL);
+    for (i = 0; i < 4; i++)
+    {
+        if (args[i].error)
+        {
+            printError("pAvlTreeCell thread %d error: %d\n", i, args[i].error);
+            goto freePointer;
+        }
+    }
+    cur = pAvlTreeCellGet(&cell);
+    ok = cur && test_pAvlTreeCheck(cur->root, 0, len, &height) == len;
+    pAvlTreeFree(cur);
+    if (!ok)
+    {
+        printError("pAvlTreeCell size error\n");
+        goto freePointer;
+    }
+
+    // A B A C within one epoch, A waits in the retire list twice
+    if (!pAvlTreeCellInit(&again, pAvlTreeRetain(v[0])))
+    {
+        printError("pAvlTreeCellInit error\n");
+        goto freePointer;
+    }
+    againInit = 1;
+    if (!pAvlTreeCellPublish(&again, v[0], pAvlTreeRetain(v[1])) ||
+        !pAvlTreeCellPublish(&again, v[1], pAvlTreeRetain(v[0])) ||
+        !pAvlTreeCellPublish(&again, v[0], pAvlTreeRetain(v[2])))
+    {
+        printError("pAvlTreeCellPublish again error\n");
+        goto freePointer;
+    }
+    cur = pAvlTreeCellGet(&again);
+    ok = cur == v[2];
+    pAvlTreeFree(cur);
+    if (!ok)
+    {
+        printError("pAvlTreeCellPublish again get error\n");
+        goto freePointer;
+    }
+
+freePointer:
+    if (cellInit)
+        pAvlTreeCellDestroy(&cell);
+    if (againInit)
+        pAvlTreeCellDestroy(&again);
+    for (i = 0; i <= len; i++)
+        pAvlTreeFree(v[i]);
+}
+
+int bhKey(void *el)
+{
+    return el ? (*(int *)el) : -1;
+}
+void bhPrintInt(void *el)
+{
+    printf("%d ", el ? (*(int *)el) : -1);
+}
+void test_binaryHeap()
+{
+    struct binaryHeap *h = bhNew(bhKey);
+    if (!h)
+    {
+        printError("bhNew error\n");
+        return;
+    }
+
+    // insert
+
+    int len = 11;
+    int a[] = {13, 14, 16, 19, 21, 19, 68, 65, 26, 32, 31};
+    int i;
+    for (i = 0; i < len; i++)
+    {
+        if (!bhInsert(h, &a[i]))
+        {
+            printError("bhInsert error\n");
+            goto freePointer;
+        }
+        bhPrint(h, bhPrintInt);
+    }
+
+    if (bhSize(h) != len)
+    {
+        printError("bhSize error\n");
+        goto freePointer;
+    }
+
+    if ((*(int *)bhFindMin(h)) != 13)
+    {
+        printError("bhFindMin error\n");
+        goto freePointer;
+    }
+    if ((*(int *)bhFindMax(h)) != 68)
+    {
+        printError("bhFindMax error\n");
+        goto freePointer;
+    }
+
+    // delete
+
+    if (!bhDeleteMin(h))
+    {
+        printError("bhDeleteMin error\n");
+        goto freePointer;
+    }
+
+    bhPrint(h, bhPrintInt);
+
+    if (bhSize(h) != len - 1)
+    {
+        printError("bhSize error\n");
+        goto freePointer;
+    }
+
+    if ((*(int *)bhFindMin(h)) != 14)
+    {
+        printError("bhFindMin error\n");
+        goto freePointer;
+    }
+    if ((*(int *)bhFindMax(h)) != 68)
+    {
+        printError("bhFindMax error\n");
+        goto freePointer;
+    }
+
+    // insert
+    int oldLen = len;
+
+    len = 1000000;
+    int *b = malloc(sizeof(int) * len);
+    for (i = 0; i < len; i++)
+    {
+        *(b + i) = (i & 1) ? len - i : i;
+        bhInsert(h, b + i);
+    }
+
+    bhPrint(h, bhPrintInt);
+
+    if (bhSize(h) != oldLen + len - 1)
+    {
+        printError("bhSize error\n");
+        goto freePointer;
+    }
+
+    if ((*(int *)bhFindMin(h)) != 0)
+    {
+        printError("bhFindMin error\n");
+        goto freePointer;
+    }
+    if ((*(int *)bhFindMax(h)) != (len - 1))
+    {
+        printError("bhFindMax error\n");
+        goto freePointer;
+    }
+
+    // delete
+
+    if (!bhDeleteMin(h))
+    {
+        printError("bhDeleteMin error\n");
+        goto freePointer;
+    }
+
+    bhPrint(h, bhPrintInt);
+
+    if (bhSize(h) != oldLen + len - 2)
+    {
+        printError("bhSize error\n");
+        goto freePointer;
+    }
+
+    if ((*(int *)bhFindMin(h)) != 1)
+    {
+        printError("bhFindMin error\n");
+        goto freePointer;
+    }
+    if ((*(int *)bhFindMax(h)) != (len - 1))
+    {
+        printError("bhFindMax error\n");
+        goto freePointer;
+    }
+
+freePointer:
+    bhFree(h);
+    if (b)
+        free(b);
+}
+
+void test_growth()
+{
+    if (growDouble(8, 9) != 16 || growHalf(8, 9) != 13 || growHalf(8, 100) < 100)
+    {
+        printError("grow policy error\n");
+        return;
+    }
+    const int page = GROW_HUGE_PAGE / sizeof(void *);
+    if (growHugePage(8, 9) != 16 || growHugePage(page, page + 1) != 2 * page)
+    {
+        printError("growHugePage error\n");
+        return;
+    }
+
+    const int len = 10000;
+    int *nums = malloc(sizeof(int) * len);
+    struct Stack *stack = stackNewWithCapacity(len);
+    struct Queue *queue = queueNewWithCapacity(len);
+    struct binaryHeap *bh = bhNewWithCapacity(bhKey, len);
+    if (!nums || !stack || !queue || !bh)
+    {
+        printError("NewWithCapacity error\n");
+        goto freePointer;
+    }
+    int i;
+    for (i = 0; i < len; i++)
+        nums[i] = len - i;
+
+    // a reserved capacity is used as is
+    for (i = 0; i < len; i++)
+    {
+        stackPush(stack, &nums[i]);
+        queueOffer(queue, &nums[i]);
+        bhInsert(bh, &nums[i]);
+    }
+    if (stack->cap != len || queue->cap != 16384 || bh->cap != len + 1)
+    {
+        printError("NewWithCapacity cap error\n");
+        goto freePointer;
+    }
+
+    // 1.5x once full
+    stackSetGrowth(stack, growHalf);
+    queueSetGrowth(queue, growHalf);
+    bhSetGrowth(bh, growHalf);
+    stackPush(stack, &nums[0]);
+    bhInsert(bh, &nums[0]);
+    if (stack->cap != growHalf(len, len + 1) || bh->cap != growHalf(len + 1, len + 2))
+    {
+        printError("growHalf cap error\n");
+        goto freePointer;
+    }
+    stackPop(stack);
+    bhDeleteMin(bh);
+
+    // wrap the queue, then shrink it
+    for (i = 0; i < len / 2; i++)
+    {
+        queuePoll(queue);
+        queueOffer(queue, &nums[i]);
+    }
+    for (i = 0; i < len - 100; i++)
+    {
+        stackPop(stack);
+        queuePoll(queue);
+        bhDeleteMin(bh);
+    }
+    if (!stackShrinkToFit(stack) || !queueShrinkToFit(queue) || !bhShrinkToFit(bh))
+    {
+        printError("ShrinkToFit error\n");
+        goto freePointer;
+    }
+    if (stack->cap != 100 || queue->cap != 128 || bh->cap != 101)
+    {
+        printError("ShrinkToFit cap error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < 100; i++)
+    {
+        int *s = (int *)stackPop(stack), *q = (int *)queuePoll(queue), *b = (int *)bhFindMin(bh);
+        bhDeleteMin(bh);
+        // the heap also holds the second copy of nums[0]
+        if (*s != len - 99 + i || *q != len / 2 + 100 - i || *b != (i < 99 ? len - 98 + i : len))
+        {
+            printError("ShrinkToFit %d error\n", i);
+            goto freePointer;
+        }
+    }
+    if (!stackReserve(stack, 1000) || !queueReserve(queue, 1000) || !bhReserve(bh, 1000))
+    {
+        printError("Reserve error\n");
+        goto freePointer;
+    }
+    if (stack->cap != 1000 || queue->cap != 1024 || bh->cap != 1001)
+    {
+        printError("Reserve cap error\n");
+        goto freePointer;
+    }
+
+freePointer:
+    if (nums)
+        free(nums);
+    stackFree(stack);
+    queueFree(queue);
+    bhFree(bh);
+}
+
+void test_memory()
+{
+    // every array of 4K or more is mmap'ed
+    memSetMmapThreshold(4096);
+    const int len = 200000;
+    int *nums = memAlloc(sizeof(int) * 100);
+    struct Stack *stack = stackNew();
+    struct Dict *dict = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    if (!nums || !stack || !dict)
+    {
+        printError("test_memory new error\n");
+        goto freePointer;
+    }
+    int i;
+    for (i = 0; i < 100; i++)
+        nums[i] = i;
+    // malloc to mmap, mremap, then back to malloc
+    size_t sizes[] = {sizeof(int) * 2000, sizeof(int) * len, sizeof(int) * 100};
+    int k;
+    for (k = 0; k < 3; k++)
+    {
+        int *p = memRealloc(nums, sizes[k]);
+        if (!p)
+        {
+            printError("memRealloc %d error\n", k);
+            goto freePointer;
+        }
+        nums = p;
+        for (i = 0; i < 100; i++)
+        {
+            if (nums[i] != i)
+            {
+                printError("memRealloc %d keep %d error\n", k, i);
+                goto freePointer;
+            }
+        }
+        if (k == 0)
+        {
+            for (i = 100; i < 2000; i++)
+                nums[i] = i;
+        }
+    }
+    nums = memRealloc(nums, sizeof(int) * len);
+    if (!nums)
+    {
+        printError("memRealloc error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < len; i++)
+        nums[i] = i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (!stackPush(stack, &nums[i]) || !dictPut(dict, &nums[i], &nums[i]))
+        {
+            printError("mmap push %d error\n", i);
+            goto freePointer;
+        }
+    }
+    for (i = 0; i < len; i++)
+    {
+        if (dictGet(dict, &nums[i]) != &nums[i] || stackPop(stack) != &nums[len - 1 - i])
+        {
+            printError("mmap get %d error\n", i);
+            goto freePointer;
+        }
+    }
+    int *zero = memCalloc(sizeof(int) * len);
+    for (i = 0; zero && i < len; i++)
+    {
+        if (zero[i])
+        {
+            printError("memCalloc %d error\n", i);
+            break;
+        }
+    }
+    memFree(zero);
+
+freePointer:
+    memFree(nums);
+    stackFree(stack);
+    dictFree(dict);
+    memSetMmapThreshold(0);
+}
+
+int slKey(void *el)
+{
+    return el ? (*(int *)el) : -1;
+}
+void slPrintInt(void *el)
+{
+    printf("%d ", el ? (*(int *)el) : -1);
+}
+void test_skipList()
+{
+    struct skipList *sl = skipListNew(slKey);
+    if (!sl)
+    {
+        return;
+    }
+
+    const int len = 100000;
+    int nums[len];
+    int i;
+    for (i = 0; i < len; i++)
+        nums[i] = i;
+
+    printDebug("---------- test skipListInsert\n");
+
+    const int step = 10;
+
+    int total = 0;
+    for (i = 0; i < step; i++)
+    {
+        int j;
+        for (j = i; j < len; j += step)
+        {
+            printDebug("---------- test skipListInsert: %d\n", j);
+
+            if (skipListGet(sl, nums[j]))
+            {
+                printError("skipListGet error: el alreadly exists\n");
+                goto freePointer;
+            }
+
+            int insert = skipListInsert(sl, &nums[j]);
+            if (!insert)
+            {
+                printError("skipListInsert error\n");
+                goto freePointer;
+            }
+
+            if (skipListSize(sl) != (++total))
+            {
+                printError("skipListSize error\n");
+                goto freePointer;
+            }
+
+            void *got = skipListGet(sl, j);
+            if (!got)
+            {
+                printError("skipListGet error: el not insert\n");
+                goto freePointer;
+            }
+
+            if ((*((int *)got)) != j)
+            {
+                printError("skipListGet error: el insert error\n");
+                goto freePointer;
+            }
+        }
+
+        skipListPrint(sl, slPrintInt);
+    }
+
+    printDebug("---------- test skipListDelete\n");
+
+    total = len;
+    for (i = 0; i < step; i++)
+    {
+        int j;
+        for (j = i; j < len; j += step)
+        {
+            printDebug("---------- test skipListDelete: %d\n", j);
+            void *got = skipListGet(sl, nums[j]);
+            if (!got)
+            {
+                printError("skipListGet error: el not exists\n");
+                goto freePointer;
+            }
+
+            if ((*((int *)got)) != j)
+            {
+                printError("skipListGet error: el delete error\n");
+                goto freePointer;
+            }
+
+            int delete = skipListDelete(sl, j);
+            if (!delete)
+            {
+                printError("skipListDelete error\n");
+                goto freePointer;
+            }
+
+            if (skipListSize(sl) != (--total))
+            {
+                printError("skipListSize error\n");
+                goto freePointer;
+            }
+
+            got = skipListGet(sl, j);
+            if (got)
+            {
+                printError("skipListGet error: el not delete\n");
+                goto freePointer;
+            }
+        }
+
+        skipListPrint(sl, slPrintInt);
+    }
+freePointer:
+    skipListFree(sl);
+}
+
+void test_stats()
+{
+    const int len = 10000;
+    int nums[10000];
+    struct Dict *dict = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    struct avlTree *avl = avlTreeNew(test_avlTreeIntKey);
+    struct rbTree *rb = rbTreeNew(test_rbTreeIntKey);
+    struct skipList *sl = skipListNew(slKey);
+    struct Dict *other = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    if (!dict || !avl || !rb || !sl || !other)
+    {
+        printError("test_stats new error\n");
+        goto freePointer;
+    }
+    const char *names[4] = {"dict", "avlTree", "rbTree", "skipList"};
+    struct opStats *stats[4];
+    stats[0] = dictOpStats(dict);
+    stats[1] = avlTreeOpStats(avl);
+    stats[2] = rbTreeOpStats(rb);
+    stats[3] = skipListOpStats(sl);
+    int t;
+    for (t = 0; t < 4; t++)
+        statsReset(stats[t]);
+    // a NULL container is refused before its stats are touched
+    if (avlTreeAdd(NULL, &nums[0]) || avlTreeRemove(NULL, &nums[0]) ||
+        avlTreeSearch(NULL, &nums[0]) || rbTreeInsert(NULL, &nums[0]) ||
+        rbTreeDelete(NULL, &nums[0]) || rbTreeSearch(NULL, &nums[0]) ||
+        skipListInsert(NULL, &nums[0]) || skipListDelete(NULL, 0))
+    {
+        printError("test_stats NULL container error\n");
+        goto freePointer;
+    }
+
+    int i;
+    for (i = 0; i < len; i++)
+    {
+        nums[i] = (i * 7919) % len;
+        dictPut(dict, &nums[i], &nums[i]);
+        avlTreeAdd(avl, &nums[i]);
+        rbTreeInsert(rb, &nums[i]);
+        skipListInsert(sl, &nums[i]);
+    }
+    for (i = 0; i < len; i++)
+    {
+        if (!dictGet(dict, &nums[i]) || !avlTreeSearch(avl, &nums[i]) ||
+            !rbTreeSearch(rb, &nums[i]) || !skipListGet(sl, nums[i]))
+        {
+            printError("test_stats get %d error\n", i);
+            goto freePointer;
+        }
+    }
+    for (i = 0; i < len; i++)
+    {
+        dictRemove(dict, &nums[i]);
+        avlTreeRemove(avl, &nums[i]);
+        rbTreeDelete(rb, &nums[i]);
+        skipListDelete(sl, nums[i]);
+    }
+    // another dict counts only its own work
+    for (i = 0; i < 3; i++)
+        dictPut(other, &nums[i], &nums[i]);
+
+    for (t = 0; t < 4; t++)
+    {
+        struct opStats *s = stats[t];
+#ifdef MYCDATA_STATS
+        statsDump(s, names[t]);
+        if (!s || s->allocs != len || s->frees != len)
+        {
+            printError("test_stats %d allocs %lu frees %lu error\n", t, s->allocs, s->frees);
+            goto freePointer;
+        }
+        if (s->insert.count != len || s->lookup.count != len || s->remove.count != len)
+        {
+            printError("test_stats %d count error\n", t);
+            goto freePointer;
+        }
+        UINT64 p50 = statsPercentile(&s->lookup, 0.5);
+        UINT64 p99 = statsPercentile(&s->lookup, 0.99);
+        if (p50 > p99 || p99 > s->lookup.max)
+        {
+            printError("test_stats %d percentile error\n", t);
+            goto freePointer;
+        }
+        if ((t == 1 || t == 2) && !s->rotations)
+        {
+            printError("test_stats %d rotations error\n", t);
+            goto freePointer;
+        }
+        if ((t == 0 || t == 3) && (!s->walks || s->maxSteps > s->steps))
+        {
+            printError("test_stats %d walks error\n", t);
+            goto freePointer;
+        }
+        if (t == 0 && !s->resizes)
+        {
+            printError("test_stats resizes error\n");
+            goto freePointer;
+        }
+#else
+        (void)names;
+        // without MYCDATA_STATS nothing is counted
+        if (s)
+        {
+            printError("test_stats %d not NULL error\n", t);
+            goto freePointer;
+        }
+#endif // MYCDATA_STATS
+    }
+#ifdef MYCDATA_STATS
+    struct opStats *o = dictOpStats(other);
+    if (!o || o->allocs != 3 || o->insert.count != 3 || o->frees || o->resizes)
+    {
+        printError("test_stats other dict error\n");
+        goto freePointer;
+    }
+#else
+    if (dictOpStats(other))
+    {
+        printError("test_stats other dict not NULL error\n");
+        goto freePointer;
+    }
+#endif // MYCDATA_STATS
+
+freePointer:
+    dictFree(dict);
+    avlTreeFree(avl);
+    rbTreeFree(rb);
+    skipListFree(sl);
+    dictFree(other);
+}
+
+long snapshotIntEncode(void *x, void *buf, long cap, void *arg)
+{
+    (void)arg;
+    if (cap >= (long)sizeof(int))
+        memcpy(buf, x, sizeof(int));
+    return sizeof(int);
+}
+void *snapshotIntDecode(const void *buf, long len, void *arg)
+{
+    int i;
+    (void)len;
+    memcpy(&i, buf, sizeof(int));
+    return (int *)arg + i;
+}
+void snapshotIntRelease(void *x, void *arg)
+{
+    // marks the element so the test sees it came back
+    (void)arg;
+    *(int *)x = -1;
+}
+void test_snapshot()
+{
+    const int len = 10000;
+    const char *path = "test_snapshot.bin";
+    int nums[10000];
+    struct snapshotCodec codec = {snapshotIntEncode, snapshotIntDecode, nums,
+                                  snapshotIntRelease};
+    struct Dict *dict = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    struct avlTree *avl = avlTreeNew(test_avlTreeIntKey);
+    struct rbTree *rb = rbTreeNew(test_rbTreeIntKey);
+    struct skipList *sl = skipListNew(slKey);
+    struct Dict *dict2 = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    struct avlTree *avl2 = avlTreeNew(test_avlTreeIntKey);
+    struct rbTree *rb2 = rbTreeNew(test_rbTreeIntKey);
+    struct skipList *sl2 = skipListNew(slKey);
+    struct Dict *dict3 = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    struct avlTree *avl3 = avlTreeNew(test_avlTreeIntKey);
+    if (!dict || !avl || !rb || !sl || !dict2 || !avl2 || !rb2 || !sl2 || !dict3 || !avl3)
+    {
+        printError("test_snapshot new error\n");
+        goto freePointer;
+    }
+    int i;
+    for (i = 0; i < len; i++)
+        nums[i] = i;
+    for (i = 0; i < len; i++)
+    {
+        int *x = &nums[(i * 7919) % len];
+        dictPut(dict, x, &nums[len - 1 - *x]);
+        avlTreeAdd(avl, x);
+        rbTreeInsert(rb, x);
+        skipListInsert(sl, x);
+    }
+
+    if (!dictSave(dict, path, &codec, &codec) || !dictLoad(dict2, path, &codec, &codec) ||
+        !avlTreeSave(avl, path, &codec) || !avlTreeLoad(avl2, path, &codec) ||
+        !rbTreeSave(rb, path, &codec) || !rbTreeLoad(rb2, path, &codec) ||
+        !skipListSave(sl, path, &codec) || !skipListLoad(sl2, path, &codec))
+    {
+        printError("test_snapshot save or load error\n");
+        goto freePointer;
+    }
+    if (dictSize(dict2) != len || avl2->size != len || rb2->size != len ||
+        skipListSize(sl2) != len)
+    {
+        printError("test_snapshot size error\n");
+        goto freePointer;
+    }
+    // built balanced, 2 ^ 13 <= len < 2 ^ 14
+    if (avl2->root->height != 13)
+    {
+        printError("test_snapshot avl height %d error\n", avl2->root->height);
+        goto freePointer;
+    }
+    for (i = 0; i < len; i++)
+    {
+        if (dictGet(dict2, &nums[i]) != &nums[len - 1 - i] || avlTreeSearch(avl2, &nums[i]) == NULL ||
+            rbTreeSearch(rb2, &nums[i]) == NULL || skipListGet(sl2, i) != &nums[i])
+        {
+            printError("test_snapshot get %d error\n", i);
+            goto freePointer;
+        }
+    }
+    // the loaded containers keep working
+    for (i = 0; i < len; i += 2)
+    {
+        if (!dictRemove(dict2, &nums[i]) || !avlTreeRemove(avl2, &nums[i]) ||
+            !rbTreeDelete(rb2, &nums[i]) || !skipListDelete(sl2, i))
+        {
+            printError("test_snapshot remove %d error\n", i);
+            goto freePointer;
+        }
+    }
+    for (i = 0; i < len; i++)
+    {
+        int in = i & 1;
+        if (!dictGet(dict2, &nums[i]) != !in || !avlTreeSearch(avl2, &nums[i]) != !in ||
+            !rbTreeSearch(rb2, &nums[i]) != !in || !skipListGet(sl2, i) != !in)
+        {
+            printError("test_snapshot after remove %d error\n", i);
+            goto freePointer;
+        }
+    }
+
+    // records 1 3 2, the out of order one is released and the load stops
+    struct snapshotHeader h = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, SNAPSHOT_AVL_TREE, 0, 3};
+    UINT32 rec[6] = {sizeof(int), 1, sizeof(int), 3, sizeof(int), 2};
+    FILE *f = fopen(path, "wb");
+    if (!f || fwrite(&h, sizeof(h), 1, f) != 1 || fwrite(rec, sizeof(rec), 1, f) != 1)
+    {
+        printError("test_snapshot write error\n");
+        if (f)
+            fclose(f);
+        goto freePointer;
+    }
+    fclose(f);
+    if (avlTreeLoad(avl3, path, &codec) || avl3->size != 2 || nums[2] != -1 || nums[3] != 3)
+    {
+        printError("test_snapshot release error\n");
+        goto freePointer;
+    }
+    // a count the file cannot hold is rejected before the table is sized
+    UINT64 counts[2] = {0x4000000000000000UL, 1000000000};
+    for (i = 0; i < 2; i++)
+    {
+        h.type = SNAPSHOT_DICT;
+        h.count = counts[i];
+        f = fopen(path, "r+b");
+        if (!f || fwrite(&h, sizeof(h), 1, f) != 1)
+        {
+            printError("test_snapshot write error\n");
+            if (f)
+                fclose(f);
+            goto freePointer;
+        }
+        fclose(f);
+        if (dictLoad(dict3, path, &codec, &codec) || dictSize(dict3))
+        {
+            printError("test_snapshot count %lu error\n", counts[i]);
+            goto freePointer;
+        }
+    }
+
+freePointer:
+    remove(path);
+    dictFree(dict);
+    avlTreeFree(avl);
+    rbTreeFree(rb);
+    skipListFree(sl);
+    dictFree(dict2);
+    avlTreeFree(avl2);
+    rbTreeFree(rb2);
+    skipListFree(sl2);
+    dictFree(dict3);
+    avlTreeFree(avl3);
+}
+
+void test_roDict()
+{
+    const int len = 10000;
+    const char *path = "test_roDict.bin";
+    int nums[10000];
+    struct snapshotCodec codec = {snapshotIntEncode, snapshotIntDecode, nums, NULL};
+    struct Dict *dict = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    struct roDict *ro = NULL;
+    struct roDict *ro2 = NULL;
+    if (!dict)
+    {
+        printError("test_roDict new error\n");
+        goto freePointer;
+    }
+    int i;
+    for (i = 0; i < len; i++)
+        nums[i] = i;
+    for (i = 0; i < len; i++)
+        dictPut(dict, &nums[i], &nums[len - 1 - i]);
+    if (!roDictBuild(dict, path, &codec, &codec))
+    {
+        printError("roDictBuild error\n");
+        goto freePointer;
+    }
+    // two handles map the same pages
+    ro = roDictOpen(path);
+    ro2 = roDictOpen(path);
+    if (!ro || !ro2 || roDictSize(ro) != len)
+    {
+        printError("roDictOpen error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < len + 100; i++)
+    {
+        long vl = 0;
+        const void *v = roDictGet(i & 1 ? ro : ro2, &i, sizeof(int), &vl);
+        int x = -1;
+        if (v)
+            memcpy(&x, v, sizeof(int));
+        if (i < len ? (!v || vl != sizeof(int) || x != len - 1 - i) : v != NULL)
+        {
+            printError("roDictGet %d error\n", i);
+            goto freePointer;
+        }
+    }
+    // the key bytes must match in length too
+    short s = 7;
+    if (roDictGet(ro, &s, sizeof(s), NULL))
+    {
+        printError("roDictGet short key error\n");
+        goto freePointer;
+    }
+
+freePointer:
+    roDictClose(ro);
+    roDictClose(ro2);
+    remove(path);
+    dictFree(dict);
+}
+
+void test_mphDict()
+{
+    const int len = 100000;
+    int *nums = malloc(sizeof(int) * len * 2);
+    struct Dict *dict = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    struct Dict *empty = dictNew(dictKeyHash, dictKeyCompare, dictValCompare);
+    struct mphDict *m = NULL;
+    struct mphDict *m0 = NULL;
+    if (!nums || !dict || !empty)
+    {
+        printError("test_mphDict new error\n");
+        goto freePointer;
+    }
+    int i;
+    for (i = 0; i < len * 2; i++)
+        nums[i] = i;
+    for (i = 0; i < len; i++)
+        dictPut(dict, &nums[i], &nums[len - 1 - i]);
+    m = mphDictNew(dict);
+    m0 = mphDictNew(empty);
+    if (!m || !m0 || mphDictSize(m) != len || mphDictSize(m0))
+    {
+        printError("mphDictNew error\n");
+        goto freePointer;
+    }
+    // each key has its own slot
+    for (i = 0; i < len * 2; i++)
+    {
+        void *v = mphDictGet(m, &nums[i]);
+        if (i < len ? v != &nums[len - 1 - i] : v != NULL)
+        {
+            printError("mphDictGet %d error\n", i);
+            goto freePointer;
+        }
+    }
+    if (mphDictGet(m0, &nums[0]))
+    {
+        printError("mphDictGet empty error\n");
+        goto freePointer;
+    }
+
+freePointer:
+    mphDictFree(m);
+    mphDictFree(m0);
+    dictFree(dict);
+    dictFree(empty);
+    if (nums)
+        free(nums);
+}
+
+int test_hamtCheck(struct hamt *h, int *a, int from, int to, int step)
+{
+    // exactly the keys a[from], a[from + step] .. below a[to] are in h
+    int i;
+    for (i = 0; i < to; i++)
+    {
+        int *val = (int *)hamtGet(h, &a[i]);
+        int in = i >= from && (i - from) % step == 0;
+        if (in ? !val || *val != a[i] : val != NULL)
+            return 0;
+    }
+    return 1;
+}
+void test_hamt()
+{
+    const int len = 20000;
+    int *a = malloc(sizeof(int) * len);
+    struct hamt *h = hamtNew(dictKeyHash, dictKeyCompare);
+    struct hamt *same = hamtNew(dictSameHash, dictKeyCompare);
+    struct hamt *half = NULL;
+    struct hamt *full = NULL;
+    struct hamt *next;
+    int i;
+    if (!a || !h || !same || hamtNew(NULL, dictKeyCompare))
+    {
+        printError("test_hamt new error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < len; i++)
+        a[i] = i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (i == len / 2)
+            half = hamtRetain(h);
+        next = hamtPut(h, &a[i], &a[i]);
+        hamtFree(h);
+        h = next;
+        if (!h)
+        {
+            printError("hamtPut %d error\n", i);
+            goto freePointer;
+        }
+    }
+    full = hamtRetain(h);
+    if (hamtSize(h) != len || hamtSize(half) != len / 2 || !test_hamtCheck(h, a, 0, len, 1) ||
+        !test_hamtCheck(half, a, 0, len / 2, 1) || hamtContainsKey(half, &a[len / 2]))
+    {
+        printError("hamtGet versions error\n");
+        goto freePointer;
+    }
+
+    // a replaced value keeps the size, a missing key gives an equal map
+    next = hamtPut(h, &a[1], &a[2]);
+    int ok = next && hamtSize(next) == len && *(int *)hamtGet(next, &a[1]) == 2 &&
+             *(int *)hamtGet(h, &a[1]) == 1;
+    hamtFree(next);
+    int missing = len;
+    next = hamtRemove(h, &missing);
+    ok = ok && next && hamtSize(next) == len && hamtGet(next, &a[0]);
+    hamtFree(next);
+    if (!ok)
+    {
+        printError("hamtPut replace error\n");
+        goto freePointer;
+    }
+
+    for (i = 0; i < len; i += 2)
+    {
+        next = hamtRemove(h, &a[i]);
+        hamtFree(h);
+        h = next;
+        if (!h)
+        {
+            printError("hamtRemove %d error\n", i);
+            goto freePointer;
+        }
+    }
+    if (hamtSize(h) != len / 2 || !test_hamtCheck(h, a, 1, len, 2) ||
+        !test_hamtCheck(full, a, 0, len, 1))
+    {
+        printError("hamtRemove versions error\n");
+        goto freePointer;
+    }
+    for (i = 1; i < len; i += 2)
+    {
+        next = hamtRemove(h, &a[i]);
+        hamtFree(h);
+        h = next;
+        if (!h)
+        {
+            printError("hamtRemove %d error\n", i);
+            goto freePointer;
+        }
+    }
+    if (hamtSize(h) != 0 || h->root)
     {
-        printError("bhFindMax error\n");
+        printError("hamtRemove empty error\n");
         goto freePointer;
     }
 
-freePointer:
-    bhFree(h);
-    if (b)
-        free(b);
-}
-
-int slKey(void *el)
-{
-    return el ? (*(int *)el) : -1;
-}
-void slPrintInt(void *el)
-{
-    printf("%d ", el ? (*(int *)el) : -1);
-}
-void test_skipList()
-{
-    struct skipList *sl = skipListNew(slKey);
-    if (!sl)
+    // keys of one hash share a collision node
+    for (i = 0; i < 100; i++)
     {
-        return;
+        next = hamtPut(same, &a[i], &a[i]);
+        hamtFree(same);
+        same = next;
+        if (!same)
+        {
+            printError("hamtPut collision %d error\n", i);
+            goto freePointer;
+        }
     }
-
-    const int len = 100000;
-    int nums[len];
-    int i;
-    for (i = 0; i < len; i++)
-        nums[i] = i;
-
-    printDebug("---------- test skipListInsert\n");
-
-    const int step = 10;
-
-    int total = 0;
-    for (i = 0; i < step; i++)
+    for (i = 0; i < 100; i += 2)
     {
-        int j;
-        for (j = i; j < len; j += step)
+        next = hamtRemove(same, &a[i]);
+        hamtFree(same);
+        same = next;
+        if (!same)
         {
-            printDebug("---------- test skipListInsert: %d\n", j);
-
-            if (skipListGet(sl, nums[j]))
-            {
-                printError("skipListGet error: el alreadly exists\n");
-                goto freePointer;
-            }
-
-            int insert = skipListInsert(sl, &nums[j]);
-            if (!insert)
-            {
-                printError("skipListInsert error\n");
-                goto freePointer;
-            }
-
-            if (skipListSize(sl) != (++total))
-            {
-                printError("skipListSize error\n");
-                goto freePointer;
-            }
-
-            void *got = skipListGet(sl, j);
-            if (!got)
-            {
-                printError("skipListGet error: el not insert\n");
-                goto freePointer;
-            }
-
-            if ((*((int *)got)) != j)
-            {
-                printError("skipListGet error: el insert error\n");
-                goto freePointer;
-            }
+            printError("hamtRemove collision %d error\n", i);
+            goto freePointer;
         }
-
-        skipListPrint(sl, slPrintInt);
+    }
+    if (hamtSize(same) != 50 || !test_hamtCheck(same, a, 1, 100, 2))
+    {
+        printError("hamt collision error\n");
+        goto freePointer;
     }
 
-    printDebug("---------- test skipListDelete\n");
-
-    total = len;
-    for (i = 0; i < step; i++)
+    // the last leaf folds back up to the root
+    for (i = 1; i < 99; i += 2)
     {
-        int j;
-        for (j = i; j < len; j += step)
+        next = hamtRemove(same, &a[i]);
+        hamtFree(same);
+        same = next;
+        if (!same)
         {
-            printDebug("---------- test skipListDelete: %d\n", j);
-            void *got = skipListGet(sl, nums[j]);
-            if (!got)
-            {
-                printError("skipListGet error: el not exists\n");
-                goto freePointer;
-            }
-
-            if ((*((int *)got)) != j)
-            {
-                printError("skipListGet error: el delete error\n");
-                goto freePointer;
-            }
-
-            int delete = skipListDelete(sl, j);
-            if (!delete)
-            {
-                printError("skipListDelete error\n");
-                goto freePointer;
-            }
-
-            if (skipListSize(sl) != (--total))
-            {
-                printError("skipListSize error\n");
-                goto freePointer;
-            }
-
-            got = skipListGet(sl, j);
-            if (got)
-            {
-                printError("skipListGet error: el not delete\n");
-                goto freePointer;
-            }
+            printError("hamtRemove collision %d error\n", i);
+            goto freePointer;
         }
-
-        skipListPrint(sl, slPrintInt);
     }
+    if (hamtSize(same) != 1 || same->root->len != 1 || !same->root->slots[0].key ||
+        *(int *)hamtGet(same, &a[99]) != 99)
+    {
+        printError("hamtRemove fold error\n");
+        goto freePointer;
+    }
+
 freePointer:
-    skipListFree(sl);
+    if (a)
+        free(a);
+    hamtFree(h);
+    hamtFree(same);
+    hamtFree(half);
+    hamtFree(full);
 }
 
 void test_bitSet()
@@ -1086,3 +3559,277 @@ freePointer:
     if (bs)
         bitSetFree(bs);
 }
+
+void test_filter()
+{
+    const int len = 100000;
+    UINT64 *hashes = malloc(sizeof(UINT64) * len * 2);
+    UINT8 *maybe = malloc(len * 2);
+    struct bloomFilter *bf = bloomFilterNew(len, 0.01);
+    struct cuckooFilter *cf = cuckooFilterNew(len, 0.001);
+    struct cuckooFilter *small = cuckooFilterNew(100, 0.01);
+    struct bloomFilter *intBf = bloomFilterNew(len, 0.001);
+    struct cuckooFilter *intCf = cuckooFilterNew(len, 0.01);
+    if (!hashes || !maybe || !bf || !cf || !small || !intBf || !intCf ||
+        cuckooFilterNew(len, 1e-10))
+    {
+        printError("test_filter new error\n");
+        goto freePointer;
+    }
+    int i;
+    for (i = 0; i < len * 2; i++)
+        hashes[i] = hashMix64(i);
+    for (i = 0; i < len; i++)
+    {
+        if (!bloomFilterAdd(bf, hashes[i]) || !cuckooFilterAdd(cf, hashes[i]))
+        {
+            printError("test_filter add %d error\n", i);
+            goto freePointer;
+        }
+    }
+
+    // no false negative, the false positives stay near the target
+    int bloomFp = bloomFilterContainsBatch(bf, hashes, len * 2, maybe) - len;
+    for (i = 0; i < len * 2; i++)
+    {
+        if (maybe[i] != bloomFilterContains(bf, hashes[i]) || (i < len && !maybe[i]))
+        {
+            printError("bloomFilterContains %d error\n", i);
+            goto freePointer;
+        }
+    }
+    int cuckooFp = cuckooFilterContainsBatch(cf, hashes, len * 2, maybe) - len;
+    for (i = 0; i < len * 2; i++)
+    {
+        if (maybe[i] != cuckooFilterContains(cf, hashes[i]) || (i < len && !maybe[i]))
+        {
+            printError("cuckooFilterContains %d error\n", i);
+            goto freePointer;
+        }
+    }
+    printInfo("test_filter bloom fpr %f cuckoo fpr %f\n", bloomFp / (double)len,
+              cuckooFp / (double)len);
+    if (bloomFp > len / 100 * 3 / 2 || cuckooFp > len / 1000)
+    {
+        printError("test_filter fpr error\n");
+        goto freePointer;
+    }
+
+    for (i = 0; i < len; i += 2)
+    {
+        if (!cuckooFilterRemove(cf, hashes[i]))
+        {
+            printError("cuckooFilterRemove %d error\n", i);
+            goto freePointer;
+        }
+    }
+    int removedFp = 0;
+    for (i = 0; i < len; i++)
+    {
+        int in = cuckooFilterContains(cf, hashes[i]);
+        if (i & 1 && !in)
+        {
+            printError("cuckooFilterRemove kept %d error\n", i);
+            goto freePointer;
+        }
+        removedFp += !(i & 1) && in;
+    }
+    if (cuckooFilterSize(cf) != len / 2 || removedFp > len / 1000)
+    {
+        printError("cuckooFilterRemove size %ld error\n", cuckooFilterSize(cf));
+        goto freePointer;
+    }
+
+    // past its capacity a cuckoo filter refuses, every added key still answers
+    int added = 0;
+    while (added < len && cuckooFilterAdd(small, hashes[added]))
+        added++;
+    if (added >= len)
+    {
+        printError("cuckooFilterAdd full error\n");
+        goto freePointer;
+    }
+    for (i = 0; i < added; i++)
+    {
+        if (!cuckooFilterContains(small, hashes[i]))
+        {
+            printError("cuckooFilterAdd full lost %d error\n", i);
+            goto freePointer;
+        }
+    }
+
+    // small integers as hashes, both filters mix them and meet the target
+    for (i = 0; i < len; i++)
+    {
+        bloomFilterAdd(intBf, i);
+        cuckooFilterAdd(intCf, i);
+    }
+    bloomFp = 0;
+    cuckooFp = 0;
+    for (i = 0; i < len; i++)
+    {
+        if (!bloomFilterContains(intBf, i) || !cuckooFilterContains(intCf, i))
+        {
+            printError("test_filter int %d error\n", i);
+            goto freePointer;
+        }
+        bloomFp += bloomFilterContains(intBf, len + i);
+        cuckooFp += cuckooFilterContains(intCf, len + i);
+    }
+    printInfo("test_filter int bloom fpr %f cuckoo fpr %f\n", bloomFp / (double)len,
+              cuckooFp / (double)len);
+    if (bloomFp > len / 1000 || cuckooFp > len / 100)
+    {
+        printError("test_filter int fpr error\n");
+        goto freePointer;
+    }
+
+freePointer:
+    if (hashes)
+        free(hashes);
+    if (maybe)
+        free(maybe);
+    bloomFilterFree(bf);
+    cuckooFilterFree(cf);
+    cuckooFilterFree(small);
+    bloomFilterFree(intBf);
+    cuckooFilterFree(intCf);
+}
+
+void test_sketch()
+{
+    struct hyperLogLog *a = hyperLogLogNew(HLL_PRECISION);
+    struct hyperLogLog *b = hyperLogLogNew(HLL_PRECISION);
+    struct countMinSketch *cms = countMinSketchNew(0.001, 0.01);
+    struct countMinSketch *cms2 = countMinSketchNew(0.001, 0.01);
+    struct topK *top = topKNew(20, dictKeyHash, dictKeyCompare);
+    static int keys[1000];
+    struct topKCounter list[20];
+    long i;
+    if (!a || !b || !cms || !cms2 || !top)
+    {
+        printError("test_sketch new error\n");
+        goto freePointer;
+    }
+    if (hyperLogLogNew(3) || countMinSketchNew(0, 0.5) || topKNew(0, dictKeyHash, dictKeyCompare))
+    {
+        printError("test_sketch bad args error\n");
+        goto freePointer;
+    }
+
+    // small counts stay sparse and exact enough, repeats do not count
+    for (i = 0; i < 2000; i++)
+        hyperLogLogAdd(a, hashMix64(i % 1000));
+    long count = hyperLogLogCount(a);
+    if (!a->sparse || count < 990 || count > 1010)
+    {
+        printError("hyperLogLogCount sparse %ld error\n", count);
+        goto freePointer;
+    }
+    long targets[] = {100000, 1000000};
+    for (i = 1000; i < targets[1]; i++)
+    {
+        hyperLogLogAdd(a, hashMix64(i));
+        if (i + 1 == targets[0] || i + 1 == targets[1])
+        {
+            count = hyperLogLogCount(a);
+            printInfo("test_sketch hll %ld estimate %ld\n", i + 1, count);
+            if (a->sparse || count < (i + 1) * 98 / 100 || count > (i + 1) * 102 / 100)
+            {
+                printError("hyperLogLogCount %ld error\n", count);
+                goto freePointer;
+            }
+        }
+    }
+
+    // a sparse sketch merges into a dense one, then two dense ones merge
+    for (i = 0; i < 1000; i++)
+        hyperLogLogAdd(b, hashMix64(i + 5000000));
+    if (!hyperLogLogMerge(a, b))
+    {
+        printError("hyperLogLogMerge sparse error\n");
+        goto freePointer;
+    }
+    for (i = 1000; i < 500000; i++)
+        hyperLogLogAdd(b, hashMix64(i + 5000000));
+    if (b->sparse || !hyperLogLogMerge(b, a))
+    {
+        printError("hyperLogLogMerge dense error\n");
+        goto freePointer;
+    }
+    count = hyperLogLogCount(b);
+    if (count < 1500000 * 98 / 100 || count > 1500000 * 102 / 100)
+    {
+        printError("hyperLogLogMerge count %ld error\n", count);
+        goto freePointer;
+    }
+
+    // a skewed stream, estimates never undercount and stay within eps * total
+    // for nearly every key
+    for (i = 0; i < 10000; i++)
+    {
+        countMinSketchAdd(i & 1 ? cms : cms2, hashMix64(i), 1000 / (i + 1) + 1);
+    }
+    if (!countMinSketchMerge(cms, cms2))
+    {
+        printError("countMinSketchMerge error\n");
+        goto freePointer;
+    }
+    int over = 0;
+    for (i = 0; i < 10000; i++)
+    {
+        UINT64 est = countMinSketchEstimate(cms, hashMix64(i));
+        UINT64 real = 1000 / (i + 1) + 1;
+        if (est < real)
+        {
+            printError("countMinSketchEstimate %ld undercount error\n", i);
+            goto freePointer;
+        }
+        over += est > real + cms->total / 1000;
+    }
+    if (over > 100)
+    {
+        printError("countMinSketchEstimate over %d error\n", over);
+        goto freePointer;
+    }
+
+    // five heavy hitters above total / k are always kept among light keys
+    for (i = 0; i < 1000; i++)
+        keys[i] = (int)i;
+    for (i = 0; i < 20000; i++)
+    {
+        int key = i % 2 == 0 ? (int)(i / 2 % 5) : (int)(5 + i % 995);
+        if (!topKAdd(top, keys + key, 1))
+        {
+            printError("topKAdd %ld error\n", i);
+            goto freePointer;
+        }
+    }
+    int n = topKList(top, list);
+    if (n != 20)
+    {
+        printError("topKList %d error\n", n);
+        goto freePointer;
+    }
+    for (i = 0; i < 5; i++)
+    {
+        int key = *(int *)list[i].key;
+        if (key >= 5 || list[i].count - list[i].error > 2000 || list[i].count < 2000)
+        {
+            printError("topKList %ld key %d count %lu error\n", i, key, list[i].count);
+            goto freePointer;
+        }
+        if (i && list[i].count > list[i - 1].count)
+        {
+            printError("topKList order error\n");
+            goto freePointer;
+        }
+    }
+
+freePointer:
+    hyperLogLogFree(a);
+    hyperLogLogFree(b);
+    countMinSketchFree(cms);
+    countMinSketchFree(cms2);
+    topKFree(top);
+}